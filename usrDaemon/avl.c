@@ -28,24 +28,29 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-static unsigned long avl_height(struct avl_node *node) {
-    unsigned long height = 0;
-    if (node != NULL) {
-        unsigned long lheight = avl_height(node->left);
-        unsigned long rheight = avl_height(node->right);
-        height = 1 + ((lheight > rheight) ? lheight : rheight);
-    }
-    return height;
+/* AVL trees are at most ~1.44 log2(n) high, 64 levels cover any address space */
+#define AVL_MAX_DEPTH 64
+
+static inline long avl_height(struct avl_node *node) {
+    return (node == NULL) ? 0 : node->height;
 }
 
-static long avl_hdiff(struct avl_node *node) {
+static inline long avl_hdiff(struct avl_node *node) {
     return avl_height(node->left) - avl_height(node->right);
 }
 
+static inline void avl_fix_height(struct avl_node *node) {
+    long lheight = avl_height(node->left);
+    long rheight = avl_height(node->right);
+    node->height = 1 + ((lheight > rheight) ? lheight : rheight);
+}
+
 static struct avl_node *avl_rrro(struct avl_node *parent) {
     struct avl_node *node = parent->right;
     parent->right = node->left;
     node->left = parent;
+    avl_fix_height(parent);
+    avl_fix_height(node);
     return node;
 }
 
@@ -53,6 +58,8 @@ static struct avl_node *avl_llro(struct avl_node *parent) {
     struct avl_node *node = parent->left;
     parent->left = node->right;
     node->right = parent;
+    avl_fix_height(parent);
+    avl_fix_height(node);
     return node;
 }
 
@@ -69,92 +76,118 @@ static struct avl_node *avl_lrro(struct avl_node *parent) {
 }
 
 static struct avl_node *avl_balance(struct avl_node *node) {
-    int height_diff = avl_hdiff(node);
+    long height_diff = avl_hdiff(node);
     if (height_diff > 1) {
-        node = (avl_hdiff(node->left) > 0) ?
+        node = (avl_hdiff(node->left) >= 0) ?
             avl_llro(node) : avl_lrro(node);
     } else
     if (height_diff < -1) {
         node = (avl_hdiff(node->right) > 0) ?
             avl_rlro(node) : avl_rrro(node);
+    } else {
+        avl_fix_height(node);
     }
     return node;
 }
 
+/*
+ * Walk back up the recorded path and rebalance each subtree. We can stop as
+ * soon as a subtree keeps its old height as nothing above it changes then.
+ */
+static void avl_retrace(struct avl_node **path[], int depth) {
+    while (depth-- > 0) {
+        struct avl_node *node = *path[depth];
+        long height = node->height;
+        node = avl_balance(node);
+        *path[depth] = node;
+        if (node->height == height)
+            break;
+    }
+}
+
 struct avl_node* avl_insert(struct avl_node *root, void *data,
                             long(*cmp)(void*, void*)) {
-    // new elem
-    if (root == NULL) {
-        root = (struct avl_node*)malloc(sizeof(struct avl_node));
-        if (root == NULL) {
-            puts("Error in memory allocation\n");
-            abort();
-        }
-        root->data = data;
-        root->left = NULL;
-        root->right = NULL;
-        return root;
+    struct avl_node **path[AVL_MAX_DEPTH];
+    struct avl_node **link = &root, *node;
+    int depth = 0;
+    while (*link != NULL) {
+        long val = cmp(data, (*link)->data);
+        // element already in the tree
+        if (val == 0) return root;
+        path[depth++] = link;
+        link = (val < 0) ? &((*link)->left) : &((*link)->right);
     }
-    // recursion left
-    if (cmp(data, root->data) < 0) {
-        root->left = avl_insert(root->left, data, cmp);
-    }
-    // recursion right
-    if (cmp(data, root->data) > 0) {
-        root->right = avl_insert(root->right, data, cmp);
+    // new elem
+    node = (struct avl_node*)malloc(sizeof(struct avl_node));
+    if (node == NULL) {
+        puts("Error in memory allocation\n");
+        abort();
     }
-    return avl_balance(root);
+    node->data = data;
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    *link = node;
+    avl_retrace(path, depth);
+    return root;
 }
 
 struct avl_node* avl_delete(struct avl_node *root, void *data,
                             long(*cmp)(void*, void*)) {
-    if (root == NULL) return NULL;
-    // recursion to left subtree
-    if (cmp(data, root->data) < 0) {
-        root->left = avl_delete(root->left, data, cmp);
-    } else
-    // recursion to right subtree
-    if (cmp(data, root->data) > 0) {
-        root->right = avl_delete(root->right, data, cmp);
-    // this node
-    } else {
-        // no child        
-        if (root->left == NULL && root->right == NULL) {
-            free(root);
-            return NULL;
-        } else
-        // single child
-        if (root->left == NULL || root->right == NULL) {
-            struct avl_node *tmp = root->left ? root->left : root->right;
-            root->data = tmp->data;
-            root->left = tmp->left;
-            root->right = tmp->right;
-            free(tmp);
-        } else {
-        // two children
-            struct avl_node *tmp = root->right;
-            while (tmp->left != NULL) tmp = tmp->left;
-            root->data = tmp->data;
-            root->right = avl_delete(root->right, tmp->data, cmp);
+    struct avl_node **path[AVL_MAX_DEPTH];
+    struct avl_node **link = &root, *node;
+    int depth = 0;
+    while (*link != NULL) {
+        long val = cmp(data, (*link)->data);
+        if (val == 0) break;
+        path[depth++] = link;
+        link = (val < 0) ? &((*link)->left) : &((*link)->right);
+    }
+    node = *link;
+    if (node == NULL) return root;
+
+    if (node->left != NULL && node->right != NULL) {
+        // two children: pull up the in-order successor and unlink it instead
+        struct avl_node **succ = &(node->right);
+        path[depth++] = link;
+        while ((*succ)->left != NULL) {
+            path[depth++] = succ;
+            succ = &((*succ)->left);
         }
+        node->data = (*succ)->data;
+        link = succ;
+        node = *succ;
     }
-    return avl_balance(root);
+    // at most one child left
+    *link = (node->left != NULL) ? node->left : node->right;
+    free(node);
+    avl_retrace(path, depth);
+    return root;
 }
 
 struct avl_node* avl_find(struct avl_node *node, void *data,
                           long(*cmp)(void*, void*)) {
-    long val;
-    if (node == NULL) return NULL;
-    val = cmp(data, node->data);
-    if (val < 0) return avl_find(node->left, data, cmp);
-    if (val > 0) return avl_find(node->right, data, cmp);
+    while (node != NULL) {
+        long val = cmp(data, node->data);
+        if (val == 0) break;
+        node = (val < 0) ? node->left : node->right;
+    }
     return node;
 }
 
 void avl_destroy(struct avl_node *node, void (*dest)(void *)) {
-    if (node == NULL) return;
-    avl_destroy(node->left, dest);
-    avl_destroy(node->right, dest);
-    dest(node->data);
-    free(node);
+    struct avl_node *left;
+    // rotate left children up so the tree unrolls into a list (no recursion)
+    while (node != NULL) {
+        if ((left = node->left) != NULL) {
+            node->left = left->right;
+            left->right = node;
+            node = left;
+            continue;
+        }
+        left = node->right;
+        dest(node->data);
+        free(node);
+        node = left;
+    }
 }
@@ -38,6 +38,8 @@ struct avl_node {
     struct avl_node *right;
     /** pointer to data node */
     void *data;
+    /** height of the subtree rooted at this node (leaf == 1) */
+    long height;
 };
 
 /**
@@ -67,6 +69,7 @@ struct avl_node* avl_delete(struct avl_node *root, void *data, long(*cmp)(void*,
 
 /**
  * Searches the given AVL tree for given data.
+ * The search is iterative and calls cmp exactly once per level.
  * @param node Root of the AVL tree.
  * @param data Data point that we try to find
  * @param cmp Compare function, left arg.: data point, right arg.: current node
@@ -76,7 +79,7 @@ struct avl_node* avl_find(struct avl_node *node, void *data, long(*cmp)(void*, v
 
 /**
  * This function destroys the given AVL tree (inorder) and executes dest for
- * each element.
+ * each element. It does not recurse, the stack use is constant.
  * @param dest function that is executed for each data element.
  */
 void avl_destroy(struct avl_node *node, void (*dest)(void *));
@@ -0,0 +1,112 @@
+/**
+ * @file avl_bench.cc
+ * Benchmarks of avl_insert, avl_find and avl_delete for trees of 10 to 10M
+ * elements, with keys in sequential and random order.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "avl.h"
+#include "bench.h"
+
+enum key_order {
+    ORDER_SEQUENTIAL,
+    ORDER_RANDOM
+};
+
+static long compare(void *left, void *right) {
+    return ((long)left > (long)right) - ((long)left < (long)right);
+}
+
+/* the keys are plain integers */
+static void keep(void *data) {
+    (void)data;
+}
+
+static std::vector<long> make_keys(long nr, long order) {
+    std::vector<long> keys(nr);
+    for (long i = 0; i < nr; i++)
+        keys[i] = i;
+    if (order == ORDER_RANDOM)
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    return keys;
+}
+
+static struct avl_node *build(const std::vector<long> &keys) {
+    struct avl_node *root = NULL;
+    for (long key : keys)
+        root = avl_insert(root, (void*)key, compare);
+    return root;
+}
+
+static void AvlArgs(benchmark::internal::Benchmark *b) {
+    for (long nr = 10; nr <= 10000000; nr *= 10) {
+        b->Args({nr, ORDER_SEQUENTIAL});
+        b->Args({nr, ORDER_RANDOM});
+    }
+    b->ArgNames({"n", "random"})->Unit(benchmark::kMillisecond);
+}
+
+static void BM_AvlInsert(benchmark::State &state) {
+    std::vector<long> keys = make_keys(state.range(0), state.range(1));
+    BenchStats stats;
+    for (auto _ : state) {
+        struct avl_node *root = build(keys);
+        stats.pause(state);
+        avl_destroy(root, keep);
+        stats.resume(state);
+    }
+    stats.report(state, keys.size());
+}
+BENCHMARK(BM_AvlInsert)->Apply(AvlArgs);
+
+static void BM_AvlFind(benchmark::State &state) {
+    std::vector<long> keys = make_keys(state.range(0), state.range(1));
+    struct avl_node *root = build(keys);
+    /* look the keys up in a different order than they were inserted */
+    std::vector<long> lookups = make_keys(state.range(0), state.range(1));
+    std::reverse(lookups.begin(), lookups.end());
+    BenchStats stats;
+    for (auto _ : state) {
+        for (long key : lookups)
+            benchmark::DoNotOptimize(avl_find(root, (void*)key, compare));
+    }
+    stats.report(state, keys.size());
+    avl_destroy(root, keep);
+}
+BENCHMARK(BM_AvlFind)->Apply(AvlArgs);
+
+static void BM_AvlDelete(benchmark::State &state) {
+    std::vector<long> keys = make_keys(state.range(0), state.range(1));
+    BenchStats stats;
+    for (auto _ : state) {
+        stats.pause(state);
+        struct avl_node *root = build(keys);
+        stats.resume(state);
+        for (long key : keys)
+            root = avl_delete(root, (void*)key, compare);
+        benchmark::DoNotOptimize(root);
+    }
+    stats.report(state, keys.size());
+}
+BENCHMARK(BM_AvlDelete)->Apply(AvlArgs);
@@ -0,0 +1,55 @@
+/**
+ * @file bench.h
+ * Helpers shared by all benchmarks: allocation counting and peak RSS.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "benchmark/benchmark.h"
+
+/**
+ * Measures allocations and the peak RSS of a benchmark and reports them as
+ * counters (together with ns_per_op). Create it right before the timing loop.
+ */
+class BenchStats {
+public:
+    BenchStats();
+
+    /** PauseTiming that also stops counting allocations */
+    void pause(benchmark::State &state);
+
+    /** ResumeTiming that also resumes counting allocations */
+    void resume(benchmark::State &state);
+
+    /**
+     * Sets the counters ns_per_op, allocs_per_op and peak_rss_kb.
+     * @param ops operations per iteration of the timing loop
+     */
+    void report(benchmark::State &state, double ops);
+
+private:
+    unsigned long start;
+    unsigned long paused;
+    unsigned long excluded;
+};
+
+#endif  /* BENCH_H */
@@ -0,0 +1,128 @@
+/**
+ * @file bench_stats.cc
+ * Allocation counting (malloc and friends are interposed) and peak RSS
+ * measurement for the benchmarks.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "bench.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static unsigned long allocs = 0;
+
+static void count_alloc() {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+}
+
+extern "C" void *malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size) {
+    count_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    count_alloc();
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr == NULL) ? ENOMEM : 0;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static unsigned long current_allocs() {
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+/* resets VmHWM of the process to the current RSS */
+static void reset_peak_rss() {
+    /* memory of earlier benchmarks would stay resident otherwise */
+    malloc_trim(0);
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f != NULL) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static long peak_rss_kb() {
+    char line[128];
+    long kb = -1;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (strncmp(line, "VmHWM:", 6) == 0)
+            kb = strtol(line + 6, NULL, 10);
+    fclose(f);
+    return kb;
+}
+
+BenchStats::BenchStats() : paused(0), excluded(0) {
+    reset_peak_rss();
+    start = current_allocs();
+}
+
+void BenchStats::pause(benchmark::State &state) {
+    state.PauseTiming();
+    paused = current_allocs();
+}
+
+void BenchStats::resume(benchmark::State &state) {
+    excluded += current_allocs() - paused;
+    state.ResumeTiming();
+}
+
+void BenchStats::report(benchmark::State &state, double ops) {
+    using benchmark::Counter;
+    double n = (double)(current_allocs() - start - excluded);
+    /* time per iteration / ops, scaled to ns */
+    state.counters["ns_per_op"] = Counter(ops * 1e-9,
+        Counter::kIsIterationInvariantRate | Counter::kInvert);
+    state.counters["allocs_per_op"] = Counter(n / ops, Counter::kAvgIterations);
+    state.counters["peak_rss_kb"] = peak_rss_kb();
+}
@@ -0,0 +1,123 @@
+/**
+ * @file td_filestate_bench.cc
+ * Benchmarks of process creation/destruction and of system call handling.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "bench.h"
+
+/* a context that does not print reports */
+static struct td_context *quiet_context() {
+    struct td_config config = {};
+    config.quiet = 1;
+    return td_context_create(&config);
+}
+
+/* creates and destroys thread groups of state.range(0) threads */
+static void BM_ProcessChurn(benchmark::State &state) {
+    struct td_context *ctx = quiet_context();
+    long threads = state.range(0), pid = 1000, t;
+    BenchStats stats;
+    for (auto _ : state) {
+        for (t = 0; t < threads; t++)
+            td_process_create(ctx, pid, pid + t, 1);
+        for (t = threads - 1; t >= 0; t--)
+            td_process_destroy(ctx, pid + t);
+        pid = (pid + threads < 1000000) ? pid + threads : 1000;
+    }
+    stats.report(state, 2 * threads);
+    td_context_destroy(ctx);
+}
+BENCHMARK(BM_ProcessChurn)->ArgName("threads")->RangeMultiplier(4)->Range(1, 256);
+
+/* td_find_process over state.range(0) threads spread over the id space */
+static void BM_FindProcess(benchmark::State &state) {
+    struct td_context *ctx = quiet_context();
+    unsigned long threads = state.range(0), tid = 1, i;
+    for (i = 0; i < threads; i++)
+        td_process_create(ctx, i * 37 + 2, i * 37 + 2, 1);
+    BenchStats stats;
+    for (auto _ : state) {
+        /* pseudo random walk over all live tids */
+        tid = (tid * 1103515245 + 12345) % threads;
+        benchmark::DoNotOptimize(td_find_process(ctx, tid * 37 + 2));
+    }
+    stats.report(state, 1);
+    td_context_destroy(ctx);
+}
+BENCHMARK(BM_FindProcess)->ArgName("threads")->Arg(1000)->Arg(100000);
+
+/* number of thread groups and threads per group of the syscall benchmark */
+#define GROUPS 16
+#define THREADS 4
+
+/*
+ * stat -> open -> close of files picked at random from a set of
+ * state.range(0) files per thread group. the hot set fits into the caches,
+ * the cold set does not.
+ */
+static void BM_Syscall(benchmark::State &state) {
+    struct td_context *ctx = quiet_context();
+    long files = state.range(0), i;
+    std::vector<std::string> names(files);
+    std::vector<struct stat> bufs(files);
+    std::mt19937_64 rnd(42);
+    for (i = 0; i < files; i++) {
+        names[i] = "/home/user/project/src/file" + std::to_string(i) + ".c";
+        memset(&bufs[i], 0, sizeof(struct stat));
+        bufs[i].st_dev = 1;
+        bufs[i].st_ino = i + 1;
+        bufs[i].st_mode = 0100644;
+    }
+    for (long g = 0; g < GROUPS; g++)
+        for (long t = 0; t < THREADS; t++)
+            td_process_create(ctx, 100 + g * THREADS, 100 + g * THREADS + t, 1);
+
+    /* touch every file once so that the cold set is not dominated by inserts */
+    for (long g = 0; g < GROUPS; g++)
+        for (i = 0; i < files; i++)
+            td_handle_syscall_n(ctx, 100 + g * THREADS, SYS_STAT,
+                                names[i].c_str(), names[i].size(), "/", 1,
+                                &bufs[i]);
+
+    BenchStats stats;
+    for (auto _ : state) {
+        unsigned long tid = 100 + rnd() % (GROUPS * THREADS);
+        long f = rnd() % files;
+        const char *name = names[f].c_str();
+        unsigned long len = names[f].size();
+        td_handle_syscall_n(ctx, tid, SYS_STAT, name, len, "/", 1, &bufs[f]);
+        td_handle_syscall_n(ctx, tid, SYS_OPEN, name, len, "/", 1, &bufs[f]);
+        td_handle_syscall_n(ctx, tid, SYS_CLOSE, name, len, "/", 1, &bufs[f]);
+    }
+    stats.report(state, 3);
+    td_context_destroy(ctx);
+}
+BENCHMARK(BM_Syscall)->ArgName("files")->Arg(64)->Arg(1 << 16);
@@ -0,0 +1,212 @@
+/**
+ * @file td_index_bench.cc
+ * Benchmarks of the specialized ordered index (td_tree.h) against the
+ * function pointer AVL tree (avl.h), with integer thread id keys and string
+ * path keys.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "avl.h"
+#include "td_index.h"
+#include "td_tree.h"
+#include "bench.h"
+
+static long compare_tid(void *left, void *right) {
+    return ((long)left > (long)right) - ((long)left < (long)right);
+}
+
+/* the data of a path is its key, as in the old file tree */
+static long compare_path(void *left, void *right) {
+    const td_index_key *lkey = (const td_index_key*)left;
+    const td_index_key *rkey = (const td_index_key*)right;
+    unsigned long len = (lkey->len < rkey->len) ? lkey->len : rkey->len;
+    int val = memcmp(lkey->name, rkey->name, len);
+    if (val != 0)
+        return val;
+    return (lkey->len > rkey->len) - (lkey->len < rkey->len);
+}
+
+struct compare_key {
+    long operator()(const td_index_key &left, const td_index_key &right) const {
+        return compare_path((void*)&left, (void*)&right);
+    }
+};
+
+static void keep(void *data) {
+    (void)data;
+}
+
+/* thread ids in random order */
+static std::vector<long> make_tids(long nr) {
+    std::vector<long> tids(nr);
+    for (long i = 0; i < nr; i++)
+        tids[i] = i + 1;
+    std::shuffle(tids.begin(), tids.end(), std::mt19937_64(42));
+    return tids;
+}
+
+/* paths with a long common prefix, as in a source tree, in random order */
+static std::vector<std::string> make_paths(long nr) {
+    std::vector<std::string> paths(nr);
+    char path[128];
+    for (long i = 0; i < nr; i++) {
+        snprintf(path, sizeof(path), "/home/user/src/project/dir%ld/file%ld.c",
+                 i % 97, i);
+        paths[i] = path;
+    }
+    std::shuffle(paths.begin(), paths.end(), std::mt19937_64(42));
+    return paths;
+}
+
+static std::vector<td_index_key> make_keys(const std::vector<std::string> &paths) {
+    std::vector<td_index_key> keys(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+        keys[i] = { paths[i].c_str(), paths[i].size() };
+    return keys;
+}
+
+static void IndexArgs(benchmark::internal::Benchmark *b) {
+    for (long nr = 100; nr <= 1000000; nr *= 100)
+        b->Arg(nr);
+    b->ArgNames({"n"})->Unit(benchmark::kMicrosecond);
+}
+
+static void BM_AvlFindTid(benchmark::State &state) {
+    std::vector<long> tids = make_tids(state.range(0));
+    struct avl_node *root = NULL;
+    for (long tid : tids)
+        root = avl_insert(root, (void*)tid, compare_tid);
+    std::reverse(tids.begin(), tids.end());
+    BenchStats stats;
+    for (auto _ : state) {
+        for (long tid : tids)
+            benchmark::DoNotOptimize(avl_find(root, (void*)tid, compare_tid));
+    }
+    stats.report(state, tids.size());
+    avl_destroy(root, keep);
+}
+BENCHMARK(BM_AvlFindTid)->Apply(IndexArgs);
+
+static void BM_TreeFindTid(benchmark::State &state) {
+    std::vector<long> tids = make_tids(state.range(0));
+    td_tree<long, void*> tree;
+    for (long tid : tids)
+        tree.insert(tid, NULL);
+    std::reverse(tids.begin(), tids.end());
+    BenchStats stats;
+    for (auto _ : state) {
+        for (long tid : tids)
+            benchmark::DoNotOptimize(tree.find(tid));
+    }
+    stats.report(state, tids.size());
+}
+BENCHMARK(BM_TreeFindTid)->Apply(IndexArgs);
+
+static void BM_AvlInsertTid(benchmark::State &state) {
+    std::vector<long> tids = make_tids(state.range(0));
+    BenchStats stats;
+    for (auto _ : state) {
+        struct avl_node *root = NULL;
+        for (long tid : tids)
+            root = avl_insert(root, (void*)tid, compare_tid);
+        stats.pause(state);
+        avl_destroy(root, keep);
+        stats.resume(state);
+    }
+    stats.report(state, tids.size());
+}
+BENCHMARK(BM_AvlInsertTid)->Apply(IndexArgs);
+
+static void BM_TreeInsertTid(benchmark::State &state) {
+    std::vector<long> tids = make_tids(state.range(0));
+    BenchStats stats;
+    for (auto _ : state) {
+        td_tree<long, void*> tree;
+        for (long tid : tids)
+            tree.insert(tid, NULL);
+        stats.pause(state);
+        tree.clear();
+        stats.resume(state);
+    }
+    stats.report(state, tids.size());
+}
+BENCHMARK(BM_TreeInsertTid)->Apply(IndexArgs);
+
+static void BM_AvlFindPath(benchmark::State &state) {
+    std::vector<std::string> paths = make_paths(state.range(0));
+    std::vector<td_index_key> keys = make_keys(paths);
+    struct avl_node *root = NULL;
+    for (td_index_key &key : keys)
+        root = avl_insert(root, &key, compare_path);
+    /* separate lookup keys, like the names passed to a system call */
+    std::vector<std::string> lookups(paths.rbegin(), paths.rend());
+    std::vector<td_index_key> lkeys = make_keys(lookups);
+    BenchStats stats;
+    for (auto _ : state) {
+        for (td_index_key &key : lkeys)
+            benchmark::DoNotOptimize(avl_find(root, &key, compare_path));
+    }
+    stats.report(state, keys.size());
+    avl_destroy(root, keep);
+}
+BENCHMARK(BM_AvlFindPath)->Apply(IndexArgs);
+
+static void BM_TreeFindPath(benchmark::State &state) {
+    std::vector<std::string> paths = make_paths(state.range(0));
+    std::vector<td_index_key> keys = make_keys(paths);
+    td_tree<td_index_key, void*, compare_key> tree;
+    for (td_index_key &key : keys)
+        tree.insert(key, NULL);
+    std::vector<std::string> lookups(paths.rbegin(), paths.rend());
+    std::vector<td_index_key> lkeys = make_keys(lookups);
+    BenchStats stats;
+    for (auto _ : state) {
+        for (td_index_key &key : lkeys)
+            benchmark::DoNotOptimize(tree.find(key));
+    }
+    stats.report(state, keys.size());
+}
+BENCHMARK(BM_TreeFindPath)->Apply(IndexArgs);
+
+/* the same tree through the C interface that the daemon uses */
+static void BM_IndexFindPath(benchmark::State &state) {
+    std::vector<std::string> paths = make_paths(state.range(0));
+    struct td_index *index = td_index_create();
+    for (std::string &path : paths)
+        td_index_insert(index, path.c_str(), path.size(), &path);
+    std::vector<std::string> lookups(paths.rbegin(), paths.rend());
+    BenchStats stats;
+    for (auto _ : state) {
+        for (std::string &path : lookups)
+            benchmark::DoNotOptimize(td_index_find(index, path.c_str(),
+                                                   path.size()));
+    }
+    stats.report(state, paths.size());
+    td_index_destroy(index, NULL);
+}
+BENCHMARK(BM_IndexFindPath)->Apply(IndexArgs);
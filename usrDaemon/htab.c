@@ -0,0 +1,293 @@
+/**
+ * @file htab.c
+ * An open-addressing (linear probing) hash table with incremental resizing.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "htab.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* number of old slots that are moved per insert/delete during a resize */
+#define HTAB_MIGRATE 16
+/* smallest table that is allocated */
+#define HTAB_MIN_SIZE 16
+
+static inline int htab_live(struct htab_slot *slot) {
+    return slot->data != NULL && slot->data != HTAB_DELETED;
+}
+
+static inline uint64_t htab_rotl(uint64_t val, int bits) {
+    return (val << bits) | (val >> (64 - bits));
+}
+
+uint64_t htab_hash(const void *buf, uint64_t len) {
+    const unsigned char *ptr = (const unsigned char*)buf;
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len, word;
+    while (len >= sizeof(word)) {
+        memcpy(&word, ptr, sizeof(word));
+        hash = htab_rotl((hash ^ word) * 0x87c37b91114253d5ULL, 31);
+        ptr += sizeof(word);
+        len -= sizeof(word);
+    }
+    if (len != 0) {
+        word = 0;
+        memcpy(&word, ptr, len);
+        hash = htab_rotl((hash ^ word) * 0x87c37b91114253d5ULL, 31);
+    }
+    /* final avalanche (murmur3 fmix64), the low bits index the table */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+void htab_init(struct htab *tab) {
+    memset(tab, 0, sizeof(struct htab));
+}
+
+static inline struct htab_slot *htab_probe(struct htab_slot *slots,
+                                           uint64_t mask, uint64_t hash,
+                                           const void *key,
+                                           long (*eq)(const void*, void*),
+                                           unsigned long *probes) {
+    uint64_t pos = hash & mask;
+    while (slots[pos].data != NULL) {
+        if (probes != NULL)
+            (*probes)++;
+        if (slots[pos].hash == hash && slots[pos].data != HTAB_DELETED &&
+            eq(key, slots[pos].data))
+            return &(slots[pos]);
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+/* places data in the first free slot, returns 1 if an empty slot was used */
+static int htab_place(struct htab_slot *slots, uint64_t mask, uint64_t hash,
+                      void *data) {
+    uint64_t pos = hash & mask;
+    while (htab_live(&(slots[pos])))
+        pos = (pos + 1) & mask;
+    int fresh = (slots[pos].data == NULL);
+    slots[pos].hash = hash;
+    slots[pos].data = data;
+    return fresh;
+}
+
+static void htab_migrate(struct htab *tab, uint64_t nr) {
+    while (tab->old != NULL && nr-- > 0) {
+        struct htab_slot *slot = &(tab->old[tab->old_pos]);
+        if (htab_live(slot)) {
+            tab->used += htab_place(tab->slots, tab->mask, slot->hash,
+                                    slot->data);
+            /* keep probe chains of the remaining old slots intact */
+            slot->data = HTAB_DELETED;
+        }
+        if (tab->old_pos++ == tab->old_mask) {
+            free(tab->old);
+            tab->old = NULL;
+        }
+    }
+}
+
+static void htab_grow(struct htab *tab) {
+    uint64_t size = HTAB_MIN_SIZE;
+    struct htab_slot *slots;
+    /* an unfinished migration is completed before we start the next one */
+    htab_migrate(tab, (uint64_t)-1);
+    /* at most half full once everything is migrated: growing at 70% load
+       doubles the table (a 35% bound would quadruple it at the boundary) */
+    while (size < (tab->count + 1) * 2)
+        size <<= 1;
+    if ((slots = (struct htab_slot*)calloc(size, sizeof(struct htab_slot))) == NULL) {
+        puts("htab.c: Unable to allocate memory\n");
+        abort();
+    }
+    if (tab->slots != NULL) {
+        tab->old = tab->slots;
+        tab->old_mask = tab->mask;
+        tab->old_pos = 0;
+    }
+    tab->slots = slots;
+    tab->mask = size - 1;
+    tab->used = 0;
+}
+
+void *htab_find(struct htab *tab, uint64_t hash, const void *key,
+                long (*eq)(const void*, void*)) {
+    struct htab_slot *slot;
+    if (tab->slots == NULL) return NULL;
+    slot = htab_probe(tab->slots, tab->mask, hash, key, eq, NULL);
+    if (slot == NULL && tab->old != NULL)
+        slot = htab_probe(tab->old, tab->old_mask, hash, key, eq, NULL);
+    return (slot == NULL) ? NULL : slot->data;
+}
+
+void *htab_find_probes(struct htab *tab, uint64_t hash, const void *key,
+                       long (*eq)(const void*, void*), unsigned long *probes) {
+    struct htab_slot *slot;
+    *probes = 0;
+    if (tab->slots == NULL) return NULL;
+    slot = htab_probe(tab->slots, tab->mask, hash, key, eq, probes);
+    if (slot == NULL && tab->old != NULL)
+        slot = htab_probe(tab->old, tab->old_mask, hash, key, eq, probes);
+    return (slot == NULL) ? NULL : slot->data;
+}
+
+void htab_insert(struct htab *tab, uint64_t hash, void *data) {
+    /* grow at 70% load (tombstones included) */
+    if (tab->slots == NULL || (tab->used + 1) * 10 > (tab->mask + 1) * 7)
+        htab_grow(tab);
+    htab_migrate(tab, HTAB_MIGRATE);
+    tab->used += htab_place(tab->slots, tab->mask, hash, data);
+    tab->count++;
+}
+
+void *htab_find_or_insert(struct htab *tab, uint64_t hash, const void *key,
+                          long (*eq)(const void*, void*),
+                          void *(*create)(const void*, void*), void *arg,
+                          unsigned long *probes) {
+    struct htab_slot *slot, *free_slot = NULL;
+    uint64_t pos;
+    if (probes != NULL)
+        *probes = 0;
+    if (tab->slots == NULL || (tab->used + 1) * 10 > (tab->mask + 1) * 7)
+        htab_grow(tab);
+    htab_migrate(tab, HTAB_MIGRATE);
+    /* the first tombstone on the way is where a new element goes */
+    for (pos = hash & tab->mask; tab->slots[pos].data != NULL;
+         pos = (pos + 1) & tab->mask) {
+        slot = &(tab->slots[pos]);
+        if (probes != NULL)
+            (*probes)++;
+        if (slot->data == HTAB_DELETED) {
+            if (free_slot == NULL)
+                free_slot = slot;
+        } else if (slot->hash == hash && eq(key, slot->data)) {
+            return slot->data;
+        }
+    }
+    if (tab->old != NULL &&
+        (slot = htab_probe(tab->old, tab->old_mask, hash, key, eq,
+                           probes)) != NULL)
+        return slot->data;
+    if (free_slot == NULL) {
+        free_slot = &(tab->slots[pos]);
+        tab->used++;
+    }
+    free_slot->data = create(key, arg);
+    free_slot->hash = hash;
+    tab->count++;
+    return free_slot->data;
+}
+
+void htab_reserve(struct htab *tab, uint64_t nr) {
+    uint64_t size = HTAB_MIN_SIZE, i;
+    struct htab_slot *slots;
+    if (tab->slots != NULL && (tab->used + nr) * 10 <= (tab->mask + 1) * 7)
+        return;
+    htab_migrate(tab, (uint64_t)-1);
+    /* same load factor as htab_grow */
+    while (size < (tab->count + nr) * 2)
+        size <<= 1;
+    if ((slots = (struct htab_slot*)calloc(size, sizeof(struct htab_slot))) == NULL) {
+        puts("htab.c: Unable to allocate memory\n");
+        abort();
+    }
+    if (tab->slots != NULL) {
+        for (i = 0; i <= tab->mask; i++)
+            if (htab_live(&(tab->slots[i])))
+                htab_place(slots, size - 1, tab->slots[i].hash,
+                           tab->slots[i].data);
+        free(tab->slots);
+    }
+    tab->slots = slots;
+    tab->mask = size - 1;
+    tab->used = tab->count;
+}
+
+void *htab_delete(struct htab *tab, uint64_t hash, const void *key,
+                  long (*eq)(const void*, void*)) {
+    struct htab_slot *slot;
+    void *data;
+    if (tab->slots == NULL) return NULL;
+    slot = htab_probe(tab->slots, tab->mask, hash, key, eq, NULL);
+    if (slot == NULL && tab->old != NULL)
+        slot = htab_probe(tab->old, tab->old_mask, hash, key, eq, NULL);
+    if (slot == NULL) return NULL;
+    data = slot->data;
+    slot->data = HTAB_DELETED;
+    tab->count--;
+    htab_migrate(tab, HTAB_MIGRATE);
+    return data;
+}
+
+void *htab_next(struct htab *tab, uint64_t *pos) {
+    uint64_t size = tab->mask + 1, nr = size, i;
+    struct htab_slot *slot;
+    if (tab->count == 0) return NULL;
+    /* positions behind the current array are slots of the old array */
+    if (tab->old != NULL)
+        nr += tab->old_mask + 1;
+    for (i = (*pos < nr) ? *pos : 0; ; i = (i + 1 < nr) ? i + 1 : 0) {
+        slot = (i < size) ? &(tab->slots[i]) : &(tab->old[i - size]);
+        if (htab_live(slot))
+            break;
+    }
+    *pos = i + 1;
+    return slot->data;
+}
+
+static void htab_foreach_slots(struct htab_slot *slots, uint64_t mask,
+                               void (*fn)(void *, void *), void *arg) {
+    uint64_t i;
+    if (slots == NULL) return;
+    for (i = 0; i <= mask; i++)
+        if (htab_live(&(slots[i])))
+            fn(slots[i].data, arg);
+}
+
+void htab_foreach(struct htab *tab, void (*fn)(void *, void *), void *arg) {
+    htab_foreach_slots(tab->slots, tab->mask, fn, arg);
+    htab_foreach_slots(tab->old, tab->old_mask, fn, arg);
+}
+
+static void htab_destroy_slots(struct htab_slot *slots, uint64_t mask,
+                               void (*dest)(void *)) {
+    uint64_t i;
+    if (slots == NULL) return;
+    if (dest != NULL) {
+        for (i = 0; i <= mask; i++)
+            if (htab_live(&(slots[i])))
+                dest(slots[i].data);
+    }
+    free(slots);
+}
+
+void htab_destroy(struct htab *tab, void (*dest)(void *)) {
+    htab_destroy_slots(tab->slots, tab->mask, dest);
+    htab_destroy_slots(tab->old, tab->old_mask, dest);
+    htab_init(tab);
+}
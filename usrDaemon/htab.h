@@ -0,0 +1,212 @@
+/**
+ * @file htab.h
+ * An open-addressing hash table keyed by precomputed 64-bit hashes.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef HTAB_H
+#define HTAB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * A single slot of the table. The hash is kept next to the data pointer so
+ * that a probe only touches the data when the full hashes match.
+ */
+struct htab_slot {
+    /** full 64-bit hash of the key */
+    uint64_t hash;
+    /** pointer to data (NULL: empty, HTAB_DELETED: tombstone) */
+    void *data;
+};
+
+/**
+ * Linear probing hash table. When the table grows, the old slot array is
+ * kept around and migrated a few slots per insert/delete, so no single
+ * operation pays for a full rehash.
+ */
+struct htab {
+    /** current slot array */
+    struct htab_slot *slots;
+    /** number of slots - 1 */
+    uint64_t mask;
+    /** number of live elements (both arrays) */
+    uint64_t count;
+    /** live elements plus tombstones in the current array */
+    uint64_t used;
+    /** slot array that is still being migrated (or NULL) */
+    struct htab_slot *old;
+    /** number of old slots - 1 */
+    uint64_t old_mask;
+    /** next old slot to migrate */
+    uint64_t old_pos;
+};
+
+/** marker for deleted slots */
+#define HTAB_DELETED ((void*)1)
+
+/**
+ * Initializes an empty hash table.
+ * @param tab table to initialize
+ */
+void htab_init(struct htab *tab);
+
+/**
+ * Hashes a buffer into a 64-bit value.
+ * @param buf pointer to the key bytes
+ * @param len number of bytes
+ * @return hash of the buffer
+ */
+uint64_t htab_hash(const void *buf, uint64_t len);
+
+/**
+ * Searches the table for an element.
+ * @param tab the hash table
+ * @param hash precomputed hash of key
+ * @param key key that is passed to eq
+ * @param eq function that returns !=0 if the key matches the data element.
+ *      Only called if the hashes match.
+ * @return data pointer or NULL
+ */
+void *htab_find(struct htab *tab, uint64_t hash, const void *key,
+                long (*eq)(const void*, void*));
+
+/**
+ * Same as htab_find but also returns the number of slots that were probed.
+ * @param probes receives the number of probed slots
+ */
+void *htab_find_probes(struct htab *tab, uint64_t hash, const void *key,
+                       long (*eq)(const void*, void*), unsigned long *probes);
+
+/**
+ * Prefetches the first slot that a lookup of hash probes.
+ * @param tab the hash table
+ * @param hash precomputed hash of key
+ */
+static inline void htab_prefetch(struct htab *tab, uint64_t hash) {
+    if (tab->slots != 0)
+        __builtin_prefetch(&(tab->slots[hash & tab->mask]));
+}
+
+/**
+ * Prefetches the element that a lookup of hash most likely finds: the data of
+ * the first slot on its probe chain with the same hash. Reads the slots, so
+ * the table must not be modified concurrently (issue htab_prefetch first).
+ * @param tab the hash table
+ * @param hash precomputed hash of key
+ */
+static inline void htab_prefetch_data(struct htab *tab, uint64_t hash) {
+    uint64_t pos;
+    if (tab->slots == 0)
+        return;
+    for (pos = hash & tab->mask; tab->slots[pos].data != 0;
+         pos = (pos + 1) & tab->mask) {
+        if (tab->slots[pos].hash == hash) {
+            __builtin_prefetch(tab->slots[pos].data);
+            return;
+        }
+    }
+}
+
+/**
+ * Inserts an element into the table. The element must not be in the table.
+ * @param tab the hash table
+ * @param hash precomputed hash of the element
+ * @param data pointer to data
+ */
+void htab_insert(struct htab *tab, uint64_t hash, void *data);
+
+/**
+ * Looks up an element and inserts a new one if it is missing. The slot for
+ * the new element is found by the same probe that searched for it, so a miss
+ * costs a single probe sequence instead of a find and an insert. The table
+ * makes room for the element before it probes (it may grow one insert
+ * earlier than htab_insert would).
+ * @param tab the hash table
+ * @param hash precomputed hash of key
+ * @param key key that is passed to eq and create
+ * @param eq compare function (see htab_find)
+ * @param create returns the new element for key, only called on a miss. It
+ *      must not modify the table.
+ * @param arg second argument for create
+ * @param probes receives the number of probed slots (or NULL)
+ * @return the element that was found or created
+ */
+void *htab_find_or_insert(struct htab *tab, uint64_t hash, const void *key,
+                          long (*eq)(const void*, void*),
+                          void *(*create)(const void*, void*), void *arg,
+                          unsigned long *probes);
+
+/**
+ * Makes room for nr more elements at once, e.g., before a bulk insert. A
+ * table that is too small is rehashed into a single new slot array, so the
+ * following nr inserts neither grow nor migrate.
+ * @param tab the hash table
+ * @param nr number of elements that are inserted next
+ */
+void htab_reserve(struct htab *tab, uint64_t nr);
+
+/**
+ * Removes an element from the table.
+ * @param tab the hash table
+ * @param hash precomputed hash of key
+ * @param key key that is passed to eq
+ * @param eq compare function (see htab_find)
+ * @return the removed data pointer or NULL
+ */
+void *htab_delete(struct htab *tab, uint64_t hash, const void *key,
+                  long (*eq)(const void*, void*));
+
+/**
+ * Executes fn for each element of the table (in no particular order). The
+ * table must not be modified by fn.
+ * @param tab the hash table
+ * @param fn function that is executed for each data element
+ * @param arg second argument passed to fn
+ */
+void htab_foreach(struct htab *tab, void (*fn)(void *, void *), void *arg);
+
+/**
+ * Returns the next element at or after a slot position, wrapping around at
+ * the end of the table. Walks the table in slot order, e.g., for the hand of
+ * a CLOCK. During a resize the walk covers the current and then the old slot
+ * array, it does not migrate any slots.
+ * @param tab the hash table
+ * @param pos slot position, moved behind the returned element
+ * @return data pointer or NULL if the table is empty
+ */
+void *htab_next(struct htab *tab, uint64_t *pos);
+
+/**
+ * Destroys the table and executes dest for each element.
+ * @param tab the hash table
+ * @param dest function that is executed for each data element (or NULL).
+ */
+void htab_destroy(struct htab *tab, void (*dest)(void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* HTAB_H */
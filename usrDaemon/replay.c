@@ -0,0 +1,180 @@
+/**
+ * @file replay.c
+ * Streams a recorded trace (see td_trace.h) through the library as fast as
+ * possible and compares the verdicts with the recorded ones.
+ *
+ * Usage: replay [-c] [-i] trace
+ *   -c  replay into a context in concurrent mode
+ *   -i  forked groups inherit the files of their parent (td_config.inherit)
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "td_filestate.h"
+#include "td_trace.h"
+#include "syscall_nr.h"
+
+/* system calls handed to td_handle_syscall_batch at once */
+#define BATCH 256
+/* mismatches that are printed */
+#define MAX_REPORTS 10
+
+struct replay {
+    struct td_context *ctx;
+    struct td_event events[BATCH];
+    struct stat bufs[BATCH];
+    const struct td_trace_syscall *recs[BATCH];
+    unsigned long nr;
+    unsigned long syscalls;
+    unsigned long mismatches;
+};
+
+static const char *result_name(unsigned long result) {
+    switch (result) {
+        case SYSCALL_PIDERR: return "PIDERR";
+        case SYSCALL_RACE: return "RACE";
+        case SYSCALL_UNCHECKED: return "UNCHECKED";
+        case SYSCALL_PASS: return "PASS";
+    }
+    return "?";
+}
+
+static void flush(struct replay *r) {
+    enum td_syscall_result out[BATCH];
+    unsigned long i;
+    td_handle_syscall_batch(r->ctx, r->events, r->nr, out);
+    for (i = 0; i < r->nr; i++) {
+        if (out[i] == r->recs[i]->result)
+            continue;
+        if (r->mismatches++ < MAX_REPORTS)
+            printf("mismatch: tid %lu syscall %lu %.*s %.*s: recorded %s, "
+                   "replayed %s\n", r->events[i].tid, r->events[i].syscall,
+                   (int)r->events[i].file_len, r->events[i].file,
+                   (int)r->events[i].path_len, r->events[i].path,
+                   result_name(r->recs[i]->result), result_name(out[i]));
+    }
+    r->syscalls += r->nr;
+    r->nr = 0;
+}
+
+static void add_syscall(struct replay *r, const struct td_trace_syscall *rec) {
+    const char *names = (const char*)(rec + 1);
+    struct stat *buf = &(r->bufs[r->nr]);
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_mode = rec->mode;
+    buf->st_uid = rec->uid;
+    buf->st_gid = rec->gid;
+    buf->st_dev = rec->dev;
+    buf->st_ino = rec->ino;
+    r->events[r->nr] = (struct td_event){ rec->rec.tid, rec->syscall, names,
+                                          rec->file_len, names + rec->file_len,
+                                          rec->path_len, buf };
+    r->recs[r->nr++] = rec;
+    if (r->nr == BATCH)
+        flush(r);
+}
+
+/* descriptor events are not batched, they are replayed in order */
+static void replay_fd(struct replay *r, const struct td_trace_fd *rec) {
+    const char *file = (const char*)(rec + 1);
+    enum td_syscall_result out;
+    flush(r);
+    if (rec->syscall == SYS_OPEN)
+        out = td_bind_fd(r->ctx, rec->rec.tid, rec->fd, file, rec->file_len);
+    else
+        out = td_handle_syscall_fd(r->ctx, rec->rec.tid, rec->syscall, rec->fd,
+                                   rec->newfd);
+    r->syscalls++;
+    if (out != rec->result && r->mismatches++ < MAX_REPORTS)
+        printf("mismatch: tid %lu syscall %lu fd %ld %ld %.*s: recorded %s, "
+               "replayed %s\n", (unsigned long)rec->rec.tid,
+               (unsigned long)rec->syscall, (long)rec->fd, (long)rec->newfd,
+               (int)rec->file_len, file, result_name(rec->result),
+               result_name(out));
+}
+
+int main(int argc, char *argv[]) {
+    static struct replay r;
+    struct td_config config = { .quiet = 1 };
+    struct td_trace_reader reader;
+    const struct td_trace_rec *rec;
+    const struct td_trace_create *create;
+    struct timespec start, end;
+    unsigned long events = 0;
+    double secs;
+    int arg = 1;
+
+    for (; arg < argc - 1; arg++) {
+        if (strcmp(argv[arg], "-c") == 0)
+            config.concurrent = 1;
+        else if (strcmp(argv[arg], "-i") == 0)
+            config.inherit = 1;
+        else
+            break;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "usage: %s [-c] [-i] trace\n", argv[0]);
+        return 2;
+    }
+    if (td_trace_map(&reader, argv[arg]) != 0) {
+        fprintf(stderr, "%s: not a trace\n", argv[arg]);
+        return 2;
+    }
+
+    r.ctx = td_context_create(&config);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((rec = td_trace_next(&reader)) != NULL) {
+        events++;
+        switch (rec->type) {
+            case TD_TRACE_CREATE:
+                flush(&r);
+                create = (const struct td_trace_create*)rec;
+                td_process_create(r.ctx, create->pid, rec->tid, create->ppid);
+                break;
+            case TD_TRACE_DESTROY:
+                flush(&r);
+                td_process_destroy(r.ctx, rec->tid);
+                break;
+            case TD_TRACE_SYSCALL:
+                add_syscall(&r, (const struct td_trace_syscall*)rec);
+                break;
+            case TD_TRACE_FD:
+                replay_fd(&r, (const struct td_trace_fd*)rec);
+                break;
+        }
+    }
+    flush(&r);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%lu events (%lu system calls) in %.3f s: %.0f events/s, "
+           "%lu verdict mismatches\n", events, r.syscalls, secs,
+           (secs > 0) ? events / secs : 0.0, r.mismatches);
+    if (reader.pos != reader.size)
+        fprintf(stderr, "%s: malformed record at offset %lu\n", argv[arg],
+                (unsigned long)reader.pos);
+    td_context_destroy(r.ctx);
+    td_trace_unmap(&reader);
+    return (r.mismatches != 0 || reader.pos != reader.size) ? 1 : 0;
+}
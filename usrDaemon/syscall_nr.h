@@ -25,11 +25,21 @@
 
 #if defined(__x86_64__)
 
-#define SYS_OPEN     2
-#define SYS_CLOSE    3
-#define SYS_STAT     4
-#define SYS_ACCESS  21
-#define SYS_CREAT   85
+#define SYS_OPEN         2
+#define SYS_CLOSE        3
+#define SYS_STAT         4
+#define SYS_LSTAT        6
+#define SYS_ACCESS      21
+#define SYS_DUP         32
+#define SYS_DUP2        33
+#define SYS_CREAT       85
+#define SYS_OPENAT     257
+#define SYS_NEWFSTATAT 262
+#define SYS_FACCESSAT  269
+#define SYS_DUP3       292
+#define SYS_STATX      332
+#define SYS_OPENAT2    437
+#define SYS_FACCESSAT2 439
 
 #endif  /* defined(__x86_64__) */
 
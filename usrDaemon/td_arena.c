@@ -0,0 +1,133 @@
+/**
+ * @file td_arena.c
+ * Bump pointer arena with per-size free lists.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_arena.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/* chunks start small (most processes are short lived) and grow up to 1MB */
+#define CHUNK_MIN 4096UL
+#define CHUNK_MAX (1024UL * 1024UL)
+#define CACHE_LINE 64UL
+
+struct td_arena_chunk {
+    struct td_arena_chunk *next;
+};
+
+/* empty objects take the smallest class, there is no class below it */
+static inline unsigned long round_size(unsigned long size) {
+    return (size != 0) ? (size + 15) & ~15UL : 16;
+}
+
+void td_arena_init(struct td_arena *arena) {
+    memset(arena, 0, sizeof(struct td_arena));
+    arena->chunk_size = CHUNK_MIN;
+}
+
+#ifdef TD_ARENA_MALLOC
+
+void *td_arena_alloc(struct td_arena *arena, unsigned long size) {
+    void *ptr;
+    if ((ptr = malloc(size)) == NULL) {
+        puts("td_arena.c: Unable to allocate memory\n");
+        abort();
+    }
+    arena->used += round_size(size);
+    return ptr;
+}
+
+void td_arena_free(struct td_arena *arena, void *ptr, unsigned long size) {
+    if (ptr == NULL) return;
+    arena->used -= round_size(size);
+    free(ptr);
+}
+
+void td_arena_release(struct td_arena *arena) {
+    td_arena_init(arena);
+}
+
+#else
+
+static void arena_new_chunk(struct td_arena *arena, unsigned long size) {
+    struct td_arena_chunk *chunk;
+    unsigned long csize = arena->chunk_size;
+    /* room for the header, alignment, and the object */
+    while (csize < size + sizeof(struct td_arena_chunk) + CACHE_LINE)
+        csize <<= 1;
+    if ((chunk = (struct td_arena_chunk*)malloc(csize)) == NULL) {
+        puts("td_arena.c: Unable to allocate memory\n");
+        abort();
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->cur = (char*)(chunk + 1);
+    arena->end = (char*)chunk + csize;
+    if (arena->chunk_size < CHUNK_MAX)
+        arena->chunk_size <<= 1;
+}
+
+void *td_arena_alloc(struct td_arena *arena, unsigned long size) {
+    unsigned long align, rsize = round_size(size);
+    uintptr_t cur;
+    void *ptr;
+    if (rsize <= TD_ARENA_MAX_CLASS && arena->free[rsize / 16 - 1] != NULL) {
+        ptr = arena->free[rsize / 16 - 1];
+        arena->free[rsize / 16 - 1] = *(void**)ptr;
+        arena->used += rsize;
+        return ptr;
+    }
+    align = (rsize >= CACHE_LINE) ? CACHE_LINE : 16;
+    cur = ((uintptr_t)arena->cur + align - 1) & ~(align - 1);
+    if (arena->cur == NULL || cur + rsize > (uintptr_t)arena->end) {
+        arena_new_chunk(arena, rsize);
+        cur = ((uintptr_t)arena->cur + align - 1) & ~(align - 1);
+    }
+    arena->cur = (char*)(cur + rsize);
+    arena->used += rsize;
+    return (void*)cur;
+}
+
+void td_arena_free(struct td_arena *arena, void *ptr, unsigned long size) {
+    unsigned long rsize = round_size(size);
+    if (ptr == NULL) return;
+    arena->used -= rsize;
+    /* large objects are only reclaimed when the arena is released */
+    if (rsize > TD_ARENA_MAX_CLASS) return;
+    *(void**)ptr = arena->free[rsize / 16 - 1];
+    arena->free[rsize / 16 - 1] = ptr;
+}
+
+void td_arena_release(struct td_arena *arena) {
+    struct td_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct td_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    td_arena_init(arena);
+}
+
+#endif  /* TD_ARENA_MALLOC */
@@ -0,0 +1,93 @@
+/**
+ * @file td_arena.h
+ * A simple arena allocator. Each thread group owns one arena that holds all
+ * of its threads and file entries, the whole arena is released at once when
+ * the last thread of the group exits.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_ARENA_H
+#define TD_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* objects up to this size are recycled through per-size free lists */
+#define TD_ARENA_MAX_CLASS 256
+
+/*
+ * Compile with -DTD_ARENA_MALLOC to turn the arena into a thin wrapper around
+ * malloc/free (e.g., for benchmarks or valgrind runs). Callers must then free
+ * each object before releasing the arena.
+ */
+#ifdef TD_ARENA_MALLOC
+#define TD_ARENA_BULK_RELEASE 0
+#else
+#define TD_ARENA_BULK_RELEASE 1
+#endif
+
+struct td_arena_chunk;
+
+struct td_arena {
+    struct td_arena_chunk *chunks;  /*< list of all chunks (newest first) */
+    char *cur;  /*< next free byte in the current chunk */
+    char *end;  /*< end of the current chunk */
+    unsigned long chunk_size;  /*< size of the next chunk */
+    unsigned long used;  /*< bytes handed out and not yet freed */
+    void *free[TD_ARENA_MAX_CLASS / 16];  /*< free lists per 16 byte class */
+};
+
+/**
+ * Initializes an empty arena, no memory is allocated until the first
+ * td_arena_alloc.
+ * @param arena the arena
+ */
+void td_arena_init(struct td_arena *arena);
+
+/**
+ * Allocates an object from the arena. Objects of 64 bytes or more are cache
+ * line aligned, all others are 16 byte aligned. Aborts if out of memory.
+ * @param arena the arena
+ * @param size size of the object
+ * @return pointer to the (uninitialized) object
+ */
+void *td_arena_alloc(struct td_arena *arena, unsigned long size);
+
+/**
+ * Returns a single object to the arena.
+ * @param arena the arena the object was allocated from
+ * @param ptr pointer to the object (or NULL)
+ * @param size size that was passed to td_arena_alloc
+ */
+void td_arena_free(struct td_arena *arena, void *ptr, unsigned long size);
+
+/**
+ * Releases all memory of the arena at once. The cost depends on the number of
+ * chunks, not on the number of objects.
+ * @param arena the arena
+ */
+void td_arena_release(struct td_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_ARENA_H */
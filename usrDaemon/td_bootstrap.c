@@ -0,0 +1,235 @@
+/**
+ * @file td_bootstrap.c
+ * Bootstrap of the processes that were already running from procfs.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_bootstrap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/* suffix of the link of a descriptor whose file was removed */
+#define DELETED " (deleted)"
+
+/* what the scan found out about a thread group */
+struct boot_group {
+    unsigned long pid;
+    unsigned long ppid;
+    int found;  /*< the group was still running when it was scanned */
+    unsigned long *tids;
+    unsigned long nr_tids, max_tids;
+    struct td_open_file *files;  /*< names are allocated with the group */
+    unsigned long nr_files, max_files;
+};
+
+struct boot_scan {
+    const char *root;
+    struct boot_group *groups;
+    unsigned long nr_groups;
+    unsigned long next;  /*< next group to scan (shared by the workers) */
+};
+
+static void *grow(void *array, unsigned long *max, unsigned long nr,
+                  size_t size) {
+    if (nr < *max)
+        return array;
+    *max = (*max != 0) ? 2 * *max : 16;
+    if ((array = realloc(array, *max * size)) == NULL) {
+        puts("td_bootstrap.c: Unable to allocate memory\n");
+        abort();
+    }
+    return array;
+}
+
+/* parses a directory entry that is a decimal id */
+static int parse_id(const char *name, unsigned long *id) {
+    char *end;
+    if (name[0] < '0' || name[0] > '9')
+        return 0;
+    *id = strtoul(name, &end, 10);
+    return *end == '\0';
+}
+
+/* reads the parent from /proc/<pid>/stat, 0 if the process is gone */
+static int read_ppid(const char *root, struct boot_group *group) {
+    char path[PATH_MAX], buf[512], *comm;
+    ssize_t len;
+    int fd;
+    snprintf(path, sizeof(path), "%s/%lu/stat", root, group->pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return 0;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return 0;
+    buf[len] = '\0';
+    /* the command may contain spaces and parentheses, it ends at the last ')' */
+    if ((comm = strrchr(buf, ')')) == NULL ||
+        sscanf(comm + 1, " %*c %lu", &(group->ppid)) != 1)
+        return 0;
+    return 1;
+}
+
+static void add_tid(struct boot_group *group, unsigned long tid) {
+    group->tids = (unsigned long*)grow(group->tids, &(group->max_tids),
+                                       group->nr_tids, sizeof(unsigned long));
+    group->tids[group->nr_tids++] = tid;
+}
+
+static void scan_tasks(const char *root, struct boot_group *group) {
+    char path[PATH_MAX];
+    struct dirent *ent;
+    unsigned long tid;
+    DIR *dir;
+    /* the main thread first, it becomes the first thread of the group */
+    add_tid(group, group->pid);
+    snprintf(path, sizeof(path), "%s/%lu/task", root, group->pid);
+    if ((dir = opendir(path)) == NULL)
+        return;
+    while ((ent = readdir(dir)) != NULL)
+        if (parse_id(ent->d_name, &tid) && tid != group->pid)
+            add_tid(group, tid);
+    closedir(dir);
+}
+
+static void scan_fds(const char *root, struct boot_group *group) {
+    char path[PATH_MAX], name[PATH_MAX];
+    struct td_open_file *file;
+    struct dirent *ent;
+    struct stat buf;
+    unsigned long fd;
+    ssize_t len;
+    DIR *dir;
+    snprintf(path, sizeof(path), "%s/%lu/fd", root, group->pid);
+    if ((dir = opendir(path)) == NULL)
+        return;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!parse_id(ent->d_name, &fd))
+            continue;
+        snprintf(path, sizeof(path), "%s/%lu/fd/%lu", root, group->pid, fd);
+        /* the link names the file, stat follows it to the open file */
+        if ((len = readlink(path, name, sizeof(name))) <= 0 ||
+            (size_t)len == sizeof(name) || name[0] != '/' ||
+            ((size_t)len >= sizeof(DELETED) - 1 &&
+             memcmp(name + len - (sizeof(DELETED) - 1), DELETED,
+                    sizeof(DELETED) - 1) == 0) ||
+            stat(path, &buf) != 0)
+            continue;
+        group->files = (struct td_open_file*)
+            grow(group->files, &(group->max_files), group->nr_files,
+                 sizeof(struct td_open_file));
+        file = &(group->files[group->nr_files++]);
+        if ((file->name = strndup(name, len)) == NULL) {
+            puts("td_bootstrap.c: Unable to allocate memory\n");
+            abort();
+        }
+        file->name_len = len;
+        file->fd = fd;
+        file->fp.dev = buf.st_dev;
+        file->fp.ino = buf.st_ino;
+        file->fp.mode = buf.st_mode;
+        file->fp.uid = buf.st_uid;
+        file->fp.gid = buf.st_gid;
+    }
+    closedir(dir);
+}
+
+static void *scan_worker(void *bootscan) {
+    struct boot_scan *scan = (struct boot_scan*)bootscan;
+    unsigned long i;
+    while ((i = __atomic_fetch_add(&(scan->next), 1, __ATOMIC_RELAXED)) <
+           scan->nr_groups) {
+        struct boot_group *group = &(scan->groups[i]);
+        if (!read_ppid(scan->root, group))
+            continue;
+        scan_tasks(scan->root, group);
+        scan_fds(scan->root, group);
+        group->found = 1;
+    }
+    return NULL;
+}
+
+/* lists the processes of the tree, -1 if it cannot be read */
+static long list_groups(struct boot_scan *scan) {
+    unsigned long max = 0, pid;
+    struct dirent *ent;
+    DIR *dir;
+    if ((dir = opendir(scan->root)) == NULL)
+        return -1;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!parse_id(ent->d_name, &pid))
+            continue;
+        scan->groups = (struct boot_group*)
+            grow(scan->groups, &max, scan->nr_groups, sizeof(struct boot_group));
+        memset(&(scan->groups[scan->nr_groups]), 0, sizeof(struct boot_group));
+        scan->groups[scan->nr_groups++].pid = pid;
+    }
+    closedir(dir);
+    return 0;
+}
+
+long td_bootstrap(struct td_context *ctx, const char *proc_root,
+                  unsigned long workers) {
+    struct boot_scan scan = { (proc_root != NULL) ? proc_root : "/proc",
+                              NULL, 0, 0 };
+    pthread_t threads[TD_BOOTSTRAP_WORKERS];
+    unsigned long i, j, started = 0;
+    long nr = 0;
+
+    if (list_groups(&scan) != 0)
+        return -1;
+    if (workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cpus > 0) ? cpus : 1;
+    }
+    if (workers > TD_BOOTSTRAP_WORKERS)
+        workers = TD_BOOTSTRAP_WORKERS;
+    if (workers > scan.nr_groups)
+        workers = scan.nr_groups;
+    /* the calling thread scans as well */
+    for (i = 1; i < workers; i++)
+        if (pthread_create(&(threads[started]), NULL, scan_worker, &scan) == 0)
+            started++;
+    scan_worker(&scan);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < scan.nr_groups; i++) {
+        struct boot_group *group = &(scan.groups[i]);
+        if (group->found)
+            nr += td_load_group(ctx, group->pid, group->ppid, group->tids,
+                                group->nr_tids, group->files,
+                                group->nr_files);
+        for (j = 0; j < group->nr_files; j++)
+            free((char*)group->files[j].name);
+        free(group->files);
+        free(group->tids);
+    }
+    free(scan.groups);
+    return nr;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file td_bootstrap.h
+ * Bootstrap of the processes that were already running when tracking
+ * started. The thread groups, threads and open files are read from procfs
+ * (/proc/<pid>/stat, /proc/<pid>/task and /proc/<pid>/fd) by a pool of
+ * worker threads, each group is then added in one step through
+ * td_load_group.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_BOOTSTRAP_H
+#define TD_BOOTSTRAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "td_filestate.h"
+
+/* upper bound of the worker threads of a scan */
+#define TD_BOOTSTRAP_WORKERS 16
+
+/**
+ * Adds all processes of a procfs tree to a context. A process that exits
+ * during the scan is skipped. Descriptors that are not files with an
+ * absolute name (pipes, sockets, deleted files) and descriptors that cannot
+ * be read (other users' processes) are skipped. A process whose task
+ * directory cannot be read is added with its main thread only.
+ * @param ctx the context
+ * @param proc_root mount point of procfs (or NULL for "/proc")
+ * @param workers number of worker threads (0: one per online CPU), at most
+ *      TD_BOOTSTRAP_WORKERS
+ * @return number of threads that were added or -1 if proc_root cannot be
+ *      read
+ */
+long td_bootstrap(struct td_context *ctx, const char *proc_root,
+                  unsigned long workers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_BOOTSTRAP_H */
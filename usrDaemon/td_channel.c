@@ -0,0 +1,503 @@
+/**
+ * @file td_channel.c
+ * Shared memory channel. Both rings are bounded multi-producer rings with a
+ * single consumer: every record carries a sequence number that tells whether
+ * it is free or being filled (seq == pos) or published (seq == pos + 1) for
+ * ring position pos. Producers claim positions with a CAS on head, so a slow
+ * producer only delays the consumer, never the other producers.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include "td_channel.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define CHAN_MAGIC 0x74646368616e0001UL
+/* empty (or full) polls before a consumer (or producer) goes to sleep */
+#define SPIN_POLLS 1000
+/* system calls that are handed to td_handle_syscall_batch at once */
+#define POLL_BATCH 64
+/* most extension records of an event */
+#define MAX_EXT ((TD_CHAN_MAX_NAMES - TD_CHAN_NAMES + TD_CHAN_EXT_NAMES - 1) / \
+                 TD_CHAN_EXT_NAMES)
+/* names of the events of a batch that are copied out of extension records */
+#define POLL_NAMES (8 * (TD_CHAN_NAMES + MAX_EXT * TD_CHAN_EXT_NAMES))
+
+/* a record that continues the names of the event before it */
+struct chan_ext {
+    uint64_t seq;  /*< ring internal */
+    char names[TD_CHAN_EXT_NAMES];
+};
+
+_Static_assert(sizeof(struct td_chan_event) == TD_CHAN_RECORD,
+               "event records must have a fixed size");
+_Static_assert(sizeof(struct chan_ext) == TD_CHAN_RECORD,
+               "extension records must have the size of an event record");
+
+struct chan_ring {
+    uint64_t head __attribute__((aligned(64)));  /*< next position to reserve */
+    uint64_t tail __attribute__((aligned(64)));  /*< next position to consume */
+    int waiting;  /*< consumer sleeps (or is about to) */
+    int wakeups;  /*< futex word of the consumer */
+    int full_waiting;  /*< producers sleep on a full ring */
+    int full_wakeups;  /*< futex word of the producers */
+};
+
+/* start of the shared mapping, followed by the event and verdict records */
+struct chan_shm {
+    uint64_t magic;
+    uint64_t nr_slots;
+    int stop;  /*< td_channel_stop was called */
+    struct chan_ring events;
+    struct chan_ring verdicts;
+};
+
+/* process local handle of a mapping */
+struct td_channel {
+    int fd;
+    size_t size;
+    uint64_t mask;
+    struct chan_shm *shm;
+    struct td_chan_event *events;
+    struct td_chan_verdict *verdicts;
+    char *names;  /*< td_channel_poll: names copied from extension records */
+};
+
+/* the mapping is shared among processes, so no private futexes */
+static void futex_wait(int *addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr, int nr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+static void wake(int *waiting, int *wakeups, int nr) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(wakeups, 1, __ATOMIC_SEQ_CST);
+        futex_wake(wakeups, nr);
+    }
+}
+
+/* sleeps until *seq changes from val (or the channel is stopped) */
+static void sleep_on(struct chan_shm *shm, int *waiting, int *wakeups,
+                     uint64_t *seq, uint64_t val) {
+    /* announce that we sleep, then check the record once more */
+    int w = __atomic_load_n(wakeups, __ATOMIC_SEQ_CST);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(seq, __ATOMIC_SEQ_CST) == val &&
+        !__atomic_load_n(&(shm->stop), __ATOMIC_SEQ_CST))
+        futex_wait(wakeups, w);
+}
+
+static uint64_t *slot_seq(void *slots, size_t size, uint64_t pos,
+                          uint64_t mask) {
+    return (uint64_t*)((char*)slots + (pos & mask) * size);
+}
+
+/* reserves nr consecutive records, returns the first one */
+static void *ring_reserve(struct td_channel *chan, struct chan_ring *ring,
+                          void *slots, size_t size, uint64_t nr) {
+    unsigned long polls = 0;
+    for (;;) {
+        uint64_t pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED), i;
+        uint64_t *seq = NULL, cur = 0;
+        /* all records must have been consumed in the last lap */
+        for (i = 0; i < nr; i++) {
+            seq = slot_seq(slots, size, pos + i, chan->mask);
+            cur = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+            if (cur != pos + i)
+                break;
+        }
+        if (i == nr) {
+            if (__atomic_compare_exchange_n(&(ring->head), &pos, pos + nr, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return slot_seq(slots, size, pos, chan->mask);
+            polls = 0;
+        } else if ((int64_t)(cur - (pos + i)) < 0) {
+            /* the record still holds an unconsumed event of the last lap */
+            if (++polls < SPIN_POLLS)
+                sched_yield();
+            else
+                sleep_on(chan->shm, &(ring->full_waiting),
+                         &(ring->full_wakeups), seq, cur);
+        }
+    }
+}
+
+static void ring_publish(struct chan_ring *ring, uint64_t *seq) {
+    uint64_t pos = *seq;
+    __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+    wake(&(ring->waiting), &(ring->wakeups), 1);
+}
+
+/* hands the records [from, to) back to the producers */
+static void ring_release(struct td_channel *chan, struct chan_ring *ring,
+                         void *slots, size_t size, uint64_t from, uint64_t to) {
+    uint64_t pos;
+    if (from == to)
+        return;
+    for (pos = from; pos != to; pos++)
+        __atomic_store_n(slot_seq(slots, size, pos, chan->mask),
+                         pos + chan->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&(ring->tail), to, __ATOMIC_RELEASE);
+    wake(&(ring->full_waiting), &(ring->full_wakeups), INT_MAX);
+}
+
+static size_t chan_size(uint64_t nr_slots) {
+    return sizeof(struct chan_shm) + nr_slots * sizeof(struct td_chan_event) +
+        nr_slots * sizeof(struct td_chan_verdict);
+}
+
+static struct td_channel *chan_map(int fd, size_t size) {
+    struct td_channel *chan;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+    if ((chan = (struct td_channel*)malloc(sizeof(struct td_channel))) == NULL) {
+        puts("td_channel.c: Unable to allocate memory\n");
+        abort();
+    }
+    chan->fd = fd;
+    chan->size = size;
+    chan->shm = (struct chan_shm*)mem;
+    chan->events = (struct td_chan_event*)(chan->shm + 1);
+    chan->names = NULL;
+    return chan;
+}
+
+static void chan_setup(struct td_channel *chan, uint64_t nr_slots) {
+    chan->mask = nr_slots - 1;
+    chan->verdicts = (struct td_chan_verdict*)(chan->events + nr_slots);
+}
+
+struct td_channel *td_channel_create(unsigned long nr_slots) {
+    struct td_channel *chan;
+    uint64_t nr = 2, i;
+    int fd;
+    while (nr < nr_slots)
+        nr <<= 1;
+    if ((fd = memfd_create("tracestate", MFD_CLOEXEC)) == -1)
+        return NULL;
+    if (ftruncate(fd, chan_size(nr)) != 0 ||
+        (chan = chan_map(fd, chan_size(nr))) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    chan_setup(chan, nr);
+    /* the file is zero filled, only the sequence numbers need a value */
+    for (i = 0; i < nr; i++) {
+        chan->events[i].seq = i;
+        chan->verdicts[i].seq = i;
+    }
+    chan->shm->nr_slots = nr;
+    __atomic_store_n(&(chan->shm->magic), CHAN_MAGIC, __ATOMIC_RELEASE);
+    return chan;
+}
+
+struct td_channel *td_channel_attach(int fd) {
+    struct td_channel *chan;
+    struct stat st;
+    uint64_t nr;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct chan_shm) ||
+        (fd = dup(fd)) == -1)
+        return NULL;
+    if ((chan = chan_map(fd, st.st_size)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    nr = chan->shm->nr_slots;
+    if (__atomic_load_n(&(chan->shm->magic), __ATOMIC_ACQUIRE) != CHAN_MAGIC ||
+        nr < 2 || (nr & (nr - 1)) != 0 || chan_size(nr) != chan->size) {
+        td_channel_destroy(chan);
+        return NULL;
+    }
+    chan_setup(chan, nr);
+    return chan;
+}
+
+int td_channel_fd(struct td_channel *chan) {
+    return chan->fd;
+}
+
+void td_channel_destroy(struct td_channel *chan) {
+    munmap(chan->shm, chan->size);
+    close(chan->fd);
+    free(chan->names);
+    free(chan);
+}
+
+/* the k-th extension record of an event */
+static struct chan_ext *ext_record(struct td_channel *chan,
+                                   struct td_chan_event *ev, unsigned long k) {
+    uint64_t slot = (ev - chan->events) + 1 + k;
+    return (struct chan_ext*)&(chan->events[slot & chan->mask]);
+}
+
+/* size of the names of an event with nr_ext extension records */
+static unsigned long names_size(unsigned long nr_ext) {
+    return TD_CHAN_NAMES + nr_ext * TD_CHAN_EXT_NAMES;
+}
+
+/*
+ * copies len bytes between buf and the names of an event at offset off, into
+ * the records if put is set, out of them otherwise
+ */
+static void copy_names(struct td_channel *chan, struct td_chan_event *ev,
+                       unsigned long off, char *buf, unsigned long len,
+                       int put) {
+    while (len > 0) {
+        char *names;
+        unsigned long room, n;
+        if (off < TD_CHAN_NAMES) {
+            names = ev->names + off;
+            room = TD_CHAN_NAMES - off;
+        } else {
+            unsigned long k = (off - TD_CHAN_NAMES) / TD_CHAN_EXT_NAMES;
+            unsigned long in = (off - TD_CHAN_NAMES) % TD_CHAN_EXT_NAMES;
+            names = ext_record(chan, ev, k)->names + in;
+            room = TD_CHAN_EXT_NAMES - in;
+        }
+        n = (len < room) ? len : room;
+        if (put)
+            memcpy(names, buf, n);
+        else
+            memcpy(buf, names, n);
+        off += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+struct td_chan_event *td_channel_reserve(struct td_channel *chan,
+                                         unsigned long names_len) {
+    struct td_chan_event *ev;
+    unsigned long nr_ext = 0;
+    if (names_len > TD_CHAN_MAX_NAMES)
+        return NULL;
+    if (names_len > TD_CHAN_NAMES)
+        nr_ext = (names_len - TD_CHAN_NAMES + TD_CHAN_EXT_NAMES - 1) /
+            TD_CHAN_EXT_NAMES;
+    if (nr_ext + 1 > chan->mask + 1)
+        return NULL;
+    ev = (struct td_chan_event*)ring_reserve(chan, &(chan->shm->events),
+                                             chan->events,
+                                             sizeof(struct td_chan_event),
+                                             nr_ext + 1);
+    ev->nr_ext = nr_ext;
+    return ev;
+}
+
+void td_channel_publish(struct td_channel *chan, struct td_chan_event *ev) {
+    unsigned long k;
+    /* the extension records are visible with the event record */
+    for (k = 0; k < ev->nr_ext; k++)
+        ext_record(chan, ev, k)->seq = ev->seq + k + 2;
+    ring_publish(&(chan->shm->events), &(ev->seq));
+}
+
+int td_chan_event_names(struct td_channel *chan, struct td_chan_event *ev,
+                        const char *file, unsigned long file_len,
+                        const char *path, unsigned long path_len) {
+    if (file_len + path_len > names_size(ev->nr_ext))
+        return -1;
+    copy_names(chan, ev, 0, (char*)file, file_len, 1);
+    copy_names(chan, ev, file_len, (char*)path, path_len, 1);
+    ev->file_off = 0;
+    ev->file_len = file_len;
+    ev->path_off = file_len;
+    ev->path_len = path_len;
+    return 0;
+}
+
+int td_channel_verdict(struct td_channel *chan, struct td_chan_verdict *out,
+                       int wait) {
+    struct chan_ring *ring = &(chan->shm->verdicts);
+    uint64_t pos = ring->tail;
+    struct td_chan_verdict *v = &(chan->verdicts[pos & chan->mask]);
+    unsigned long polls = 0;
+    while (__atomic_load_n(&(v->seq), __ATOMIC_ACQUIRE) != pos + 1) {
+        if (!wait || __atomic_load_n(&(chan->shm->stop), __ATOMIC_ACQUIRE))
+            return 0;
+        if (++polls < SPIN_POLLS)
+            sched_yield();
+        else
+            sleep_on(chan->shm, &(ring->waiting), &(ring->wakeups), &(v->seq),
+                     pos);
+    }
+    out->cookie = v->cookie;
+    out->result = v->result;
+    ring_release(chan, ring, chan->verdicts, sizeof(struct td_chan_verdict),
+                 pos, pos + 1);
+    return 1;
+}
+
+/* keeps a name of a (possibly bogus) record inside of its names */
+static void clamp_name(unsigned long size, unsigned long *off,
+                       unsigned long *len) {
+    if (*off > size)
+        *off = size;
+    if (*len > size - *off)
+        *len = size - *off;
+}
+
+/*
+ * handles the system calls of a batch, hands the event records [from, to)
+ * back to the producers and then writes the verdicts, which waits while the
+ * verdict ring is full
+ */
+static void flush_syscalls(struct td_channel *chan, struct td_context *ctx,
+                           struct td_event *batch, uint64_t *cookies,
+                           unsigned long nr, uint64_t from, uint64_t to) {
+    enum td_syscall_result res[POLL_BATCH];
+    unsigned long i;
+    if (nr != 0)
+        td_handle_syscall_batch(ctx, batch, nr, res);
+    ring_release(chan, &(chan->shm->events), chan->events,
+                 sizeof(struct td_chan_event), from, to);
+    for (i = 0; i < nr; i++) {
+        struct td_chan_verdict *v = (struct td_chan_verdict*)
+            ring_reserve(chan, &(chan->shm->verdicts), chan->verdicts,
+                         sizeof(struct td_chan_verdict), 1);
+        v->cookie = cookies[i];
+        v->result = res[i];
+        ring_publish(&(chan->shm->verdicts), &(v->seq));
+    }
+}
+
+unsigned long td_channel_poll(struct td_channel *chan, struct td_context *ctx,
+                              unsigned long max) {
+    struct chan_ring *ring = &(chan->shm->events);
+    struct td_event batch[POLL_BATCH];
+    struct stat bufs[POLL_BATCH];
+    uint64_t cookies[POLL_BATCH];
+    uint64_t done = ring->tail, pos = done;
+    unsigned long nr = 0, nr_events = 0, used = 0;
+
+    while (nr_events < max) {
+        struct td_chan_event *ev = &(chan->events[pos & chan->mask]);
+        unsigned long nr_ext, size;
+        if (__atomic_load_n(&(ev->seq), __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+        nr_ext = ev->nr_ext;
+        if (nr_ext > MAX_EXT || nr_ext > chan->mask)
+            nr_ext = 0;
+        size = names_size(nr_ext);
+        if (ev->op == TD_CHAN_SYSCALL) {
+            unsigned long file_off = ev->file_off, file_len = ev->file_len;
+            unsigned long path_off = ev->path_off, path_len = ev->path_len;
+            struct stat *buf;
+            char *names = ev->names;
+            if (nr == POLL_BATCH ||
+                (nr_ext != 0 && used + size > POLL_NAMES)) {
+                flush_syscalls(chan, ctx, batch, cookies, nr, done, pos);
+                done = pos;
+                nr = 0;
+                used = 0;
+            }
+            /* the batch points into the records, they are released later */
+            if (nr_ext != 0) {
+                if (chan->names == NULL &&
+                    (chan->names = (char*)malloc(POLL_NAMES)) == NULL) {
+                    puts("td_channel.c: Unable to allocate memory\n");
+                    abort();
+                }
+                names = chan->names + used;
+                copy_names(chan, ev, 0, names, size, 0);
+                used += size;
+            }
+            clamp_name(size, &file_off, &file_len);
+            clamp_name(size, &path_off, &path_len);
+            buf = &(bufs[nr]);
+            memset(buf, 0, sizeof(struct stat));
+            buf->st_dev = ev->dev;
+            buf->st_ino = ev->ino;
+            buf->st_mode = ev->mode;
+            buf->st_uid = ev->uid;
+            buf->st_gid = ev->gid;
+            batch[nr] = (struct td_event){ ev->tid, ev->syscall,
+                                           names + file_off, file_len,
+                                           names + path_off, path_len, buf };
+            cookies[nr++] = ev->cookie;
+        } else {
+            /* process events must see all system calls that came before them */
+            flush_syscalls(chan, ctx, batch, cookies, nr, done, pos);
+            done = pos;
+            nr = 0;
+            used = 0;
+            if (ev->op == TD_CHAN_CREATE)
+                td_process_create(ctx, ev->pid, ev->tid, ev->ppid);
+            else if (ev->op == TD_CHAN_DESTROY)
+                td_process_destroy(ctx, ev->tid);
+        }
+        pos += 1 + nr_ext;
+        nr_events++;
+    }
+    flush_syscalls(chan, ctx, batch, cookies, nr, done, pos);
+    return nr_events;
+}
+
+void td_channel_run(struct td_channel *chan, struct td_context *ctx) {
+    struct chan_ring *ring = &(chan->shm->events);
+    unsigned long polls = 0;
+    for (;;) {
+        uint64_t pos;
+        if (td_channel_poll(chan, ctx, ULONG_MAX) != 0) {
+            polls = 0;
+            continue;
+        }
+        if (__atomic_load_n(&(chan->shm->stop), __ATOMIC_ACQUIRE))
+            break;
+        /* busy-poll under load, sleep once the ring stays empty */
+        if (++polls < SPIN_POLLS) {
+            sched_yield();
+            continue;
+        }
+        pos = ring->tail;
+        sleep_on(chan->shm, &(ring->waiting), &(ring->wakeups),
+                 &(chan->events[pos & chan->mask].seq), pos);
+        polls = 0;
+    }
+}
+
+void td_channel_stop(struct td_channel *chan) {
+    struct chan_shm *shm = chan->shm;
+    __atomic_store_n(&(shm->stop), 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(shm->events.waiting), 1, __ATOMIC_SEQ_CST);
+    wake(&(shm->events.waiting), &(shm->events.wakeups), INT_MAX);
+    __atomic_store_n(&(shm->verdicts.waiting), 1, __ATOMIC_SEQ_CST);
+    wake(&(shm->verdicts.waiting), &(shm->verdicts.wakeups), INT_MAX);
+    __atomic_store_n(&(shm->events.full_waiting), 1, __ATOMIC_SEQ_CST);
+    wake(&(shm->events.full_waiting), &(shm->events.full_wakeups), INT_MAX);
+    __atomic_store_n(&(shm->verdicts.full_waiting), 1, __ATOMIC_SEQ_CST);
+    wake(&(shm->verdicts.full_waiting), &(shm->verdicts.full_wakeups), INT_MAX);
+}
@@ -0,0 +1,198 @@
+/**
+ * @file td_channel.h
+ * Shared memory transport between the kernel side (LSM module) and the daemon.
+ * A channel is a memory mapping that holds a ring of fixed-size event records
+ * and a ring of verdicts. Records are filled in place by the producers and
+ * read in place by the daemon, nothing is copied on the way. Names that do
+ * not fit into a record continue in the records that follow it (extension
+ * records), only those are copied by the daemon.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_CHANNEL_H
+#define TD_CHANNEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "td_filestate.h"
+
+/* size of a single event record in the shared ring */
+#define TD_CHAN_RECORD 256
+/* space for the file and path names in the record of an event */
+#define TD_CHAN_NAMES (TD_CHAN_RECORD - 72)
+/* space for names in each extension record */
+#define TD_CHAN_EXT_NAMES (TD_CHAN_RECORD - 8)
+/* longest file and path of an event together (PATH_MAX each) */
+#define TD_CHAN_MAX_NAMES 8192
+
+enum td_chan_op {
+    TD_CHAN_SYSCALL, /*< system call, answered with a verdict */
+    TD_CHAN_CREATE, /*< new thread (pid, tid, ppid) */
+    TD_CHAN_DESTROY /*< thread tid exited */
+};
+
+/*
+ * An event record. file and path are stored in names and continue in the
+ * nr_ext extension records that follow, file_off/path_off are offsets into
+ * this space (see td_chan_event_names). The fingerprint fields are the parts
+ * of struct stat that the daemon checks.
+ */
+struct td_chan_event {
+    uint64_t seq;  /*< ring internal, do not touch */
+    uint64_t cookie;  /*< returned with the verdict */
+    uint16_t op;  /*< enum td_chan_op */
+    uint16_t nr_ext;  /*< extension records, set by td_channel_reserve */
+    uint32_t syscall;  /*< syscall number (see syscall_nr.h) */
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t ppid;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t dev;
+    uint64_t ino;
+    uint16_t file_off;
+    uint16_t file_len;
+    uint16_t path_off;
+    uint16_t path_len;
+    char names[TD_CHAN_NAMES];
+};
+
+/* verdict for the system call with the given cookie */
+struct td_chan_verdict {
+    uint64_t seq;  /*< ring internal, do not touch */
+    uint64_t cookie;
+    uint32_t result;  /*< enum td_syscall_result */
+    uint32_t pad;
+};
+
+struct td_channel;
+
+/**
+ * Creates a new channel in an anonymous shared memory file.
+ * @param nr_slots number of records per ring (rounded up to a power of 2)
+ * @return the channel or NULL if the mapping could not be created
+ */
+struct td_channel *td_channel_create(unsigned long nr_slots);
+
+/**
+ * Maps an existing channel (e.g., the fd was inherited or passed over a unix
+ * socket).
+ * @param fd file descriptor returned by td_channel_fd
+ * @return the channel or NULL if fd does not hold a channel
+ */
+struct td_channel *td_channel_attach(int fd);
+
+/**
+ * @return the file descriptor of the shared memory that backs the channel
+ */
+int td_channel_fd(struct td_channel *chan);
+
+/**
+ * Unmaps the channel and closes its file descriptor.
+ * @param chan the channel
+ */
+void td_channel_destroy(struct td_channel *chan);
+
+/**
+ * Reserves the next event record, followed by as many extension records as
+ * the names need. Any number of producers may reserve records concurrently.
+ * Waits (spinning, then sleeping) while the ring is full.
+ * @param chan the channel
+ * @param names_len length of the file and path of the event together (0 for
+ *      events without names)
+ * @return the record that must be filled and passed to td_channel_publish,
+ *      or NULL if names_len exceeds TD_CHAN_MAX_NAMES or the ring is too
+ *      small to ever hold the records
+ */
+struct td_chan_event *td_channel_reserve(struct td_channel *chan,
+                                         unsigned long names_len);
+
+/**
+ * Hands a reserved record to the daemon. Records of different producers may
+ * be published in any order, the daemon reads them in reservation order.
+ * @param chan the channel
+ * @param ev record returned by td_channel_reserve
+ */
+void td_channel_publish(struct td_channel *chan, struct td_chan_event *ev);
+
+/**
+ * Sets the names of an event record (and of its extension records).
+ * @param chan the channel the record was reserved in
+ * @param ev record returned by td_channel_reserve
+ * @return 0 or -1 if the names do not fit into the reserved records
+ */
+int td_chan_event_names(struct td_channel *chan, struct td_chan_event *ev,
+                        const char *file, unsigned long file_len,
+                        const char *path, unsigned long path_len);
+
+/**
+ * Takes the next verdict from the verdict ring. Must only be called by a
+ * single thread at a time.
+ * @param chan the channel
+ * @param out receives the verdict
+ * @param wait wait for a verdict if the ring is empty
+ * @return 1 if a verdict was returned, 0 if the ring is empty (or the channel
+ *      was stopped while waiting)
+ */
+int td_channel_verdict(struct td_channel *chan, struct td_chan_verdict *out,
+                       int wait);
+
+/**
+ * Handles all events that are currently in the event ring (at most max) and
+ * writes their verdicts. System calls are handed to td_handle_syscall_batch.
+ * The event records of a batch are released before its verdicts are written,
+ * so a producer that waits for event space never waits for the verdict ring.
+ * The daemon itself waits while the verdict ring is full, so the verdicts
+ * must be taken by a thread that does not wait for event space. Must only be
+ * called by a single thread at a time.
+ * @param chan the channel
+ * @param ctx the context that tracks the events
+ * @param max maximum number of events
+ * @return number of handled events (an event with its extension records
+ *      counts once)
+ */
+unsigned long td_channel_poll(struct td_channel *chan, struct td_context *ctx,
+                              unsigned long max);
+
+/**
+ * Daemon loop. Busy-polls the event ring while events arrive and sleeps on a
+ * futex once it was idle for a while. Returns after td_channel_stop once the
+ * ring is empty.
+ * @param chan the channel
+ * @param ctx the context that tracks the events
+ */
+void td_channel_run(struct td_channel *chan, struct td_context *ctx);
+
+/**
+ * Stops td_channel_run and wakes up all sleepers of the channel.
+ * @param chan the channel
+ */
+void td_channel_stop(struct td_channel *chan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_CHANNEL_H */
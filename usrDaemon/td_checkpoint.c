@@ -0,0 +1,404 @@
+/**
+ * @file td_checkpoint.c
+ * Checkpoint image of the tracking state of a context.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_checkpoint.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* stdio buffer of the writer */
+#define CHECKPOINT_BUFFER (1 << 20)
+/* file numbers in the index of the writer (NULL and HTAB_DELETED are taken) */
+#define INDEX_BASE 2UL
+
+struct td_checkpoint_writer {
+    FILE *out;
+    char *path;  /*< name of the image */
+    char *tmp;  /*< name of the image while it is written */
+    uint64_t pos;  /*< bytes written */
+    int error;  /*< a write failed */
+    /* the current group, kept in memory until it is complete */
+    int in_group;
+    unsigned long pid;
+    struct td_checkpoint_file *files;  /*< name is relative to names */
+    unsigned long nr_files, max_files;
+    char *names;
+    unsigned long names_len, max_names;
+    struct htab index;  /*< file number + INDEX_BASE, keyed by the name hash */
+    uint32_t *fds;
+    unsigned long nr_fds, max_fds;
+    /* written at the end */
+    struct td_checkpoint_group *groups;
+    unsigned long nr_groups, max_groups;
+    struct td_checkpoint_thread *threads;
+    unsigned long nr_threads, max_threads;
+};
+
+/* makes room for nr elements of size bytes in a growing array */
+static void *grow(void *array, unsigned long *max, unsigned long nr,
+                  size_t size) {
+    unsigned long n = (*max != 0) ? *max : 64;
+    if (nr <= *max)
+        return array;
+    while (n < nr)
+        n *= 2;
+    if ((array = realloc(array, n * size)) == NULL) {
+        puts("td_checkpoint.c: Unable to allocate memory\n");
+        abort();
+    }
+    *max = n;
+    return array;
+}
+
+static void out_write(struct td_checkpoint_writer *w, const void *buf,
+                      size_t len) {
+    if (len != 0 && fwrite(buf, len, 1, w->out) != 1)
+        w->error = 1;
+    w->pos += len;
+}
+
+static void out_align(struct td_checkpoint_writer *w) {
+    static const char pad[8];
+    out_write(w, pad, (8 - (w->pos & 7)) & 7);
+}
+
+struct td_checkpoint_writer *td_checkpoint_create(const char *path) {
+    struct td_checkpoint_header header;
+    struct td_checkpoint_writer *w;
+    size_t len = strlen(path);
+    if ((w = (struct td_checkpoint_writer*)calloc(1, sizeof(*w))) == NULL ||
+        (w->path = strdup(path)) == NULL ||
+        (w->tmp = (char*)malloc(len + sizeof(".tmp"))) == NULL) {
+        puts("td_checkpoint.c: Unable to allocate memory\n");
+        abort();
+    }
+    memcpy(w->tmp, path, len);
+    memcpy(w->tmp + len, ".tmp", sizeof(".tmp"));
+    if ((w->out = fopen(w->tmp, "wb")) == NULL) {
+        free(w->tmp);
+        free(w->path);
+        free(w);
+        return NULL;
+    }
+    setvbuf(w->out, NULL, _IOFBF, CHECKPOINT_BUFFER);
+    htab_init(&(w->index));
+    /* written again once the tables are known */
+    memset(&header, 0, sizeof(header));
+    out_write(w, &header, sizeof(header));
+    return w;
+}
+
+void td_checkpoint_thread(struct td_checkpoint_writer *w, unsigned long pid,
+                          unsigned long tid, unsigned long ppid) {
+    struct td_checkpoint_thread *thread;
+    w->threads = (struct td_checkpoint_thread*)
+        grow(w->threads, &(w->max_threads), w->nr_threads + 1,
+             sizeof(struct td_checkpoint_thread));
+    thread = &(w->threads[w->nr_threads++]);
+    thread->pid = pid;
+    thread->tid = tid;
+    thread->ppid = ppid;
+    thread->pad = 0;
+}
+
+/* writes the files, names, index and descriptors of the current group */
+static void flush_group(struct td_checkpoint_writer *w) {
+    struct td_checkpoint_group *group;
+    unsigned long i, nr_slots = 1;
+    uint64_t names;
+    uint32_t *slots;
+
+    w->groups = (struct td_checkpoint_group*)
+        grow(w->groups, &(w->max_groups), w->nr_groups + 1,
+             sizeof(struct td_checkpoint_group));
+    group = &(w->groups[w->nr_groups++]);
+    memset(group, 0, sizeof(*group));
+    group->pid = w->pid;
+    group->nr_files = w->nr_files;
+
+    out_align(w);
+    group->files = w->pos;
+    names = w->pos + w->nr_files * sizeof(struct td_checkpoint_file);
+    for (i = 0; i < w->nr_files; i++)
+        w->files[i].name += names;
+    out_write(w, w->files, w->nr_files * sizeof(struct td_checkpoint_file));
+    out_write(w, w->names, w->names_len);
+
+    /* at most half full, so misses end at an empty slot soon */
+    while (nr_slots < 2 * w->nr_files)
+        nr_slots *= 2;
+    if ((slots = (uint32_t*)calloc(nr_slots, sizeof(uint32_t))) == NULL) {
+        puts("td_checkpoint.c: Unable to allocate memory\n");
+        abort();
+    }
+    for (i = 0; i < w->nr_files; i++) {
+        uint64_t slot = w->files[i].hash & (nr_slots - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (nr_slots - 1);
+        slots[slot] = i + 1;
+    }
+    out_align(w);
+    group->mask = nr_slots - 1;
+    group->slots = w->pos;
+    out_write(w, slots, nr_slots * sizeof(uint32_t));
+    free(slots);
+
+    out_align(w);
+    group->nr_fds = w->nr_fds;
+    group->fds = w->pos;
+    out_write(w, w->fds, w->nr_fds * sizeof(uint32_t));
+
+    w->nr_files = 0;
+    w->names_len = 0;
+    w->nr_fds = 0;
+    htab_destroy(&(w->index), NULL);
+    htab_init(&(w->index));
+    w->in_group = 0;
+}
+
+void td_checkpoint_group(struct td_checkpoint_writer *w, unsigned long pid) {
+    if (w->in_group)
+        flush_group(w);
+    w->in_group = 1;
+    w->pid = pid;
+}
+
+struct name_key {
+    const struct td_checkpoint_writer *w;
+    const char *name;
+    unsigned long len;
+};
+
+static long same_name(const void *key, void *data) {
+    const struct name_key *nkey = (const struct name_key*)key;
+    const struct td_checkpoint_file *file =
+        &(nkey->w->files[(unsigned long)data - INDEX_BASE]);
+    return file->name_len == nkey->len &&
+        memcmp(nkey->w->names + file->name, nkey->name, nkey->len) == 0;
+}
+
+/* adds a file with the fields of tmpl, returns the file of the same name */
+static unsigned long add_file(struct td_checkpoint_writer *w,
+                              const char *name,
+                              const struct td_checkpoint_file *tmpl) {
+    struct name_key key = { w, name, tmpl->name_len };
+    struct td_checkpoint_file *file;
+    unsigned long nr = (unsigned long)htab_find(&(w->index), tmpl->hash, &key,
+                                                same_name);
+    if (nr != 0)
+        return nr - INDEX_BASE;
+    w->files = (struct td_checkpoint_file*)
+        grow(w->files, &(w->max_files), w->nr_files + 1,
+             sizeof(struct td_checkpoint_file));
+    w->names = (char*)grow(w->names, &(w->max_names),
+                           w->names_len + tmpl->name_len, 1);
+    file = &(w->files[w->nr_files]);
+    *file = *tmpl;
+    file->name = w->names_len;
+    memcpy(w->names + w->names_len, name, tmpl->name_len);
+    w->names_len += tmpl->name_len;
+    htab_insert(&(w->index), tmpl->hash, (void*)(w->nr_files + INDEX_BASE));
+    return w->nr_files++;
+}
+
+unsigned long td_checkpoint_file(struct td_checkpoint_writer *w,
+                                 const struct td_file *file) {
+    struct td_checkpoint_file tmpl;
+    memset(&tmpl, 0, sizeof(tmpl));
+    tmpl.hash = file->name->hash;
+    tmpl.name_len = file->name->len;
+    tmpl.nropen = file->nropen;
+    tmpl.dev = file->fp.dev;
+    tmpl.ino = file->fp.ino;
+    tmpl.mode = file->fp.mode;
+    tmpl.uid = file->fp.uid;
+    tmpl.gid = file->fp.gid;
+    tmpl.state = file->state;
+    tmpl.health = file->health;
+    tmpl.stale = file->stale;
+    return add_file(w, file->name->str, &tmpl);
+}
+
+unsigned long td_checkpoint_copy(struct td_checkpoint_writer *w,
+                                 const char *name,
+                                 const struct td_checkpoint_file *file) {
+    return add_file(w, name, file);
+}
+
+void td_checkpoint_fd(struct td_checkpoint_writer *w, unsigned long fd,
+                      unsigned long nr) {
+    if (fd >= w->nr_fds) {
+        w->fds = (uint32_t*)grow(w->fds, &(w->max_fds), fd + 1,
+                                 sizeof(uint32_t));
+        memset(w->fds + w->nr_fds, 0, (fd + 1 - w->nr_fds) * sizeof(uint32_t));
+        w->nr_fds = fd + 1;
+    }
+    w->fds[fd] = nr + 1;
+}
+
+int td_checkpoint_finish(struct td_checkpoint_writer *w) {
+    struct td_checkpoint_header header;
+    int error;
+    if (w->in_group)
+        flush_group(w);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TD_CHECKPOINT_MAGIC, sizeof(header.magic));
+    out_align(w);
+    header.nr_threads = w->nr_threads;
+    header.threads = w->pos;
+    out_write(w, w->threads, w->nr_threads * sizeof(struct td_checkpoint_thread));
+    header.nr_groups = w->nr_groups;
+    header.groups = w->pos;
+    out_write(w, w->groups, w->nr_groups * sizeof(struct td_checkpoint_group));
+    header.size = w->pos;
+    if (fseek(w->out, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, w->out) != 1 ||
+        fflush(w->out) != 0 || fsync(fileno(w->out)) != 0)
+        w->error = 1;
+    if (fclose(w->out) != 0)
+        w->error = 1;
+    /* an old image stays in place until the new one is complete */
+    if (w->error || rename(w->tmp, w->path) != 0) {
+        unlink(w->tmp);
+        w->error = 1;
+    }
+    error = w->error;
+    htab_destroy(&(w->index), NULL);
+    free(w->files);
+    free(w->names);
+    free(w->fds);
+    free(w->groups);
+    free(w->threads);
+    free(w->tmp);
+    free(w->path);
+    free(w);
+    return error ? -1 : 0;
+}
+
+/* an array of nr elements of size bytes at off lies within the image */
+static int in_image(size_t size, uint64_t off, uint64_t nr, size_t elem) {
+    return (off & 7) == 0 && off <= size && nr <= (size - off) / elem;
+}
+
+static int valid_image(const char *map, size_t size) {
+    const struct td_checkpoint_header *header =
+        (const struct td_checkpoint_header*)map;
+    const struct td_checkpoint_group *groups;
+    uint64_t i;
+    if (memcmp(header->magic, TD_CHECKPOINT_MAGIC, 8) != 0 ||
+        header->size != size ||
+        !in_image(size, header->threads, header->nr_threads,
+                  sizeof(struct td_checkpoint_thread)) ||
+        !in_image(size, header->groups, header->nr_groups,
+                  sizeof(struct td_checkpoint_group)))
+        return 0;
+    groups = (const struct td_checkpoint_group*)(map + header->groups);
+    for (i = 0; i < header->nr_groups; i++)
+        if (!in_image(size, groups[i].files, groups[i].nr_files,
+                      sizeof(struct td_checkpoint_file)) ||
+            groups[i].mask >= UINT32_MAX ||
+            (groups[i].mask & (groups[i].mask + 1)) != 0 ||
+            !in_image(size, groups[i].slots, groups[i].mask + 1,
+                      sizeof(uint32_t)) ||
+            !in_image(size, groups[i].fds, groups[i].nr_fds, sizeof(uint32_t)))
+            return 0;
+    return 1;
+}
+
+struct td_checkpoint *td_checkpoint_map(const char *path) {
+    struct td_checkpoint *ckpt;
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(struct td_checkpoint_header)) {
+        close(fd);
+        return NULL;
+    }
+    /* no MAP_POPULATE: pages of files that are never used are never read */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (!valid_image((const char*)map, st.st_size)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_RANDOM);
+    if ((ckpt = (struct td_checkpoint*)malloc(sizeof(*ckpt))) == NULL) {
+        puts("td_checkpoint.c: Unable to allocate memory\n");
+        abort();
+    }
+    ckpt->map = (const char*)map;
+    ckpt->size = st.st_size;
+    ckpt->refs = 1;
+    return ckpt;
+}
+
+void td_checkpoint_get(struct td_checkpoint *ckpt) {
+    __atomic_add_fetch(&(ckpt->refs), 1, __ATOMIC_RELAXED);
+}
+
+void td_checkpoint_put(struct td_checkpoint *ckpt) {
+    if (__atomic_sub_fetch(&(ckpt->refs), 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    munmap((void*)ckpt->map, ckpt->size);
+    free(ckpt);
+}
+
+const char *td_checkpoint_name(const struct td_checkpoint *ckpt,
+                               const struct td_checkpoint_file *file) {
+    if (file->name > ckpt->size || file->name_len > ckpt->size - file->name)
+        return NULL;
+    return ckpt->map + file->name;
+}
+
+const struct td_checkpoint_file *
+td_checkpoint_find(const struct td_checkpoint *ckpt,
+                   const struct td_checkpoint_group *group, uint64_t hash,
+                   const char *name, unsigned long len) {
+    const struct td_checkpoint_file *files = td_checkpoint_files(ckpt, group);
+    const uint32_t *slots = (const uint32_t*)(ckpt->map + group->slots);
+    uint64_t slot = hash & group->mask, steps;
+    for (steps = 0; steps <= group->mask; steps++) {
+        const struct td_checkpoint_file *file;
+        const char *fname;
+        uint32_t nr = slots[slot];
+        if (nr == 0 || nr > group->nr_files)
+            return NULL;
+        file = &(files[nr - 1]);
+        if (file->hash == hash && file->name_len == len &&
+            (fname = td_checkpoint_name(ckpt, file)) != NULL &&
+            memcmp(fname, name, len) == 0)
+            return file;
+        slot = (slot + 1) & group->mask;
+    }
+    return NULL;
+}
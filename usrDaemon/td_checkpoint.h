@@ -0,0 +1,231 @@
+/**
+ * @file td_checkpoint.h
+ * Checkpoint image of the tracking state of a context (threads, thread groups
+ * and their files) for warm restarts, see td_context_checkpoint and
+ * td_context_restore. The image only holds offsets, so it is used in place
+ * through a read-only mapping: every group has an open addressing index of
+ * its files, a restored group looks its files up in the image and only loads
+ * the files it touches.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_CHECKPOINT_H
+#define TD_CHECKPOINT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "td_filestate.h"
+
+/*
+ * An image is a header followed by the data of each group (files, names,
+ * index and descriptors), the threads and the groups. Offsets are counted
+ * from the start of the image and aligned to 8 bytes, names are not NUL
+ * terminated. All values are in host byte order.
+ */
+#define TD_CHECKPOINT_MAGIC "TDCKPT01"
+
+struct td_checkpoint_header {
+    char magic[8];  /*< TD_CHECKPOINT_MAGIC */
+    uint64_t size;  /*< size of the image */
+    uint64_t nr_threads;
+    uint64_t threads;  /*< offset of the struct td_checkpoint_thread array */
+    uint64_t nr_groups;
+    uint64_t groups;  /*< offset of the struct td_checkpoint_group array */
+};
+
+struct td_checkpoint_thread {
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t ppid;
+    uint32_t pad;
+};
+
+struct td_checkpoint_group {
+    uint32_t pid;
+    uint32_t pad;
+    uint64_t nr_files;
+    uint64_t files;  /*< offset of the struct td_checkpoint_file array */
+    uint64_t mask;  /*< number of slots - 1 (a power of two - 1) */
+    uint64_t slots;  /*< offset of the index: uint32_t file number + 1 or 0
+                         for an empty slot, probed linearly from the hash */
+    uint64_t nr_fds;
+    uint64_t fds;  /*< offset of the descriptors: uint32_t file number + 1
+                       or 0 for an unbound descriptor */
+};
+
+struct td_checkpoint_file {
+    uint64_t hash;  /*< htab_hash() of the name */
+    uint64_t name;  /*< offset of the name */
+    uint32_t name_len;
+    int32_t nropen;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint8_t state;  /*< enum td_file_state */
+    uint8_t health;  /*< enum td_file_health */
+    uint8_t stale;  /*< td_file.stale */
+    uint8_t pad;
+};
+
+/* writer, used by one thread */
+struct td_checkpoint_writer;
+
+/**
+ * Starts a new image. The image is written to path.tmp and only replaces
+ * path once it is complete (see td_checkpoint_finish).
+ * @param path name of the image
+ * @return the writer or NULL if the file could not be created
+ */
+struct td_checkpoint_writer *td_checkpoint_create(const char *path);
+
+/**
+ * Adds a thread.
+ */
+void td_checkpoint_thread(struct td_checkpoint_writer *w, unsigned long pid,
+                          unsigned long tid, unsigned long ppid);
+
+/**
+ * Starts the files of a thread group, the previous group is written out.
+ * @param w the writer
+ * @param pid id of the group
+ */
+void td_checkpoint_group(struct td_checkpoint_writer *w, unsigned long pid);
+
+/**
+ * Adds a file to the current group. A file with a name that the group already
+ * has is not added again (files added first shadow later ones).
+ * @param w the writer
+ * @param file the file
+ * @return number of the file in the group
+ */
+unsigned long td_checkpoint_file(struct td_checkpoint_writer *w,
+                                 const struct td_file *file);
+
+/**
+ * Same as td_checkpoint_file for a file of another image.
+ * @param w the writer
+ * @param name the name of the file (see td_checkpoint_name)
+ * @param file the file
+ * @return number of the file in the group
+ */
+unsigned long td_checkpoint_copy(struct td_checkpoint_writer *w,
+                                 const char *name,
+                                 const struct td_checkpoint_file *file);
+
+/**
+ * Binds a descriptor of the current group.
+ * @param w the writer
+ * @param fd the descriptor
+ * @param nr number of the file (see td_checkpoint_file)
+ */
+void td_checkpoint_fd(struct td_checkpoint_writer *w, unsigned long fd,
+                      unsigned long nr);
+
+/**
+ * Writes the rest of the image, syncs it and moves it to its name.
+ * @param w the writer (freed)
+ * @return 0 or -1 if the image could not be written (path is unchanged)
+ */
+int td_checkpoint_finish(struct td_checkpoint_writer *w);
+
+/* a mapped image, shared by the groups restored from it */
+struct td_checkpoint {
+    const char *map;
+    size_t size;
+    unsigned long refs;
+};
+
+/**
+ * Maps an image. The tables are checked, the files are only read on demand
+ * (the reader skips files with a name outside of the image or with a state
+ * or health that does not exist).
+ * @param path name of the image
+ * @return the image (one reference) or NULL if the file is not a valid image
+ */
+struct td_checkpoint *td_checkpoint_map(const char *path);
+
+void td_checkpoint_get(struct td_checkpoint *ckpt);
+
+/**
+ * Drops a reference, the last one unmaps the image.
+ */
+void td_checkpoint_put(struct td_checkpoint *ckpt);
+
+static inline const struct td_checkpoint_header *
+td_checkpoint_header(const struct td_checkpoint *ckpt) {
+    return (const struct td_checkpoint_header*)ckpt->map;
+}
+
+static inline const struct td_checkpoint_thread *
+td_checkpoint_threads(const struct td_checkpoint *ckpt) {
+    return (const struct td_checkpoint_thread*)
+        (ckpt->map + td_checkpoint_header(ckpt)->threads);
+}
+
+static inline const struct td_checkpoint_group *
+td_checkpoint_groups(const struct td_checkpoint *ckpt) {
+    return (const struct td_checkpoint_group*)
+        (ckpt->map + td_checkpoint_header(ckpt)->groups);
+}
+
+static inline const struct td_checkpoint_file *
+td_checkpoint_files(const struct td_checkpoint *ckpt,
+                    const struct td_checkpoint_group *group) {
+    return (const struct td_checkpoint_file*)(ckpt->map + group->files);
+}
+
+static inline const uint32_t *
+td_checkpoint_fds(const struct td_checkpoint *ckpt,
+                  const struct td_checkpoint_group *group) {
+    return (const uint32_t*)(ckpt->map + group->fds);
+}
+
+/**
+ * @return the name of a file or NULL if it is outside of the image
+ */
+const char *td_checkpoint_name(const struct td_checkpoint *ckpt,
+                               const struct td_checkpoint_file *file);
+
+/**
+ * Looks up a file of a group through the index of the image.
+ * @param ckpt the image
+ * @param group the group
+ * @param hash htab_hash() of name
+ * @param name name of the file
+ * @param len length of name
+ * @return the file or NULL
+ */
+const struct td_checkpoint_file *
+td_checkpoint_find(const struct td_checkpoint *ckpt,
+                   const struct td_checkpoint_group *group, uint64_t hash,
+                   const char *name, unsigned long len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_CHECKPOINT_H */
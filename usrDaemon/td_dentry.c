@@ -0,0 +1,230 @@
+/**
+ * @file td_dentry.c
+ * Directory cache for the path check.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_dentry.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+struct dentry_key {
+    const char *path;
+    unsigned long len;
+};
+
+static long same_path(const void *key, void *data) {
+    const struct dentry_key *dkey = (const struct dentry_key*)key;
+    return td_dentry_is((struct td_dentry*)data, dkey->path, dkey->len);
+}
+
+static inline void dents_lock(struct td_dentries *dents) {
+    if (dents->concurrent)
+        pthread_mutex_lock(&(dents->lock));
+}
+
+static inline void dents_unlock(struct td_dentries *dents) {
+    if (dents->concurrent)
+        pthread_mutex_unlock(&(dents->lock));
+}
+
+void td_dentry_init(struct td_dentries *dents, int concurrent) {
+    htab_init(&(dents->table));
+    dents->all = NULL;
+    dents->count = 0;
+    td_arena_init(&(dents->arena));
+    dents->clock = 0;
+    pthread_mutex_init(&(dents->lock), NULL);
+    dents->concurrent = concurrent;
+}
+
+void td_dentry_destroy(struct td_dentries *dents) {
+    struct td_dentry *dent = dents->all;
+    while (!TD_ARENA_BULK_RELEASE && dent != NULL) {
+        struct td_dentry *next = dent->next;
+        td_arena_free(&(dents->arena), dent,
+                      sizeof(struct td_dentry) + dent->len + 1);
+        dent = next;
+    }
+    htab_destroy(&(dents->table), NULL);
+    td_arena_release(&(dents->arena));
+    pthread_mutex_destroy(&(dents->lock));
+}
+
+static inline unsigned long trim(const char *path, unsigned long len) {
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+    return len;
+}
+
+/* length of the parent directory of a normalized path, 0 if there is none */
+static unsigned long parent_len(const char *path, unsigned long len) {
+    if (len == 1 && path[0] == '/')
+        return 0;
+    while (len > 0 && path[len - 1] != '/')
+        len--;
+    return (len == 0) ? 0 : trim(path, len);
+}
+
+/* recomputes the staleness of a directory, called with the lock held */
+static unsigned long stale(struct td_dentry *dent, uint64_t clock) {
+    unsigned long result;
+    if (__atomic_load_n(&(dent->stale_clock), __ATOMIC_RELAXED) == clock)
+        return dent->stale;
+    /* parents that were computed at this clock are reused */
+    result = dent->state == STATE_DIR_ERR ||
+        (dent->parent != NULL && stale(dent->parent, clock));
+    __atomic_store_n(&(dent->stale), result, __ATOMIC_RELAXED);
+    __atomic_store_n(&(dent->stale_clock), clock, __ATOMIC_RELEASE);
+    return result;
+}
+
+/*
+ * drops a reference, frees the version (and drops its reference to the
+ * parent) with the last one. only a replaced version can lose its last
+ * reference, so no other thread can take a new one. called with the lock held.
+ */
+static void release(struct td_dentries *dents, struct td_dentry *dent) {
+    struct td_dentry *parent;
+    while (dent != NULL &&
+           __atomic_sub_fetch(&(dent->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+        parent = dent->parent;
+        if (dent->prev != NULL)
+            dent->prev->next = dent->next;
+        else
+            dents->all = dent->next;
+        if (dent->next != NULL)
+            dent->next->prev = dent->prev;
+        dents->count--;
+        td_arena_free(&(dents->arena), dent,
+                      sizeof(struct td_dentry) + dent->len + 1);
+        dent = parent;
+    }
+}
+
+/*
+ * returns the current version of a directory, creates it (and its parents)
+ * if needed. called with the lock held.
+ */
+static struct td_dentry *lookup(struct td_dentries *dents, const char *path,
+                                unsigned long len) {
+    struct dentry_key key = { path, len };
+    uint64_t hash = htab_hash(path, len);
+    struct td_dentry *dent, *old;
+    unsigned long plen;
+
+    old = (struct td_dentry*)htab_find(&(dents->table), hash, &key, same_path);
+    if (old != NULL && !stale(old, dents->clock))
+        return old;
+    /* new directory or a directory below a replaced one */
+    dent = (struct td_dentry*)td_arena_alloc(&(dents->arena),
+                                             sizeof(struct td_dentry) + len + 1);
+    plen = parent_len(path, len);
+    dent->parent = (plen != 0) ? lookup(dents, path, plen) : NULL;
+    td_dentry_get(dent->parent);
+    dent->next = dents->all;
+    dent->prev = NULL;
+    if (dents->all != NULL)
+        dents->all->prev = dent;
+    dents->all = dent;
+    dents->count++;
+    dent->refs = 1;
+    dent->hash = hash;
+    memset(&(dent->fp), 0, sizeof(struct td_fingerprint));
+    dent->state = STATE_UPDATE;
+    dent->stale = 0;
+    dent->stale_clock = ~0UL;
+    dent->len = len;
+    memcpy(dent->path, path, len);
+    dent->path[len] = '\0';
+    if (old != NULL) {
+        htab_delete(&(dents->table), hash, &key, same_path);
+        release(dents, old);
+    }
+    htab_insert(&(dents->table), hash, dent);
+    return dent;
+}
+
+struct td_dentry *td_dentry_lookup(struct td_dentries *dents, const char *path,
+                                   unsigned long len) {
+    struct td_dentry *dent;
+    len = trim(path, len);
+    if (len == 0)
+        return NULL;
+    dents_lock(dents);
+    dent = lookup(dents, path, len);
+    td_dentry_get(dent);
+    dents_unlock(dents);
+    return dent;
+}
+
+void td_dentry_put(struct td_dentries *dents, struct td_dentry *dent) {
+    if (dent == NULL)
+        return;
+    dents_lock(dents);
+    release(dents, dent);
+    dents_unlock(dents);
+}
+
+static inline void set_fingerprint(struct td_fingerprint *fp,
+                                   const struct stat *buf) {
+    fp->dev = buf->st_dev;
+    fp->ino = buf->st_ino;
+    fp->mode = buf->st_mode;
+    fp->uid = buf->st_uid;
+    fp->gid = buf->st_gid;
+}
+
+long td_dentry_verify(struct td_dentries *dents, const char *path,
+                      unsigned long len, const struct stat *buf) {
+    struct td_dentry *dent;
+    long replaced = 0;
+    len = trim(path, len);
+    if (len == 0)
+        return 0;
+    dents_lock(dents);
+    dent = lookup(dents, path, len);
+    if (dent->state != STATE_UPDATE &&
+        (dent->fp.dev != buf->st_dev || dent->fp.ino != buf->st_ino ||
+         dent->fp.mode != buf->st_mode || dent->fp.uid != buf->st_uid ||
+         dent->fp.gid != buf->st_gid)) {
+        /* everything that was checked below this version is stale now */
+        dent->state = STATE_DIR_ERR;
+        __atomic_add_fetch(&(dents->clock), 1, __ATOMIC_RELEASE);
+        dent = lookup(dents, path, len);
+        replaced = 1;
+    }
+    set_fingerprint(&(dent->fp), buf);
+    dent->state = STATE_DIR_OK;
+    dents_unlock(dents);
+    return replaced;
+}
+
+unsigned long td_dentry_stale(struct td_dentries *dents, struct td_dentry *dent) {
+    uint64_t clock = __atomic_load_n(&(dents->clock), __ATOMIC_ACQUIRE);
+    unsigned long result;
+    if (__atomic_load_n(&(dent->stale_clock), __ATOMIC_ACQUIRE) == clock)
+        return __atomic_load_n(&(dent->stale), __ATOMIC_RELAXED);
+    dents_lock(dents);
+    result = stale(dent, dents->clock);
+    dents_unlock(dents);
+    return result;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file td_dentry.h
+ * Directory cache for the path check (following "Portably Solving File
+ * TOCTTOU Races with Hardness Amplification" by Dan Tsafrir et al.). Every
+ * directory that a path runs through is a node that points to its parent
+ * and stores the fingerprint the directory was verified with. A directory
+ * that shows up with a different fingerprint is replaced by a new version
+ * of its node, the old version and everything below it become stale. Files
+ * point to the version of the directory they were checked in and are only
+ * trusted as long as that version is not stale. A replaced version is freed
+ * once no file and no directory points to it anymore.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_DENTRY_H
+#define TD_DENTRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "htab.h"
+#include "td_arena.h"
+#include "td_filestate.h"
+
+/* a version of a directory */
+struct td_dentry {
+    struct td_dentry *parent;  /*< NULL for the root and relative paths */
+    struct td_dentry *next;  /*< list of all versions */
+    struct td_dentry *prev;
+    unsigned long refs;  /*< references of files and of the directories below,
+                             plus one while it is the current version */
+    uint64_t hash;  /*< htab_hash() of the path */
+    struct td_fingerprint fp;  /*< fingerprint the directory was verified with */
+    enum td_file_state state;  /*< STATE_DIR_OK, STATE_DIR_ERR (replaced by a
+                                   newer version), or STATE_UPDATE if never
+                                   verified */
+    unsigned long stale;  /*< cached td_dentry_stale */
+    uint64_t stale_clock;  /*< clock stale was computed at */
+    unsigned long len;  /*< length of the path */
+    char path[];  /*< normalized path (no trailing '/') */
+};
+
+/* the directories of a context */
+struct td_dentries {
+    struct htab table;  /*< current versions, keyed by the hash of their path */
+    struct td_dentry *all;  /*< all versions */
+    unsigned long count;  /*< number of versions in all */
+    struct td_arena arena;  /*< backs the directories */
+    uint64_t clock;  /*< counts replaced directories */
+    pthread_mutex_t lock;  /*< protects table, arena and fingerprints */
+    int concurrent;  /*< take the lock */
+};
+
+/**
+ * Initializes an empty directory cache.
+ * @param dents the cache
+ * @param concurrent !=0 if the cache is used from several threads
+ */
+void td_dentry_init(struct td_dentries *dents, int concurrent);
+
+/**
+ * Frees all directories of the cache, references that are still held become
+ * invalid.
+ * @param dents the cache
+ */
+void td_dentry_destroy(struct td_dentries *dents);
+
+/**
+ * Returns the current version of a directory. Missing directories and new
+ * versions of directories below a replaced one are created on the way, only
+ * the part of the path that is not cached yet is walked component by
+ * component.
+ * @param dents the cache
+ * @param path the path (need not be NUL terminated, trailing '/' is ignored)
+ * @param len length of path
+ * @return the directory with a reference for the caller (see td_dentry_put)
+ *      or NULL for an empty path
+ */
+struct td_dentry *td_dentry_lookup(struct td_dentries *dents, const char *path,
+                                   unsigned long len);
+
+/**
+ * Takes an additional reference to a directory.
+ * @param dent the directory (or NULL)
+ */
+static inline void td_dentry_get(struct td_dentry *dent) {
+    if (dent != NULL)
+        __atomic_add_fetch(&(dent->refs), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Drops a reference to a directory. A replaced version is freed with its
+ * last reference, the current version of a directory stays in the cache.
+ * @param dents the cache
+ * @param dent the directory (or NULL)
+ */
+void td_dentry_put(struct td_dentries *dents, struct td_dentry *dent);
+
+/**
+ * Verifies a directory against the result of a stat system call. The first
+ * fingerprint of a directory is taken as is, a different fingerprint later
+ * on replaces the directory by a new version.
+ * @param dents the cache
+ * @param path path of the directory
+ * @param len length of path
+ * @param buf stat of the directory
+ * @return 1 if the directory was replaced, 0 otherwise
+ */
+long td_dentry_verify(struct td_dentries *dents, const char *path,
+                      unsigned long len, const struct stat *buf);
+
+/**
+ * Checks if a directory or one of its parents was replaced. The result is
+ * cached per directory until the next directory is replaced, so this is O(1)
+ * unless directories changed.
+ * @param dents the cache
+ * @param dent the directory
+ * @return !=0 if the directory is stale
+ */
+unsigned long td_dentry_stale(struct td_dentries *dents, struct td_dentry *dent);
+
+/**
+ * @return !=0 if dent is the directory of path
+ */
+static inline long td_dentry_is(const struct td_dentry *dent, const char *path,
+                                unsigned long len) {
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+    return dent->len == len && memcmp(dent->path, path, len) == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_DENTRY_H */
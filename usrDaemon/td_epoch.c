@@ -0,0 +1,251 @@
+/**
+ * @file td_epoch.c
+ * Classic three-epoch reclamation (Fraser). An object that is retired in
+ * epoch e can be reclaimed once the global epoch reaches e+2, as every reader
+ * that could see it has left by then.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_epoch.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+/* try to advance the epoch after this many retired objects */
+#define RETIRE_BATCH 64
+/* number of domains a thread caches its record for */
+#define REC_CACHE 4
+
+/* owner of a record */
+enum rec_owner {
+    REC_FREE = 0,  /*< may be claimed by any thread */
+    REC_CLAIMED = 1,  /*< used by one thread */
+    REC_ORPHAN = 2  /*< claimed, its domain is gone (the thread frees it) */
+};
+
+struct td_epoch_rec {
+    unsigned long active;  /*< (epoch << 1) | 1 while inside, 0 outside */
+    unsigned long owner;  /*< enum rec_owner */
+    int transient;  /*< not cached by its thread, released on exit */
+    struct td_epoch_rec *next;
+} __attribute__((aligned(64)));
+
+struct td_epoch_retired {
+    void *obj;
+    void (*reclaim)(void *, void *);
+    void *arg;
+    struct td_epoch_retired *next;
+};
+
+/* domain ids are never reused, so a cached record can't be stale */
+static unsigned long next_domain_id = 1;
+
+static __thread struct {
+    unsigned long id;
+    struct td_epoch_rec *rec;
+} rec_cache[REC_CACHE];
+static __thread unsigned long rec_cache_next;
+
+/* releases the cached records when their thread exits */
+static pthread_key_t rec_key;
+static pthread_once_t rec_key_once = PTHREAD_ONCE_INIT;
+
+void td_epoch_init(struct td_epoch *dom) {
+    memset(dom, 0, sizeof(struct td_epoch));
+    dom->id = __atomic_fetch_add(&next_domain_id, 1, __ATOMIC_RELAXED);
+}
+
+/* hands a record back to its domain, or frees it if the domain is gone */
+static void epoch_release(struct td_epoch_rec *rec) {
+    unsigned long owner = REC_CLAIMED;
+    if (!__atomic_compare_exchange_n(&(rec->owner), &owner, REC_FREE, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        free(rec);
+}
+
+static void epoch_thread_exit(void *arg) {
+    unsigned long i;
+    (void)arg;
+    for (i = 0; i < REC_CACHE; i++) {
+        if (rec_cache[i].rec != NULL)
+            epoch_release(rec_cache[i].rec);
+        rec_cache[i].id = 0;
+        rec_cache[i].rec = NULL;
+    }
+}
+
+static void epoch_key_create(void) {
+    if (pthread_key_create(&rec_key, epoch_thread_exit) != 0) {
+        puts("td_epoch.c: Unable to create thread key\n");
+        abort();
+    }
+}
+
+/* takes a free record of the domain or adds a new one */
+static struct td_epoch_rec *epoch_claim(struct td_epoch *dom) {
+    struct td_epoch_rec *rec;
+    unsigned long owner;
+    for (rec = __atomic_load_n(&(dom->recs), __ATOMIC_ACQUIRE); rec != NULL;
+         rec = rec->next) {
+        owner = REC_FREE;
+        if (__atomic_load_n(&(rec->owner), __ATOMIC_RELAXED) == REC_FREE &&
+            __atomic_compare_exchange_n(&(rec->owner), &owner, REC_CLAIMED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return rec;
+    }
+    if (posix_memalign((void**)&rec, 64, sizeof(struct td_epoch_rec)) != 0) {
+        puts("td_epoch.c: Unable to allocate memory\n");
+        abort();
+    }
+    rec->active = 0;
+    rec->owner = REC_CLAIMED;
+    rec->next = __atomic_load_n(&(dom->recs), __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&(dom->recs), &(rec->next), rec, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&(dom->nr_recs), 1, __ATOMIC_RELAXED);
+    return rec;
+}
+
+static struct td_epoch_rec *epoch_register(struct td_epoch *dom) {
+    struct td_epoch_rec *rec;
+    unsigned long i, n;
+    for (i = 0; i < REC_CACHE; i++)
+        if (rec_cache[i].id == dom->id)
+            return rec_cache[i].rec;
+    rec = epoch_claim(dom);
+    /* the record of a section that is still open can't be given away */
+    for (n = 0; n < REC_CACHE; n++) {
+        i = rec_cache_next++ % REC_CACHE;
+        if (rec_cache[i].rec == NULL ||
+            __atomic_load_n(&(rec_cache[i].rec->active), __ATOMIC_RELAXED) == 0)
+            break;
+    }
+    if (n == REC_CACHE) {
+        rec->transient = 1;
+        return rec;
+    }
+    if (rec_cache[i].rec != NULL) {
+        epoch_release(rec_cache[i].rec);
+    } else {
+        pthread_once(&rec_key_once, epoch_key_create);
+        pthread_setspecific(rec_key, rec_cache);
+    }
+    rec->transient = 0;
+    rec_cache[i].id = dom->id;
+    rec_cache[i].rec = rec;
+    return rec;
+}
+
+struct td_epoch_rec *td_epoch_enter(struct td_epoch *dom) {
+    struct td_epoch_rec *rec = epoch_register(dom);
+    unsigned long epoch = __atomic_load_n(&(dom->epoch), __ATOMIC_SEQ_CST);
+    for (;;) {
+        __atomic_store_n(&(rec->active), (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+        /* the epoch must not have moved on before our record was visible */
+        unsigned long now = __atomic_load_n(&(dom->epoch), __ATOMIC_SEQ_CST);
+        if (now == epoch)
+            return rec;
+        epoch = now;
+    }
+}
+
+void td_epoch_exit(struct td_epoch_rec *rec) {
+    __atomic_store_n(&(rec->active), 0, __ATOMIC_RELEASE);
+    if (rec->transient)
+        epoch_release(rec);
+}
+
+static void epoch_reclaim(struct td_epoch *dom, unsigned long slot) {
+    struct td_epoch_retired *ret = dom->limbo[slot];
+    dom->limbo[slot] = NULL;
+    dom->limbo_tail[slot] = NULL;
+    while (ret != NULL) {
+        struct td_epoch_retired *next = ret->next;
+        ret->reclaim(ret->obj, ret->arg);
+        free(ret);
+        dom->nr_retired--;
+        ret = next;
+    }
+}
+
+/* advances the epoch if all active readers have seen the current one */
+static int epoch_try_advance(struct td_epoch *dom) {
+    unsigned long epoch = dom->epoch;
+    struct td_epoch_rec *rec;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (rec = __atomic_load_n(&(dom->recs), __ATOMIC_ACQUIRE); rec != NULL;
+         rec = rec->next) {
+        unsigned long active = __atomic_load_n(&(rec->active), __ATOMIC_ACQUIRE);
+        if ((active & 1) && (active >> 1) != epoch)
+            return 0;
+    }
+    __atomic_store_n(&(dom->epoch), epoch + 1, __ATOMIC_RELEASE);
+    /* objects retired two epochs ago are unreachable for all readers */
+    epoch_reclaim(dom, (epoch + 1) % 3);
+    return 1;
+}
+
+void td_epoch_retire(struct td_epoch *dom, void *obj,
+                     void (*reclaim)(void *, void *), void *arg) {
+    struct td_epoch_retired *ret;
+    unsigned long slot = dom->epoch % 3;
+    if ((ret = (struct td_epoch_retired*)malloc(sizeof(struct td_epoch_retired))) == NULL) {
+        puts("td_epoch.c: Unable to allocate memory\n");
+        abort();
+    }
+    ret->obj = obj;
+    ret->reclaim = reclaim;
+    ret->arg = arg;
+    ret->next = NULL;
+    if (dom->limbo_tail[slot] != NULL)
+        dom->limbo_tail[slot]->next = ret;
+    else
+        dom->limbo[slot] = ret;
+    dom->limbo_tail[slot] = ret;
+    if (++dom->nr_retired % RETIRE_BATCH == 0)
+        epoch_try_advance(dom);
+}
+
+void td_epoch_synchronize(struct td_epoch *dom) {
+    while (dom->nr_retired != 0) {
+        if (!epoch_try_advance(dom))
+            sched_yield();
+    }
+}
+
+void td_epoch_destroy(struct td_epoch *dom) {
+    struct td_epoch_rec *rec = dom->recs;
+    td_epoch_synchronize(dom);
+    while (rec != NULL) {
+        struct td_epoch_rec *next = rec->next;
+        unsigned long owner = REC_CLAIMED;
+        /* a record that a thread still caches is freed by that thread */
+        if (!__atomic_compare_exchange_n(&(rec->owner), &owner, REC_ORPHAN, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            free(rec);
+        rec = next;
+    }
+    dom->recs = NULL;
+    dom->nr_recs = 0;
+}
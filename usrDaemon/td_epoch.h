@@ -0,0 +1,103 @@
+/**
+ * @file td_epoch.h
+ * Epoch based memory reclamation. Readers access shared objects without
+ * locks inside td_epoch_enter/td_epoch_exit, writers retire objects that are
+ * freed once no reader can hold a reference anymore.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_EPOCH_H
+#define TD_EPOCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct td_epoch_rec;
+struct td_epoch_retired;
+
+/*
+ * A reclamation domain. td_epoch_retire and td_epoch_synchronize must be
+ * serialized by the caller (e.g., under a writer lock), readers may enter and
+ * exit concurrently from any thread.
+ */
+struct td_epoch {
+    unsigned long epoch;  /*< global epoch */
+    unsigned long id;  /*< unique id of the domain */
+    struct td_epoch_rec *recs;  /*< one record per reader thread */
+    unsigned long nr_recs;  /*< number of records in recs */
+    struct td_epoch_retired *limbo[3];  /*< retired objects per epoch */
+    struct td_epoch_retired *limbo_tail[3];
+    unsigned long nr_retired;  /*< objects waiting for reclamation */
+};
+
+/**
+ * Initializes a reclamation domain.
+ * @param dom the domain
+ */
+void td_epoch_init(struct td_epoch *dom);
+
+/**
+ * Reclaims all retired objects and frees all reader records. No reader may be
+ * active. A record that a thread still caches is freed when the thread
+ * drops it.
+ * @param dom the domain
+ */
+void td_epoch_destroy(struct td_epoch *dom);
+
+/**
+ * Enters a read-side critical section. Objects that are reachable now will not
+ * be reclaimed before the matching td_epoch_exit. Sections do not nest.
+ * A thread keeps its record of the last few domains it entered. It hands a
+ * record back to the domain when it drops it from that cache or exits, and
+ * other threads reuse it.
+ * @param dom the domain
+ * @return handle that must be passed to td_epoch_exit
+ */
+struct td_epoch_rec *td_epoch_enter(struct td_epoch *dom);
+
+/**
+ * Leaves a read-side critical section.
+ * @param rec handle returned by td_epoch_enter
+ */
+void td_epoch_exit(struct td_epoch_rec *rec);
+
+/**
+ * Defers reclamation of an object until all current readers have left.
+ * Retired objects are reclaimed in the order they were retired.
+ * @param dom the domain
+ * @param obj the object
+ * @param reclaim function that frees obj
+ * @param arg second argument for reclaim
+ */
+void td_epoch_retire(struct td_epoch *dom, void *obj,
+                     void (*reclaim)(void *, void *), void *arg);
+
+/**
+ * Waits until all retired objects have been reclaimed.
+ * @param dom the domain
+ */
+void td_epoch_synchronize(struct td_epoch *dom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_EPOCH_H */
@@ -28,95 +28,379 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
 
-#include "avl.h"
+#include "td_checkpoint.h"
+#include "td_dentry.h"
+#include "td_epoch.h"
+#include "td_index.h"
+#include "td_metrics.h"
+#include "td_radix.h"
+#include "td_report.h"
+#include "td_trace.h"
 #include "syscall_nr.h"
 
-struct avl_node *root_proc_tid = NULL;
-struct avl_node *root_proc_pid = NULL;
+/* the hot part of a file must stay within one cache line */
+_Static_assert(sizeof(struct td_file) <= 64, "struct td_file exceeds a cache line");
 
-static long compare_proc_tid(void *left, void *right) {
-    struct td_thread *trl, *trr;
-    trl = (struct td_thread*)left;
-    trr = (struct td_thread*)right;
-    return trl->tid - trr->tid;
+struct td_context {
+    struct td_radix threads;  /*< all threads, indexed by tid */
+    struct td_radix groups;  /*< first thread of each group, indexed by pid */
+    struct td_intern names;  /*< file names of all thread groups */
+    struct td_config config;  /*< configuration of this instance */
+    pthread_mutex_t lock;  /*< serializes process create/destroy */
+    struct td_epoch epoch;  /*< defers freeing of threads and groups */
+    struct td_dentries dentries;  /*< directories of all paths (path check) */
+    unsigned long nr_files;  /*< files of all groups and layers (budget) */
+};
+
+/* context behind the legacy (context-less) API */
+static struct td_context *default_ctx = NULL;
+
+static struct td_context *default_context(void) {
+    if (default_ctx == NULL)
+        default_ctx = td_context_create(NULL);
+    return default_ctx;
 }
 
-static long compare_proc_pid(void *left, void *right) {
-    struct td_thread *trl, *trr;
-    trl = (struct td_thread*)left;
-    trr = (struct td_thread*)right;
-    return trl->pid - trr->pid;
+/*
+ * Locking helpers. In concurrent mode the context lock serializes changes of
+ * the process indexes, the group lock protects the file table and the arena
+ * of a thread group (lock order: context, then group). Threads and groups are
+ * reclaimed through the epoch domain.
+ */
+static inline void ctx_lock(struct td_context *ctx) {
+    if (ctx->config.concurrent)
+        pthread_mutex_lock(&(ctx->lock));
 }
 
-struct td_thread* find_process(unsigned long tid) {
-    struct td_thread proc;
-    proc.tid = tid;
-    struct avl_node *node = avl_find(root_proc_tid, (void*)(&proc), compare_proc_tid);
-    return (node == NULL) ? NULL : node->data;
+static inline void ctx_unlock(struct td_context *ctx) {
+    if (ctx->config.concurrent)
+        pthread_mutex_unlock(&(ctx->lock));
 }
 
-struct td_thread* find_process_pid(unsigned long pid) {
-    struct td_thread proc;
-    proc.pid = pid;
-    struct avl_node *node = avl_find(root_proc_pid, (void*)(&proc), compare_proc_pid);
-    return (node == NULL) ? NULL : node->data;
+static inline void files_lock(struct td_files *files) {
+    if (files->ctx->config.concurrent)
+        pthread_mutex_lock(&(files->lock));
 }
 
-struct td_thread* process_create(unsigned long pid, unsigned long tid,
-                                 unsigned long ppid) {
-    struct td_thread *npid, *proc = NULL;
-    if ((npid = (struct td_thread*)malloc(sizeof(struct td_thread))) == NULL) {
+static inline void files_unlock(struct td_files *files) {
+    if (files->ctx->config.concurrent)
+        pthread_mutex_unlock(&(files->lock));
+}
+
+static inline struct td_epoch_rec *ctx_enter(struct td_context *ctx) {
+    return ctx->config.concurrent ? td_epoch_enter(&(ctx->epoch)) : NULL;
+}
+
+static inline void ctx_exit(struct td_epoch_rec *rec) {
+    if (rec != NULL)
+        td_epoch_exit(rec);
+}
+
+/* frees obj now or, in concurrent mode, once no reader can reach it */
+static inline void ctx_retire(struct td_context *ctx, void *obj,
+                              void (*reclaim)(void *, void *), void *arg) {
+    if (ctx->config.concurrent)
+        td_epoch_retire(&(ctx->epoch), obj, reclaim, arg);
+    else
+        reclaim(obj, arg);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+struct td_context *td_context_create(const struct td_config *config) {
+    struct td_context *ctx;
+    if ((ctx = (struct td_context*)calloc(1, sizeof(struct td_context))) == NULL) {
         puts("td_filestate.c: Unable to allocate memory\n");
         abort();
     }
+    if (config != NULL)
+        ctx->config = *config;
+    td_radix_init(&(ctx->threads));
+    td_radix_init(&(ctx->groups));
+    td_intern_init(&(ctx->names), ctx->config.concurrent);
+    pthread_mutex_init(&(ctx->lock), NULL);
+    td_epoch_init(&(ctx->epoch));
+    td_dentry_init(&(ctx->dentries), ctx->config.concurrent);
+    return ctx;
+}
+
+/* destroys all threads of the group of tdthread */
+static void destroy_group(void *tdthread, void *tdcontext) {
+    struct td_context *ctx = (struct td_context*)tdcontext;
+    unsigned long pid = ((struct td_thread*)tdthread)->pid;
+    struct td_thread *proc;
+    while ((proc = (struct td_thread*)td_radix_find(&(ctx->groups), pid)) != NULL)
+        td_process_destroy(ctx, proc->tid);
+}
+
+void td_context_destroy(struct td_context *ctx) {
+    td_radix_foreach(&(ctx->groups), destroy_group, ctx);
+    td_epoch_destroy(&(ctx->epoch));
+    td_dentry_destroy(&(ctx->dentries));
+    td_radix_destroy(&(ctx->threads));
+    td_radix_destroy(&(ctx->groups));
+    td_intern_destroy(&(ctx->names));
+    pthread_mutex_destroy(&(ctx->lock));
+    if (ctx == default_ctx)
+        default_ctx = NULL;
+    free(ctx);
+}
+
+struct td_thread* td_find_process(struct td_context *ctx, unsigned long tid) {
+    struct td_epoch_rec *rec = ctx_enter(ctx);
+    struct td_thread *proc = (struct td_thread*)td_radix_find(&(ctx->threads), tid);
+    ctx_exit(rec);
+    return proc;
+}
+
+/*
+ * lets a new group share the files of its parent (fork). the table of the
+ * parent is frozen into a layer unless it is empty, so repeated forks of a
+ * group that did not touch new files share a single layer. the child gets a
+ * copy of the descriptors of the parent, they point into the layer.
+ */
+static void inherit_files(struct td_files *child, struct td_files *parent) {
+    struct td_files *layer;
+    files_lock(parent);
+    if (parent->table.count != 0) {
+        if ((layer = (struct td_files*)malloc(sizeof(struct td_files))) == NULL) {
+            puts("td_filestate.c: Unable to allocate memory\n");
+            abort();
+        }
+        layer->ctx = parent->ctx;
+        layer->table = parent->table;
+        td_arena_init(&(layer->arena));
+        /* groups that share the layer build its name index under this lock */
+        pthread_mutex_init(&(layer->lock), NULL);
+        layer->base = parent->base;
+        layer->owner = parent;
+        layer->refs = 1;  /* the parent, the child is added below */
+        layer->fds = NULL;
+        layer->nr_fds = 0;
+        layer->hand = 0;
+        layer->ckpt = NULL;
+        layer->group = NULL;
+        layer->names = parent->names;
+        htab_init(&(parent->table));
+        parent->names = NULL;
+        __atomic_add_fetch(&(parent->refs), 1, __ATOMIC_RELAXED);
+        parent->base = layer;
+    }
+    if (parent->base != NULL)
+        __atomic_add_fetch(&(parent->base->refs), 1, __ATOMIC_RELAXED);
+    child->base = parent->base;
+    if (parent->nr_fds != 0) {
+        if ((child->fds = (struct td_file**)malloc(parent->nr_fds *
+                                                   sizeof(struct td_file*))) == NULL) {
+            puts("td_filestate.c: Unable to allocate memory\n");
+            abort();
+        }
+        memcpy(child->fds, parent->fds, parent->nr_fds * sizeof(struct td_file*));
+        child->nr_fds = parent->nr_fds;
+    }
+    files_unlock(parent);
+}
+
+/* adds a thread, a new group inherits the files of ppid if inherit is set */
+static struct td_thread *create_thread(struct td_context *ctx,
+                                       unsigned long pid, unsigned long tid,
+                                       unsigned long ppid, int inherit) {
+    struct td_thread *npid, *proc = NULL, *parent;
+    struct td_files *files;
+    long used;
+
+    ctx_lock(ctx);
+    if (ctx->config.trace != NULL)
+        td_trace_create(ctx->config.trace, pid, tid, ppid);
+    /* ids are unique and bounded by PID_MAX_LIMIT */
+    if ((tid | pid) >> TD_RADIX_BITS || td_radix_find(&(ctx->threads), tid) != NULL) {
+        ctx_unlock(ctx);
+        return NULL;
+    }
+    proc = (struct td_thread*)td_radix_find(&(ctx->groups), pid);
+    if (proc != NULL) {
+        files = proc->files;
+    } else {
+        if ((files = (struct td_files*)malloc(sizeof(struct td_files))) == NULL) {
+            puts("td_filestate.c: Unable to allocate memory\n");
+            abort();
+        }
+        files->ctx = ctx;
+        htab_init(&(files->table));
+        td_arena_init(&(files->arena));
+        pthread_mutex_init(&(files->lock), NULL);
+        files->base = NULL;
+        files->owner = NULL;
+        files->refs = 1;
+        files->fds = NULL;
+        files->nr_fds = 0;
+        files->hand = 0;
+        files->ckpt = NULL;
+        files->group = NULL;
+        files->names = NULL;
+        if (inherit && (ppid >> TD_RADIX_BITS) == 0 &&
+            (parent = (struct td_thread*)td_radix_find(&(ctx->groups), ppid)) != NULL)
+            inherit_files(files, parent->files);
+    }
+    files_lock(files);
+    used = files->arena.used;
+    npid = (struct td_thread*)td_arena_alloc(&(files->arena),
+                                             sizeof(struct td_thread));
+    used = files->arena.used - used;
+    files_unlock(files);
+    if (ctx->config.metrics != NULL)
+        td_metrics_gauges(ctx->config.metrics, 1, proc == NULL, 0, used);
     npid->pid = pid;
     npid->tid = tid;
     npid->ppid = ppid;
     npid->next_thread = NULL;
-    npid->files = NULL;
+    npid->files = files;
 
-    proc = find_process_pid(pid);
     if (proc != NULL) {
         npid->next_thread = proc->next_thread;
         proc->next_thread = npid;
-        npid->files = proc->files;
     } else {
-        root_proc_pid = avl_insert(root_proc_pid, npid, compare_proc_pid);
-        if ((npid->files = (struct td_files*)malloc(sizeof(struct td_files))) == NULL) {
-            puts("td_filestate.c: Unable to allocate memory\n");
-            abort();
-        }
-        npid->files->tree = NULL;
+        td_radix_set(&(ctx->groups), pid, npid);
     }
-    root_proc_tid = avl_insert(root_proc_tid, npid, compare_proc_tid);
+    td_radix_set(&(ctx->threads), tid, npid);
+    ctx_unlock(ctx);
     return npid;
 }
 
-static void destroy_file_data(void *tdfile) {
+struct td_thread* td_process_create(struct td_context *ctx, unsigned long pid,
+                                    unsigned long tid, unsigned long ppid) {
+    return create_thread(ctx, pid, tid, ppid, ctx->config.inherit);
+}
+
+/* tdfiles is the group whose arena holds the file */
+static void destroy_file_data(void *tdfile, void *tdfiles) {
     struct td_file *file = (struct td_file*)tdfile;
-    free(file);
+    struct td_files *files = (struct td_files*)tdfiles;
+    struct td_arena *arena = &(files->arena);
+    td_intern_put(&(files->ctx->names), file->name);
+    td_dentry_put(&(files->ctx->dentries), file->dir);
+    if (!TD_ARENA_BULK_RELEASE)
+        td_arena_free(arena, file, sizeof(struct td_file));
 }
 
-long process_destroy(unsigned long tid) {
-    struct td_thread *proc = find_process(tid);
-    if (proc == NULL)
+/*
+ * drops a reference to a group or layer. the arena of a group outlives the
+ * group as long as layers keep files in it.
+ */
+static void put_files(struct td_files *files) {
+    struct td_metrics *metrics = files->ctx->config.metrics;
+    struct td_files *base = files->base;
+    long used;
+    if (__atomic_sub_fetch(&(files->refs), 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    if (files->names != NULL)
+        td_index_destroy(files->names, NULL);
+    if (files->owner != NULL) {
+        /* a layer, the owner may still use its arena */
+        files_lock(files->owner);
+        used = files->owner->arena.used;
+        htab_foreach(&(files->table), destroy_file_data, files->owner);
+        used = files->owner->arena.used - used;
+        files_unlock(files->owner);
+        if (metrics != NULL)
+            td_metrics_gauges(metrics, 0, 0, -(long)files->table.count, used);
+        __atomic_sub_fetch(&(files->ctx->nr_files), files->table.count,
+                           __ATOMIC_RELAXED);
+        htab_destroy(&(files->table), NULL);
+        pthread_mutex_destroy(&(files->lock));
+        put_files(files->owner);
+    } else {
+        /* files of a group are gone already, those of a checkpoint layer not */
+        long count = files->table.count;
+        used = files->arena.used;
+        if (files->ckpt != NULL) {
+            htab_foreach(&(files->table), destroy_file_data, files);
+            __atomic_sub_fetch(&(files->ctx->nr_files), count, __ATOMIC_RELAXED);
+            htab_destroy(&(files->table), NULL);
+            td_checkpoint_put(files->ckpt);
+        }
+        if (metrics != NULL)
+            td_metrics_gauges(metrics, 0, 0, -count, -used);
+        td_arena_release(&(files->arena));
+        pthread_mutex_destroy(&(files->lock));
+    }
+    free(files);
+    if (base != NULL)
+        put_files(base);
+}
+
+/*
+ * frees all files of a thread group together with its last thread. called
+ * with the context lock held.
+ */
+static void destroy_files(void *tdfiles, void *tdthread) {
+    struct td_files *files = (struct td_files*)tdfiles;
+    struct td_metrics *metrics = files->ctx->config.metrics;
+    struct td_files *base;
+    long used = files->arena.used;
+    htab_foreach(&(files->table), destroy_file_data, files);
+    if (!TD_ARENA_BULK_RELEASE)
+        td_arena_free(&(files->arena), tdthread, sizeof(struct td_thread));
+    if (metrics != NULL)
+        td_metrics_gauges(metrics, -1, -1, -(long)files->table.count,
+                          (long)files->arena.used - used);
+    __atomic_sub_fetch(&(files->ctx->nr_files), files->table.count,
+                       __ATOMIC_RELAXED);
+    htab_destroy(&(files->table), NULL);
+    htab_init(&(files->table));
+    if (files->names != NULL)
+        td_index_destroy(files->names, NULL);
+    files->names = NULL;
+    free(files->fds);
+    files->fds = NULL;
+    files->nr_fds = 0;
+    /* the base may be a layer that keeps files in our arena (no cycle) */
+    base = files->base;
+    files->base = NULL;
+    put_files(files);
+    if (base != NULL)
+        put_files(base);
+}
+
+/* returns a single thread to the arena of its group */
+static void destroy_thread(void *tdthread, void *tdfiles) {
+    struct td_files *files = (struct td_files*)tdfiles;
+    long used;
+    files_lock(files);
+    used = files->arena.used;
+    td_arena_free(&(files->arena), tdthread, sizeof(struct td_thread));
+    used = files->arena.used - used;
+    files_unlock(files);
+    if (files->ctx->config.metrics != NULL)
+        td_metrics_gauges(files->ctx->config.metrics, -1, 0, 0, used);
+}
+
+long td_process_destroy(struct td_context *ctx, unsigned long tid) {
+    ctx_lock(ctx);
+    if (ctx->config.trace != NULL)
+        td_trace_destroy(ctx->config.trace, tid);
+    struct td_thread *proc = (struct td_thread*)td_radix_find(&(ctx->threads), tid);
+    if (proc == NULL) {
+        ctx_unlock(ctx);
         return -1;
-    root_proc_tid = avl_delete(root_proc_tid, (void*)proc, compare_proc_tid);
-    // todo: delete if last pid
-    //root_proc_pid = avl_delete(root_proc_pid, (void*)proc, compare_proc_pid);
+    }
+    td_radix_set(&(ctx->threads), tid, NULL);
 
-    struct td_thread *pid = find_process_pid(proc->pid);
+    struct td_thread *pid = (struct td_thread*)td_radix_find(&(ctx->groups), proc->pid);
     
     // check for threads (if so, delete from linked list)
     if (pid != proc || proc->next_thread != NULL) {
         // we delete the root of the linked list
         if (pid == proc) {
-            struct td_thread *first = pid->next_thread;
-            root_proc_pid = avl_delete(root_proc_pid, (void*)pid, compare_proc_pid); 
-            if (first != NULL) {
-                root_proc_pid = avl_insert(root_proc_pid, (void*)first, compare_proc_pid);
-            }
+            td_radix_set(&(ctx->groups), proc->pid, pid->next_thread);
         } else {
             // delete from list
             struct td_thread *tr = pid;
@@ -128,79 +412,781 @@ long process_destroy(unsigned long tid) {
                 tr = tr->next_thread;
             }
         }
+        // free this process
+        ctx_retire(ctx, proc, destroy_thread, proc->files);
     } else {
         // last process in thread group, we have to kill all files
-        root_proc_pid = avl_delete(root_proc_pid, (void*)proc, compare_proc_pid); 
-        avl_destroy(proc->files->tree, destroy_file_data);
-        free(proc->files);
+        td_radix_set(&(ctx->groups), proc->pid, NULL);
+        ctx_retire(ctx, proc->files, destroy_files, proc);
     }
-    
-    // free this process
-    free(proc);
+    ctx_unlock(ctx);
     return 0;
 }
 
+struct td_thread* process_create(unsigned long pid, unsigned long tid,
+                                 unsigned long ppid) {
+    return td_process_create(default_context(), pid, tid, ppid);
+}
+
+long process_destroy(unsigned long tid) {
+    return td_process_destroy(default_context(), tid);
+}
+
+struct td_thread* find_process(unsigned long tid) {
+    return td_find_process(default_context(), tid);
+}
+
 
 struct td_file *check_file(struct td_thread *proc, const char *file,
-                           const char *path, struct stat *buf,
-                           enum transition next_state);
+                           unsigned long file_len, uint64_t hash,
+                           const char *path, unsigned long path_len,
+                           struct stat *buf, enum transition next_state);
 
 enum td_syscall_result handle_syscall(unsigned long tid, unsigned long syscall,
                                       const char *file, const char *path,
                                       struct stat *buf) {
-    struct td_thread *proc = find_process(tid);
-    if (proc == NULL) {
-        printf("Could not find pid %ld (unable to handle system call %ld)\n",
-               tid, syscall);
-        return SYSCALL_PIDERR;
-    }
+    return td_handle_syscall_n(default_context(), tid, syscall, file,
+                               strlen(file), path,
+                               (path == NULL) ? 0 : strlen(path), buf);
+}
 
-    struct td_file *rc = NULL;
-    switch (syscall) {
-        case SYS_ACCESS:
-            rc = check_file(proc, file, path, buf, TRANS_TEST);
-            break;
-        case SYS_STAT:
-            rc = check_file(proc, file, path, buf, TRANS_TEST);
-            break;
-        case SYS_CREAT:
-            rc = check_file(proc, file, path, buf, TRANS_USE);
-            rc->nropen++;
-            break;
-        case SYS_OPEN:
-            rc = check_file(proc, file, path, buf, TRANS_USE);
-            rc->nropen++;
-            break;
-        case SYS_CLOSE:
-            rc = check_file(proc, file, path, buf, TRANS_CLOSE);
-            break;
-    }
-    switch (rc->health) {
+enum td_syscall_result handle_syscall_n(unsigned long tid, unsigned long syscall,
+                                        const char *file, unsigned long file_len,
+                                        const char *path, unsigned long path_len,
+                                        struct stat *buf) {
+    return td_handle_syscall_n(default_context(), tid, syscall, file, file_len,
+                               path, path_len, buf);
+}
+
+void handle_syscall_batch(const struct td_event *ev, unsigned long nr,
+                          enum td_syscall_result *out) {
+    td_handle_syscall_batch(default_context(), ev, nr, out);
+}
+
+enum td_syscall_result bind_fd(unsigned long tid, long fd, const char *file) {
+    return td_bind_fd(default_context(), tid, fd, file, strlen(file));
+}
+
+enum td_syscall_result handle_syscall_fd(unsigned long tid,
+                                         unsigned long syscall, long fd,
+                                         long newfd) {
+    return td_handle_syscall_fd(default_context(), tid, syscall, fd, newfd);
+}
+
+enum td_syscall_result td_handle_syscall(struct td_context *ctx,
+                                         unsigned long tid, unsigned long syscall,
+                                         const char *file, const char *path,
+                                         struct stat *buf) {
+    return td_handle_syscall_n(ctx, tid, syscall, file, strlen(file), path,
+                               (path == NULL) ? 0 : strlen(path), buf);
+}
+
+static enum td_syscall_result health_result(enum td_file_health health) {
+    switch (health) {
         case HEALTH_UNCHECKED:
-            printf("Possible race condition: %s %s\n", file, path);
             return SYSCALL_UNCHECKED;
         case HEALTH_OK:
             return SYSCALL_PASS;
         case HEALTH_BAD:
-            printf("Race condition: %s %s\n", file, path);
             return SYSCALL_RACE;
     }
     return SYSCALL_PASS;
 }
 
-static long compare_file(void *left, void *right) {
-    struct td_file *trl, *trr;
-    trl = (struct td_file*)left;
-    trr = (struct td_file*)right;
-    return strncmp(trl->name, trr->name, MAX_FILE_LEN);
+/* queues a report for the reporter of ctx */
+static void push_report(struct td_context *ctx, const struct td_event *ev,
+                        unsigned long pid, const struct td_file *file,
+                        enum td_syscall_result verdict) {
+    struct td_report rep;
+    struct timespec ts;
+    unsigned long len = (ev->file_len < TD_REPORT_NAME) ? ev->file_len :
+        TD_REPORT_NAME;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rep.time = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    rep.name_hash = (file != NULL) ? file->name->hash :
+        htab_hash(ev->file, ev->file_len);
+    rep.tid = ev->tid;
+    rep.pid = pid;
+    rep.syscall = ev->syscall;
+    rep.verdict = verdict;
+    memset(&(rep.checked), 0, sizeof(struct td_fingerprint));
+    memset(&(rep.seen), 0, sizeof(struct td_fingerprint));
+    if (file != NULL)
+        rep.checked = file->fp;
+    if (ev->buf != NULL) {
+        rep.seen.dev = ev->buf->st_dev;
+        rep.seen.ino = ev->buf->st_ino;
+        rep.seen.mode = ev->buf->st_mode;
+        rep.seen.uid = ev->buf->st_uid;
+        rep.seen.gid = ev->buf->st_gid;
+    }
+    rep.name_len = (ev->file_len > 0xffff) ? 0xffff : ev->file_len;
+    memcpy(rep.name, ev->file, len);
+    td_report_push(ctx->config.reporter, &rep);
+}
+
+/* system calls with a number below are looked up in the dispatch table */
+#define NR_SYSCALLS 512
+
+/* how a system call is handled */
+struct syscall_desc {
+    unsigned char known;  /*< 0: the system call is ignored (passes) */
+    unsigned char transition;  /*< enum transition of the file */
+    unsigned char opens;  /*< counts as an open of the file (nropen) */
+    unsigned char at;  /*< *at call: file is relative to path (see decode) */
+};
+
+static const struct syscall_desc syscall_table[NR_SYSCALLS] = {
+    [SYS_OPEN] = { 1, TRANS_USE, 1, 0 },
+    [SYS_CLOSE] = { 1, TRANS_CLOSE, 0, 0 },
+    [SYS_STAT] = { 1, TRANS_TEST, 0, 0 },
+    [SYS_LSTAT] = { 1, TRANS_TEST, 0, 0 },
+    [SYS_ACCESS] = { 1, TRANS_TEST, 0, 0 },
+    [SYS_CREAT] = { 1, TRANS_USE, 1, 0 },
+    [SYS_OPENAT] = { 1, TRANS_USE, 1, 1 },
+    [SYS_NEWFSTATAT] = { 1, TRANS_TEST, 0, 1 },
+    [SYS_FACCESSAT] = { 1, TRANS_TEST, 0, 1 },
+    [SYS_STATX] = { 1, TRANS_TEST, 0, 1 },
+    [SYS_OPENAT2] = { 1, TRANS_USE, 1, 1 },
+    [SYS_FACCESSAT2] = { 1, TRANS_TEST, 0, 1 }
+};
+
+/* returns the table entry of a system call or NULL if it is ignored */
+static inline const struct syscall_desc *syscall_desc(unsigned long syscall) {
+    if (syscall >= NR_SYSCALLS || !syscall_table[syscall].known)
+        return NULL;
+    return &(syscall_table[syscall]);
+}
+
+/*
+ * an absolute directory verifies its node of the directory cache, which all
+ * thread groups share (see check_file)
+ */
+static inline long verifies_dir(const char *file, unsigned long file_len,
+                                const struct stat *buf) {
+    return S_ISDIR(buf->st_mode) && file_len != 0 && file[0] == '/';
+}
+
+/*
+ * the directory of a resolved name is its parent, the way the legacy calls
+ * report it. the root has no directory to check.
+ */
+static inline void set_parent(struct td_event *ev) {
+    unsigned long len = ev->file_len;
+    while (len > 1 && ev->file[len - 1] == '/')
+        len--;
+    if (len == 1) {
+        ev->path_len = 0;
+        return;
+    }
+    while (len > 0 && ev->file[len - 1] != '/')
+        len--;
+    while (len > 1 && ev->file[len - 1] == '/')
+        len--;
+    ev->path = ev->file;
+    ev->path_len = len;
+}
+
+/*
+ * resolves the name of an *at call: a relative name is joined with the
+ * absolute path of dirfd into buf, an empty name (AT_EMPTY_PATH) is the
+ * file of dirfd itself. the directory of the event becomes the parent of the
+ * resolved name, or unknown if dirfd has no absolute path. other events are
+ * copied unchanged. returns the bytes of buf that were used or ~0UL if the
+ * name does not fit.
+ */
+static unsigned long decode(const struct syscall_desc *desc,
+                            const struct td_event *ev, struct td_event *out,
+                            char *buf, unsigned long size) {
+    unsigned long dir_len = ev->path_len, len = 0;
+    *out = *ev;
+    if (!desc->at)
+        return 0;
+    if (ev->file_len != 0 && ev->file[0] == '/') {
+        set_parent(out);
+        return 0;
+    }
+    if (ev->path_len == 0 || ev->path[0] != '/') {
+        out->path_len = 0;
+        return 0;
+    }
+    while (dir_len > 0 && ev->path[dir_len - 1] == '/')
+        dir_len--;
+    if (ev->file_len == 0) {
+        /* the root stays "/" */
+        out->file = ev->path;
+        out->file_len = (dir_len != 0) ? dir_len : 1;
+    } else {
+        len = dir_len + 1 + ev->file_len;
+        if (len > size)
+            return ~0UL;
+        memcpy(buf, ev->path, dir_len);
+        buf[dir_len] = '/';
+        memcpy(buf + dir_len + 1, ev->file, ev->file_len);
+        out->file = buf;
+        out->file_len = len;
+    }
+    set_parent(out);
+    return len;
+}
+
+/* runs the state machine for a single event, the group lock is held */
+static enum td_file_health file_syscall(struct td_thread *proc,
+                                        const struct td_event *ev,
+                                        uint64_t hash,
+                                        const struct syscall_desc *desc) {
+    struct td_file *rc = check_file(proc, ev->file, ev->file_len, hash,
+                                    ev->path, ev->path_len, ev->buf,
+                                    (enum transition)desc->transition);
+    rc->nropen += desc->opens;
+    /* recorded under the group lock to keep the order within the group */
+    if (proc->files->ctx->config.trace != NULL)
+        td_trace_syscall(proc->files->ctx->config.trace, ev,
+                         health_result(rc->health));
+    if (rc->health != HEALTH_OK && proc->files->ctx->config.reporter != NULL)
+        push_report(proc->files->ctx, ev, proc->pid, rc,
+                    health_result(rc->health));
+    return rc->health;
+}
+
+/* turns the file health into the verdict and reports problems */
+static enum td_syscall_result syscall_verdict(struct td_context *ctx,
+                                              const struct td_event *ev,
+                                              enum td_file_health health) {
+    enum td_syscall_result result = health_result(health);
+    /* the reporter already has the report */
+    if (ctx->config.quiet || ctx->config.reporter != NULL)
+        return result;
+    if (result == SYSCALL_UNCHECKED)
+        printf("Possible race condition: %.*s %.*s\n", (int)ev->file_len,
+               ev->file, (int)ev->path_len, ev->path);
+    else if (result == SYSCALL_RACE)
+        printf("Race condition: %.*s %.*s\n", (int)ev->file_len, ev->file,
+               (int)ev->path_len, ev->path);
+    return result;
+}
+
+static enum td_syscall_result report_unknown_pid(struct td_context *ctx,
+                                                 const struct td_event *ev) {
+    if (ctx->config.reporter != NULL)
+        push_report(ctx, ev, 0, NULL, SYSCALL_PIDERR);
+    else if (!ctx->config.quiet)
+        printf("Could not find pid %ld (unable to handle system call %ld)\n",
+               ev->tid, ev->syscall);
+    return SYSCALL_PIDERR;
+}
+
+static enum td_syscall_result unknown_pid(struct td_context *ctx,
+                                          const struct td_event *ev) {
+    if (ctx->config.trace != NULL)
+        td_trace_syscall(ctx->config.trace, ev, SYSCALL_PIDERR);
+    return report_unknown_pid(ctx, ev);
+}
+
+/* system calls that are not in the dispatch table pass untouched */
+static enum td_syscall_result ignored_syscall(struct td_context *ctx,
+                                              const struct td_event *ev) {
+    if (ctx->config.trace != NULL)
+        td_trace_syscall(ctx->config.trace, ev, SYSCALL_PASS);
+    return SYSCALL_PASS;
+}
+
+enum td_syscall_result td_handle_syscall_n(struct td_context *ctx,
+                                           unsigned long tid,
+                                           unsigned long syscall,
+                                           const char *file,
+                                           unsigned long file_len,
+                                           const char *path,
+                                           unsigned long path_len,
+                                           struct stat *buf) {
+    struct td_event raw = { tid, syscall, file, file_len, path, path_len, buf };
+    struct td_event ev;
+    struct td_metrics *metrics = ctx->config.metrics;
+    uint64_t start = (metrics != NULL) ? now_ns() : 0;
+    const struct syscall_desc *desc = syscall_desc(syscall);
+    struct td_epoch_rec *rec;
+    struct td_thread *proc;
+    enum td_syscall_result result;
+    char name[PATH_MAX];
+    if (desc == NULL) {
+        result = ignored_syscall(ctx, &raw);
+        if (metrics != NULL)
+            td_metrics_syscall(metrics, syscall, result, now_ns() - start);
+        return result;
+    }
+    if (decode(desc, &raw, &ev, name, sizeof(name)) == ~0UL)
+        ev = raw;
+    rec = ctx_enter(ctx);
+    proc = (struct td_thread*)td_radix_find(&(ctx->threads), tid);
+    if (proc == NULL) {
+        ctx_exit(rec);
+        result = unknown_pid(ctx, &ev);
+    } else {
+        enum td_file_health health;
+        files_lock(proc->files);
+        health = file_syscall(proc, &ev, htab_hash(ev.file, ev.file_len), desc);
+        files_unlock(proc->files);
+        ctx_exit(rec);
+        result = syscall_verdict(ctx, &ev, health);
+    }
+    if (metrics != NULL)
+        td_metrics_syscall(metrics, syscall, result, now_ns() - start);
+    return result;
+}
+
+/* events that are looked up, prefetched, and grouped together */
+#define BATCH_CHUNK 64
+/* threads a chunk remembers the lookup of (direct mapped by tid) */
+#define BATCH_TIDS 16
+/* resolved names of *at calls per chunk, a full buffer ends the chunk */
+#define BATCH_NAMES (4 * PATH_MAX)
+
+void td_handle_syscall_batch(struct td_context *ctx, const struct td_event *ev,
+                             unsigned long nr, enum td_syscall_result *out) {
+    struct td_thread *procs[BATCH_CHUNK];
+    struct {
+        unsigned long tid;
+        struct td_thread *proc;
+    } tids[BATCH_TIDS];
+    struct td_event dec[BATCH_CHUNK];
+    const struct syscall_desc *descs[BATCH_CHUNK];
+    uint64_t hashes[BATCH_CHUNK];
+    enum td_file_health health[BATCH_CHUNK];
+    unsigned char done[BATCH_CHUNK];
+    char names[BATCH_NAMES];
+    struct td_metrics *metrics = ctx->config.metrics;
+    struct td_epoch_rec *rec;
+    unsigned long base, i, j, len, used, n;
+
+    /*
+     * the global budget evicts files in the order of all events, traces and
+     * reports record it: handle the events one by one
+     */
+    if (ctx->config.max_files != 0 || ctx->config.trace != NULL ||
+        ctx->config.reporter != NULL) {
+        for (i = 0; i < nr; i++)
+            out[i] = td_handle_syscall_n(ctx, ev[i].tid, ev[i].syscall,
+                                         ev[i].file, ev[i].file_len,
+                                         ev[i].path, ev[i].path_len,
+                                         ev[i].buf);
+        return;
+    }
+
+    rec = ctx_enter(ctx);
+    for (base = 0; base < nr; base += len) {
+        const struct td_event *cev = ev + base;
+        uint64_t start = (metrics != NULL) ? now_ns() : 0;
+        len = (nr - base < BATCH_CHUNK) ? nr - base : BATCH_CHUNK;
+        used = 0;
+        /* ~0UL is no valid tid, its lookup yields NULL as well */
+        for (i = 0; i < BATCH_TIDS; i++) {
+            tids[i].tid = ~0UL;
+            tids[i].proc = NULL;
+        }
+
+        /* one process lookup per tid of the chunk (unless tids collide) */
+        for (i = 0; i < len; i++) {
+            unsigned long tid = cev[i].tid, t = tid % BATCH_TIDS;
+            procs[i] = NULL;
+            done[i] = 1;
+            if ((descs[i] = syscall_desc(cev[i].syscall)) == NULL)
+                continue;
+            n = decode(descs[i], &(cev[i]), &(dec[i]), names + used,
+                       BATCH_NAMES - used);
+            if (n == ~0UL) {
+                /* names longer than PATH_MAX are kept as they are */
+                if (BATCH_NAMES - used < PATH_MAX) {
+                    len = i;
+                    break;
+                }
+                dec[i] = cev[i];
+                n = 0;
+            }
+            /*
+             * a directory that may be replaced starts a new chunk: the
+             * events before it see the old version, the events after it the
+             * new one, in every thread group
+             */
+            if (i > 0 && verifies_dir(dec[i].file, dec[i].file_len,
+                                      dec[i].buf)) {
+                len = i;
+                break;
+            }
+            used += n;
+            if (tids[t].tid != tid) {
+                tids[t].tid = tid;
+                tids[t].proc = (struct td_thread*)td_radix_find(&(ctx->threads),
+                                                                tid);
+            }
+            procs[i] = tids[t].proc;
+            hashes[i] = htab_hash(dec[i].file, dec[i].file_len);
+            done[i] = (procs[i] == NULL);
+            /* tables of other groups may be resized concurrently */
+            if (procs[i] != NULL && !ctx->config.concurrent)
+                htab_prefetch(&(procs[i]->files->table), hashes[i]);
+        }
+
+        /*
+         * handle the events group by group. events of a thread group stay in
+         * their original order (this keeps the order of each thread and the
+         * interleaving of threads that share the file table).
+         */
+        for (i = 0; i < len; i++) {
+            struct td_files *files;
+            if (done[i])
+                continue;
+            files = procs[i]->files;
+            files_lock(files);
+            /* the table is stable now, prefetch the files of the group */
+            for (j = i; j < len; j++) {
+                if (done[j] || procs[j]->files != files)
+                    continue;
+                if (ctx->config.concurrent)
+                    htab_prefetch(&(files->table), hashes[j]);
+                htab_prefetch_data(&(files->table), hashes[j]);
+            }
+            for (j = i; j < len; j++) {
+                if (done[j] || procs[j]->files != files)
+                    continue;
+                health[j] = file_syscall(procs[j], &(dec[j]), hashes[j],
+                                         descs[j]);
+                done[j] = 1;
+            }
+            files_unlock(files);
+        }
+
+        for (i = 0; i < len; i++) {
+            if (descs[i] == NULL)
+                out[base + i] = ignored_syscall(ctx, &(cev[i]));
+            else if (procs[i] == NULL)
+                out[base + i] = unknown_pid(ctx, &(dec[i]));
+            else
+                out[base + i] = syscall_verdict(ctx, &(dec[i]), health[i]);
+        }
+
+        /* events of a chunk are handled together, they share its latency */
+        if (metrics != NULL) {
+            uint64_t ns = (now_ns() - start) / len;
+            for (i = 0; i < len; i++)
+                td_metrics_syscall(metrics, cev[i].syscall, out[base + i], ns);
+        }
+    }
+    ctx_exit(rec);
+}
+
+struct file_key {
+    const char *name;
+    unsigned long len;
+};
+
+static long same_file_name(const void *key, void *tdfile) {
+    const struct file_key *fkey = (const struct file_key*)key;
+    return td_str_equal(((struct td_file*)tdfile)->name, fkey->name, fkey->len);
+}
+
+/* adds a new file of a table to its name index (if it has one) */
+static inline void index_file(struct td_files *files, struct td_file *file) {
+    if (files->names != NULL)
+        td_index_insert(files->names, file->name->str, file->name->len, file);
+}
+
+/*
+ * returns the file of a checkpoint layer for a file of the image, loads it on
+ * first use. a record with its name outside of the image or with a state or
+ * health that does not exist (corrupt or foreign image) is not loaded.
+ * called with the lock of the layer held.
+ */
+static struct td_file *load_file(struct td_files *layer,
+                                 const struct td_checkpoint_file *cfile) {
+    struct td_metrics *metrics = layer->ctx->config.metrics;
+    const char *name = td_checkpoint_name(layer->ckpt, cfile);
+    struct file_key key = { name, cfile->name_len };
+    struct td_file *file;
+    long used;
+    if (name == NULL || cfile->state > STATE_RETIRE ||
+        cfile->health > HEALTH_BAD)
+        return NULL;
+    if ((file = (struct td_file*)htab_find(&(layer->table), cfile->hash, &key,
+                                           same_file_name)) != NULL)
+        return file;
+    used = layer->arena.used;
+    file = (struct td_file*)td_arena_alloc(&(layer->arena),
+                                           sizeof(struct td_file));
+    if (metrics != NULL)
+        td_metrics_gauges(metrics, 0, 0, 1, layer->arena.used - used);
+    __atomic_add_fetch(&(layer->ctx->nr_files), 1, __ATOMIC_RELAXED);
+    file->fp.dev = cfile->dev;
+    file->fp.ino = cfile->ino;
+    file->fp.mode = cfile->mode;
+    file->fp.uid = cfile->uid;
+    file->fp.gid = cfile->gid;
+    file->name = td_intern(&(layer->ctx->names), name, cfile->name_len,
+                           cfile->hash);
+    file->dir = NULL;
+    file->nropen = cfile->nropen;
+    file->state = (enum td_file_state)cfile->state;
+    file->health = (enum td_file_health)cfile->health;
+    file->ref = 0;
+    file->stale = cfile->stale;
+    htab_insert(&(layer->table), cfile->hash, file);
+    index_file(layer, file);
+    return file;
+}
+
+/* looks up a file in a layer */
+static struct td_file *find_layer(struct td_files *layer, uint64_t hash,
+                                  const struct file_key *key) {
+    const struct td_checkpoint_file *cfile;
+    struct td_file *file;
+    if (layer->ckpt == NULL)
+        return (struct td_file*)htab_find(&(layer->table), hash, key,
+                                          same_file_name);
+    /* groups that share a checkpoint layer load its files concurrently */
+    files_lock(layer);
+    file = (struct td_file*)htab_find(&(layer->table), hash, key,
+                                      same_file_name);
+    if (file == NULL &&
+        (cfile = td_checkpoint_find(layer->ckpt, layer->group, hash, key->name,
+                                    key->len)) != NULL)
+        file = load_file(layer, cfile);
+    files_unlock(layer);
+    return file;
 }
 
-static inline long same_file_notime(struct stat *stat1, struct stat *stat2) {
+/* looks up a file in the frozen layers below a table */
+static struct td_file *find_inherited(struct td_files *files, uint64_t hash,
+                                      const struct file_key *key) {
+    struct td_files *layer;
+    struct td_file *file;
+    for (layer = files->base; layer != NULL; layer = layer->base)
+        if ((file = find_layer(layer, hash, key)) != NULL)
+            return file;
+    return NULL;
+}
+
+struct td_file *find_file(struct td_thread *proc, const char *file,
+                          unsigned long file_len) {
+    struct file_key key = { file, file_len };
+    uint64_t hash = htab_hash(file, file_len);
+    struct td_file *lfile = (struct td_file*)htab_find(&(proc->files->table),
+                                                       hash, &key,
+                                                       same_file_name);
+    return (lfile != NULL) ? lfile : find_inherited(proc->files, hash, &key);
+}
+
+/* files evicted at once, the descriptors are scanned once per batch */
+#define EVICT_BATCH 32
+/* files the hand passes per eviction at most (keeps inserts O(1)) */
+#define EVICT_SCAN 1024
+
+static long same_ptr(const void *key, void *data) {
+    return key == data;
+}
+
+/*
+ * evicts up to nr retired files of a group (except keep) that were not used
+ * since the hand passed them last. victims are marked with a negative nropen
+ * until the descriptors that still point to them are dropped.
+ */
+static unsigned long evict_files(struct td_files *files, unsigned long nr,
+                                 const struct td_file *keep) {
+    struct td_context *ctx = files->ctx;
+    struct td_metrics *metrics = ctx->config.metrics;
+    struct td_file *victims[EVICT_BATCH], *file;
+    unsigned long i, n = 0, steps = 2 * files->table.count + 1;
+    long used = files->arena.used;
+    if (nr > EVICT_BATCH)
+        nr = EVICT_BATCH;
+    if (steps > EVICT_SCAN)
+        steps = EVICT_SCAN;
+    while (n < nr && steps-- > 0 &&
+           (file = (struct td_file*)htab_next(&(files->table),
+                                              &(files->hand))) != NULL) {
+        struct file_key key = { file->name->str, file->name->len };
+        if (file->state != STATE_RETIRE || file == keep)
+            continue;
+        if (file->ref) {
+            file->ref = 0;
+            continue;
+        }
+        /* the inherited file would come back with its old state */
+        if (files->base != NULL &&
+            find_inherited(files, file->name->hash, &key) != NULL)
+            continue;
+        htab_delete(&(files->table), file->name->hash, file, same_ptr);
+        if (files->names != NULL)
+            td_index_delete(files->names, file->name->str, file->name->len);
+        file->nropen = -1;
+        victims[n++] = file;
+    }
+    if (n == 0)
+        return 0;
+    for (i = 0; i < files->nr_fds; i++)
+        if (files->fds[i] != NULL && files->fds[i]->nropen < 0)
+            files->fds[i] = NULL;
+    for (i = 0; i < n; i++)
+        destroy_file_data(victims[i], files);
+    __atomic_sub_fetch(&(ctx->nr_files), n, __ATOMIC_RELAXED);
+    if (metrics != NULL) {
+        td_metrics_evictions(metrics, n);
+        td_metrics_gauges(metrics, 0, 0, -(long)n,
+                          (long)files->arena.used - used);
+    }
+    return n;
+}
+
+/*
+ * brings a group back within its budget after a new file was added (see
+ * td_config.max_files). the new file is never a victim.
+ */
+static void make_room(struct td_files *files, const struct td_file *keep) {
+    const struct td_config *config = &(files->ctx->config);
+    unsigned long nr = 0, total;
+    if (config->max_group_files != 0 &&
+        files->table.count > config->max_group_files)
+        nr = files->table.count - config->max_group_files;
+    if (config->max_files != 0 &&
+        (total = __atomic_load_n(&(files->ctx->nr_files), __ATOMIC_RELAXED)) >
+        config->max_files && total - config->max_files > nr)
+        nr = total - config->max_files;
+    /* a few more, so the descriptors are not scanned for every new file */
+    if (nr != 0)
+        evict_files(files, (nr < EVICT_BATCH / 4) ? EVICT_BATCH / 4 : nr,
+                    keep);
+}
+
+/* allocates a new file of a group, see insert_file */
+static struct td_file *alloc_file(struct td_files *files) {
+    struct td_metrics *metrics = files->ctx->config.metrics;
+    struct td_file *lfile;
+    long used = files->arena.used;
+    lfile = (struct td_file*)td_arena_alloc(&(files->arena),
+                                            sizeof(struct td_file));
+    if (metrics != NULL)
+        td_metrics_gauges(metrics, 0, 0, 1, files->arena.used - used);
+    __atomic_add_fetch(&(files->ctx->nr_files), 1, __ATOMIC_RELAXED);
+    return lfile;
+}
+
+/* tracks a new file of a group */
+static void insert_file(struct td_files *files, struct td_file *lfile,
+                        uint64_t hash) {
+    htab_insert(&(files->table), hash, lfile);
+    index_file(files, lfile);
+    make_room(files, lfile);
+}
+
+/* initializes a new file from the inherited one */
+static void copy_file(struct td_files *files, struct td_file *lfile,
+                      const struct td_file *inherited) {
+    *lfile = *inherited;
+    td_intern_get(&(files->ctx->names), lfile->name);
+    td_dentry_get(lfile->dir);
+    lfile->ref = 1;
+}
+
+/* copies an inherited file into the table of the group */
+static struct td_file *copy_inherited(struct td_files *files,
+                                      const struct td_file *inherited,
+                                      uint64_t hash) {
+    struct td_file *lfile = alloc_file(files);
+    copy_file(files, lfile, inherited);
+    insert_file(files, lfile, hash);
+    return lfile;
+}
+
+/* a file that check_file adds to the table of a group */
+struct file_create {
+    struct td_files *files;
+    uint64_t hash;
+    int created;  /*< the group did not have the file */
+    int inherited;  /*< the file was copied from a layer */
+};
+
+/* creates the file for a name that the group does not have yet */
+static void *create_file(const void *fkey, void *filecreate) {
+    const struct file_key *key = (const struct file_key*)fkey;
+    struct file_create *fc = (struct file_create*)filecreate;
+    struct td_file *lfile = alloc_file(fc->files), *inherited;
+    fc->created = 1;
+    /* copy on write: inherited files are shared with other groups */
+    if ((inherited = find_inherited(fc->files, fc->hash, key)) != NULL) {
+        copy_file(fc->files, lfile, inherited);
+        fc->inherited = 1;
+        return lfile;
+    }
+    lfile->name = td_intern(&(fc->files->ctx->names), key->name, key->len,
+                            fc->hash);
+    lfile->nropen = 0;
+    lfile->dir = NULL;
+    lfile->ref = 1;
+    lfile->stale = 0;
+    lfile->health = HEALTH_OK;
+    return lfile;
+}
+
+static inline void set_fingerprint(struct td_fingerprint *fp,
+                                   struct stat *buf) {
+    fp->dev = buf->st_dev;
+    fp->ino = buf->st_ino;
+    fp->mode = buf->st_mode;
+    fp->uid = buf->st_uid;
+    fp->gid = buf->st_gid;
+}
+
+static inline long same_file_notime(struct td_fingerprint *fp,
+                                    struct stat *buf) {
   /* if inode, device, permissions, and user/group information are the same
      then the file is the same as well */
-  return (stat1->st_dev == stat2->st_dev && stat1->st_ino == stat2->st_ino &&
-          stat1->st_mode == stat2->st_mode && stat1->st_uid == stat2->st_uid &&
-          stat1->st_gid == stat2->st_gid);
+  return (fp->dev == buf->st_dev && fp->ino == buf->st_ino &&
+          fp->mode == buf->st_mode && fp->uid == buf->st_uid &&
+          fp->gid == buf->st_gid);
+}
+
+/*
+ * remembers the directory a file is checked in. the directory is only looked
+ * up again if the file is checked through a different path or the directory
+ * was replaced since. the file holds a reference to its directory.
+ */
+static inline void set_dir(struct td_files *files, struct td_file *file,
+                           const char *path, unsigned long path_len) {
+    struct td_dentries *dents = &(files->ctx->dentries);
+    struct td_dentry *dir;
+    if (file->dir == NULL || !td_dentry_is(file->dir, path, path_len) ||
+        td_dentry_stale(dents, file->dir)) {
+        dir = td_dentry_lookup(dents, path, path_len);
+        td_dentry_put(dents, file->dir);
+        file->dir = dir;
+    }
+}
+
+/*
+ * a file is only the checked one if it is used through the same directory
+ * and no directory on the way to it was replaced since the check (paths
+ * that are not known at either side are not compared).
+ */
+static inline long same_dir(struct td_files *files, struct td_file *file,
+                            const char *path, unsigned long path_len) {
+    if (file->dir == NULL || path_len == 0)
+        return 1;
+    return td_dentry_is(file->dir, path, path_len) &&
+        !td_dentry_stale(&(files->ctx->dentries), file->dir);
+}
+
+/* the file was checked (test or update transition) */
+static inline void set_checked(struct td_files *files, struct td_file *file,
+                               struct stat *buf, const char *path,
+                               unsigned long path_len) {
+    set_fingerprint(&(file->fp), buf);
+    set_dir(files, file, path, path_len);
+    file->stale = 0;
+}
+
+static inline long same_file(struct td_files *files, struct td_file *file,
+                             struct stat *buf, const char *path,
+                             unsigned long path_len) {
+    return !file->stale && same_file_notime(&(file->fp), buf) &&
+        same_dir(files, file, path, path_len);
 }
 
 static inline void update_health(struct td_file *file,
@@ -210,121 +1196,551 @@ static inline void update_health(struct td_file *file,
     if (file->health < health)
         file->health = health;
 }
-    
+
+/* files are only ever in these states (directories are in td_dentry.h) */
+#define NR_FILE_STATES (STATE_RETIRE + 1)
+#define NR_TRANSITIONS (TRANS_CLOSE + 1)
+
+/*
+ * a rule of the state machine: what a transition does to a file in a given
+ * state. new system calls map to one of the transitions (see file_syscall),
+ * a new kind of transition is a new column of the tables below.
+ */
+struct rule {
+    unsigned char next;  /*< enum td_file_state after the transition */
+    unsigned char compare;  /*< compare with the fingerprint of the check */
+    unsigned char refresh;  /*< buf becomes the fingerprint of the check */
+    unsigned char health[2];  /*< health on a mismatch [0] and match [1] */
+};
+
+/* the file is checked, its fingerprint is taken */
+#define RULE_UPDATE(state) { state, 0, 1, { HEALTH_OK, HEALTH_OK } }
+/* the file must be the one that was checked */
+#define RULE_ENFORCE(state) { state, 1, 0, { HEALTH_BAD, HEALTH_OK } }
+/* the first use of a file */
+#define RULE_FIRST(state, health) { state, 0, 1, { health, health } }
+
+static const struct rule rules[NR_FILE_STATES][NR_TRANSITIONS] = {
+    [STATE_UPDATE] = {
+        [TRANS_TEST] = RULE_UPDATE(STATE_UPDATE),
+        [TRANS_USE] = RULE_ENFORCE(STATE_ENFORCE),
+        [TRANS_CLOSE] = RULE_ENFORCE(STATE_RETIRE)
+    },
+    [STATE_ENFORCE] = {
+        [TRANS_TEST] = RULE_ENFORCE(STATE_ENFORCE),
+        [TRANS_USE] = RULE_ENFORCE(STATE_ENFORCE),
+        [TRANS_CLOSE] = RULE_ENFORCE(STATE_RETIRE)
+    },
+    [STATE_RETIRE] = {
+        [TRANS_TEST] = RULE_UPDATE(STATE_UPDATE),
+        [TRANS_USE] = RULE_ENFORCE(STATE_ENFORCE),
+        [TRANS_CLOSE] = RULE_UPDATE(STATE_RETIRE)
+    }
+};
+
+/* rules for a file that was not seen before */
+static const struct rule first_rules[NR_TRANSITIONS] = {
+    [TRANS_TEST] = RULE_FIRST(STATE_UPDATE, HEALTH_OK),
+    [TRANS_USE] = RULE_FIRST(STATE_ENFORCE, HEALTH_UNCHECKED),
+    [TRANS_CLOSE] = RULE_FIRST(STATE_RETIRE, HEALTH_UNCHECKED)
+};
+
+/*
+ * a test of an invalidated file is a new check in any state: it takes the
+ * fingerprint and clears the mark (see td_invalidate_prefix)
+ */
+static const struct rule recheck_rules[NR_FILE_STATES] = {
+    [STATE_UPDATE] = RULE_UPDATE(STATE_UPDATE),
+    [STATE_ENFORCE] = RULE_UPDATE(STATE_ENFORCE),
+    [STATE_RETIRE] = RULE_UPDATE(STATE_UPDATE)
+};
+
+static inline void apply_rule(struct td_files *files, struct td_file *lfile,
+                              const struct rule *rule, struct stat *buf,
+                              const char *path, unsigned long path_len) {
+    long same = !rule->compare || same_file(files, lfile, buf, path, path_len);
+    if (rule->refresh)
+        set_checked(files, lfile, buf, path, path_len);
+    update_health(lfile, (enum td_file_health)rule->health[same]);
+    lfile->state = (enum td_file_state)rule->next;
+}
+
 struct td_file *check_file(struct td_thread *proc, const char *file,
-                           const char *path, struct stat *buf,
-                           enum transition next_state) {
-    struct td_file loc, *lfile = NULL;
-    struct avl_node *node;
-    strncpy(loc.name, file, MAX_FILE_LEN);
-    /* TODO: do the actual file/path check (according to the paper by Dan Tsafrir */
-    node = avl_find(proc->files->tree, (void*)(&loc), compare_file);
-
-    /* we have not seen this file (status: new) */
-    if (node == NULL) {
-        if ((lfile = (struct td_file*)malloc(sizeof(struct td_file))) == NULL) {
-            puts("td_filestate.c: Unable to allocate memory\n");
-            abort();
+                           unsigned long file_len, uint64_t hash,
+                           const char *path, unsigned long path_len,
+                           struct stat *buf, enum transition next_state) {
+    struct td_files *files = proc->files;
+    struct td_file *lfile;
+    struct file_key key = { file, file_len };
+    struct file_create fc = { files, hash, 0, 0 };
+    struct td_metrics *metrics = files->ctx->config.metrics;
+    /*
+     * path check (according to the paper by Dan Tsafrir): absolute
+     * directories verify their node of the directory cache, files remember
+     * the directory they were checked in (see set_dir and same_dir).
+     */
+    if (verifies_dir(file, file_len, buf))
+        td_dentry_verify(&(files->ctx->dentries), file, file_len, buf);
+    /* a single probe finds the file or the slot for a new one */
+    if (metrics != NULL) {
+        unsigned long probes;
+        lfile = (struct td_file*)htab_find_or_insert(&(files->table), hash,
+                                                     &key, same_file_name,
+                                                     create_file, &fc, &probes);
+        td_metrics_probes(metrics, probes);
+    } else {
+        lfile = (struct td_file*)htab_find_or_insert(&(files->table), hash,
+                                                     &key, same_file_name,
+                                                     create_file, &fc, NULL);
+    }
+    if (fc.created && !fc.inherited) {
+        /* we have not seen this file (status: new) */
+        apply_rule(files, lfile, &(first_rules[next_state]), buf, path,
+                   path_len);
+    } else {
+        /* check existing file according to buf and state */
+        lfile->ref = 1;
+        if (lfile->stale && next_state == TRANS_TEST)
+            apply_rule(files, lfile, &(recheck_rules[lfile->state]), buf,
+                       path, path_len);
+        else
+            apply_rule(files, lfile, &(rules[lfile->state][next_state]), buf,
+                       path, path_len);
+    }
+    /* the CLOCK hand may pass the new file, it must be complete by now */
+    if (fc.created) {
+        index_file(files, lfile);
+        make_room(files, lfile);
+    }
+    return lfile;
+}
+
+static void index_name(void *tdfile, void *tdindex) {
+    struct td_file *file = (struct td_file*)tdfile;
+    td_index_insert((struct td_index*)tdindex, file->name->str,
+                    file->name->len, file);
+}
+
+/* returns the name index of a table, builds it on first use */
+static struct td_index *file_names(struct td_files *files) {
+    if (files->names == NULL) {
+        files->names = td_index_create();
+        htab_foreach(&(files->table), index_name, files->names);
+    }
+    return files->names;
+}
+
+/*
+ * returns the name index of a layer. a checkpoint layer loads all its files
+ * first, so no layer changes anymore once it has an index and the index can
+ * be walked without the lock of the layer.
+ */
+static struct td_index *layer_names(struct td_files *layer) {
+    const struct td_checkpoint_file *cfiles;
+    struct td_index *names;
+    unsigned long i;
+    files_lock(layer);
+    if (layer->names == NULL && layer->ckpt != NULL) {
+        cfiles = td_checkpoint_files(layer->ckpt, layer->group);
+        for (i = 0; i < layer->group->nr_files; i++)
+            load_file(layer, &(cfiles[i]));
+    }
+    names = file_names(layer);
+    files_unlock(layer);
+    return names;
+}
+
+static inline long has_prefix(const struct td_index_key *key,
+                              const char *prefix, unsigned long prefix_len) {
+    return key->len >= prefix_len && memcmp(key->name, prefix, prefix_len) == 0;
+}
+
+unsigned long td_invalidate_prefix(struct td_thread *proc, const char *prefix,
+                                   unsigned long prefix_len) {
+    struct td_files *files = proc->files, *layer;
+    struct td_index_cursor cur;
+    struct td_index_key key;
+    struct td_file *file;
+    unsigned long nr = 0;
+    files_lock(files);
+    /* copy on write: the marks of inherited files go to copies of them */
+    for (layer = files->base; layer != NULL; layer = layer->base) {
+        td_index_lower_bound(layer_names(layer), &cur, prefix, prefix_len);
+        while ((file = (struct td_file*)td_index_next(&cur, &key)) != NULL &&
+               has_prefix(&key, prefix, prefix_len)) {
+            struct file_key fkey = { key.name, key.len };
+            /* shadowed by a file of the group or of a layer above */
+            if (htab_find(&(files->table), file->name->hash, &fkey,
+                          same_file_name) == NULL)
+                copy_inherited(files, file, file->name->hash);
         }
-        strncpy(lfile->name, file, MAX_FILE_LEN);
-        lfile->name[MAX_FILE_LEN] = 0;
-        if (strlen(lfile->name) == MAX_FILE_LEN) {
-            printf("td_filestate.c: Input file name too long: '%s'\n", file);
+    }
+    td_index_lower_bound(file_names(files), &cur, prefix, prefix_len);
+    while ((file = (struct td_file*)td_index_next(&cur, &key)) != NULL &&
+           has_prefix(&key, prefix, prefix_len)) {
+        file->stale = 1;
+        nr++;
+    }
+    files_unlock(files);
+    return nr;
+}
+
+/* descriptors above are not tracked (far beyond any RLIMIT_NOFILE) */
+#define FD_MAX (1L << 20)
+
+/* returns the slot of a descriptor, grows the table if needed */
+static struct td_file **fd_slot(struct td_files *files, long fd) {
+    struct td_file **fds;
+    unsigned long nr;
+    if (fd < 0 || fd >= FD_MAX)
+        return NULL;
+    if ((unsigned long)fd >= files->nr_fds) {
+        nr = (files->nr_fds != 0) ? files->nr_fds : 64;
+        while (nr <= (unsigned long)fd)
+            nr *= 2;
+        if ((fds = (struct td_file**)realloc(files->fds,
+                                             nr * sizeof(struct td_file*))) == NULL) {
+            puts("td_filestate.c: Unable to allocate memory\n");
             abort();
         }
-        lfile->nropen = 0;
-        lfile->fderr = 0;
-        memcpy(&(lfile->stat), buf, sizeof(struct stat));
-        lfile->state = next_state;
-        switch (next_state) {
-            case TRANS_TEST:
-                lfile->health = HEALTH_OK;
-                break;
-            case TRANS_USE:
-            case TRANS_CLOSE:
-                lfile->health = HEALTH_UNCHECKED;
-                break;
-        }
-        proc->files->tree = avl_insert(proc->files->tree, lfile, compare_file);
-        return lfile;
-    } else {
-        // we have found the file in the process cache
-        lfile = (struct td_file*)(node->data);
-    }
-
-    /* check existing file according to buf and state */
-    switch (lfile->state) {
-        case STATE_UPDATE:
-            switch (next_state) {
-                case TRANS_TEST: /* update */
-                    memcpy(&(lfile->stat), buf, sizeof(struct stat));
-                    update_health(lfile, HEALTH_OK);
-                    lfile->state = STATE_UPDATE;
-                    break;
-                case TRANS_USE: /* enforce */
-                    if (!same_file_notime(&(lfile->stat), buf)) {
-                        update_health(lfile, HEALTH_BAD);
-                    } else {
-                        update_health(lfile, HEALTH_OK);
-                    }
-                    lfile->state = STATE_ENFORCE;
-                    break;
-                case TRANS_CLOSE: /* enforce */
-                    if (!same_file_notime(&(lfile->stat), buf)) {
-                        update_health(lfile, HEALTH_BAD);
-                    } else {
-                        update_health(lfile, HEALTH_OK);
-                    }
-                    lfile->state = STATE_RETIRE;
-                    break;
-            }
-            break;
-        case STATE_ENFORCE:
-            switch (next_state) {
-                case TRANS_TEST: /* update */
-                case TRANS_USE: /* enforce */
-                    if (!same_file_notime(&(lfile->stat), buf)) {
-                        update_health(lfile, HEALTH_BAD);
-                    } else {
-                        update_health(lfile, HEALTH_OK);
-                    }
-                    lfile->state = STATE_ENFORCE;
-                    break;
-                case TRANS_CLOSE: /* enforce */
-                    if (!same_file_notime(&(lfile->stat), buf)) {
-                        update_health(lfile, HEALTH_BAD);
-                    } else {
-                        update_health(lfile, HEALTH_OK);
-                    }
-                    lfile->state = STATE_RETIRE;
-                    break;
-            }
+        memset(fds + files->nr_fds, 0,
+               (nr - files->nr_fds) * sizeof(struct td_file*));
+        files->fds = fds;
+        files->nr_fds = nr;
+    }
+    return &(files->fds[fd]);
+}
+
+static inline struct td_file *fd_file(struct td_files *files, long fd) {
+    return (fd >= 0 && (unsigned long)fd < files->nr_fds) ? files->fds[fd] :
+        NULL;
+}
+
+/* returns the copy of a file in the table of the group (see inherit_files) */
+static struct td_file *own_file(struct td_files *files, struct td_file *file) {
+    struct file_key key = { file->name->str, file->name->len };
+    struct td_file *lfile;
+    if (files->base == NULL)
+        return file;
+    lfile = (struct td_file*)htab_find(&(files->table), file->name->hash, &key,
+                                       same_file_name);
+    return (lfile != NULL) ? lfile :
+        copy_inherited(files, file, file->name->hash);
+}
+
+/* drops a bound descriptor, the last one retires the file */
+static struct td_file *fd_close(struct td_files *files, long fd) {
+    struct td_file *file = own_file(files, files->fds[fd]);
+    files->fds[fd] = NULL;
+    if (file->nropen > 0)
+        file->nropen--;
+    if (file->nropen == 0 && file->state == STATE_ENFORCE)
+        file->state = STATE_RETIRE;
+    return file;
+}
+
+/* runs a descriptor event, the group lock is held */
+static struct td_file *fd_syscall(struct td_files *files, unsigned long syscall,
+                                  long fd, long newfd) {
+    struct td_file *file = fd_file(files, fd);
+    struct td_file **slot;
+    if (file == NULL)
+        return NULL;
+    switch (syscall) {
+        case SYS_CLOSE:
+            file = fd_close(files, fd);
+            file->ref = 1;
             break;
-        case STATE_RETIRE:
-            switch (next_state) {
-                case TRANS_TEST: /* update */
-                    memcpy(&(lfile->stat), buf, sizeof(struct stat));
-                    update_health(lfile, HEALTH_OK);
-                    lfile->state = STATE_UPDATE;
-                    break;
-                case TRANS_USE: /* enforce */
-                    if (!same_file_notime(&(lfile->stat), buf)) {
-                        update_health(lfile, HEALTH_BAD);
-                    } else {
-                        update_health(lfile, HEALTH_OK);
-                    }
-                    lfile->state = STATE_ENFORCE;
-                    break;
-                case TRANS_CLOSE: /* update */
-                    memcpy(&(lfile->stat), buf, sizeof(struct stat));
-                    update_health(lfile, HEALTH_OK);
-                    lfile->state = STATE_RETIRE;
-                    break;
+        case SYS_DUP:
+        case SYS_DUP2:
+        case SYS_DUP3:
+            /* dup2 and dup3 silently close newfd (this may evict files) */
+            if (newfd != fd && (slot = fd_slot(files, newfd)) != NULL &&
+                *slot != NULL)
+                fd_close(files, newfd);
+            if ((file = fd_file(files, fd)) == NULL)
+                return NULL;
+            file = own_file(files, file);
+            file->ref = 1;
+            files->fds[fd] = file;
+            if (newfd != fd && (slot = fd_slot(files, newfd)) != NULL) {
+                *slot = file;
+                file->nropen++;
             }
             break;
-        default:
-            puts("Unhandled state encountered.\n");
+    }
+    return file;
+}
+
+enum td_syscall_result td_bind_fd(struct td_context *ctx, unsigned long tid,
+                                  long fd, const char *file,
+                                  unsigned long file_len) {
+    struct td_event ev = { tid, SYS_OPEN, file, file_len, NULL, 0, NULL };
+    struct file_key key = { file, file_len };
+    uint64_t hash = htab_hash(file, file_len);
+    struct td_epoch_rec *rec = ctx_enter(ctx);
+    struct td_thread *proc = (struct td_thread*)td_radix_find(&(ctx->threads), tid);
+    struct td_file *lfile, **slot;
+    enum td_syscall_result result = SYSCALL_UNCHECKED;
+    if (proc == NULL) {
+        ctx_exit(rec);
+        if (ctx->config.trace != NULL)
+            td_trace_fd(ctx->config.trace, tid, SYS_OPEN, fd, -1, file,
+                        file_len, SYSCALL_PIDERR);
+        return report_unknown_pid(ctx, &ev);
+    }
+    files_lock(proc->files);
+    /* a bound descriptor was closed without notice (this may evict files) */
+    if ((slot = fd_slot(proc->files, fd)) != NULL && *slot != NULL)
+        fd_close(proc->files, fd);
+    lfile = (struct td_file*)htab_find(&(proc->files->table), hash, &key,
+                                       same_file_name);
+    if (lfile == NULL && (lfile = find_inherited(proc->files, hash, &key)) != NULL)
+        lfile = copy_inherited(proc->files, lfile, hash);
+    if (lfile != NULL && slot != NULL) {
+        lfile->ref = 1;
+        *slot = lfile;
+        result = SYSCALL_PASS;
+    }
+    if (ctx->config.trace != NULL)
+        td_trace_fd(ctx->config.trace, tid, SYS_OPEN, fd, -1, file, file_len,
+                    result);
+    files_unlock(proc->files);
+    ctx_exit(rec);
+    return result;
+}
+
+enum td_syscall_result td_handle_syscall_fd(struct td_context *ctx,
+                                            unsigned long tid,
+                                            unsigned long syscall, long fd,
+                                            long newfd) {
+    struct td_event ev = { tid, syscall, "", 0, NULL, 0, NULL };
+    struct td_metrics *metrics = ctx->config.metrics;
+    uint64_t start = (metrics != NULL) ? now_ns() : 0;
+    struct td_epoch_rec *rec = ctx_enter(ctx);
+    struct td_thread *proc = (struct td_thread*)td_radix_find(&(ctx->threads), tid);
+    enum td_syscall_result result;
+    if (proc == NULL) {
+        ctx_exit(rec);
+        if (ctx->config.trace != NULL)
+            td_trace_fd(ctx->config.trace, tid, syscall, fd, newfd, NULL, 0,
+                        SYSCALL_PIDERR);
+        result = report_unknown_pid(ctx, &ev);
+    } else {
+        enum td_file_health health = HEALTH_OK;
+        struct td_file *file;
+        files_lock(proc->files);
+        if ((file = fd_syscall(proc->files, syscall, fd, newfd)) != NULL) {
+            ev.file = file->name->str;
+            ev.file_len = file->name->len;
+            health = file->health;
+        }
+        if (ctx->config.trace != NULL)
+            td_trace_fd(ctx->config.trace, tid, syscall, fd, newfd, NULL, 0,
+                        health_result(health));
+        if (health != HEALTH_OK && ctx->config.reporter != NULL)
+            push_report(ctx, &ev, proc->pid, file, health_result(health));
+        /* the name goes away with the file (eviction) */
+        result = syscall_verdict(ctx, &ev, health);
+        files_unlock(proc->files);
+        ctx_exit(rec);
+    }
+    if (metrics != NULL)
+        td_metrics_syscall(metrics, syscall, result, now_ns() - start);
+    return result;
+}
+
+/* the pids of all groups of a context */
+struct group_pids {
+    unsigned long *pids;
+    unsigned long nr;
+    unsigned long max;
+};
+
+static void add_group_pid(void *tdthread, void *grouppids) {
+    struct group_pids *groups = (struct group_pids*)grouppids;
+    if (groups->nr == groups->max) {
+        groups->max = (groups->max != 0) ? 2 * groups->max : 64;
+        if ((groups->pids = (unsigned long*)realloc(groups->pids, groups->max *
+                                                    sizeof(unsigned long))) == NULL) {
+            puts("td_filestate.c: Unable to allocate memory\n");
             abort();
+        }
     }
-    return lfile;
+    groups->pids[groups->nr++] = ((struct td_thread*)tdthread)->pid;
+}
+
+static void checkpoint_file(void *tdfile, void *writer) {
+    td_checkpoint_file((struct td_checkpoint_writer*)writer,
+                       (struct td_file*)tdfile);
+}
+
+/* adds the files of a group to the image, the group lock is held */
+static void checkpoint_files(struct td_checkpoint_writer *w,
+                             struct td_files *files) {
+    const struct td_checkpoint_file *cfiles;
+    struct td_files *layer;
+    const char *name;
+    unsigned long i;
+    /* own files first, they shadow the files of the layers below */
+    htab_foreach(&(files->table), checkpoint_file, w);
+    for (layer = files->base; layer != NULL; layer = layer->base) {
+        if (layer->ckpt == NULL) {
+            htab_foreach(&(layer->table), checkpoint_file, w);
+            continue;
+        }
+        /* loaded files are never changed, the image has all of them */
+        cfiles = td_checkpoint_files(layer->ckpt, layer->group);
+        for (i = 0; i < layer->group->nr_files; i++)
+            if ((name = td_checkpoint_name(layer->ckpt, &(cfiles[i]))) != NULL)
+                td_checkpoint_copy(w, name, &(cfiles[i]));
+    }
+    for (i = 0; i < files->nr_fds; i++)
+        if (files->fds[i] != NULL)
+            td_checkpoint_fd(w, i, td_checkpoint_file(w, files->fds[i]));
+}
+
+int td_context_checkpoint(struct td_context *ctx, const char *path) {
+    struct td_checkpoint_writer *w = td_checkpoint_create(path);
+    struct group_pids groups = { NULL, 0, 0 };
+    struct td_thread *proc, *thread;
+    unsigned long i;
+    if (w == NULL)
+        return -1;
+    ctx_lock(ctx);
+    td_radix_foreach(&(ctx->groups), add_group_pid, &groups);
+    ctx_unlock(ctx);
+    for (i = 0; i < groups.nr; i++) {
+        /* writes the previous group, no lock is held */
+        td_checkpoint_group(w, groups.pids[i]);
+        /* keeps the threads of the group in place while they are copied */
+        ctx_lock(ctx);
+        proc = (struct td_thread*)td_radix_find(&(ctx->groups), groups.pids[i]);
+        if (proc != NULL) {
+            for (thread = proc; thread != NULL; thread = thread->next_thread)
+                td_checkpoint_thread(w, thread->pid, thread->tid, thread->ppid);
+            files_lock(proc->files);
+            checkpoint_files(w, proc->files);
+            files_unlock(proc->files);
+        }
+        ctx_unlock(ctx);
+    }
+    free(groups.pids);
+    return td_checkpoint_finish(w);
+}
+
+/* puts a checkpoint layer with the files of the image below a group */
+static void restore_files(struct td_files *files, struct td_checkpoint *ckpt,
+                          const struct td_checkpoint_group *group) {
+    const struct td_checkpoint_file *cfiles = td_checkpoint_files(ckpt, group);
+    const uint32_t *fds = td_checkpoint_fds(ckpt, group);
+    struct td_files *layer;
+    struct td_file **slot;
+    unsigned long fd;
+    if ((layer = (struct td_files*)malloc(sizeof(struct td_files))) == NULL) {
+        puts("td_filestate.c: Unable to allocate memory\n");
+        abort();
+    }
+    layer->ctx = files->ctx;
+    htab_init(&(layer->table));
+    td_arena_init(&(layer->arena));
+    pthread_mutex_init(&(layer->lock), NULL);
+    layer->base = NULL;
+    layer->owner = NULL;
+    layer->refs = 1;
+    layer->fds = NULL;
+    layer->nr_fds = 0;
+    layer->hand = 0;
+    layer->ckpt = ckpt;
+    layer->group = group;
+    layer->names = NULL;
+    td_checkpoint_get(ckpt);
+    files->base = layer;
+    /* bound descriptors point into the layer, like inherited ones */
+    files_lock(layer);
+    for (fd = 0; fd < group->nr_fds; fd++)
+        if (fds[fd] != 0 && fds[fd] <= group->nr_files &&
+            (slot = fd_slot(files, fd)) != NULL)
+            *slot = load_file(layer, &(cfiles[fds[fd] - 1]));
+    files_unlock(layer);
+}
+
+struct td_context *td_context_restore(const char *path,
+                                      const struct td_config *config) {
+    struct td_checkpoint *ckpt = td_checkpoint_map(path);
+    const struct td_checkpoint_header *header;
+    const struct td_checkpoint_thread *threads;
+    const struct td_checkpoint_group *groups;
+    struct td_context *ctx;
+    struct td_thread *proc;
+    unsigned long i;
+    if (ckpt == NULL)
+        return NULL;
+    header = td_checkpoint_header(ckpt);
+    threads = td_checkpoint_threads(ckpt);
+    groups = td_checkpoint_groups(ckpt);
+    ctx = td_context_create(config);
+    /* the image already has the inherited files of every group */
+    for (i = 0; i < header->nr_threads; i++)
+        create_thread(ctx, threads[i].pid, threads[i].tid, threads[i].ppid, 0);
+    for (i = 0; i < header->nr_groups; i++) {
+        proc = (struct td_thread*)td_radix_find(&(ctx->groups), groups[i].pid);
+        if (proc != NULL && proc->files->base == NULL)
+            restore_files(proc->files, ckpt, &(groups[i]));
+    }
+    td_checkpoint_put(ckpt);
+    return ctx;
+}
+
+unsigned long td_load_group(struct td_context *ctx, unsigned long pid,
+                            unsigned long ppid, const unsigned long *tids,
+                            unsigned long nr_tids,
+                            const struct td_open_file *ofiles,
+                            unsigned long nr_files) {
+    struct td_epoch_rec *rec;
+    struct td_thread *proc;
+    struct td_files *files;
+    struct td_file *lfile, **slot;
+    unsigned long i, nr = 0;
+    /* the group has its own descriptors, nothing is inherited */
+    for (i = 0; i < nr_tids; i++)
+        if (create_thread(ctx, pid, tids[i], ppid, 0) != NULL)
+            nr++;
+    rec = ctx_enter(ctx);
+    proc = (struct td_thread*)td_radix_find(&(ctx->groups), pid);
+    if (proc == NULL || nr_files == 0) {
+        ctx_exit(rec);
+        return nr;
+    }
+    files = proc->files;
+    files_lock(files);
+    htab_reserve(&(files->table), nr_files);
+    for (i = 0; i < nr_files; i++) {
+        struct file_key key = { ofiles[i].name, ofiles[i].name_len };
+        uint64_t hash = htab_hash(ofiles[i].name, ofiles[i].name_len);
+        lfile = (struct td_file*)htab_find(&(files->table), hash, &key,
+                                           same_file_name);
+        if (lfile == NULL) {
+            lfile = alloc_file(files);
+            lfile->fp = ofiles[i].fp;
+            lfile->name = td_intern(&(ctx->names), ofiles[i].name,
+                                    ofiles[i].name_len, hash);
+            lfile->dir = NULL;
+            lfile->nropen = 0;
+            lfile->state = STATE_ENFORCE;
+            lfile->health = HEALTH_OK;
+            lfile->ref = 1;
+            lfile->stale = 0;
+            insert_file(files, lfile, hash);
+        }
+        /* a descriptor counts as an open of its file once it is bound, the
+           close of an untracked descriptor never reaches the file */
+        if ((slot = fd_slot(files, ofiles[i].fd)) != NULL && *slot == NULL) {
+            *slot = lfile;
+            lfile->nropen++;
+        }
+    }
+    files_unlock(files);
+    ctx_exit(rec);
+    return nr;
 }
@@ -29,9 +29,12 @@
 extern "C" {
 #endif
 
+#include <pthread.h>
 #include <sys/stat.h>
 
-#define MAX_FILE_LEN 255
+#include "htab.h"
+#include "td_arena.h"
+#include "td_intern.h"
 
 enum td_file_state {
   STATE_UPDATE,  /*< file has already been checked (e.g., access'ed) */
@@ -47,19 +50,63 @@ enum td_file_health {
     HEALTH_BAD = 3 /*< race possible */
 };
 
-/* this struct represents a single file of a thread */
+/* the parts of struct stat that identify a file (see same_file_notime) */
+struct td_fingerprint {
+  dev_t dev;  /*< device */
+  ino_t ino;  /*< inode */
+  mode_t mode;  /*< type and permissions */
+  uid_t uid;  /*< owner */
+  gid_t gid;  /*< group */
+};
+
+struct td_dentry;
+
+/*
+ * this struct represents a single file of a thread. it only holds the data
+ * needed for the transition check and fits into a single cache line.
+ */
 struct td_file {
-  enum td_file_state state;  /*< state of the file (in the state machine) */
-  enum td_file_health health;  /*< state of the file */
-  long nropen; /*< how many times opened in app */
-  long fderr;  /*< if !=0 error code (e.g., for illegal files) */
-  char name[MAX_FILE_LEN+1];  /*< filename */
-  struct stat stat;  /*< stat of the file */
-  struct td_file *dir;  /*< descriptor of the dir */
+  struct td_fingerprint fp;  /*< fingerprint of the file */
+  const struct td_str *name;  /*< interned filename (incl. its hash) */
+  struct td_dentry *dir;  /*< version of the directory the file was checked
+                              in or NULL (see td_dentry.h) */
+  int nropen; /*< how many times opened in app (opens and dups, minus
+                  descriptors closed through handle_syscall_fd) */
+  enum td_file_state state : 8;  /*< state of the file (in the state machine) */
+  enum td_file_health health : 8;  /*< state of the file */
+  unsigned int ref : 1;  /*< used since the CLOCK hand passed (eviction) */
+  unsigned int stale : 1;  /*< a directory on the way was renamed or removed
+                               since the check (see td_invalidate_prefix) */
 };
 
+struct td_checkpoint;
+struct td_checkpoint_group;
+struct td_index;
+
+/*
+ * the files of a thread group. with td_config.inherit a forked group shares
+ * the files of its parent: fork freezes the table of the parent into a layer
+ * (a td_files that no group owns) that becomes the base of both groups.
+ * layers are never modified, a group copies a file into its own table before
+ * it changes its state. a group restored from a checkpoint has a checkpoint
+ * layer that loads its files from the image on first use (under its lock).
+ */
 struct td_files {
-    struct avl_node *tree;
+    struct td_context *ctx; /*< context that tracks the thread group */
+    struct htab table; /*< files of the thread group, keyed by name hash */
+    struct td_arena arena; /*< backs all threads and files of the group */
+    pthread_mutex_t lock; /*< protects table and arena (concurrent mode) */
+    struct td_files *base; /*< frozen files below this table (or NULL) */
+    struct td_files *owner; /*< layers: group whose arena holds the files */
+    unsigned long refs; /*< owning group, layers above, and owned layers */
+    struct td_file **fds; /*< open file of each descriptor (or NULL) */
+    unsigned long nr_fds; /*< size of fds */
+    uint64_t hand; /*< CLOCK hand (slot of table) for evictions */
+    struct td_checkpoint *ckpt; /*< checkpoint layers: image (or NULL) */
+    const struct td_checkpoint_group *group; /*< checkpoint layers: files of
+                                                 the group in the image */
+    struct td_index *names; /*< files of table ordered by name, built by the
+                                first td_invalidate_prefix (or NULL) */
 };
 
 struct td_thread {
@@ -77,24 +124,253 @@ enum td_syscall_result {
     SYSCALL_PASS /*< all is fine */
 };
 
+/* a single system call event (see handle_syscall_n for the fields) */
+struct td_event {
+    unsigned long tid;
+    unsigned long syscall;
+    const char *file;
+    unsigned long file_len;
+    const char *path;
+    unsigned long path_len;
+    struct stat *buf;
+};
+
 enum transition {
     TRANS_TEST, /*< file is checked */
     TRANS_USE, /*< file is used */
     TRANS_CLOSE /*< file is no longer used */
 };
 
+struct td_trace;
+struct td_reporter;
+struct td_metrics;
+
+/* configuration of a tracking context */
+struct td_config {
+    int quiet; /*< do not print reports to stdout */
+    int concurrent; /*< context is used by several threads at once */
+    struct td_trace *trace; /*< records all events (or NULL, see td_trace.h) */
+    struct td_reporter *reporter; /*< queue for reports instead of stdout
+                                      (or NULL, see td_report.h) */
+    struct td_metrics *metrics; /*< counters and latencies (or NULL, see
+                                    td_metrics.h) */
+    int inherit; /*< new thread groups inherit the files of their parent
+                     (ppid) copy-on-write */
+    unsigned long max_files; /*< budget of tracked files of all groups
+                                 (0: unlimited) */
+    unsigned long max_group_files; /*< budget of tracked files of each group
+                                       (0: unlimited) */
+};
+
+/*
+ * Budgets. A group that is about to track a new file while it or the context
+ * is at its budget evicts retired files (STATE_RETIRE) of its own table in
+ * approximate LRU order (CLOCK: every use of a file sets its reference bit,
+ * the hand clears it and evicts files that were not used for a full round).
+ * Files that are not retired, inherited files, and files that shadow an
+ * inherited file are never evicted, so the budgets are soft limits if a group
+ * holds no retired files. Each file costs a td_file in the arena of the
+ * group plus its share of the interned name.
+ *
+ * An evicted file is forgotten, which changes the verdicts for that file:
+ *  - a use (open/creat) without a new check is SYSCALL_UNCHECKED instead of
+ *    being compared with the fingerprint of the last check (PASS or RACE)
+ *  - a close by name is SYSCALL_UNCHECKED instead of SYSCALL_PASS
+ *  - a race or unchecked use that stuck to the file is not reported again
+ *  - descriptors that are still bound to the file are dropped, their close
+ *    passes
+ */
+
+/*
+ * Opaque handle to an independent instance of the tracking state (process
+ * indexes, name table, allocators, configuration). Contexts share no mutable
+ * state. By default a context must only be used by one thread at a time.
+ *
+ * In concurrent mode all td_* functions of a context may be called from any
+ * number of threads: thread lookups are lock-free, system calls of different
+ * thread groups only take their own group lock, and threads/groups are freed
+ * through epoch based reclamation once no concurrent call can use them.
+ * Pointers returned by td_find_process/td_process_create must not be used
+ * after the thread may have been destroyed.
+ */
+struct td_context;
+
+/**
+ * Creates a new, empty tracking context.
+ * @param config configuration of the context (or NULL for defaults)
+ * @return the new context
+ */
+struct td_context *td_context_create(const struct td_config *config);
+
+/**
+ * Destroys a context together with all processes and files it tracks.
+ * @param ctx the context
+ */
+void td_context_destroy(struct td_context *ctx);
+
+/**
+ * Context variant of process_create.
+ */
+struct td_thread* td_process_create(struct td_context *ctx, unsigned long pid,
+                                    unsigned long tid, unsigned long ppid);
+
+/**
+ * Context variant of process_destroy.
+ */
+long td_process_destroy(struct td_context *ctx, unsigned long tid);
+
+/**
+ * Context variant of find_process.
+ */
+struct td_thread* td_find_process(struct td_context *ctx, unsigned long tid);
+
+/**
+ * Context variant of handle_syscall.
+ */
+enum td_syscall_result td_handle_syscall(struct td_context *ctx,
+                                         unsigned long tid, unsigned long syscall,
+                                         const char *file, const char *path,
+                                         struct stat *buf);
+
+/**
+ * Context variant of handle_syscall_n.
+ */
+enum td_syscall_result td_handle_syscall_n(struct td_context *ctx,
+                                           unsigned long tid,
+                                           unsigned long syscall,
+                                           const char *file,
+                                           unsigned long file_len,
+                                           const char *path,
+                                           unsigned long path_len,
+                                           struct stat *buf);
+
+/**
+ * Context variant of handle_syscall_batch.
+ */
+void td_handle_syscall_batch(struct td_context *ctx, const struct td_event *ev,
+                             unsigned long nr, enum td_syscall_result *out);
+
+/**
+ * Context variant of bind_fd.
+ */
+enum td_syscall_result td_bind_fd(struct td_context *ctx, unsigned long tid,
+                                  long fd, const char *file,
+                                  unsigned long file_len);
+
+/**
+ * Context variant of handle_syscall_fd.
+ */
+enum td_syscall_result td_handle_syscall_fd(struct td_context *ctx,
+                                            unsigned long tid,
+                                            unsigned long syscall, long fd,
+                                            long newfd);
+
+/**
+ * Writes a checkpoint of all threads, thread groups and files of a context
+ * (see td_checkpoint.h). In concurrent mode other threads may keep using the
+ * context meanwhile, each group is locked while its files are copied, so the
+ * image is consistent per group. Files are saved with their fingerprint, state,
+ * health and open count, and the bound descriptors with them. The directory
+ * a file was checked in is not saved.
+ * @param ctx the context
+ * @param path name of the image, replaced once the new image is complete
+ * @return 0 or -1 if the image could not be written
+ */
+int td_context_checkpoint(struct td_context *ctx, const char *path);
+
+/**
+ * Creates a context from a checkpoint. The threads and groups are created
+ * right away, the files stay in the mapped image until a group uses them:
+ * each group looks its files up through the index of the image and loads a
+ * file when it is first touched, like an inherited file (see
+ * td_config.inherit). Restored files have no directory, the path check
+ * starts with their next check.
+ * @param path name of the image
+ * @param config configuration of the context (or NULL for defaults)
+ * @return the new context or NULL if path is not a valid image
+ */
+struct td_context *td_context_restore(const char *path,
+                                      const struct td_config *config);
+
+/* a file that a running thread group has open (see td_load_group) */
+struct td_open_file {
+    const char *name; /*< absolute name of the file */
+    unsigned long name_len; /*< length of name */
+    long fd; /*< the descriptor */
+    struct td_fingerprint fp; /*< fingerprint of the open file */
+};
+
+/**
+ * Adds a thread group that was already running before it was tracked,
+ * together with its threads and the files it has open (see td_bootstrap.h).
+ * The open files are in STATE_ENFORCE with the fingerprint of the open file
+ * and are bound to their descriptors. Descriptors that are not tracked
+ * (negative, too large or listed twice) do not count as opens of their file.
+ * The table of the group is sized for
+ * all of them before they are inserted. The group does not inherit the files
+ * of its parent and the files are not recorded in the trace.
+ * @param ctx the context
+ * @param pid the process id of the group
+ * @param ppid the process id of the parent
+ * @param tids the threads of the group
+ * @param nr_tids number of threads
+ * @param ofiles the open files, one per descriptor
+ * @param nr_files number of open files
+ * @return number of threads that were added (known threads are skipped)
+ */
+unsigned long td_load_group(struct td_context *ctx, unsigned long pid,
+                            unsigned long ppid, const unsigned long *tids,
+                            unsigned long nr_tids,
+                            const struct td_open_file *ofiles,
+                            unsigned long nr_files);
+
+/**
+ * Marks the files of a thread group whose name starts with a prefix (e.g.,
+ * "/dir/" once /dir was renamed or removed) for re-verification: a use of
+ * such a file without a new check is a race, a check (a test transition)
+ * clears the mark in any state, also while the file is open. Inherited files under the prefix are copied into the table of the group
+ * first. The files are found through an ordered index of the names that the
+ * first call builds for the group (and for each layer below it, loading a
+ * checkpoint layer completely) and that is kept up to date from then on, so
+ * later calls cost O(log n + k) for k matching files. The invalidation is
+ * not recorded in the trace.
+ * @param proc any thread of the thread group
+ * @param prefix the prefix (need not be NUL terminated)
+ * @param prefix_len length of prefix
+ * @return number of files that were marked
+ */
+unsigned long td_invalidate_prefix(struct td_thread *proc, const char *prefix,
+                                   unsigned long prefix_len);
+
+/**
+ * Looks up a file in the file table of a thread group.
+ * @param proc any thread of the thread group
+ * @param file name of the file
+ * @param file_len length of file
+ * @return the file or NULL
+ */
+struct td_file *find_file(struct td_thread *proc, const char *file,
+                          unsigned long file_len);
+
+/*
+ * The functions below operate on a default context that is created on first
+ * use.
+ */
+
 /**
  * This function creates all the necessary data structures for
  * a new process.
  * @param pid the process id of the new process
  * @param tid the thread id of the new process
  * @param ppid the process id of the parent
+ * @return the new thread or NULL if tid is already known or an id exceeds
+ *      PID_MAX_LIMIT
  **/
 struct td_thread* process_create(unsigned long pid, unsigned long tid, unsigned long ppid);
 
 /**
  * Destroys an existing process, deletes the process from the
- * global AVL tree and frees all resources.
+ * process index and frees all resources.
  * @param tid the tid that is deleted
  * @return 0 on successful deletion or an error code.
  **/
@@ -120,6 +396,80 @@ enum td_syscall_result handle_syscall(unsigned long tid, unsigned long syscall,
                                       const char *file, const char *path,
                                       struct stat *buf);
 
+/**
+ * Handle a system call with explicit name lengths. Same as handle_syscall but
+ * the strings do not need to be NUL terminated and are never copied on the
+ * fast path.
+ *
+ * System calls are dispatched through a table indexed by their number, those
+ * that are not tracked pass without any lookup. For the *at system calls
+ * (openat, openat2, newfstatat, faccessat, faccessat2, statx) path is the
+ * absolute path of dirfd (the working directory for AT_FDCWD): a relative
+ * file is resolved against it, an empty file (AT_EMPTY_PATH) is dirfd
+ * itself. The file is then checked in the directory of the resolved name,
+ * like the same file through a legacy call.
+ * @param tid Thread ID that executes the current system call.
+ * @param syscall Syscall number (as specified in syscall_nr.h)
+ * @param file Current file atom
+ * @param file_len Length of file
+ * @param path Path of the file
+ * @param path_len Length of path
+ * @param buf Result of the kernel-side stat system call
+ */
+enum td_syscall_result handle_syscall_n(unsigned long tid, unsigned long syscall,
+                                        const char *file, unsigned long file_len,
+                                        const char *path, unsigned long path_len,
+                                        struct stat *buf);
+
+/**
+ * Handle a burst of system calls. The burst is handled in chunks of 64
+ * events. Each thread of a chunk is looked up once (threads whose tids are
+ * equal modulo 16 may be looked up again) and all names are hashed up front.
+ * The events are then handled thread group by thread group: under the lock
+ * of the group the hash slots and the files they point to are prefetched
+ * before the first event is handled (without concurrency the slots are
+ * prefetched earlier, during the lookups). The events of each thread group
+ * are handled in their original order. The directory cache is shared by all
+ * thread groups, so the stat of an absolute directory (which may replace its
+ * version) starts a new chunk. The results are the same as for nr calls of
+ * handle_syscall_n. With a global budget (td_config.max_files), a trace or a
+ * reporter the order of all events matters (evictions, trace records and
+ * reports), so the events are handed to handle_syscall_n one by one.
+ * @param ev array of events
+ * @param nr number of events
+ * @param out array that receives the nr results
+ */
+void handle_syscall_batch(const struct td_event *ev, unsigned long nr,
+                          enum td_syscall_result *out);
+
+/**
+ * Binds the descriptor that an open or creat returned to the file it opened
+ * (call it after handle_syscall for the open). A descriptor that is still
+ * bound was closed without notice and is closed first.
+ * @param tid Thread ID that executed the open.
+ * @param fd the returned descriptor
+ * @param file the opened file (as passed to handle_syscall)
+ * @return SYSCALL_PASS, SYSCALL_UNCHECKED if the file was never opened, or
+ *      SYSCALL_PIDERR
+ */
+enum td_syscall_result bind_fd(unsigned long tid, long fd, const char *file);
+
+/**
+ * Handle a system call that only has descriptors (close, dup, dup2, dup3).
+ * The file is found through the descriptor table of the thread group in O(1)
+ * without any name handling. Every bound descriptor counts as one open of its
+ * file, the file is retired when its last descriptor is closed. Descriptors
+ * that were never bound are not tracked and pass.
+ * @param tid Thread ID that executes the current system call.
+ * @param syscall SYS_CLOSE, SYS_DUP, SYS_DUP2 or SYS_DUP3
+ * @param fd the (old) descriptor
+ * @param newfd the new descriptor of a dup (the return value of dup)
+ * @return the verdict of the file behind fd
+ */
+enum td_syscall_result handle_syscall_fd(unsigned long tid,
+                                         unsigned long syscall, long fd,
+                                         long newfd);
+
 #ifdef __cplusplus
 }
 #endif
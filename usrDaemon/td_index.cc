@@ -0,0 +1,118 @@
+/**
+ * @file td_index.cc
+ * C interface of the ordered index of names, see td_index.h.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_index.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <new>
+
+#include "td_tree.h"
+
+/*
+ * This file is compiled into the C library: it must not depend on the C++
+ * runtime (no exceptions, no operator new, no RTTI).
+ */
+
+/* bytewise order, a prefix sorts before the names it starts */
+struct compare_name {
+    long operator()(const td_index_key &left, const td_index_key &right) const {
+        unsigned long len = (left.len < right.len) ? left.len : right.len;
+        int val = memcmp(left.name, right.name, len);
+        if (val != 0)
+            return val;
+        return (left.len > right.len) - (left.len < right.len);
+    }
+};
+
+struct td_index {
+    td_tree<td_index_key, void*, compare_name> tree;
+};
+
+typedef td_tree<td_index_key, void*, compare_name>::cursor tree_cursor;
+
+static_assert(TD_INDEX_MAX_DEPTH == TD_TREE_MAX_DEPTH &&
+              sizeof(tree_cursor) <= sizeof(struct td_index_cursor) &&
+              std::is_trivially_copyable<tree_cursor>::value,
+              "td_index_cursor holds a td_tree cursor");
+
+struct td_index *td_index_create(void) {
+    void *mem = malloc(sizeof(struct td_index));
+    if (mem == NULL) {
+        puts("td_index.cc: Unable to allocate memory\n");
+        abort();
+    }
+    return new (mem) td_index();
+}
+
+void td_index_destroy(struct td_index *index, void (*dest)(void*)) {
+    if (dest != NULL)
+        index->tree.clear([dest](void *data) { dest(data); });
+    index->~td_index();
+    free(index);
+}
+
+unsigned long td_index_count(const struct td_index *index) {
+    return index->tree.size();
+}
+
+void *td_index_find(struct td_index *index, const char *name,
+                    unsigned long len) {
+    td_index_key key = { name, len };
+    void **data = index->tree.find(key);
+    return (data == NULL) ? NULL : *data;
+}
+
+void *td_index_insert(struct td_index *index, const char *name,
+                      unsigned long len, void *data) {
+    td_index_key key = { name, len };
+    return *(index->tree.insert(key, data));
+}
+
+void *td_index_delete(struct td_index *index, const char *name,
+                      unsigned long len) {
+    td_index_key key = { name, len };
+    void *data = NULL;
+    index->tree.erase(key, &data);
+    return data;
+}
+
+void td_index_lower_bound(struct td_index *index, struct td_index_cursor *cur,
+                          const char *name, unsigned long len) {
+    td_index_key key = { name, len };
+    new (cur) tree_cursor(index->tree.lower_bound(key));
+}
+
+void *td_index_next(struct td_index_cursor *cur, struct td_index_key *key) {
+    tree_cursor *pos = reinterpret_cast<tree_cursor*>(cur);
+    void *data;
+    if (!pos->valid())
+        return NULL;
+    if (key != NULL)
+        *key = pos->key();
+    data = pos->value();
+    pos->next();
+    return data;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file td_index.h
+ * C interface of an ordered index of names. The index is a td_tree that is
+ * specialized for name keys, so its comparisons are inlined memcmp calls.
+ * Names are ordered bytewise, a name sorts right after its prefixes.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_INDEX_H
+#define TD_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* key of an index, stored in the nodes (the name itself is not copied) */
+struct td_index_key {
+    const char *name;
+    unsigned long len;
+};
+
+struct td_index;
+
+/* AVL trees are at most ~1.44 log2(n) high, 64 levels cover any address space */
+#define TD_INDEX_MAX_DEPTH 64
+
+/*
+ * position in an index for an ordered walk (see td_index_lower_bound). a
+ * cursor is invalid once the index is modified.
+ */
+struct td_index_cursor {
+    void *opaque[TD_INDEX_MAX_DEPTH + 1];  /*< path to the current name */
+};
+
+/**
+ * Creates an empty index.
+ * @return the index, free it with td_index_destroy
+ */
+struct td_index *td_index_create(void);
+
+/**
+ * Destroys an index.
+ * @param index the index
+ * @param dest function that is executed for each data element (or NULL)
+ */
+void td_index_destroy(struct td_index *index, void (*dest)(void*));
+
+/**
+ * @param index the index
+ * @return number of names in the index
+ */
+unsigned long td_index_count(const struct td_index *index);
+
+/**
+ * Searches a name.
+ * @param index the index
+ * @param name the name (need not be NUL terminated)
+ * @param len length of name
+ * @return data of the name or NULL
+ */
+void *td_index_find(struct td_index *index, const char *name,
+                    unsigned long len);
+
+/**
+ * Adds a name unless it is already in the index. The name is referenced by
+ * the index until it is deleted, it must not change in the meantime.
+ * @param index the index
+ * @param name the name
+ * @param len length of name
+ * @param data data of the name (not NULL)
+ * @return data of the name, the existing data if it was in the index
+ */
+void *td_index_insert(struct td_index *index, const char *name,
+                      unsigned long len, void *data);
+
+/**
+ * Removes a name.
+ * @param index the index
+ * @param name the name
+ * @param len length of name
+ * @return data of the removed name or NULL
+ */
+void *td_index_delete(struct td_index *index, const char *name,
+                      unsigned long len);
+
+/**
+ * Seeks the first name that is not smaller than name, O(log n). All names
+ * that start with a prefix follow the cursor of the prefix in a row.
+ * @param index the index
+ * @param cur the cursor
+ * @param name the name
+ * @param len length of name
+ */
+void td_index_lower_bound(struct td_index *index, struct td_index_cursor *cur,
+                          const char *name, unsigned long len);
+
+/**
+ * Returns the name at a cursor and moves the cursor to the next larger name.
+ * The walk needs no recursion, O(1) amortized per name.
+ * @param cur the cursor
+ * @param key receives the name (or NULL)
+ * @return data of the name or NULL after the largest name
+ */
+void *td_index_next(struct td_index_cursor *cur, struct td_index_key *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_INDEX_H */
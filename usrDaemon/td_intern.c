@@ -0,0 +1,125 @@
+/**
+ * @file td_intern.c
+ * Implementation of the file name intern table.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_intern.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+struct intern_key {
+    const char *str;
+    unsigned long len;
+};
+
+static long same_str(const void *key, void *data) {
+    const struct intern_key *ikey = (const struct intern_key*)key;
+    return td_str_equal((struct td_str*)data, ikey->str, ikey->len);
+}
+
+static inline unsigned long stripe_of(uint64_t hash) {
+    return hash >> 60;
+}
+
+static inline void stripe_lock(struct td_intern *tab, unsigned long stripe) {
+    if (tab->concurrent)
+        pthread_mutex_lock(&(tab->stripe[stripe].lock));
+}
+
+static inline void stripe_unlock(struct td_intern *tab, unsigned long stripe) {
+    if (tab->concurrent)
+        pthread_mutex_unlock(&(tab->stripe[stripe].lock));
+}
+
+void td_intern_init(struct td_intern *tab, int concurrent) {
+    unsigned long i;
+    for (i = 0; i < TD_INTERN_STRIPES; i++) {
+        pthread_mutex_init(&(tab->stripe[i].lock), NULL);
+        htab_init(&(tab->stripe[i].table));
+    }
+    tab->concurrent = concurrent;
+}
+
+void td_intern_destroy(struct td_intern *tab) {
+    unsigned long i;
+    for (i = 0; i < TD_INTERN_STRIPES; i++) {
+        htab_destroy(&(tab->stripe[i].table), free);
+        pthread_mutex_destroy(&(tab->stripe[i].lock));
+    }
+}
+
+const struct td_str *td_intern(struct td_intern *tab, const char *str,
+                               unsigned long len, uint64_t hash) {
+    struct intern_key key = { str, len };
+    unsigned long stripe = stripe_of(hash);
+    struct td_str *istr;
+    stripe_lock(tab, stripe);
+    istr = (struct td_str*)htab_find(&(tab->stripe[stripe].table), hash, &key,
+                                     same_str);
+    if (istr != NULL) {
+        istr->refcnt++;
+        stripe_unlock(tab, stripe);
+        return istr;
+    }
+    if ((istr = (struct td_str*)malloc(sizeof(struct td_str) + len + 1)) == NULL) {
+        puts("td_intern.c: Unable to allocate memory\n");
+        abort();
+    }
+    istr->hash = hash;
+    istr->refcnt = 1;
+    istr->len = len;
+    memcpy(istr->str, str, len);
+    istr->str[len] = 0;
+    htab_insert(&(tab->stripe[stripe].table), hash, istr);
+    stripe_unlock(tab, stripe);
+    return istr;
+}
+
+void td_intern_get(struct td_intern *tab, const struct td_str *str) {
+    unsigned long stripe = stripe_of(str->hash);
+    stripe_lock(tab, stripe);
+    ((struct td_str*)str)->refcnt++;
+    stripe_unlock(tab, stripe);
+}
+
+void td_intern_put(struct td_intern *tab, const struct td_str *str) {
+    struct td_str *istr = (struct td_str*)str;
+    struct intern_key key = { istr->str, istr->len };
+    unsigned long stripe = stripe_of(istr->hash);
+    stripe_lock(tab, stripe);
+    if (--istr->refcnt != 0) {
+        stripe_unlock(tab, stripe);
+        return;
+    }
+    htab_delete(&(tab->stripe[stripe].table), istr->hash, &key, same_str);
+    stripe_unlock(tab, stripe);
+    free(istr);
+}
+
+unsigned long td_intern_count(struct td_intern *tab) {
+    unsigned long i, count = 0;
+    for (i = 0; i < TD_INTERN_STRIPES; i++)
+        count += tab->stripe[i].table.count;
+    return count;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file td_intern.h
+ * Table of interned, reference counted file names. All thread groups of a
+ * tracking context share a single copy of each name.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_INTERN_H
+#define TD_INTERN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "htab.h"
+
+/* an interned string, never modified after creation */
+struct td_str {
+    uint64_t hash;  /*< htab_hash() of the string */
+    uint32_t refcnt;  /*< number of references to this string */
+    uint32_t len;  /*< length of the string (without NUL, < PATH_MAX) */
+    char str[];  /*< NUL terminated string */
+};
+
+/* number of independently locked parts of an intern table */
+#define TD_INTERN_STRIPES 16
+
+/* a set of interned strings */
+struct td_intern {
+    struct {
+        pthread_mutex_t lock;  /*< protects table and refcounts */
+        struct htab table;  /*< strings, keyed by their hash */
+    } stripe[TD_INTERN_STRIPES];  /*< selected by the top bits of the hash */
+    int concurrent;  /*< take the stripe locks */
+};
+
+/**
+ * Initializes an empty intern table.
+ * @param tab the intern table
+ * @param concurrent !=0 if the table is used from several threads
+ */
+void td_intern_init(struct td_intern *tab, int concurrent);
+
+/**
+ * Destroys the intern table. All references must have been dropped.
+ * @param tab the intern table
+ */
+void td_intern_destroy(struct td_intern *tab);
+
+/**
+ * Returns the interned copy of a string and takes a reference to it.
+ * @param tab the intern table
+ * @param str string (need not be NUL terminated)
+ * @param len length of str
+ * @param hash htab_hash(str, len)
+ * @return interned string, release with td_intern_put
+ */
+const struct td_str *td_intern(struct td_intern *tab, const char *str,
+                               unsigned long len, uint64_t hash);
+
+/**
+ * Takes an additional reference to an interned string.
+ * @param tab the intern table the string belongs to
+ * @param str interned string
+ */
+void td_intern_get(struct td_intern *tab, const struct td_str *str);
+
+/**
+ * Drops a reference to an interned string, the string is freed when the last
+ * reference goes away.
+ * @param tab the intern table the string belongs to
+ * @param str interned string
+ */
+void td_intern_put(struct td_intern *tab, const struct td_str *str);
+
+/**
+ * @param tab the intern table
+ * @return number of distinct strings in the intern table
+ */
+unsigned long td_intern_count(struct td_intern *tab);
+
+/**
+ * Compares an interned string with a plain string.
+ * @return !=0 if both strings are equal
+ */
+static inline long td_str_equal(const struct td_str *istr, const char *str,
+                                unsigned long len) {
+    return istr->len == len && memcmp(istr->str, str, len) == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_INTERN_H */
@@ -0,0 +1,368 @@
+/**
+ * @file td_metrics.c
+ * Per-thread metric counters and the shared memory snapshot.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include "td_metrics.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* number of metrics domains a thread caches its counters for */
+#define THREAD_CACHE 4
+/* words of struct td_metrics_values */
+#define NR_VALUES (sizeof(struct td_metrics_values) / sizeof(uint64_t))
+
+/* owner of the counters of a thread */
+enum counters_owner {
+    COUNTERS_FREE = 0,  /*< may be claimed by any thread */
+    COUNTERS_CLAIMED = 1,  /*< used by one thread */
+    COUNTERS_ORPHAN = 2  /*< claimed, its domain is gone (the thread frees it) */
+};
+
+/*
+ * counters of a single thread. a thread that exits hands its counters back
+ * to the domain, the next thread that claims them adds to the same values.
+ */
+struct thread_metrics {
+    struct td_metrics_values values;
+    struct thread_metrics *next;
+    unsigned long owner;  /*< enum counters_owner */
+} __attribute__((aligned(64)));
+
+struct td_metrics {
+    unsigned long id;  /*< unique id of the domain */
+    struct thread_metrics *threads;  /*< counters of all threads */
+    pthread_mutex_t lock;  /*< serializes publishing */
+    struct td_metrics_snapshot *snap;  /*< shared snapshot or NULL */
+    char *name;
+    unsigned long interval_ms;
+    int stop;  /*< futex word, publisher must exit */
+    pthread_t publisher;
+    struct td_metrics_values sum;  /*< scratch space of the publisher */
+};
+
+/* domain ids are never reused, so cached counters can't be stale */
+static unsigned long next_metrics_id = 1;
+
+static __thread struct {
+    unsigned long id;
+    struct thread_metrics *counters;
+} thread_cache[THREAD_CACHE];
+static __thread unsigned long thread_cache_next;
+
+/* releases the cached counters when their thread exits */
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+/* hands counters back to their domain, or frees them if the domain is gone */
+static void counters_release(struct thread_metrics *tm) {
+    unsigned long owner = COUNTERS_CLAIMED;
+    if (!__atomic_compare_exchange_n(&(tm->owner), &owner, COUNTERS_FREE, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        free(tm);
+}
+
+static void metrics_thread_exit(void *arg) {
+    unsigned long i;
+    (void)arg;
+    for (i = 0; i < THREAD_CACHE; i++) {
+        if (thread_cache[i].counters != NULL)
+            counters_release(thread_cache[i].counters);
+        thread_cache[i].id = 0;
+        thread_cache[i].counters = NULL;
+    }
+}
+
+static void metrics_key_create(void) {
+    if (pthread_key_create(&thread_key, metrics_thread_exit) != 0) {
+        puts("td_metrics.c: Unable to create thread key\n");
+        abort();
+    }
+}
+
+/* takes free counters of the domain or adds new ones */
+static struct thread_metrics *counters_claim(struct td_metrics *metrics) {
+    struct thread_metrics *tm;
+    unsigned long owner;
+    for (tm = __atomic_load_n(&(metrics->threads), __ATOMIC_ACQUIRE); tm != NULL;
+         tm = tm->next) {
+        owner = COUNTERS_FREE;
+        if (__atomic_load_n(&(tm->owner), __ATOMIC_RELAXED) == COUNTERS_FREE &&
+            __atomic_compare_exchange_n(&(tm->owner), &owner, COUNTERS_CLAIMED,
+                                        0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return tm;
+    }
+    if (posix_memalign((void**)&tm, 64, sizeof(struct thread_metrics)) != 0) {
+        puts("td_metrics.c: Unable to allocate memory\n");
+        abort();
+    }
+    memset(tm, 0, sizeof(struct thread_metrics));
+    tm->owner = COUNTERS_CLAIMED;
+    tm->next = __atomic_load_n(&(metrics->threads), __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&(metrics->threads), &(tm->next), tm, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return tm;
+}
+
+static struct thread_metrics *thread_counters(struct td_metrics *metrics) {
+    struct thread_metrics *tm;
+    unsigned long i;
+    for (i = 0; i < THREAD_CACHE; i++)
+        if (thread_cache[i].id == metrics->id)
+            return thread_cache[i].counters;
+    tm = counters_claim(metrics);
+    i = thread_cache_next++ % THREAD_CACHE;
+    if (thread_cache[i].counters != NULL) {
+        counters_release(thread_cache[i].counters);
+    } else {
+        pthread_once(&thread_key_once, metrics_key_create);
+        pthread_setspecific(thread_key, thread_cache);
+    }
+    thread_cache[i].id = metrics->id;
+    thread_cache[i].counters = tm;
+    return tm;
+}
+
+/*
+ * only the owning thread writes a counter, a relaxed load and store compile
+ * to a plain add but let the publisher read the value at any time
+ */
+static inline void counter_add(uint64_t *counter, uint64_t val) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + val,
+                     __ATOMIC_RELAXED);
+}
+
+unsigned long td_metrics_bucket(uint64_t ns) {
+    unsigned long exp;
+    if (ns < (1UL << TD_METRICS_SUB_BITS))
+        return ns;
+    exp = 63 - __builtin_clzl(ns);
+    return ((exp - TD_METRICS_SUB_BITS + 1) << TD_METRICS_SUB_BITS) +
+        ((ns >> (exp - TD_METRICS_SUB_BITS)) & ((1UL << TD_METRICS_SUB_BITS) - 1));
+}
+
+uint64_t td_metrics_bucket_value(unsigned long bucket) {
+    unsigned long exp, sub;
+    if (bucket < (1UL << TD_METRICS_SUB_BITS))
+        return bucket;
+    exp = (bucket >> TD_METRICS_SUB_BITS) + TD_METRICS_SUB_BITS - 1;
+    sub = bucket & ((1UL << TD_METRICS_SUB_BITS) - 1);
+    return ((1UL << TD_METRICS_SUB_BITS) + sub) << (exp - TD_METRICS_SUB_BITS);
+}
+
+void td_metrics_syscall(struct td_metrics *metrics, unsigned long syscall,
+                        unsigned long result, uint64_t ns) {
+    struct thread_metrics *tm = thread_counters(metrics);
+    if (syscall >= TD_METRICS_SYSCALLS)
+        syscall = TD_METRICS_SYSCALLS - 1;
+    counter_add(&(tm->values.syscalls[syscall]), 1);
+    if (result < TD_METRICS_RESULTS)
+        counter_add(&(tm->values.results[result]), 1);
+    counter_add(&(tm->values.latency[td_metrics_bucket(ns)]), 1);
+}
+
+void td_metrics_probes(struct td_metrics *metrics, unsigned long probes) {
+    struct thread_metrics *tm = thread_counters(metrics);
+    if (probes >= TD_METRICS_PROBES)
+        probes = TD_METRICS_PROBES - 1;
+    counter_add(&(tm->values.probes[probes]), 1);
+}
+
+void td_metrics_evictions(struct td_metrics *metrics, unsigned long nr) {
+    counter_add(&(thread_counters(metrics)->values.evictions), nr);
+}
+
+void td_metrics_gauges(struct td_metrics *metrics, long threads, long groups,
+                       long files, long arena_bytes) {
+    struct thread_metrics *tm = thread_counters(metrics);
+    /* the sums over all threads are right, even if single threads wrap */
+    counter_add(&(tm->values.threads), threads);
+    counter_add(&(tm->values.groups), groups);
+    counter_add(&(tm->values.files), files);
+    counter_add(&(tm->values.arena_bytes), arena_bytes);
+}
+
+static void copy_words(uint64_t *dst, const uint64_t *src, unsigned long nr) {
+    unsigned long i;
+    for (i = 0; i < nr; i++)
+        __atomic_store_n(&(dst[i]), __atomic_load_n(&(src[i]), __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+}
+
+void td_metrics_publish(struct td_metrics *metrics,
+                        struct td_metrics_values *values) {
+    struct td_metrics_values *sum = &(metrics->sum);
+    struct thread_metrics *tm;
+    struct td_metrics_snapshot *snap = metrics->snap;
+    struct timespec ts;
+    unsigned long i;
+
+    pthread_mutex_lock(&(metrics->lock));
+    memset(sum, 0, sizeof(struct td_metrics_values));
+    for (tm = __atomic_load_n(&(metrics->threads), __ATOMIC_ACQUIRE); tm != NULL;
+         tm = tm->next) {
+        const uint64_t *src = (const uint64_t*)&(tm->values);
+        uint64_t *dst = (uint64_t*)sum;
+        for (i = 0; i < NR_VALUES; i++)
+            dst[i] += __atomic_load_n(&(src[i]), __ATOMIC_RELAXED);
+    }
+    if (values != NULL)
+        *values = *sum;
+    if (snap != NULL) {
+        /* seqlock write side, readers retry while seq is odd or changed */
+        uint64_t seq = snap->seq;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        __atomic_store_n(&(snap->seq), seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&(snap->time), ts.tv_sec * 1000000000UL + ts.tv_nsec,
+                         __ATOMIC_RELAXED);
+        copy_words((uint64_t*)&(snap->values), (const uint64_t*)sum, NR_VALUES);
+        __atomic_store_n(&(snap->seq), seq + 2, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&(metrics->lock));
+}
+
+static void *publisher(void *arg) {
+    struct td_metrics *metrics = (struct td_metrics*)arg;
+    struct timespec period;
+    period.tv_sec = metrics->interval_ms / 1000;
+    period.tv_nsec = (metrics->interval_ms % 1000) * 1000000L;
+    while (!__atomic_load_n(&(metrics->stop), __ATOMIC_ACQUIRE)) {
+        td_metrics_publish(metrics, NULL);
+        syscall(SYS_futex, &(metrics->stop), FUTEX_WAIT_PRIVATE, 0, &period,
+                NULL, 0);
+    }
+    return NULL;
+}
+
+struct td_metrics *td_metrics_create(const char *name,
+                                     unsigned long interval_ms) {
+    struct td_metrics *metrics;
+    if ((metrics = (struct td_metrics*)calloc(1, sizeof(struct td_metrics))) == NULL) {
+        puts("td_metrics.c: Unable to allocate memory\n");
+        abort();
+    }
+    metrics->id = __atomic_fetch_add(&next_metrics_id, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&(metrics->lock), NULL);
+    if (name != NULL) {
+        void *map = MAP_FAILED;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd != -1) {
+            if (ftruncate(fd, sizeof(struct td_metrics_snapshot)) == 0)
+                map = mmap(NULL, sizeof(struct td_metrics_snapshot),
+                           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+        }
+        if (map == MAP_FAILED) {
+            if (fd != -1)
+                shm_unlink(name);
+            pthread_mutex_destroy(&(metrics->lock));
+            free(metrics);
+            return NULL;
+        }
+        metrics->snap = (struct td_metrics_snapshot*)map;
+        metrics->name = strdup(name);
+        metrics->snap->version = TD_METRICS_VERSION;
+        metrics->snap->pid = getpid();
+        __atomic_store_n(&(metrics->snap->magic), TD_METRICS_MAGIC,
+                         __ATOMIC_RELEASE);
+    }
+    metrics->interval_ms = interval_ms;
+    if (interval_ms != 0 &&
+        pthread_create(&(metrics->publisher), NULL, publisher, metrics) != 0) {
+        puts("td_metrics.c: Unable to start publisher thread\n");
+        abort();
+    }
+    return metrics;
+}
+
+void td_metrics_destroy(struct td_metrics *metrics) {
+    struct thread_metrics *tm = metrics->threads;
+    if (metrics->interval_ms != 0) {
+        __atomic_store_n(&(metrics->stop), 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &(metrics->stop), FUTEX_WAKE_PRIVATE, 1, NULL, NULL,
+                0);
+        pthread_join(metrics->publisher, NULL);
+    }
+    if (metrics->snap != NULL) {
+        munmap(metrics->snap, sizeof(struct td_metrics_snapshot));
+        shm_unlink(metrics->name);
+        free(metrics->name);
+    }
+    while (tm != NULL) {
+        struct thread_metrics *next = tm->next;
+        unsigned long owner = COUNTERS_CLAIMED;
+        /* counters that a thread still caches are freed by that thread */
+        if (!__atomic_compare_exchange_n(&(tm->owner), &owner, COUNTERS_ORPHAN,
+                                         0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            free(tm);
+        tm = next;
+    }
+    pthread_mutex_destroy(&(metrics->lock));
+    free(metrics);
+}
+
+const struct td_metrics_snapshot *td_metrics_open(const char *name) {
+    void *map;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    map = mmap(NULL, sizeof(struct td_metrics_snapshot), PROT_READ, MAP_SHARED,
+               fd, 0);
+    close(fd);
+    return (map == MAP_FAILED) ? NULL : (const struct td_metrics_snapshot*)map;
+}
+
+void td_metrics_close(const struct td_metrics_snapshot *snap) {
+    munmap((void*)snap, sizeof(struct td_metrics_snapshot));
+}
+
+int td_metrics_read(const struct td_metrics_snapshot *snap,
+                    struct td_metrics_snapshot *out) {
+    uint64_t seq;
+    if (__atomic_load_n(&(snap->magic), __ATOMIC_ACQUIRE) != TD_METRICS_MAGIC ||
+        snap->version != TD_METRICS_VERSION)
+        return -1;
+    do {
+        while ((seq = __atomic_load_n(&(snap->seq), __ATOMIC_ACQUIRE)) & 1)
+            ;
+        out->time = __atomic_load_n(&(snap->time), __ATOMIC_RELAXED);
+        copy_words((uint64_t*)&(out->values), (const uint64_t*)&(snap->values),
+                   NR_VALUES);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&(snap->seq), __ATOMIC_RELAXED) != seq);
+    out->magic = snap->magic;
+    out->version = snap->version;
+    out->seq = seq;
+    out->pid = snap->pid;
+    return 0;
+}
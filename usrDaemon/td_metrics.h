@@ -0,0 +1,158 @@
+/**
+ * @file td_metrics.h
+ * Built-in metrics. Contexts that have a td_metrics in their configuration
+ * count system calls, verdicts, latencies, hash table probe lengths, and
+ * created/destroyed threads, thread groups, files and allocator bytes, and
+ * evicted files.
+ * Every thread updates its own counters (plain stores, no atomic
+ * read-modify-write). A thread that exits hands its counters to the next
+ * thread that records, so short-lived threads do not add up. A publisher
+ * thread periodically sums them up and writes a seqlock protected snapshot
+ * into shared memory that tdstat reads.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_METRICS_H
+#define TD_METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define TD_METRICS_MAGIC 0x7464737461740000UL
+/* bumped whenever the layout of struct td_metrics_snapshot changes */
+#define TD_METRICS_VERSION 2
+
+/* syscall numbers >= TD_METRICS_SYSCALLS share the last counter */
+#define TD_METRICS_SYSCALLS 512
+/* number of td_syscall_result values */
+#define TD_METRICS_RESULTS 4
+/*
+ * log-linear latency buckets (ns): values below 16 have their own bucket,
+ * every power of 2 above is split into 16 buckets (at most 6.25% error)
+ */
+#define TD_METRICS_SUB_BITS 4
+#define TD_METRICS_LATENCY ((64 - TD_METRICS_SUB_BITS + 1) << TD_METRICS_SUB_BITS)
+/* probe lengths of file lookups, the last bucket counts all longer ones */
+#define TD_METRICS_PROBES 32
+
+/* counters and gauges (the gauges are created - destroyed) */
+struct td_metrics_values {
+    uint64_t syscalls[TD_METRICS_SYSCALLS];
+    uint64_t results[TD_METRICS_RESULTS];
+    uint64_t latency[TD_METRICS_LATENCY];
+    uint64_t probes[TD_METRICS_PROBES];
+    uint64_t threads;  /*< live threads */
+    uint64_t groups;  /*< live thread groups */
+    uint64_t files;  /*< tracked files */
+    uint64_t arena_bytes;  /*< bytes in use in the group arenas */
+    uint64_t evictions;  /*< files evicted to stay within the budget */
+};
+
+/* layout of the shared memory object */
+struct td_metrics_snapshot {
+    uint64_t magic;  /*< TD_METRICS_MAGIC */
+    uint64_t version;  /*< TD_METRICS_VERSION */
+    uint64_t seq;  /*< seqlock, odd while the snapshot is updated */
+    uint64_t time;  /*< CLOCK_REALTIME of the last update in ns */
+    uint64_t pid;  /*< process that publishes the snapshot */
+    struct td_metrics_values values;
+};
+
+struct td_metrics;
+
+/**
+ * Creates a metrics domain.
+ * @param name name of the POSIX shared memory object for the snapshot (e.g.,
+ *      "/tracestate") or NULL for no snapshot
+ * @param interval_ms publish interval of the background thread (0 to only
+ *      publish on td_metrics_publish)
+ * @return the metrics or NULL if the shared memory object could not be created
+ */
+struct td_metrics *td_metrics_create(const char *name,
+                                     unsigned long interval_ms);
+
+/**
+ * Stops the publisher and unlinks the shared memory object. No context may
+ * still use the metrics.
+ * @param metrics the metrics
+ */
+void td_metrics_destroy(struct td_metrics *metrics);
+
+/**
+ * Sums up the counters of all threads and publishes them.
+ * @param metrics the metrics
+ * @param values receives the sums (or NULL)
+ */
+void td_metrics_publish(struct td_metrics *metrics,
+                        struct td_metrics_values *values);
+
+/*
+ * Recording. Each thread updates its own counters, so the functions below may
+ * be called from any number of threads.
+ */
+void td_metrics_syscall(struct td_metrics *metrics, unsigned long syscall,
+                        unsigned long result, uint64_t ns);
+
+void td_metrics_probes(struct td_metrics *metrics, unsigned long probes);
+
+void td_metrics_evictions(struct td_metrics *metrics, unsigned long nr);
+
+/**
+ * Adds deltas to the gauges (negative values for destroyed objects).
+ */
+void td_metrics_gauges(struct td_metrics *metrics, long threads, long groups,
+                       long files, long arena_bytes);
+
+/**
+ * @return the latency bucket of a value in ns
+ */
+unsigned long td_metrics_bucket(uint64_t ns);
+
+/**
+ * @return the smallest value of a latency bucket
+ */
+uint64_t td_metrics_bucket_value(unsigned long bucket);
+
+/**
+ * Maps a published snapshot read-only.
+ * @param name name passed to td_metrics_create
+ * @return the snapshot or NULL
+ */
+const struct td_metrics_snapshot *td_metrics_open(const char *name);
+
+void td_metrics_close(const struct td_metrics_snapshot *snap);
+
+/**
+ * Takes a consistent copy of a snapshot. Never blocks the publisher.
+ * @param snap the mapped snapshot
+ * @param out receives the copy
+ * @return 0 or -1 if the layout version is not supported
+ */
+int td_metrics_read(const struct td_metrics_snapshot *snap,
+                    struct td_metrics_snapshot *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_METRICS_H */
@@ -0,0 +1,74 @@
+/**
+ * @file td_radix.c
+ * Implementation of the id radix array.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_radix.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+void td_radix_init(struct td_radix *radix) {
+    memset(radix, 0, sizeof(struct td_radix));
+}
+
+void td_radix_destroy(struct td_radix *radix) {
+    unsigned long i;
+    for (i = 0; i < TD_RADIX_TOP_SIZE; i++)
+        free(radix->leaves[i]);
+    td_radix_init(radix);
+}
+
+long td_radix_set(struct td_radix *radix, unsigned long key, void *data) {
+    void **leaf, *old;
+    if (key >> TD_RADIX_BITS)
+        return -1;
+    leaf = radix->leaves[key >> TD_RADIX_LEAF_BITS];
+    if (leaf == NULL) {
+        if (data == NULL)
+            return 0;
+        if ((leaf = (void**)calloc(TD_RADIX_LEAF_SIZE, sizeof(void*))) == NULL) {
+            puts("td_radix.c: Unable to allocate memory\n");
+            abort();
+        }
+        __atomic_store_n(&(radix->leaves[key >> TD_RADIX_LEAF_BITS]), leaf,
+                         __ATOMIC_RELEASE);
+    }
+    old = leaf[key & (TD_RADIX_LEAF_SIZE - 1)];
+    radix->count += (old == NULL) - (data == NULL);
+    __atomic_store_n(&(leaf[key & (TD_RADIX_LEAF_SIZE - 1)]), data,
+                     __ATOMIC_RELEASE);
+    return 0;
+}
+
+void td_radix_foreach(struct td_radix *radix, void (*fn)(void *, void *),
+                      void *arg) {
+    unsigned long i, j;
+    for (i = 0; i < TD_RADIX_TOP_SIZE; i++) {
+        void **leaf = radix->leaves[i];
+        if (leaf == NULL)
+            continue;
+        for (j = 0; j < TD_RADIX_LEAF_SIZE; j++)
+            if (leaf[j] != NULL)
+                fn(leaf[j], arg);
+    }
+}
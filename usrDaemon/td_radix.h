@@ -0,0 +1,99 @@
+/**
+ * @file td_radix.h
+ * Two-level radix array that maps process/thread ids directly to objects.
+ * Lookups take two dependent loads, are lock-free, and may run concurrently
+ * to (serialized) updates.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_RADIX_H
+#define TD_RADIX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* ids are bounded by PID_MAX_LIMIT (4M on 64-bit Linux) */
+#define TD_RADIX_BITS 22
+#define TD_RADIX_LEAF_BITS 11
+#define TD_RADIX_LEAF_SIZE (1UL << TD_RADIX_LEAF_BITS)
+#define TD_RADIX_TOP_SIZE (1UL << (TD_RADIX_BITS - TD_RADIX_LEAF_BITS))
+
+struct td_radix {
+    /* leaves are allocated on first use and only freed on destroy */
+    void **leaves[TD_RADIX_TOP_SIZE];
+    unsigned long count;  /*< number of set keys */
+};
+
+/**
+ * Initializes an empty radix array.
+ * @param radix the radix array
+ */
+void td_radix_init(struct td_radix *radix);
+
+/**
+ * Frees all leaves (but not the objects).
+ * @param radix the radix array
+ */
+void td_radix_destroy(struct td_radix *radix);
+
+/**
+ * Sets or clears the object for a key. Updates must be serialized.
+ * @param radix the radix array
+ * @param key the id
+ * @param data the object (NULL clears the key)
+ * @return 0 on success, -1 if key is out of range
+ */
+long td_radix_set(struct td_radix *radix, unsigned long key, void *data);
+
+/**
+ * Executes fn for each object (in key order). fn may clear the current key.
+ * @param radix the radix array
+ * @param fn function that is executed for each object
+ * @param arg second argument for fn
+ */
+void td_radix_foreach(struct td_radix *radix, void (*fn)(void *, void *),
+                      void *arg);
+
+/**
+ * Looks up the object for a key.
+ * @param radix the radix array
+ * @param key the id
+ * @return the object or NULL
+ */
+static inline void *td_radix_find(struct td_radix *radix, unsigned long key) {
+    void **leaf;
+    if (key >> TD_RADIX_BITS)
+        return NULL;
+    leaf = __atomic_load_n(&(radix->leaves[key >> TD_RADIX_LEAF_BITS]),
+                           __ATOMIC_ACQUIRE);
+    if (leaf == NULL)
+        return NULL;
+    return __atomic_load_n(&(leaf[key & (TD_RADIX_LEAF_SIZE - 1)]),
+                           __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_RADIX_H */
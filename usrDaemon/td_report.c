@@ -0,0 +1,285 @@
+/**
+ * @file td_report.c
+ * Report queue (bounded multi-producer ring with per-slot sequence numbers)
+ * and its writer thread.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include "td_report.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "htab.h"
+
+_Static_assert(sizeof(struct td_report) == TD_REPORT_SIZE,
+               "reports must have a fixed size");
+
+/* the writer looks for new reports at least this often (ns) */
+#define WRITER_PERIOD 10000000L
+/* files that are remembered for deduplication */
+#define DEDUP_MAX 65536
+
+struct report_slot {
+    uint64_t seq;  /*< pos: free, pos + 1: holds the report of pos */
+    struct td_report report;
+};
+
+/* key of the deduplication table */
+struct report_key {
+    uint64_t name_hash;
+    uint32_t pid;
+    uint32_t verdict;
+};
+
+struct td_reporter {
+    uint64_t head __attribute__((aligned(64)));  /*< next slot to fill */
+    unsigned long dropped;
+    uint64_t tail __attribute__((aligned(64)));  /*< next slot to drain */
+    int wakeups;  /*< futex word of the writer */
+    int stop;
+    uint64_t mask;
+    struct report_slot *slots;
+    td_report_sink sink;
+    void *arg;
+    pthread_t writer;
+    /* writer state */
+    struct htab seen;  /*< reported files */
+    unsigned long rate;
+    double tokens;  /*< rate limit bucket */
+    uint64_t last;  /*< time of the last refill */
+    struct td_reporter_stats stats;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static long same_key(const void *key, void *data) {
+    return memcmp(key, data, sizeof(struct report_key)) == 0;
+}
+
+/* returns 1 if the file was reported before */
+static int duplicate(struct td_reporter *rep, const struct td_report *report) {
+    struct report_key key, *nkey;
+    uint64_t hash;
+    memset(&key, 0, sizeof(key));
+    key.name_hash = report->name_hash;
+    key.pid = report->pid ? report->pid : report->tid;
+    key.verdict = report->verdict;
+    hash = htab_hash((const char*)&key, sizeof(key));
+    if (htab_find(&(rep->seen), hash, &key, same_key) != NULL)
+        return 1;
+    if (rep->seen.count >= DEDUP_MAX) {
+        /* forget everything, a file may be reported once more */
+        htab_destroy(&(rep->seen), free);
+        htab_init(&(rep->seen));
+    }
+    if ((nkey = (struct report_key*)malloc(sizeof(struct report_key))) == NULL) {
+        puts("td_report.c: Unable to allocate memory\n");
+        abort();
+    }
+    *nkey = key;
+    htab_insert(&(rep->seen), hash, nkey);
+    return 0;
+}
+
+/* token bucket with a burst of one second worth of reports */
+static int ratelimited(struct td_reporter *rep) {
+    uint64_t now;
+    if (rep->rate == 0)
+        return 0;
+    now = now_ns();
+    rep->tokens += (now - rep->last) * 1e-9 * rep->rate;
+    if (rep->tokens > rep->rate)
+        rep->tokens = rep->rate;
+    rep->last = now;
+    if (rep->tokens < 1)
+        return 1;
+    rep->tokens -= 1;
+    return 0;
+}
+
+/* only the writer counts, td_reporter_stats may read at any time */
+static inline void count(unsigned long *counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static void handle(struct td_reporter *rep, const struct td_report *report) {
+    if (duplicate(rep, report))
+        count(&(rep->stats.duplicates));
+    else if (ratelimited(rep))
+        count(&(rep->stats.ratelimited));
+    else {
+        rep->sink(rep->arg, report);
+        count(&(rep->stats.reported));
+    }
+}
+
+/* handles all published reports, returns their number */
+static unsigned long drain(struct td_reporter *rep) {
+    uint64_t pos = rep->tail;
+    unsigned long nr = 0;
+    for (;;) {
+        struct report_slot *slot = &(rep->slots[pos & rep->mask]);
+        if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+        handle(rep, &(slot->report));
+        __atomic_store_n(&(slot->seq), pos + rep->mask + 1, __ATOMIC_RELEASE);
+        pos++;
+        nr++;
+    }
+    __atomic_store_n(&(rep->tail), pos, __ATOMIC_RELEASE);
+    return nr;
+}
+
+static void *writer(void *arg) {
+    struct td_reporter *rep = (struct td_reporter*)arg;
+    struct timespec period = { 0, WRITER_PERIOD };
+    for (;;) {
+        int wakeups = __atomic_load_n(&(rep->wakeups), __ATOMIC_ACQUIRE);
+        if (drain(rep) != 0)
+            continue;
+        if (__atomic_load_n(&(rep->stop), __ATOMIC_ACQUIRE))
+            break;
+        /* producers never wake us, so sleep for a bounded time */
+        syscall(SYS_futex, &(rep->wakeups), FUTEX_WAIT_PRIVATE, wakeups,
+                &period, NULL, 0);
+    }
+    return NULL;
+}
+
+static void wake_writer(struct td_reporter *rep) {
+    __atomic_add_fetch(&(rep->wakeups), 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &(rep->wakeups), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+struct td_reporter *td_reporter_create(unsigned long nr_slots,
+                                       unsigned long rate, td_report_sink sink,
+                                       void *arg) {
+    struct td_reporter *rep;
+    uint64_t nr = 2, i;
+    while (nr < nr_slots)
+        nr <<= 1;
+    if (posix_memalign((void**)&rep, 64, sizeof(struct td_reporter)) != 0 ||
+        (rep->slots = (struct report_slot*)malloc(nr * sizeof(struct report_slot))) == NULL) {
+        puts("td_report.c: Unable to allocate memory\n");
+        abort();
+    }
+    memset(rep, 0, offsetof(struct td_reporter, slots));
+    for (i = 0; i < nr; i++)
+        rep->slots[i].seq = i;
+    rep->mask = nr - 1;
+    rep->sink = (sink != NULL) ? sink : td_report_text;
+    rep->arg = arg;
+    htab_init(&(rep->seen));
+    rep->rate = rate;
+    rep->tokens = rate;
+    rep->last = now_ns();
+    memset(&(rep->stats), 0, sizeof(rep->stats));
+    if (pthread_create(&(rep->writer), NULL, writer, rep) != 0) {
+        puts("td_report.c: Unable to start writer thread\n");
+        abort();
+    }
+    return rep;
+}
+
+void td_reporter_destroy(struct td_reporter *rep) {
+    __atomic_store_n(&(rep->stop), 1, __ATOMIC_RELEASE);
+    wake_writer(rep);
+    pthread_join(rep->writer, NULL);
+    drain(rep);
+    htab_destroy(&(rep->seen), free);
+    free(rep->slots);
+    free(rep);
+}
+
+int td_report_push(struct td_reporter *rep, const struct td_report *report) {
+    uint64_t pos = __atomic_load_n(&(rep->head), __ATOMIC_RELAXED);
+    for (;;) {
+        struct report_slot *slot = &(rep->slots[pos & rep->mask]);
+        uint64_t seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&(rep->head), &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->report = *report;
+                __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if ((int64_t)(seq - pos) < 0) {
+            /* full: count the loss instead of waiting for the writer */
+            __atomic_add_fetch(&(rep->dropped), 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&(rep->head), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void td_reporter_flush(struct td_reporter *rep) {
+    uint64_t head = __atomic_load_n(&(rep->head), __ATOMIC_ACQUIRE);
+    while ((int64_t)(__atomic_load_n(&(rep->tail), __ATOMIC_ACQUIRE) - head) < 0) {
+        wake_writer(rep);
+        sched_yield();
+    }
+}
+
+void td_reporter_stats(struct td_reporter *rep, struct td_reporter_stats *stats) {
+    /* the writer counters are only exact after td_reporter_flush */
+    stats->reported = __atomic_load_n(&(rep->stats.reported), __ATOMIC_RELAXED);
+    stats->duplicates = __atomic_load_n(&(rep->stats.duplicates),
+                                        __ATOMIC_RELAXED);
+    stats->ratelimited = __atomic_load_n(&(rep->stats.ratelimited),
+                                         __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&(rep->dropped), __ATOMIC_RELAXED);
+}
+
+void td_report_text(void *file, const struct td_report *rep) {
+    FILE *out = (file != NULL) ? (FILE*)file : stdout;
+    int len = (rep->name_len < TD_REPORT_NAME) ? rep->name_len : TD_REPORT_NAME;
+    switch (rep->verdict) {
+        case SYSCALL_PIDERR:
+            fprintf(out, "Could not find pid %u (unable to handle system call "
+                    "%u)\n", rep->tid, rep->syscall);
+            break;
+        case SYSCALL_UNCHECKED:
+            fprintf(out, "Possible race condition: %.*s (tid %u, syscall %u)\n",
+                    len, rep->name, rep->tid, rep->syscall);
+            break;
+        case SYSCALL_RACE:
+            fprintf(out, "Race condition: %.*s (tid %u, syscall %u, inode "
+                    "%lu:%lu -> %lu:%lu)\n", len, rep->name, rep->tid,
+                    rep->syscall, (unsigned long)rep->checked.dev,
+                    (unsigned long)rep->checked.ino,
+                    (unsigned long)rep->seen.dev, (unsigned long)rep->seen.ino);
+            break;
+    }
+    fflush(out);
+}
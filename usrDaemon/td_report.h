@@ -0,0 +1,126 @@
+/**
+ * @file td_report.h
+ * Asynchronous race reports. System call handlers push fixed-size records
+ * into a lock-free queue and never block; a writer thread drains the queue,
+ * suppresses repeated reports of the same file, applies a rate limit and
+ * hands the remaining reports to a sink.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_REPORT_H
+#define TD_REPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "td_filestate.h"
+
+/* size of a report record */
+#define TD_REPORT_SIZE 256
+/* bytes of the file name that are kept in a record */
+#define TD_REPORT_NAME (TD_REPORT_SIZE - 98)
+
+/* a single report, names longer than TD_REPORT_NAME are truncated */
+struct td_report {
+    uint64_t time;  /*< CLOCK_MONOTONIC in ns */
+    uint64_t name_hash;  /*< hash of the full name (see htab_hash) */
+    uint32_t tid;
+    uint32_t pid;  /*< thread group or 0 for unknown threads */
+    uint32_t syscall;
+    uint32_t verdict;  /*< enum td_syscall_result */
+    struct td_fingerprint checked;  /*< fingerprint the file was checked with */
+    struct td_fingerprint seen;  /*< fingerprint of the reported system call */
+    uint16_t name_len;  /*< length of the full name */
+    char name[TD_REPORT_NAME];
+};
+
+/**
+ * Receives the reports that pass deduplication and rate limiting. Executed
+ * on the writer thread.
+ * @param arg argument passed to td_reporter_create
+ * @param rep the report
+ */
+typedef void (*td_report_sink)(void *arg, const struct td_report *rep);
+
+struct td_reporter_stats {
+    unsigned long reported;  /*< reports handed to the sink */
+    unsigned long duplicates;  /*< repeated reports of a file */
+    unsigned long ratelimited;  /*< reports above the rate limit */
+    unsigned long dropped;  /*< reports lost because the queue was full */
+};
+
+struct td_reporter;
+
+/**
+ * Creates a reporter and starts its writer thread.
+ * @param nr_slots queue size (rounded up to a power of 2)
+ * @param rate maximum number of reports per second (0 for no limit)
+ * @param sink receives the reports (or NULL for td_report_text)
+ * @param arg first argument of sink (the FILE for td_report_text, NULL for
+ *      stdout)
+ * @return the reporter
+ */
+struct td_reporter *td_reporter_create(unsigned long nr_slots,
+                                       unsigned long rate, td_report_sink sink,
+                                       void *arg);
+
+/**
+ * Handles all queued reports, stops the writer and frees the reporter.
+ * @param rep the reporter
+ */
+void td_reporter_destroy(struct td_reporter *rep);
+
+/**
+ * Queues a report. Lock-free, any number of threads may push at once.
+ * @param rep the reporter
+ * @param report the report (copied)
+ * @return 0 or -1 if the queue was full and the report was dropped
+ */
+int td_report_push(struct td_reporter *rep, const struct td_report *report);
+
+/**
+ * Waits until the writer handled all reports that were queued before.
+ * @param rep the reporter
+ */
+void td_reporter_flush(struct td_reporter *rep);
+
+/**
+ * Reads the counters of a reporter.
+ * @param rep the reporter
+ * @param stats receives the counters
+ */
+void td_reporter_stats(struct td_reporter *rep, struct td_reporter_stats *stats);
+
+/**
+ * Sink that prints one line per report.
+ * @param file the FILE to write to (or NULL for stdout)
+ * @param rep the report
+ */
+void td_report_text(void *file, const struct td_report *rep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_REPORT_H */
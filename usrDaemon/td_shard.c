@@ -0,0 +1,264 @@
+/**
+ * @file td_shard.c
+ * PID-sharded front end. The caller is the single producer of a set of SPSC
+ * rings, one per worker/context.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include "td_shard.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* events per ring (power of 2) */
+#define RING_SIZE 1024
+/* empty polls before a worker goes to sleep */
+#define SPIN_POLLS 1000
+
+enum shard_op {
+    OP_CREATE,
+    OP_DESTROY,
+    OP_SYSCALL
+};
+
+struct shard_event {
+    enum shard_op op;
+    unsigned long pid;
+    unsigned long tid;
+    unsigned long arg;  /*< ppid or syscall number */
+    const char *file;
+    unsigned long file_len;
+    const char *path;
+    unsigned long path_len;
+    struct stat *buf;
+    void *cookie;
+};
+
+struct shard {
+    /* producer side */
+    unsigned long head __attribute__((aligned(64)));
+    /* consumer side */
+    unsigned long tail __attribute__((aligned(64)));
+    int waiting;  /*< consumer sleeps (or is about to) */
+    int wakeups;  /*< futex word, bumped on each wakeup */
+    int stop;  /*< worker must exit once the ring is empty */
+    struct td_context *ctx;
+    struct td_shards *owner;
+    pthread_t thread;
+    struct shard_event ring[RING_SIZE];
+};
+
+struct td_shards {
+    unsigned long nr;
+    td_shard_verdict verdict;
+    void *arg;
+    struct shard *shards;
+};
+
+static void futex_wait(int *addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void shard_wake(struct shard *shard) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(shard->waiting), __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&(shard->waiting), 0, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&(shard->wakeups), 1, __ATOMIC_SEQ_CST);
+        futex_wake(&(shard->wakeups));
+    }
+}
+
+static void shard_process(struct shard *shard, struct shard_event *ev) {
+    enum td_syscall_result res;
+    switch (ev->op) {
+        case OP_CREATE:
+            td_process_create(shard->ctx, ev->pid, ev->tid, ev->arg);
+            break;
+        case OP_DESTROY:
+            td_process_destroy(shard->ctx, ev->tid);
+            break;
+        case OP_SYSCALL:
+            res = td_handle_syscall_n(shard->ctx, ev->tid, ev->arg, ev->file,
+                                      ev->file_len, ev->path, ev->path_len,
+                                      ev->buf);
+            if (shard->owner->verdict != NULL)
+                shard->owner->verdict(shard->owner->arg, ev->cookie, res);
+            break;
+    }
+}
+
+static void *shard_worker(void *arg) {
+    struct shard *shard = (struct shard*)arg;
+    unsigned long tail = shard->tail, polls = 0;
+    for (;;) {
+        unsigned long head = __atomic_load_n(&(shard->head), __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            while (tail != head) {
+                shard_process(shard, &(shard->ring[tail & (RING_SIZE - 1)]));
+                tail++;
+            }
+            __atomic_store_n(&(shard->tail), tail, __ATOMIC_RELEASE);
+            polls = 0;
+            continue;
+        }
+        if (__atomic_load_n(&(shard->stop), __ATOMIC_ACQUIRE))
+            break;
+        if (++polls < SPIN_POLLS) {
+            sched_yield();
+            continue;
+        }
+        /* announce that we sleep, then check the ring once more */
+        int wakeups = __atomic_load_n(&(shard->wakeups), __ATOMIC_SEQ_CST);
+        __atomic_store_n(&(shard->waiting), 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(shard->head), __ATOMIC_SEQ_CST) == tail &&
+            !__atomic_load_n(&(shard->stop), __ATOMIC_SEQ_CST))
+            futex_wait(&(shard->wakeups), wakeups);
+        __atomic_store_n(&(shard->waiting), 0, __ATOMIC_SEQ_CST);
+        polls = 0;
+    }
+    return NULL;
+}
+
+struct td_shards *td_shards_create(unsigned long nr,
+                                   const struct td_config *config,
+                                   td_shard_verdict verdict, void *arg) {
+    struct td_shards *shards;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long i;
+    if (nr == 0) nr = 1;
+    if (ncpu < 1) ncpu = 1;
+    if ((shards = (struct td_shards*)malloc(sizeof(struct td_shards))) == NULL ||
+        posix_memalign((void**)&(shards->shards), 64,
+                       nr * sizeof(struct shard)) != 0) {
+        puts("td_shard.c: Unable to allocate memory\n");
+        abort();
+    }
+    memset(shards->shards, 0, nr * sizeof(struct shard));
+    shards->nr = nr;
+    shards->verdict = verdict;
+    shards->arg = arg;
+    for (i = 0; i < nr; i++) {
+        struct shard *shard = &(shards->shards[i]);
+        cpu_set_t cpus;
+        shard->ctx = td_context_create(config);
+        shard->owner = shards;
+        if (pthread_create(&(shard->thread), NULL, shard_worker, shard) != 0) {
+            puts("td_shard.c: Unable to start worker thread\n");
+            abort();
+        }
+        CPU_ZERO(&cpus);
+        CPU_SET(i % ncpu, &cpus);
+        /* pinning is best effort (e.g., restricted cpusets) */
+        pthread_setaffinity_np(shard->thread, sizeof(cpu_set_t), &cpus);
+    }
+    return shards;
+}
+
+void td_shards_destroy(struct td_shards *shards) {
+    unsigned long i;
+    for (i = 0; i < shards->nr; i++) {
+        struct shard *shard = &(shards->shards[i]);
+        __atomic_store_n(&(shard->stop), 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&(shard->waiting), 1, __ATOMIC_SEQ_CST);
+        shard_wake(shard);
+        pthread_join(shard->thread, NULL);
+        td_context_destroy(shard->ctx);
+    }
+    free(shards->shards);
+    free(shards);
+}
+
+unsigned long td_shards_index(struct td_shards *shards, unsigned long pid) {
+    /* fibonacci hashing spreads consecutive pids over all shards */
+    return ((pid * 0x9e3779b97f4a7c15UL) >> 32) % shards->nr;
+}
+
+static struct shard_event *shard_reserve(struct shard *shard) {
+    unsigned long head = shard->head;
+    while (head - __atomic_load_n(&(shard->tail), __ATOMIC_ACQUIRE) >= RING_SIZE)
+        sched_yield();
+    return &(shard->ring[head & (RING_SIZE - 1)]);
+}
+
+static void shard_publish(struct shard *shard) {
+    __atomic_store_n(&(shard->head), shard->head + 1, __ATOMIC_RELEASE);
+    shard_wake(shard);
+}
+
+void td_shards_process_create(struct td_shards *shards, unsigned long pid,
+                              unsigned long tid, unsigned long ppid) {
+    struct shard *shard = &(shards->shards[td_shards_index(shards, pid)]);
+    struct shard_event *ev = shard_reserve(shard);
+    ev->op = OP_CREATE;
+    ev->pid = pid;
+    ev->tid = tid;
+    ev->arg = ppid;
+    shard_publish(shard);
+}
+
+void td_shards_process_destroy(struct td_shards *shards, unsigned long pid,
+                               unsigned long tid) {
+    struct shard *shard = &(shards->shards[td_shards_index(shards, pid)]);
+    struct shard_event *ev = shard_reserve(shard);
+    ev->op = OP_DESTROY;
+    ev->pid = pid;
+    ev->tid = tid;
+    shard_publish(shard);
+}
+
+void td_shards_syscall(struct td_shards *shards, unsigned long pid,
+                       unsigned long tid, unsigned long syscall,
+                       const char *file, unsigned long file_len,
+                       const char *path, unsigned long path_len,
+                       struct stat *buf, void *cookie) {
+    struct shard *shard = &(shards->shards[td_shards_index(shards, pid)]);
+    struct shard_event *ev = shard_reserve(shard);
+    ev->op = OP_SYSCALL;
+    ev->pid = pid;
+    ev->tid = tid;
+    ev->arg = syscall;
+    ev->file = file;
+    ev->file_len = file_len;
+    ev->path = path;
+    ev->path_len = path_len;
+    ev->buf = buf;
+    ev->cookie = cookie;
+    shard_publish(shard);
+}
+
+void td_shards_flush(struct td_shards *shards) {
+    unsigned long i;
+    for (i = 0; i < shards->nr; i++) {
+        struct shard *shard = &(shards->shards[i]);
+        while (__atomic_load_n(&(shard->tail), __ATOMIC_ACQUIRE) != shard->head)
+            sched_yield();
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * @file td_shard.h
+ * Front end that distributes events over several independent tracking
+ * contexts. Each context is owned by one worker thread and handles a disjoint
+ * slice of the PID space, so workers never share locks.
+ *
+ * The queues are single-producer: td_shards_process_create,
+ * td_shards_process_destroy, td_shards_syscall and td_shards_flush must all be
+ * called from the same thread (or be serialized by the caller). Several
+ * producers are served by td_channel.h instead.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_SHARD_H
+#define TD_SHARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "td_filestate.h"
+
+struct td_shards;
+
+/**
+ * Callback that receives the verdict of a system call. Executed on the worker
+ * thread that owns the thread group of the event.
+ * @param arg argument passed to td_shards_create
+ * @param cookie cookie passed to td_shards_syscall
+ * @param result verdict for the system call
+ */
+typedef void (*td_shard_verdict)(void *arg, void *cookie,
+                                 enum td_syscall_result result);
+
+/**
+ * Creates nr contexts and starts one worker thread per context. Worker i is
+ * pinned to CPU i (modulo the number of online CPUs).
+ * @param nr number of shards
+ * @param config configuration for all contexts (or NULL)
+ * @param verdict callback for system call verdicts (or NULL)
+ * @param arg first argument of the callback
+ * @return the front end
+ */
+struct td_shards *td_shards_create(unsigned long nr,
+                                   const struct td_config *config,
+                                   td_shard_verdict verdict, void *arg);
+
+/**
+ * Waits for all queued events, stops the workers and destroys all contexts.
+ * @param shards the front end
+ */
+void td_shards_destroy(struct td_shards *shards);
+
+/**
+ * @return the shard (0..nr-1) that owns the given thread group
+ */
+unsigned long td_shards_index(struct td_shards *shards, unsigned long pid);
+
+/**
+ * Queues a process_create event for the shard of pid.
+ */
+void td_shards_process_create(struct td_shards *shards, unsigned long pid,
+                              unsigned long tid, unsigned long ppid);
+
+/**
+ * Queues a process_destroy event for the shard of pid.
+ */
+void td_shards_process_destroy(struct td_shards *shards, unsigned long pid,
+                               unsigned long tid);
+
+/**
+ * Queues a system call for the shard of pid. The strings and the stat buffer
+ * must stay valid until the verdict callback for cookie was executed (or
+ * until td_shards_flush returns).
+ */
+void td_shards_syscall(struct td_shards *shards, unsigned long pid,
+                       unsigned long tid, unsigned long syscall,
+                       const char *file, unsigned long file_len,
+                       const char *path, unsigned long path_len,
+                       struct stat *buf, void *cookie);
+
+/**
+ * Waits until all queued events have been processed.
+ * @param shards the front end
+ */
+void td_shards_flush(struct td_shards *shards);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_SHARD_H */
@@ -0,0 +1,220 @@
+/**
+ * @file td_trace.c
+ * Recording and reading of binary event traces.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* stdio buffer of the writer */
+#define TRACE_BUFFER (1 << 20)
+
+struct td_trace {
+    FILE *out;
+    pthread_mutex_t lock;  /*< keeps records whole */
+    int error;  /*< a write failed */
+};
+
+static uint16_t record_size(size_t len) {
+    return (len + 7) & ~7UL;
+}
+
+static void trace_write(struct td_trace *trace, const void *rec, size_t len,
+                        const char *file, size_t file_len, const char *path,
+                        size_t path_len) {
+    static const char pad[8];
+    size_t size = record_size(len + file_len + path_len);
+    pthread_mutex_lock(&(trace->lock));
+    if (fwrite(rec, len, 1, trace->out) != 1 ||
+        (file_len && fwrite(file, file_len, 1, trace->out) != 1) ||
+        (path_len && fwrite(path, path_len, 1, trace->out) != 1) ||
+        (size != len + file_len + path_len &&
+         fwrite(pad, size - len - file_len - path_len, 1, trace->out) != 1))
+        trace->error = 1;
+    pthread_mutex_unlock(&(trace->lock));
+}
+
+struct td_trace *td_trace_open(const char *path) {
+    struct td_trace_header header;
+    struct td_trace *trace;
+    if ((trace = (struct td_trace*)malloc(sizeof(struct td_trace))) == NULL) {
+        puts("td_trace.c: Unable to allocate memory\n");
+        abort();
+    }
+    if ((trace->out = fopen(path, "wb")) == NULL) {
+        free(trace);
+        return NULL;
+    }
+    setvbuf(trace->out, NULL, _IOFBF, TRACE_BUFFER);
+    pthread_mutex_init(&(trace->lock), NULL);
+    trace->error = 0;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TD_TRACE_MAGIC, sizeof(header.magic));
+    trace_write(trace, &header, sizeof(header), NULL, 0, NULL, 0);
+    return trace;
+}
+
+int td_trace_close(struct td_trace *trace) {
+    int error = trace->error;
+    if (fclose(trace->out) != 0)
+        error = 1;
+    pthread_mutex_destroy(&(trace->lock));
+    free(trace);
+    return error ? -1 : 0;
+}
+
+void td_trace_create(struct td_trace *trace, unsigned long pid,
+                     unsigned long tid, unsigned long ppid) {
+    struct td_trace_create rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.type = TD_TRACE_CREATE;
+    rec.rec.size = record_size(sizeof(rec));
+    rec.rec.tid = tid;
+    rec.pid = pid;
+    rec.ppid = ppid;
+    trace_write(trace, &rec, sizeof(rec), NULL, 0, NULL, 0);
+}
+
+void td_trace_destroy(struct td_trace *trace, unsigned long tid) {
+    struct td_trace_rec rec;
+    rec.type = TD_TRACE_DESTROY;
+    rec.size = record_size(sizeof(rec));
+    rec.tid = tid;
+    trace_write(trace, &rec, sizeof(rec), NULL, 0, NULL, 0);
+}
+
+void td_trace_syscall(struct td_trace *trace, const struct td_event *ev,
+                      enum td_syscall_result result) {
+    struct td_trace_syscall rec;
+    /* the record size is 16 bits as well */
+    size_t max = 0xfff0 - sizeof(rec);
+    size_t file_len = (ev->file_len > max / 2) ? max / 2 : ev->file_len;
+    size_t path_len = (ev->path_len > max / 2) ? max / 2 : ev->path_len;
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.type = TD_TRACE_SYSCALL;
+    rec.rec.size = record_size(sizeof(rec) + file_len + path_len);
+    rec.rec.tid = ev->tid;
+    rec.syscall = ev->syscall;
+    rec.result = result;
+    rec.file_len = file_len;
+    rec.path_len = path_len;
+    if (ev->buf != NULL) {
+        rec.mode = ev->buf->st_mode;
+        rec.uid = ev->buf->st_uid;
+        rec.gid = ev->buf->st_gid;
+        rec.dev = ev->buf->st_dev;
+        rec.ino = ev->buf->st_ino;
+    }
+    trace_write(trace, &rec, sizeof(rec), ev->file, file_len, ev->path,
+                path_len);
+}
+
+void td_trace_fd(struct td_trace *trace, unsigned long tid,
+                 unsigned long syscall, long fd, long newfd, const char *file,
+                 unsigned long file_len, enum td_syscall_result result) {
+    struct td_trace_fd rec;
+    size_t max = 0xfff0 - sizeof(rec);
+    if (file_len > max)
+        file_len = max;
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.type = TD_TRACE_FD;
+    rec.rec.size = record_size(sizeof(rec) + file_len);
+    rec.rec.tid = tid;
+    rec.syscall = syscall;
+    rec.result = result;
+    rec.fd = fd;
+    rec.newfd = newfd;
+    rec.file_len = file_len;
+    trace_write(trace, &rec, sizeof(rec), file, file_len, NULL, 0);
+}
+
+int td_trace_map(struct td_trace_reader *reader, const char *path) {
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(struct td_trace_header)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if (memcmp(map, TD_TRACE_MAGIC, 8) != 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    reader->map = (const char*)map;
+    reader->size = st.st_size;
+    reader->pos = sizeof(struct td_trace_header);
+    return 0;
+}
+
+void td_trace_unmap(struct td_trace_reader *reader) {
+    munmap((void*)reader->map, reader->size);
+    reader->map = NULL;
+}
+
+const struct td_trace_rec *td_trace_next(struct td_trace_reader *reader) {
+    const struct td_trace_rec *rec;
+    size_t min;
+    if (reader->size - reader->pos < sizeof(struct td_trace_rec))
+        return NULL;
+    rec = (const struct td_trace_rec*)(reader->map + reader->pos);
+    switch (rec->type) {
+        case TD_TRACE_CREATE:
+            min = sizeof(struct td_trace_create);
+            break;
+        case TD_TRACE_DESTROY:
+            min = sizeof(struct td_trace_rec);
+            break;
+        case TD_TRACE_SYSCALL:
+            min = sizeof(struct td_trace_syscall);
+            if (rec->size >= min)
+                min += ((const struct td_trace_syscall*)rec)->file_len +
+                    ((const struct td_trace_syscall*)rec)->path_len;
+            break;
+        case TD_TRACE_FD:
+            min = sizeof(struct td_trace_fd);
+            if (rec->size >= min)
+                min += ((const struct td_trace_fd*)rec)->file_len;
+            break;
+        default:
+            return NULL;
+    }
+    if (rec->size < min || (rec->size & 7) != 0 ||
+        rec->size > reader->size - reader->pos)
+        return NULL;
+    reader->pos += rec->size;
+    return rec;
+}
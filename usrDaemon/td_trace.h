@@ -0,0 +1,175 @@
+/**
+ * @file td_trace.h
+ * Compact binary trace of all events of a tracking context (process creation
+ * and destruction, system calls and their verdicts). Traces are recorded by
+ * the library (see td_config) and can be replayed with the replay tool.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_TRACE_H
+#define TD_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "td_filestate.h"
+
+/*
+ * A trace is a header followed by a sequence of records. Every record starts
+ * with struct td_trace_rec and is padded to a multiple of 8 bytes. All values
+ * are in host byte order.
+ */
+#define TD_TRACE_MAGIC "TDTRACE1"
+
+enum td_trace_type {
+    TD_TRACE_CREATE = 1, /*< td_process_create (struct td_trace_create) */
+    TD_TRACE_DESTROY = 2, /*< td_process_destroy (struct td_trace_rec) */
+    TD_TRACE_SYSCALL = 3, /*< system call (struct td_trace_syscall) */
+    TD_TRACE_FD = 4 /*< td_bind_fd and td_handle_syscall_fd (struct
+                        td_trace_fd) */
+};
+
+struct td_trace_header {
+    char magic[8];  /*< TD_TRACE_MAGIC */
+    uint64_t flags;  /*< reserved */
+};
+
+struct td_trace_rec {
+    uint16_t type;  /*< enum td_trace_type */
+    uint16_t size;  /*< size of the record incl. names and padding */
+    uint32_t tid;
+};
+
+struct td_trace_create {
+    struct td_trace_rec rec;
+    uint32_t pid;
+    uint32_t ppid;
+};
+
+/* followed by file_len bytes of file and path_len bytes of path */
+struct td_trace_syscall {
+    struct td_trace_rec rec;
+    uint32_t syscall;
+    uint32_t result;  /*< enum td_syscall_result of the recorded run */
+    uint16_t file_len;
+    uint16_t path_len;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t dev;
+    uint64_t ino;
+};
+
+/* followed by file_len bytes of file (binds only) */
+struct td_trace_fd {
+    struct td_trace_rec rec;
+    uint32_t syscall;  /*< SYS_OPEN for td_bind_fd */
+    uint32_t result;  /*< enum td_syscall_result of the recorded run */
+    int32_t fd;
+    int32_t newfd;
+    uint16_t file_len;
+    uint16_t pad[3];
+};
+
+/* writer, all functions may be called from several threads */
+struct td_trace;
+
+/**
+ * Creates (or truncates) a trace file.
+ * @param path name of the file
+ * @return the trace or NULL if the file could not be created
+ */
+struct td_trace *td_trace_open(const char *path);
+
+/**
+ * Flushes and closes a trace.
+ * @param trace the trace
+ * @return 0 or -1 if not all records could be written
+ */
+int td_trace_close(struct td_trace *trace);
+
+void td_trace_create(struct td_trace *trace, unsigned long pid,
+                     unsigned long tid, unsigned long ppid);
+
+void td_trace_destroy(struct td_trace *trace, unsigned long tid);
+
+/**
+ * Appends a system call. Names longer than 64k are truncated.
+ * @param trace the trace
+ * @param ev the system call
+ * @param result the verdict for the system call
+ */
+void td_trace_syscall(struct td_trace *trace, const struct td_event *ev,
+                      enum td_syscall_result result);
+
+/**
+ * Appends a descriptor event. Names longer than 64k are truncated.
+ * @param trace the trace
+ * @param tid the thread
+ * @param syscall SYS_OPEN for a bind, the system call otherwise
+ * @param fd the descriptor
+ * @param newfd the new descriptor of a dup
+ * @param file name of the bound file (or NULL)
+ * @param file_len length of file
+ * @param result the verdict for the event
+ */
+void td_trace_fd(struct td_trace *trace, unsigned long tid,
+                 unsigned long syscall, long fd, long newfd, const char *file,
+                 unsigned long file_len, enum td_syscall_result result);
+
+/* reader that iterates over a mapped trace file */
+struct td_trace_reader {
+    const char *map;
+    size_t size;
+    size_t pos;
+};
+
+/**
+ * Maps a trace file.
+ * @param reader the reader
+ * @param path name of the file
+ * @return 0 or -1 if the file is not a trace
+ */
+int td_trace_map(struct td_trace_reader *reader, const char *path);
+
+/**
+ * Unmaps the trace file of a reader.
+ * @param reader the reader
+ */
+void td_trace_unmap(struct td_trace_reader *reader);
+
+/**
+ * Returns the next record of a trace. The names of a system call or
+ * descriptor record follow the record and are not NUL terminated.
+ * @param reader the reader
+ * @return the record or NULL at the end of the trace (or at the first
+ *      truncated or malformed record)
+ */
+const struct td_trace_rec *td_trace_next(struct td_trace_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TD_TRACE_H */
@@ -0,0 +1,330 @@
+/**
+ * @file td_tree.h
+ * Header-only ordered index (an AVL tree) that is specialized at compile
+ * time for its key, value and comparator. Unlike avl.h the keys are stored
+ * in the nodes and each instantiation inlines its comparator, so a lookup
+ * does not call through a function pointer and does not dereference a data
+ * pointer per level. C code uses it through a shim, see td_index.h.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef TD_TREE_H
+#define TD_TREE_H
+
+#ifndef __cplusplus
+#error "td_tree.h is C++ only, C code uses td_index.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <type_traits>
+
+/* AVL trees are at most ~1.44 log2(n) high, 64 levels cover any address space */
+#define TD_TREE_MAX_DEPTH 64
+
+/**
+ * Three-way comparator of integer keys (e.g., thread ids).
+ */
+template <typename K>
+struct td_tree_less {
+    long operator()(const K &left, const K &right) const {
+        return (left > right) - (left < right);
+    }
+};
+
+/**
+ * Ordered index of unique keys. Keys and values are copied into the nodes,
+ * so both must be trivially copyable (e.g., integers and pointers). The
+ * tree does not throw: it aborts if it runs out of memory, like the rest of
+ * the daemon.
+ * @param K key type
+ * @param V value type
+ * @param Compare functor with long operator()(const K&, const K&) that
+ *      returns a strict ordering (<0, 0, >0) of its arguments
+ */
+template <typename K, typename V, typename Compare = td_tree_less<K> >
+class td_tree {
+    static_assert(std::is_trivially_copyable<K>::value,
+                  "td_tree keys are copied into the nodes");
+    static_assert(std::is_trivially_copyable<V>::value,
+                  "td_tree values are copied into the nodes");
+
+    struct node {
+        node *left;
+        node *right;
+        K key;
+        V value;
+        long height;  /*< height of the subtree (leaf == 1) */
+    };
+
+public:
+    /**
+     * Position in the tree for an in-order walk. The cursor keeps the path
+     * to its node on an explicit stack, so a walk needs no recursion and no
+     * parent pointers. A cursor is invalid once the tree is modified.
+     */
+    class cursor {
+    public:
+        cursor() : depth(0) {}
+
+        /** false once the cursor has passed the largest key */
+        bool valid() const { return depth > 0; }
+
+        const K &key() const { return stack[depth - 1]->key; }
+        V &value() const { return stack[depth - 1]->value; }
+
+        /** moves to the next larger key */
+        void next() {
+            node *cur = stack[--depth]->right;
+            push_left(cur);
+        }
+
+    private:
+        friend class td_tree;
+
+        /* the stack holds the nodes whose left subtree is being walked */
+        void push_left(node *cur) {
+            for (; cur != NULL; cur = cur->left)
+                stack[depth++] = cur;
+        }
+
+        node *stack[TD_TREE_MAX_DEPTH];
+        int depth;
+    };
+
+    td_tree() : root(NULL), count(0), cmp() {}
+    ~td_tree() { clear(); }
+
+    td_tree(const td_tree&) = delete;
+    td_tree &operator=(const td_tree&) = delete;
+
+    /** number of keys in the tree */
+    unsigned long size() const { return count; }
+
+    /**
+     * Searches a key.
+     * @return the value of the key or NULL
+     */
+    V *find(const K &key) {
+        node *cur = root;
+        while (cur != NULL) {
+            long val = cmp(key, cur->key);
+            if (val == 0)
+                return &(cur->value);
+            cur = (val < 0) ? cur->left : cur->right;
+        }
+        return NULL;
+    }
+
+    /** @return a cursor at the smallest key */
+    cursor begin() const {
+        cursor pos;
+        pos.push_left(root);
+        return pos;
+    }
+
+    /**
+     * Seeks the first key that is not smaller than key, O(log n).
+     * @return a cursor at that key, or an invalid one if there is none
+     */
+    cursor lower_bound(const K &key) const {
+        cursor pos;
+        node *cur = root;
+        while (cur != NULL) {
+            if (cmp(key, cur->key) <= 0) {
+                pos.stack[pos.depth++] = cur;
+                cur = cur->left;
+            } else {
+                cur = cur->right;
+            }
+        }
+        return pos;
+    }
+
+    /**
+     * Inserts a key unless it is already in the tree.
+     * @param inserted set to whether the key was new (or NULL)
+     * @return the value of the key, the existing one if it was in the tree
+     */
+    V *insert(const K &key, const V &value, bool *inserted = NULL) {
+        node **path[TD_TREE_MAX_DEPTH];
+        node **link = &root, *cur;
+        int depth = 0;
+        while (*link != NULL) {
+            long val = cmp(key, (*link)->key);
+            if (val == 0) {
+                if (inserted != NULL)
+                    *inserted = false;
+                return &((*link)->value);
+            }
+            path[depth++] = link;
+            link = (val < 0) ? &((*link)->left) : &((*link)->right);
+        }
+        if ((cur = (node*)malloc(sizeof(node))) == NULL) {
+            puts("td_tree.h: Unable to allocate memory\n");
+            abort();
+        }
+        cur->left = NULL;
+        cur->right = NULL;
+        cur->key = key;
+        cur->value = value;
+        cur->height = 1;
+        *link = cur;
+        count++;
+        retrace(path, depth);
+        if (inserted != NULL)
+            *inserted = true;
+        return &(cur->value);
+    }
+
+    /**
+     * Removes a key.
+     * @param value receives the value of the removed key (or NULL)
+     * @return whether the key was in the tree
+     */
+    bool erase(const K &key, V *value = NULL) {
+        node **path[TD_TREE_MAX_DEPTH];
+        node **link = &root, *cur;
+        int depth = 0;
+        while (*link != NULL) {
+            long val = cmp(key, (*link)->key);
+            if (val == 0)
+                break;
+            path[depth++] = link;
+            link = (val < 0) ? &((*link)->left) : &((*link)->right);
+        }
+        if ((cur = *link) == NULL)
+            return false;
+        if (value != NULL)
+            *value = cur->value;
+        if (cur->left != NULL && cur->right != NULL) {
+            /* two children: pull up the in-order successor and unlink it */
+            node **succ = &(cur->right);
+            path[depth++] = link;
+            while ((*succ)->left != NULL) {
+                path[depth++] = succ;
+                succ = &((*succ)->left);
+            }
+            cur->key = (*succ)->key;
+            cur->value = (*succ)->value;
+            link = succ;
+            cur = *succ;
+        }
+        *link = (cur->left != NULL) ? cur->left : cur->right;
+        free(cur);
+        count--;
+        retrace(path, depth);
+        return true;
+    }
+
+    /**
+     * Removes all keys without recursion.
+     * @param dest called with each value before its node is freed
+     */
+    template <typename F>
+    void clear(F dest) {
+        node *cur = root, *left;
+        /* rotate left children up so the tree unrolls into a list */
+        while (cur != NULL) {
+            if ((left = cur->left) != NULL) {
+                cur->left = left->right;
+                left->right = cur;
+                cur = left;
+                continue;
+            }
+            left = cur->right;
+            dest(cur->value);
+            free(cur);
+            cur = left;
+        }
+        root = NULL;
+        count = 0;
+    }
+
+    void clear() { clear([](V&) {}); }
+
+private:
+    static long height(const node *cur) {
+        return (cur == NULL) ? 0 : cur->height;
+    }
+
+    static long hdiff(const node *cur) {
+        return height(cur->left) - height(cur->right);
+    }
+
+    static void fix_height(node *cur) {
+        long lheight = height(cur->left);
+        long rheight = height(cur->right);
+        cur->height = 1 + ((lheight > rheight) ? lheight : rheight);
+    }
+
+    static node *rotate_left(node *parent) {
+        node *cur = parent->right;
+        parent->right = cur->left;
+        cur->left = parent;
+        fix_height(parent);
+        fix_height(cur);
+        return cur;
+    }
+
+    static node *rotate_right(node *parent) {
+        node *cur = parent->left;
+        parent->left = cur->right;
+        cur->right = parent;
+        fix_height(parent);
+        fix_height(cur);
+        return cur;
+    }
+
+    static node *balance(node *cur) {
+        long height_diff = hdiff(cur);
+        if (height_diff > 1) {
+            if (hdiff(cur->left) < 0)
+                cur->left = rotate_left(cur->left);
+            return rotate_right(cur);
+        }
+        if (height_diff < -1) {
+            if (hdiff(cur->right) > 0)
+                cur->right = rotate_right(cur->right);
+            return rotate_left(cur);
+        }
+        fix_height(cur);
+        return cur;
+    }
+
+    /* rebalances the recorded path, stops at the first unchanged height */
+    static void retrace(node **path[], int depth) {
+        while (depth-- > 0) {
+            node *cur = *path[depth];
+            long old = cur->height;
+            cur = balance(cur);
+            *path[depth] = cur;
+            if (cur->height == old)
+                break;
+        }
+    }
+
+    node *root;
+    unsigned long count;
+    Compare cmp;
+};
+
+#endif  /* TD_TREE_H */
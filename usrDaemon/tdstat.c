@@ -0,0 +1,160 @@
+/**
+ * @file tdstat.c
+ * Prints the metrics that a context publishes (see td_metrics.h): system
+ * call and verdict counts, latency percentiles, file lookup probe lengths,
+ * the live threads, groups, files and arena bytes, and evicted files.
+ *
+ * Usage: tdstat [-i interval_ms] name
+ *   -i  print the rates every interval_ms instead of a single snapshot
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "td_filestate.h"
+#include "td_metrics.h"
+
+static const char *result_names[TD_METRICS_RESULTS] = {
+    [SYSCALL_PIDERR] = "PIDERR",
+    [SYSCALL_RACE] = "RACE",
+    [SYSCALL_UNCHECKED] = "UNCHECKED",
+    [SYSCALL_PASS] = "PASS"
+};
+
+/* smallest latency that at least fraction of the system calls stay below */
+static uint64_t percentile(const uint64_t *latency, uint64_t total,
+                           double fraction) {
+    uint64_t seen = 0;
+    unsigned long i;
+    for (i = 0; i < TD_METRICS_LATENCY; i++) {
+        seen += latency[i];
+        if (seen > 0 && seen >= fraction * total)
+            return td_metrics_bucket_value(i);
+    }
+    return 0;
+}
+
+/* prints the difference of two snapshots (prev may be zeroed) */
+static void print_values(const struct td_metrics_values *cur,
+                         const struct td_metrics_values *prev, double secs) {
+    uint64_t latency[TD_METRICS_LATENCY];
+    uint64_t total = 0, probes = 0, lookups = 0;
+    unsigned long i, max = 0;
+
+    for (i = 0; i < TD_METRICS_SYSCALLS; i++) {
+        uint64_t nr = cur->syscalls[i] - prev->syscalls[i];
+        if (nr == 0)
+            continue;
+        total += nr;
+        if (secs > 0)
+            printf("syscall %3lu%s %12lu %10.0f/s\n", i,
+                   (i == TD_METRICS_SYSCALLS - 1) ? "+" : " ",
+                   (unsigned long)nr, nr / secs);
+        else
+            printf("syscall %3lu%s %12lu\n", i,
+                   (i == TD_METRICS_SYSCALLS - 1) ? "+" : " ",
+                   (unsigned long)nr);
+    }
+    for (i = 0; i < TD_METRICS_RESULTS; i++)
+        printf("%-9s    %12lu\n", result_names[i],
+               (unsigned long)(cur->results[i] - prev->results[i]));
+
+    for (i = 0; i < TD_METRICS_LATENCY; i++) {
+        latency[i] = cur->latency[i] - prev->latency[i];
+        if (latency[i] != 0)
+            max = i;
+    }
+    if (total != 0)
+        printf("latency ns   p50 %lu p90 %lu p99 %lu max %lu\n",
+               (unsigned long)percentile(latency, total, 0.5),
+               (unsigned long)percentile(latency, total, 0.9),
+               (unsigned long)percentile(latency, total, 0.99),
+               (unsigned long)td_metrics_bucket_value(max));
+
+    for (i = 0; i < TD_METRICS_PROBES; i++) {
+        uint64_t nr = cur->probes[i] - prev->probes[i];
+        lookups += nr;
+        probes += nr * i;
+    }
+    if (lookups != 0) {
+        printf("probes       avg %.2f", (double)probes / lookups);
+        for (i = 0; i < TD_METRICS_PROBES; i++)
+            if (cur->probes[i] != prev->probes[i])
+                printf(" %lu%s:%lu", i, (i == TD_METRICS_PROBES - 1) ? "+" : "",
+                       (unsigned long)(cur->probes[i] - prev->probes[i]));
+        printf("\n");
+    }
+
+    printf("threads %lu groups %lu files %lu arena %lu bytes\n",
+           (unsigned long)cur->threads, (unsigned long)cur->groups,
+           (unsigned long)cur->files, (unsigned long)cur->arena_bytes);
+    printf("evictions %lu\n",
+           (unsigned long)(cur->evictions - prev->evictions));
+}
+
+int main(int argc, char *argv[]) {
+    static struct td_metrics_snapshot cur, prev;
+    const struct td_metrics_snapshot *snap;
+    unsigned long interval = 0;
+    int arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-i") == 0) {
+        interval = strtoul(argv[2], NULL, 10);
+        arg += 2;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "usage: %s [-i interval_ms] name\n", argv[0]);
+        return 2;
+    }
+    if ((snap = td_metrics_open(argv[arg])) == NULL) {
+        fprintf(stderr, "%s: no metrics published\n", argv[arg]);
+        return 2;
+    }
+    if (td_metrics_read(snap, &cur) != 0) {
+        fprintf(stderr, "%s: unsupported metrics version\n", argv[arg]);
+        td_metrics_close(snap);
+        return 2;
+    }
+
+    if (interval == 0) {
+        memset(&prev, 0, sizeof(prev));
+        printf("pid %lu\n", (unsigned long)cur.pid);
+        print_values(&(cur.values), &(prev.values), 0);
+    } else {
+        struct timespec period;
+        period.tv_sec = interval / 1000;
+        period.tv_nsec = (interval % 1000) * 1000000L;
+        for (;;) {
+            prev = cur;
+            nanosleep(&period, NULL);
+            td_metrics_read(snap, &cur);
+            printf("pid %lu\n", (unsigned long)cur.pid);
+            print_values(&(cur.values), &(prev.values),
+                         (cur.time - prev.time) / 1e9);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    td_metrics_close(snap);
+    return 0;
+}
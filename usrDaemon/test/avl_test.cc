@@ -82,3 +82,41 @@ TEST(AVLTest, InsertSearchDelete) {
     EXPECT_TRUE(avl_find(root, (void*)2, compare) == NULL);
     EXPECT_TRUE(root == NULL);
 }
+
+/* verifies cached heights and the AVL invariant, returns the subtree height */
+static long check_balanced(struct avl_node *node, long *count) {
+    if (node == NULL) return 0;
+    long lheight = check_balanced(node->left, count);
+    long rheight = check_balanced(node->right, count);
+    EXPECT_LE(lheight - rheight, 1);
+    EXPECT_GE(lheight - rheight, -1);
+    EXPECT_EQ(node->height, 1 + ((lheight > rheight) ? lheight : rheight));
+    (*count)++;
+    return node->height;
+}
+
+TEST(AVLTest, BalancedMillion) {
+    /* sequential inserts are the worst case for an unbalanced tree */
+    struct avl_node *root = NULL;
+    long i, count = 0;
+    const long nr = 1000000;
+    for (i = 0; i < nr; i++)
+        root = avl_insert(root, (void*)i, compare);
+    EXPECT_EQ(check_balanced(root, &count), root->height);
+    EXPECT_EQ(count, nr);
+    /* 1.44 * log2(1M) ~ 28.7 */
+    EXPECT_LE(root->height, 29);
+
+    /* delete every other element (mix of leaf and inner node deletes) */
+    for (i = 0; i < nr; i += 2)
+        root = avl_delete(root, (void*)i, compare);
+    count = 0;
+    check_balanced(root, &count);
+    EXPECT_EQ(count, nr / 2);
+    for (i = 0; i < nr; i++)
+        EXPECT_EQ(avl_find(root, (void*)i, compare) == NULL, (i % 2) == 0);
+
+    for (i = 1; i < nr; i += 2)
+        root = avl_delete(root, (void*)i, compare);
+    EXPECT_TRUE(root == NULL);
+}
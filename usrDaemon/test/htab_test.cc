@@ -0,0 +1,209 @@
+/**
+ * @file htab_test.cc
+ * A set of unit tests that check the implementation of the hash table.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "htab.h"
+#include "gtest/gtest.h"
+
+static long same(const void *key, void *data) {
+    return (long)key == (long)data;
+}
+
+static uint64_t hash_of(long i) {
+    return htab_hash(&i, sizeof(i));
+}
+
+static long destroyed;
+static void count_dest(void *data) {
+    (void)data;
+    destroyed++;
+}
+
+TEST(HTabTest, InsertSearchDelete) {
+    struct htab tab;
+    long i;
+    htab_init(&tab);
+    EXPECT_TRUE(htab_find(&tab, hash_of(2), (void*)2, same) == NULL);
+    /* data pointers 0 and 1 are reserved, start at 2 */
+    for (i = 2; i < 100000; i++) {
+        htab_insert(&tab, hash_of(i), (void*)i);
+        /* elements stay visible while the table is being migrated */
+        EXPECT_EQ((long)htab_find(&tab, hash_of(i / 2 + 1), (void*)(i / 2 + 1), same),
+                  (i / 2 + 1 >= 2) ? i / 2 + 1 : 0);
+    }
+    EXPECT_EQ(tab.count, 99998UL);
+    for (i = 2; i < 100000; i += 2)
+        EXPECT_EQ((long)htab_delete(&tab, hash_of(i), (void*)i, same), i);
+    for (i = 2; i < 100000; i++)
+        EXPECT_EQ(htab_find(&tab, hash_of(i), (void*)i, same) == NULL, i % 2 == 0);
+    EXPECT_TRUE(htab_delete(&tab, hash_of(2), (void*)2, same) == NULL);
+    EXPECT_TRUE(htab_find(&tab, hash_of(100000), (void*)100000, same) == NULL);
+
+    destroyed = 0;
+    htab_destroy(&tab, count_dest);
+    EXPECT_EQ(destroyed, 49999);
+    EXPECT_EQ(tab.count, 0UL);
+}
+
+TEST(HTabTest, Collisions) {
+    /* all elements share one hash, lookups fall back to the eq function */
+    struct htab tab;
+    long i;
+    htab_init(&tab);
+    for (i = 2; i < 1000; i++)
+        htab_insert(&tab, 42, (void*)i);
+    for (i = 2; i < 1000; i++)
+        EXPECT_EQ((long)htab_find(&tab, 42, (void*)i, same), i);
+    for (i = 2; i < 1000; i++)
+        EXPECT_EQ((long)htab_delete(&tab, 42, (void*)i, same), i);
+    EXPECT_TRUE(htab_find(&tab, 42, (void*)5, same) == NULL);
+    htab_destroy(&tab, NULL);
+}
+
+TEST(HTabTest, Churn) {
+    /* insert/delete churn must not fill the table with tombstones */
+    struct htab tab;
+    long i;
+    htab_init(&tab);
+    for (i = 2; i < 1000000; i++) {
+        htab_insert(&tab, hash_of(i), (void*)i);
+        if (i >= 10) {
+            EXPECT_EQ((long)htab_delete(&tab, hash_of(i - 8), (void*)(i - 8), same), i - 8);
+        }
+    }
+    EXPECT_EQ(tab.count, 8UL);
+    EXPECT_LE(tab.mask + 1, 64UL);
+    htab_destroy(&tab, NULL);
+}
+
+TEST(HTabTest, Next) {
+    /* a full round of the hand visits every element once */
+    struct htab tab;
+    uint64_t pos = 0;
+    long i, sum = 0;
+    htab_init(&tab);
+    EXPECT_TRUE(htab_next(&tab, &pos) == NULL);
+    for (i = 2; i < 1002; i++)
+        htab_insert(&tab, hash_of(i), (void*)i);
+    for (i = 0; i < 1000; i++)
+        sum += (long)htab_next(&tab, &pos);
+    EXPECT_EQ(sum, 1001L * 1002 / 2 - 1);
+    /* the hand wraps around and skips deleted elements */
+    for (i = 2; i < 1001; i++)
+        htab_delete(&tab, hash_of(i), (void*)i, same);
+    EXPECT_EQ((long)htab_next(&tab, &pos), 1001L);
+    EXPECT_EQ((long)htab_next(&tab, &pos), 1001L);
+    htab_destroy(&tab, NULL);
+
+    /* during a resize the hand walks both arrays and migrates nothing */
+    htab_init(&tab);
+    for (i = 2; tab.old == NULL; i++)
+        htab_insert(&tab, hash_of(i), (void*)i);
+    uint64_t old_pos = tab.old_pos, count = tab.count;
+    sum = 0;
+    pos = 0;
+    for (uint64_t n = 0; n < count; n++)
+        sum += (long)htab_next(&tab, &pos);
+    EXPECT_EQ(sum, i * (i - 1) / 2 - 1);
+    EXPECT_TRUE(tab.old != NULL);
+    EXPECT_EQ(tab.old_pos, old_pos);
+    htab_destroy(&tab, NULL);
+}
+
+TEST(HTabTest, Reserve) {
+    struct htab tab;
+    struct htab_slot *slots;
+    long i;
+    htab_init(&tab);
+    for (i = 2; i < 100; i++)
+        htab_insert(&tab, hash_of(i), (void*)i);
+    /* a reserved table takes the bulk insert without a resize */
+    htab_reserve(&tab, 10000);
+    EXPECT_TRUE(tab.old == NULL);
+    slots = tab.slots;
+    for (i = 100; i < 10100; i++)
+        htab_insert(&tab, hash_of(i), (void*)i);
+    EXPECT_TRUE(tab.slots == slots);
+    EXPECT_TRUE(tab.old == NULL);
+    for (i = 2; i < 10100; i++)
+        EXPECT_EQ((long)htab_find(&tab, hash_of(i), (void*)i, same), i);
+    /* a table that is large enough stays as it is */
+    htab_reserve(&tab, 10);
+    EXPECT_TRUE(tab.slots == slots);
+    htab_destroy(&tab, NULL);
+}
+
+static long created;
+static void *create_key(const void *key, void *arg) {
+    (void)arg;
+    created++;
+    return (void*)key;
+}
+
+TEST(HTabTest, FindOrInsert) {
+    struct htab tab;
+    unsigned long probes;
+    long i;
+    htab_init(&tab);
+    created = 0;
+    /* misses create the element, also while the table is being migrated */
+    for (i = 2; i < 100000; i++) {
+        EXPECT_EQ((long)htab_find_or_insert(&tab, hash_of(i), (void*)i, same,
+                                            create_key, NULL, NULL), i);
+        EXPECT_EQ((long)htab_find_or_insert(&tab, hash_of(i / 2 + 1),
+                                            (void*)(i / 2 + 1), same,
+                                            create_key, NULL, NULL), i / 2 + 1);
+    }
+    EXPECT_EQ(created, 99998L);
+    EXPECT_EQ(tab.count, 99998UL);
+    for (i = 2; i < 100000; i++)
+        EXPECT_EQ((long)htab_find(&tab, hash_of(i), (void*)i, same), i);
+
+    /* a hit does not create, the probes of a hit are counted */
+    EXPECT_EQ((long)htab_find_or_insert(&tab, hash_of(7), (void*)7, same,
+                                        create_key, NULL, &probes), 7L);
+    EXPECT_GE(probes, 1UL);
+    EXPECT_EQ(created, 99998L);
+    htab_destroy(&tab, NULL);
+}
+
+TEST(HTabTest, FindOrInsertTombstone) {
+    /* a new element reuses the first tombstone of its probe sequence */
+    struct htab tab;
+    uint64_t used;
+    long i;
+    htab_init(&tab);
+    for (i = 2; i < 10; i++)
+        htab_insert(&tab, 42, (void*)i);
+    EXPECT_EQ((long)htab_delete(&tab, 42, (void*)3, same), 3L);
+    used = tab.used;
+    created = 0;
+    EXPECT_EQ((long)htab_find_or_insert(&tab, 42, (void*)20, same, create_key,
+                                        NULL, NULL), 20L);
+    EXPECT_EQ(created, 1L);
+    EXPECT_EQ(tab.used, used);
+    EXPECT_EQ(tab.count, 8UL);
+    for (i = 2; i < 10; i++)
+        EXPECT_EQ(htab_find(&tab, 42, (void*)i, same) == NULL, i == 3);
+    EXPECT_EQ((long)htab_find(&tab, 42, (void*)20, same), 20L);
+    htab_destroy(&tab, NULL);
+}
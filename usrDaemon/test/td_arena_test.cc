@@ -0,0 +1,83 @@
+/**
+ * @file td_arena_test.cc
+ * A set of unit tests that check the arena allocator.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "td_arena.h"
+#include "gtest/gtest.h"
+
+TEST(TDArenaTest, AllocFree) {
+    struct td_arena arena;
+    void *ptrs[10000];
+    long i;
+    td_arena_init(&arena);
+    for (i = 0; i < 10000; i++) {
+        ptrs[i] = td_arena_alloc(&arena, 40);
+        memset(ptrs[i], 0xff, 40);
+        EXPECT_EQ((uintptr_t)ptrs[i] % 16, 0UL);
+    }
+    EXPECT_EQ(arena.used, 10000UL * 48);
+    for (i = 0; i < 10000; i++)
+        td_arena_free(&arena, ptrs[i], 40);
+    EXPECT_EQ(arena.used, 0UL);
+    /* empty objects take the smallest class */
+    void *empty = td_arena_alloc(&arena, 0);
+    EXPECT_EQ(arena.used, 16UL);
+    td_arena_free(&arena, empty, 0);
+    EXPECT_EQ(arena.used, 0UL);
+    if (TD_ARENA_BULK_RELEASE) {
+        /* freed objects are handed out again (LIFO) */
+        EXPECT_EQ(td_arena_alloc(&arena, 40), ptrs[9999]);
+        EXPECT_EQ(td_arena_alloc(&arena, 33), ptrs[9998]);
+    }
+    td_arena_release(&arena);
+    EXPECT_EQ(arena.used, 0UL);
+}
+
+TEST(TDArenaTest, Alignment) {
+    struct td_arena arena;
+    long i;
+    td_arena_init(&arena);
+    for (i = 1; i < 1000; i++) {
+        void *small = td_arena_alloc(&arena, i % 63 + 1);
+        void *line = td_arena_alloc(&arena, 64);
+        void *large = td_arena_alloc(&arena, 1000 + i);
+        EXPECT_EQ((uintptr_t)small % 16, 0UL);
+        if (TD_ARENA_BULK_RELEASE) {
+            EXPECT_EQ((uintptr_t)line % 64, 0UL);
+        }
+        memset(large, 0, 1000 + i);
+        if (!TD_ARENA_BULK_RELEASE) {
+            td_arena_free(&arena, small, i % 63 + 1);
+            td_arena_free(&arena, line, 64);
+            td_arena_free(&arena, large, 1000 + i);
+        }
+    }
+    /* objects larger than a chunk get their own chunk */
+    void *huge = td_arena_alloc(&arena, 4 * 1024 * 1024);
+    memset(huge, 0, 4 * 1024 * 1024);
+    if (!TD_ARENA_BULK_RELEASE)
+        td_arena_free(&arena, huge, 4 * 1024 * 1024);
+    td_arena_release(&arena);
+}
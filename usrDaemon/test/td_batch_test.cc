@@ -0,0 +1,218 @@
+/**
+ * @file td_batch_test.cc
+ * A set of unit tests that check the batched system call API.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+
+#include "gtest/gtest.h"
+
+#define NR_GROUPS 8
+#define NR_THREADS 4
+#define NR_FILES 32
+#define NR_EVENTS 20000
+
+static void create_procs(struct td_context *ctx) {
+    for (unsigned long pid = 1; pid <= NR_GROUPS; pid++) {
+        ASSERT_TRUE(td_process_create(ctx, pid, pid, 0) != NULL);
+        for (unsigned long t = 1; t < NR_THREADS; t++)
+            ASSERT_TRUE(td_process_create(ctx, pid, pid + t * 100, 0) != NULL);
+    }
+}
+
+/*
+ * runs random events one by one and in bursts, the results must not differ.
+ * with dirs some events stat the directory /tmp, which changes now and then.
+ * max_files is the global budget of tracked files.
+ */
+static void same_as_sequential(const unsigned long *syscalls, int nr_syscalls,
+                               const char *const *paths, int nr_paths,
+                               int dirs = 0, unsigned long max_files = 0) {
+    static char names[NR_FILES][32];
+    static struct td_event events[NR_EVENTS];
+    static enum td_syscall_result seq[NR_EVENTS], batch[NR_EVENTS];
+    struct stat bufs[4];
+    struct td_config config = {};
+    config.quiet = 1;
+    config.max_files = max_files;
+    memset(bufs, 0, sizeof(bufs));
+    bufs[1].st_ino = 5;
+    bufs[2].st_ino = 7;
+    bufs[2].st_mode = S_IFDIR;
+    bufs[3].st_ino = 8;
+    bufs[3].st_mode = S_IFDIR;
+    srand(42);
+
+    for (int i = 0; i < NR_FILES; i++)
+        snprintf(names[i], sizeof(names[i]), "file%d", i);
+    for (int i = 0; i < NR_EVENTS; i++) {
+        unsigned long pid = 1 + rand() % NR_GROUPS;
+        const char *name = names[rand() % NR_FILES];
+        const char *path = paths[rand() % nr_paths];
+        /* runs of the same thread as well as interleaved threads */
+        if (i > 0 && rand() % 4 == 0) {
+            events[i] = events[i - 1];
+        } else {
+            events[i].tid = pid + (rand() % NR_THREADS) * 100;
+            events[i].file = name;
+            events[i].file_len = strlen(name);
+            events[i].path = path;
+            events[i].path_len = strlen(path);
+        }
+        /* some events of unknown threads */
+        if (rand() % 64 == 0)
+            events[i].tid = 1000 + rand() % 10;
+        events[i].syscall = syscalls[rand() % nr_syscalls];
+        events[i].buf = &bufs[rand() % 16 == 0];
+        if (dirs && rand() % 8 == 0) {
+            events[i].syscall = SYS_STAT;
+            events[i].file = "/tmp";
+            events[i].file_len = 4;
+            events[i].path = "/";
+            events[i].path_len = 1;
+            events[i].buf = &bufs[2 + (rand() % 32 == 0)];
+        }
+    }
+
+    struct td_context *a = td_context_create(&config);
+    struct td_context *b = td_context_create(&config);
+    create_procs(a);
+    create_procs(b);
+
+    for (int i = 0; i < NR_EVENTS; i++)
+        seq[i] = td_handle_syscall_n(a, events[i].tid, events[i].syscall,
+                                     events[i].file, events[i].file_len,
+                                     events[i].path, events[i].path_len,
+                                     events[i].buf);
+    /* uneven bursts that do not line up with the internal chunks */
+    for (int i = 0; i < NR_EVENTS; ) {
+        int n = 1 + rand() % 200;
+        if (n > NR_EVENTS - i)
+            n = NR_EVENTS - i;
+        td_handle_syscall_batch(b, &events[i], n, &batch[i]);
+        i += n;
+    }
+
+    int races = 0;
+    for (int i = 0; i < NR_EVENTS; i++) {
+        EXPECT_EQ(seq[i], batch[i]) << "event " << i;
+        races += (seq[i] == SYSCALL_RACE);
+    }
+    EXPECT_GT(races, 0);
+    for (int i = 0; i < NR_FILES; i++) {
+        struct td_file *fa = find_file(td_find_process(a, 1), names[i],
+                                       strlen(names[i]));
+        struct td_file *fb = find_file(td_find_process(b, 1), names[i],
+                                       strlen(names[i]));
+        ASSERT_EQ(fa == NULL, fb == NULL);
+        if (fa != NULL) {
+            EXPECT_EQ(fa->state, fb->state);
+            EXPECT_EQ(fa->health, fb->health);
+            EXPECT_EQ(fa->nropen, fb->nropen);
+        }
+    }
+    td_context_destroy(a);
+    td_context_destroy(b);
+}
+
+TEST(TDBatchTest, SameAsSequential) {
+    static const unsigned long syscalls[] = { SYS_ACCESS, SYS_STAT, SYS_OPEN,
+                                              SYS_CREAT, SYS_CLOSE };
+    static const char *const paths[] = { "/" };
+    same_as_sequential(syscalls, 5, paths, 1);
+}
+
+TEST(TDBatchTest, SameAsSequentialAt) {
+    static const unsigned long syscalls[] = { SYS_OPENAT, SYS_NEWFSTATAT,
+                                              SYS_FACCESSAT2, SYS_STATX,
+                                              SYS_CLOSE, SYS_OPEN, 999 };
+    static char long_path[3000];
+    static const char *const paths[] = { "/", "/tmp/", "", long_path };
+    /* resolved names that fill the name buffer of a chunk */
+    memset(long_path, 'x', sizeof(long_path) - 1);
+    long_path[0] = '/';
+    same_as_sequential(syscalls, 7, paths, 4);
+}
+
+TEST(TDBatchTest, SameAsSequentialDirs) {
+    static const unsigned long syscalls[] = { SYS_OPENAT, SYS_NEWFSTATAT,
+                                              SYS_STAT, SYS_OPEN, SYS_CLOSE };
+    static const char *const paths[] = { "/tmp", "/tmp/", "/" };
+    same_as_sequential(syscalls, 5, paths, 3, 1);
+}
+
+TEST(TDBatchTest, SameAsSequentialBudget) {
+    static const unsigned long syscalls[] = { SYS_STAT, SYS_OPEN, SYS_CLOSE };
+    static const char *const paths[] = { "/" };
+    /* evictions follow the order of all events */
+    same_as_sequential(syscalls, 3, paths, 1, 0, NR_GROUPS * NR_FILES / 4);
+}
+
+TEST(TDBatchTest, DirectoryOrder) {
+    struct stat file, dir1, dir2;
+    struct td_event ev[4];
+    enum td_syscall_result out[4];
+    memset(&file, 0, sizeof(struct stat));
+    memset(&dir1, 0, sizeof(struct stat));
+    memset(&dir2, 0, sizeof(struct stat));
+    dir1.st_mode = dir2.st_mode = S_IFDIR;
+    dir1.st_ino = 1;
+    dir2.st_ino = 2;
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    ASSERT_TRUE(td_process_create(ctx, 1, 1, 0) != NULL);
+    ASSERT_TRUE(td_process_create(ctx, 2, 2, 0) != NULL);
+    /* another group replaces the directory between check and use */
+    ev[0] = (struct td_event){ 2, SYS_STAT, "/tmp", 4, "/", 1, &dir1 };
+    ev[1] = (struct td_event){ 1, SYS_STAT, "/tmp/x", 6, "/tmp", 4, &file };
+    ev[2] = (struct td_event){ 2, SYS_STAT, "/tmp", 4, "/", 1, &dir2 };
+    ev[3] = (struct td_event){ 1, SYS_OPEN, "/tmp/x", 6, "/tmp", 4, &file };
+    td_handle_syscall_batch(ctx, ev, 4, out);
+    EXPECT_EQ(out[0], SYSCALL_PASS);
+    EXPECT_EQ(out[1], SYSCALL_PASS);
+    EXPECT_EQ(out[2], SYSCALL_PASS);
+    EXPECT_EQ(out[3], SYSCALL_RACE);
+    td_context_destroy(ctx);
+}
+
+TEST(TDBatchTest, LegacyAPI) {
+    struct stat buf;
+    struct td_event ev[3];
+    enum td_syscall_result out[3];
+    memset(&buf, 0, sizeof(struct stat));
+    ASSERT_TRUE(process_create(7000, 7000, 0) != NULL);
+    ev[0] = (struct td_event){ 7000, SYS_STAT, "bar", 3, "/", 1, &buf };
+    ev[1] = (struct td_event){ 7000, SYS_OPEN, "bar", 3, "/", 1, &buf };
+    ev[2] = (struct td_event){ 7001, SYS_OPEN, "bar", 3, "/", 1, &buf };
+    handle_syscall_batch(ev, 3, out);
+    EXPECT_EQ(out[0], SYSCALL_PASS);
+    EXPECT_EQ(out[1], SYSCALL_PASS);
+    EXPECT_EQ(out[2], SYSCALL_PIDERR);
+    EXPECT_EQ(process_destroy(7000), 0);
+}
@@ -0,0 +1,156 @@
+/**
+ * @file td_bootstrap_test.cc
+ * A set of unit tests that check the bootstrap of running processes from
+ * procfs.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "syscall_nr.h"
+#include "td_bootstrap.h"
+#include "td_filestate.h"
+
+#include "gtest/gtest.h"
+
+static void write_file(const char *root, const char *name, const char *data) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    FILE *out = fopen(path, "w");
+    ASSERT_TRUE(out != NULL);
+    fputs(data, out);
+    fclose(out);
+}
+
+static void make_dir(const char *root, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    ASSERT_EQ(mkdir(path, 0700), 0);
+}
+
+static void make_link(const char *root, const char *name, const char *target) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    ASSERT_EQ(symlink(target, path), 0);
+}
+
+static int remove_entry(const char *path, const struct stat *buf, int flag,
+                        struct FTW *ftw) {
+    (void)buf;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+TEST(TDBootstrapTest, Tree) {
+    char root[] = "/tmp/td_bootstrap_testXXXXXX";
+    char file[PATH_MAX];
+    struct stat buf1, buf2;
+    ASSERT_TRUE(mkdtemp(root) != NULL);
+    snprintf(file, sizeof(file), "%s/data", root);
+    write_file(root, "data", "data");
+    ASSERT_EQ(stat(file, &buf1), 0);
+    buf2 = buf1;
+    buf2.st_ino++;
+
+    /* a group with two threads and three descriptors of which one is a file */
+    make_dir(root, "100");
+    write_file(root, "100/stat", "100 (a (b) c) S 1 100 100 0 -1\n");
+    make_dir(root, "100/task");
+    make_dir(root, "100/task/100");
+    make_dir(root, "100/task/101");
+    make_dir(root, "100/fd");
+    make_link(root, "100/fd/3", file);
+    make_link(root, "100/fd/4", file);
+    make_link(root, "100/fd/5", "pipe:[42]");
+    make_link(root, "100/fd/6", "/tmp/gone (deleted)");
+    /* a group without task and fd directories, a group that exited */
+    make_dir(root, "200");
+    write_file(root, "200/stat", "200 (d) S 100 200 200 0 -1\n");
+    make_dir(root, "300");
+    make_dir(root, "sys");
+
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    EXPECT_EQ(td_bootstrap(ctx, root, 4), 3L);
+    struct td_thread *proc = td_find_process(ctx, 101);
+    ASSERT_TRUE(proc != NULL);
+    EXPECT_EQ(proc->pid, 100UL);
+    EXPECT_EQ(proc->ppid, 1UL);
+    ASSERT_TRUE(td_find_process(ctx, 200) != NULL);
+    EXPECT_EQ(td_find_process(ctx, 200)->ppid, 100UL);
+    EXPECT_TRUE(td_find_process(ctx, 300) == NULL);
+
+    /* both descriptors of the file are bound to a single entry */
+    struct td_file *lfile = find_file(proc, file, strlen(file));
+    ASSERT_TRUE(lfile != NULL);
+    EXPECT_EQ(lfile->state, STATE_ENFORCE);
+    EXPECT_EQ(lfile->nropen, 2);
+    EXPECT_EQ(proc->files->table.count, 1UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 100, SYS_OPEN, file, root, &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 100, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 100, SYS_CLOSE, 4, -1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 100, SYS_CLOSE, 5, -1), SYSCALL_PASS);
+    EXPECT_EQ(lfile->nropen, 1);
+    EXPECT_EQ(td_handle_syscall(ctx, 100, SYS_OPEN, file, root, &buf2), SYSCALL_RACE);
+
+    /* known threads are not added again */
+    EXPECT_EQ(td_bootstrap(ctx, root, 1), 0L);
+    td_context_destroy(ctx);
+
+    ctx = td_context_create(&config);
+    snprintf(file, sizeof(file), "%s/missing", root);
+    EXPECT_EQ(td_bootstrap(ctx, file, 0), -1L);
+    td_context_destroy(ctx);
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+TEST(TDBootstrapTest, Self) {
+    char path[] = "/tmp/td_bootstrap_testXXXXXX";
+    char name[PATH_MAX];
+    struct stat buf1;
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    ASSERT_TRUE(realpath(path, name) != NULL);
+    ASSERT_EQ(fstat(fd, &buf1), 0);
+
+    /* this process, its thread and the open file are found in /proc */
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    EXPECT_GT(td_bootstrap(ctx, NULL, 0), 0L);
+    struct td_thread *proc = td_find_process(ctx, syscall(SYS_gettid));
+    ASSERT_TRUE(proc != NULL);
+    EXPECT_EQ(proc->pid, (unsigned long)getpid());
+    EXPECT_TRUE(find_file(proc, name, strlen(name)) != NULL);
+    EXPECT_EQ(td_handle_syscall(ctx, getpid(), SYS_OPEN, name, "/tmp", &buf1), SYSCALL_PASS);
+    td_context_destroy(ctx);
+    close(fd);
+    unlink(path);
+}
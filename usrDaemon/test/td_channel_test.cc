@@ -0,0 +1,320 @@
+/**
+ * @file td_channel_test.cc
+ * Tests and a throughput benchmark of the shared memory channel. The producer
+ * stand-in below emulates the kernel side (LSM module).
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "syscall_nr.h"
+#include "td_channel.h"
+
+#include "gtest/gtest.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* kernel side stand-in: fills records like the LSM hooks would */
+static void emu_create(struct td_channel *chan, uint32_t pid, uint32_t tid) {
+    struct td_chan_event *ev = td_channel_reserve(chan, 0);
+    ev->op = TD_CHAN_CREATE;
+    ev->pid = pid;
+    ev->tid = tid;
+    ev->ppid = 0;
+    td_channel_publish(chan, ev);
+}
+
+static void emu_syscall_in(struct td_channel *chan, uint32_t tid,
+                           uint32_t syscall, const char *file,
+                           const char *path, uint64_t ino, uint64_t cookie) {
+    struct td_chan_event *ev =
+        td_channel_reserve(chan, strlen(file) + strlen(path));
+    ev->op = TD_CHAN_SYSCALL;
+    ev->cookie = cookie;
+    ev->tid = tid;
+    ev->syscall = syscall;
+    ev->dev = 1;
+    ev->ino = ino;
+    ev->mode = 0100644;
+    ev->uid = ev->gid = 0;
+    td_chan_event_names(chan, ev, file, strlen(file), path, strlen(path));
+    td_channel_publish(chan, ev);
+}
+
+static void emu_syscall(struct td_channel *chan, uint32_t tid,
+                        uint32_t syscall, const char *file, uint64_t ino,
+                        uint64_t cookie) {
+    emu_syscall_in(chan, tid, syscall, file, "/tmp", ino, cookie);
+}
+
+TEST(TDChannelTest, Verdicts) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    struct td_channel *chan = td_channel_create(8);
+    struct td_chan_verdict v;
+    ASSERT_TRUE(chan != NULL);
+
+    emu_create(chan, 10, 10);
+    emu_syscall(chan, 10, SYS_STAT, "foo", 1, 100);
+    emu_syscall(chan, 10, SYS_OPEN, "foo", 2, 101);
+    emu_syscall(chan, 11, SYS_OPEN, "foo", 2, 102);
+    EXPECT_EQ(td_channel_poll(chan, ctx, 100), 4UL);
+    EXPECT_EQ(td_channel_verdict(chan, &v, 0), 1);
+    EXPECT_EQ(v.cookie, 100UL);
+    EXPECT_EQ(v.result, (uint32_t)SYSCALL_PASS);
+    EXPECT_EQ(td_channel_verdict(chan, &v, 0), 1);
+    EXPECT_EQ(v.cookie, 101UL);
+    EXPECT_EQ(v.result, (uint32_t)SYSCALL_RACE);
+    EXPECT_EQ(td_channel_verdict(chan, &v, 0), 1);
+    EXPECT_EQ(v.cookie, 102UL);
+    EXPECT_EQ(v.result, (uint32_t)SYSCALL_PIDERR);
+    EXPECT_EQ(td_channel_verdict(chan, &v, 0), 0);
+    EXPECT_EQ(td_channel_poll(chan, ctx, 100), 0UL);
+
+    /* names that do not fit are rejected */
+    static char big[TD_CHAN_NAMES + 1];
+    memset(big, 'a', sizeof(big));
+    EXPECT_TRUE(td_channel_reserve(chan, TD_CHAN_MAX_NAMES + 1) == NULL);
+    EXPECT_TRUE(td_channel_reserve(chan, 9 * TD_CHAN_RECORD) == NULL);
+    struct td_chan_event *ev = td_channel_reserve(chan, 0);
+    EXPECT_EQ(td_chan_event_names(chan, ev, big, sizeof(big), "", 0), -1);
+    EXPECT_EQ(td_chan_event_names(chan, ev, big, TD_CHAN_NAMES, "", 0), 0);
+    ev->op = TD_CHAN_DESTROY;
+    ev->tid = 10;
+    td_channel_publish(chan, ev);
+    EXPECT_EQ(td_channel_poll(chan, ctx, 100), 1UL);
+    EXPECT_TRUE(td_find_process(ctx, 10) == NULL);
+
+    /* a second mapping sees the same rings */
+    struct td_channel *other = td_channel_attach(td_channel_fd(chan));
+    ASSERT_TRUE(other != NULL);
+    emu_create(other, 20, 20);
+    EXPECT_EQ(td_channel_poll(chan, ctx, 100), 1UL);
+    EXPECT_TRUE(td_find_process(ctx, 20) != NULL);
+    td_channel_destroy(other);
+    td_channel_destroy(chan);
+    td_context_destroy(ctx);
+}
+
+TEST(TDChannelTest, LongNames) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    struct td_channel *chan = td_channel_create(16);
+    struct td_chan_verdict v;
+    char dir[1024], file[2048];
+    long i, round;
+    ASSERT_TRUE(chan != NULL);
+
+    emu_create(chan, 10, 10);
+    EXPECT_EQ(td_channel_poll(chan, ctx, 100), 1UL);
+    /* names of 2 to 8 records each, the records wrap around the ring */
+    for (round = 0; round < 18; round++) {
+        long dlen = 100 + 37 * round, flen = 120 + 11 * round;
+        memset(dir, 'd', dlen);
+        dir[0] = '/';
+        dir[dlen] = '\0';
+        memcpy(file, dir, dlen);
+        file[dlen] = '/';
+        for (i = dlen + 1; i < flen + dlen; i++)
+            file[i] = 'a' + round;
+        file[flen + dlen] = '\0';
+        emu_syscall_in(chan, 10, SYS_STAT, file, dir, 1, 2 * round);
+        emu_syscall_in(chan, 10, SYS_OPEN, file, dir, 1 + (round & 1),
+                       2 * round + 1);
+        EXPECT_EQ(td_channel_poll(chan, ctx, 100), 2UL);
+        ASSERT_EQ(td_channel_verdict(chan, &v, 0), 1);
+        EXPECT_EQ(v.result, (uint32_t)SYSCALL_PASS);
+        ASSERT_EQ(td_channel_verdict(chan, &v, 0), 1);
+        EXPECT_EQ(v.result,
+                  (uint32_t)((round & 1) ? SYSCALL_RACE : SYSCALL_PASS));
+        /* the daemon saw the whole name */
+        struct td_thread *proc = td_find_process(ctx, 10);
+        EXPECT_TRUE(find_file(proc, file, strlen(file)) != NULL);
+    }
+    td_channel_destroy(chan);
+    td_context_destroy(ctx);
+}
+
+#define NR_PRODUCERS 4
+#define NR_CALLS 50000
+
+struct bench {
+    struct td_channel *chan;
+    struct td_context *ctx;
+    uint64_t *sent;  /*< send time per cookie */
+    uint64_t *latency;  /*< round trip time per cookie */
+    long id;
+};
+
+static void *producer(void *arg) {
+    struct bench *b = (struct bench*)arg;
+    uint32_t tid = 100 + b->id;
+    char name[32];
+    emu_create(b->chan, tid, tid);
+    for (long i = 0; i < NR_CALLS; i++) {
+        uint64_t cookie = b->id * NR_CALLS + i;
+        /* stat/open pairs on 256 files */
+        snprintf(name, sizeof(name), "file%ld", (i / 2) % 256);
+        b->sent[cookie] = now_ns();
+        emu_syscall(b->chan, tid, (i & 1) ? SYS_OPEN : SYS_STAT, name,
+                    (i / 2) % 256, cookie);
+    }
+    return NULL;
+}
+
+static void *daemon_loop(void *arg) {
+    struct bench *b = (struct bench*)arg;
+    td_channel_run(b->chan, b->ctx);
+    return NULL;
+}
+
+TEST(TDChannelTest, Throughput) {
+    struct bench b[NR_PRODUCERS];
+    pthread_t producers[NR_PRODUCERS], daemon;
+    std::vector<uint64_t> sent(NR_PRODUCERS * NR_CALLS);
+    std::vector<uint64_t> latency(NR_PRODUCERS * NR_CALLS);
+    struct td_chan_verdict v;
+    long i, passed = 0;
+
+    struct td_channel *chan = td_channel_create(256);
+    ASSERT_TRUE(chan != NULL);
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    for (i = 0; i < NR_PRODUCERS; i++)
+        b[i] = (struct bench){ chan, ctx, &sent[0], &latency[0], i };
+    uint64_t start = now_ns();
+    ASSERT_EQ(pthread_create(&daemon, NULL, daemon_loop, &b[0]), 0);
+    for (i = 0; i < NR_PRODUCERS; i++)
+        ASSERT_EQ(pthread_create(&producers[i], NULL, producer, &b[i]), 0);
+    /* the verdict ring has a single consumer (the kernel side) */
+    for (i = 0; i < NR_PRODUCERS * NR_CALLS; i++) {
+        ASSERT_EQ(td_channel_verdict(chan, &v, 1), 1);
+        ASSERT_LT(v.cookie, (uint64_t)(NR_PRODUCERS * NR_CALLS));
+        latency[v.cookie] = now_ns() - sent[v.cookie];
+        passed += (v.result == SYSCALL_PASS);
+    }
+    uint64_t elapsed = now_ns() - start;
+    for (i = 0; i < NR_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    td_channel_stop(chan);
+    pthread_join(daemon, NULL);
+
+    /* every open follows a stat of the same file (per thread group) */
+    EXPECT_EQ(passed, NR_PRODUCERS * NR_CALLS);
+    std::sort(latency.begin(), latency.end());
+    printf("channel: %.0f events/s, latency p50 %lu ns, p99 %lu ns, "
+           "p99.9 %lu ns\n",
+           (double)latency.size() * 1e9 / elapsed,
+           (unsigned long)latency[latency.size() / 2],
+           (unsigned long)latency[latency.size() * 99 / 100],
+           (unsigned long)latency[latency.size() * 999 / 1000]);
+    td_channel_destroy(chan);
+    td_context_destroy(ctx);
+}
+
+TEST(TDChannelTest, VerdictBackpressure) {
+    struct td_channel *chan = td_channel_create(8);
+    struct td_chan_verdict v;
+    pthread_t daemon;
+    long i;
+    ASSERT_TRUE(chan != NULL);
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    struct bench b = { chan, ctx, NULL, NULL, 0 };
+
+    /*
+     * the producer takes no verdicts while it sends: the daemon waits for
+     * verdict space, but the event records of its batch are free again, so
+     * 8 verdicts, the batch and 8 records fit
+     */
+    ASSERT_EQ(pthread_create(&daemon, NULL, daemon_loop, &b), 0);
+    emu_create(chan, 10, 10);
+    for (i = 0; i < 17; i++)
+        emu_syscall(chan, 10, SYS_STAT, "foo", 1, i);
+    for (i = 0; i < 17; i++) {
+        ASSERT_EQ(td_channel_verdict(chan, &v, 1), 1);
+        EXPECT_EQ(v.cookie, (uint64_t)i);
+    }
+    td_channel_stop(chan);
+    pthread_join(daemon, NULL);
+    td_channel_destroy(chan);
+    td_context_destroy(ctx);
+}
+
+TEST(TDChannelTest, CrossProcess) {
+    struct td_channel *chan = td_channel_create(64);
+    struct td_chan_verdict v;
+    long i, races = 0;
+    ASSERT_TRUE(chan != NULL);
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0) {
+        /* the producer only knows the fd of the mapping */
+        struct td_channel *prod = td_channel_attach(td_channel_fd(chan));
+        if (prod == NULL)
+            _exit(1);
+        char name[32];
+        emu_create(prod, 7, 7);
+        /* every tenth file is replaced between check and use */
+        for (i = 0; i < 1000; i++) {
+            snprintf(name, sizeof(name), "bar%ld", i);
+            emu_syscall(prod, 7, SYS_STAT, name, 1, 2 * i);
+            emu_syscall(prod, 7, SYS_OPEN, name, 1 + (i % 10 == 0), 2 * i + 1);
+        }
+        td_channel_destroy(prod);
+        _exit(0);
+    }
+    for (i = 0; i < 2000; ) {
+        td_channel_poll(chan, ctx, 64);
+        while (td_channel_verdict(chan, &v, 0)) {
+            EXPECT_EQ(v.cookie, (uint64_t)i);
+            races += (v.result == SYSCALL_RACE);
+            i++;
+        }
+    }
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_EQ(races, 100);
+    td_channel_destroy(chan);
+    td_context_destroy(ctx);
+}
@@ -0,0 +1,265 @@
+/**
+ * @file td_checkpoint_test.cc
+ * A set of unit tests that check checkpoints and the restore of a context.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "syscall_nr.h"
+#include "td_checkpoint.h"
+#include "td_filestate.h"
+
+#include "gtest/gtest.h"
+
+static void temp_path(char *path) {
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+}
+
+TEST(TDCheckpointTest, Restore) {
+    char path[] = "/tmp/td_checkpoint_testXXXXXX";
+    temp_path(path);
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_process_create(ctx, 1, 2, 0);
+    td_process_create(ctx, 5, 5, 1);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_bind_fd(ctx, 2, 3, "foo", 3), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "bar", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "bar", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_STAT, "baz", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+
+    ctx = td_context_restore(path, &config);
+    ASSERT_TRUE(ctx != NULL);
+    struct td_thread *proc = td_find_process(ctx, 2);
+    ASSERT_TRUE(proc != NULL);
+    EXPECT_EQ(proc->pid, 1UL);
+    EXPECT_TRUE(td_find_process(ctx, 5) != NULL);
+    EXPECT_TRUE(td_find_process(ctx, 3) == NULL);
+
+    /* only the file behind the descriptor is loaded right away */
+    ASSERT_TRUE(proc->files->base != NULL);
+    EXPECT_EQ(proc->files->base->table.count, 1UL);
+    EXPECT_EQ(proc->files->table.count, 0UL);
+
+    /* the verdicts are the same as before the restart */
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(find_file(proc, "foo", 3)->nropen, 2);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 1, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    EXPECT_EQ(find_file(proc, "foo", 3)->nropen, 1);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "bar", "/", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_OPEN, "baz", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_OPEN, "foo", "/", &buf1), SYSCALL_UNCHECKED);
+    EXPECT_EQ(td_handle_syscall(ctx, 7, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PIDERR);
+    td_context_destroy(ctx);
+    unlink(path);
+}
+
+TEST(TDCheckpointTest, Lazy) {
+    char path[] = "/tmp/td_checkpoint_testXXXXXX";
+    temp_path(path);
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    for (i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        td_handle_syscall(ctx, 1, SYS_STAT, name, "/tmp", &buf1);
+    }
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+
+    ctx = td_context_restore(path, &config);
+    ASSERT_TRUE(ctx != NULL);
+    struct td_files *layer = td_find_process(ctx, 1)->files->base;
+    ASSERT_TRUE(layer != NULL);
+    EXPECT_EQ(layer->table.count, 0UL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "/tmp/file7", 10) != NULL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "/tmp/file", 9) == NULL);
+    EXPECT_EQ(layer->table.count, 1UL);
+    for (i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, name, "/tmp", &buf1), SYSCALL_PASS);
+    }
+    EXPECT_EQ(layer->table.count, 1000UL);
+    td_context_destroy(ctx);
+    unlink(path);
+}
+
+TEST(TDCheckpointTest, Inherit) {
+    char path[] = "/tmp/td_checkpoint_testXXXXXX";
+    temp_path(path);
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_handle_syscall(ctx, 1, SYS_STAT, "a", "/", &buf1);
+    td_process_create(ctx, 2, 2, 1);
+    td_handle_syscall(ctx, 2, SYS_STAT, "b", "/", &buf1);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "a", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+
+    /* each group has its inherited files, the child its own copy of "a" */
+    ctx = td_context_restore(path, &config);
+    ASSERT_TRUE(ctx != NULL);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "a", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "b", "/", &buf1), SYSCALL_UNCHECKED);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "a", "/", &buf1), SYSCALL_RACE);
+
+    /* forks of restored groups share the image */
+    td_process_create(ctx, 3, 3, 2);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "b", "/", &buf1), SYSCALL_PASS);
+    td_process_destroy(ctx, 2);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "a", "/", &buf1), SYSCALL_RACE);
+
+    /* a checkpoint of a restored context keeps the changes */
+    td_handle_syscall(ctx, 3, SYS_STAT, "c", "/", &buf1);
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+    ctx = td_context_restore(path, &config);
+    ASSERT_TRUE(ctx != NULL);
+    EXPECT_TRUE(td_find_process(ctx, 2) == NULL);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "a", "/", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "b", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "c", "/", &buf1), SYSCALL_PASS);
+    td_context_destroy(ctx);
+    unlink(path);
+}
+
+TEST(TDCheckpointTest, InvalidatePrefix) {
+    char path[] = "/tmp/td_checkpoint_testXXXXXX";
+    temp_path(path);
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "/%s/file%ld", (i % 2) ? "a" : "b", i);
+        td_handle_syscall(ctx, 1, SYS_STAT, name, "/", &buf1);
+    }
+    EXPECT_EQ(td_invalidate_prefix(td_find_process(ctx, 1), "/b/", 3), 50UL);
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+
+    /* the marks are saved, the first invalidation loads the whole image */
+    ctx = td_context_restore(path, &config);
+    ASSERT_TRUE(ctx != NULL);
+    struct td_thread *proc = td_find_process(ctx, 1);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/b/file0", "/", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_invalidate_prefix(proc, "/a/", 3), 50UL);
+    EXPECT_EQ(proc->files->base->table.count, 100UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/a/file1", "/", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/a/file3", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/a/file3", "/", &buf1), SYSCALL_PASS);
+    td_context_destroy(ctx);
+    unlink(path);
+}
+
+TEST(TDCheckpointTest, Invalid) {
+    char path[] = "/tmp/td_checkpoint_testXXXXXX";
+    temp_path(path);
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_TRUE(td_context_restore(path, NULL) == NULL);
+    EXPECT_TRUE(td_context_restore("/nonexistent/image", NULL) == NULL);
+
+    struct td_context *ctx = td_context_create(NULL);
+    EXPECT_NE(td_context_checkpoint(ctx, "/nonexistent/image"), 0);
+    td_process_create(ctx, 1, 1, 0);
+    td_handle_syscall(ctx, 1, SYS_STAT, "foo", "/", &buf1);
+    EXPECT_EQ(td_context_checkpoint(ctx, path), 0);
+    td_context_destroy(ctx);
+
+    /* a record with a state or health that does not exist is not loaded */
+    struct td_checkpoint_header header;
+    struct td_checkpoint_group group;
+    struct td_checkpoint_file cfile;
+    int fd = open(path, O_RDWR);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(pread(fd, &header, sizeof(header), 0), (ssize_t)sizeof(header));
+    ASSERT_EQ(pread(fd, &group, sizeof(group), header.groups),
+              (ssize_t)sizeof(group));
+    ASSERT_EQ(pread(fd, &cfile, sizeof(cfile), group.files),
+              (ssize_t)sizeof(cfile));
+    for (int field = 0; field < 2; field++) {
+        struct td_checkpoint_file bad = cfile;
+        if (field == 0)
+            bad.state = 200;
+        else
+            bad.health = 200;
+        ASSERT_EQ(pwrite(fd, &bad, sizeof(bad), group.files),
+                  (ssize_t)sizeof(bad));
+        ctx = td_context_restore(path, NULL);
+        ASSERT_TRUE(ctx != NULL);
+        EXPECT_TRUE(find_file(td_find_process(ctx, 1), "foo", 3) == NULL);
+        EXPECT_EQ(td_invalidate_prefix(td_find_process(ctx, 1), "", 0), 0UL);
+        td_context_destroy(ctx);
+    }
+    ASSERT_EQ(pwrite(fd, &cfile, sizeof(cfile), group.files),
+              (ssize_t)sizeof(cfile));
+    close(fd);
+    ctx = td_context_restore(path, NULL);
+    ASSERT_TRUE(ctx != NULL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "foo", 3) != NULL);
+    td_context_destroy(ctx);
+
+    /* a truncated image is rejected */
+    struct stat st;
+    ASSERT_EQ(stat(path, &st), 0);
+    ASSERT_EQ(truncate(path, st.st_size - 8), 0);
+    EXPECT_TRUE(td_context_restore(path, NULL) == NULL);
+    unlink(path);
+}
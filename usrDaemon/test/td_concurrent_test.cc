@@ -0,0 +1,185 @@
+/**
+ * @file td_concurrent_test.cc
+ * Multi-threaded stress test for contexts in concurrent mode. Run it through
+ * `make runtsan` to check it with ThreadSanitizer.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+
+#include "gtest/gtest.h"
+
+#define NR_WORKERS 8
+#define NR_ROUNDS 200
+#define NR_FILES 32
+/* thread group that all workers share */
+#define SHARED_PID 1
+
+struct worker {
+    struct td_context *ctx;
+    long id;
+    long errors;
+    bool invalidate;
+    pthread_t thread;
+};
+
+static char names[NR_FILES][32];
+
+static void *worker_main(void *arg) {
+    struct worker *w = (struct worker*)arg;
+    struct stat buf1;
+    long round, i;
+    memset(&buf1, 0, sizeof(struct stat));
+    for (round = 0; round < NR_ROUNDS; round++) {
+        /* a private group with two threads */
+        unsigned long pid = 1000 + w->id * NR_ROUNDS + round;
+        unsigned long tid2 = pid + 1000000;
+        if (td_process_create(w->ctx, pid, pid, 1) == NULL ||
+            td_process_create(w->ctx, pid, tid2, 1) == NULL)
+            w->errors++;
+        /* our own thread in the shared group */
+        unsigned long shared_tid = 100 + w->id;
+        if (td_process_create(w->ctx, SHARED_PID, shared_tid, 0) == NULL)
+            w->errors++;
+
+        for (i = 0; i < NR_FILES; i++) {
+            if (td_handle_syscall(w->ctx, pid, SYS_STAT, names[i], "/tmp", &buf1) != SYSCALL_PASS)
+                w->errors++;
+            if (td_handle_syscall(w->ctx, tid2, SYS_OPEN, names[i], "/tmp", &buf1) != SYSCALL_PASS)
+                w->errors++;
+            if (td_handle_syscall(w->ctx, pid, SYS_CLOSE, names[i], "/tmp", &buf1) != SYSCALL_PASS)
+                w->errors++;
+            /* the shared group is updated by all workers at once */
+            enum td_syscall_result res = td_handle_syscall(w->ctx, shared_tid, SYS_STAT, names[i], "/tmp", &buf1);
+            if (res != SYSCALL_PASS)
+                w->errors++;
+            /* lookups of other workers' threads may race with their exit */
+            td_find_process(w->ctx, 100 + (w->id + 1) % NR_WORKERS);
+        }
+        /* walks the layers that other groups index and walk at once */
+        if (w->invalidate &&
+            (td_invalidate_prefix(td_find_process(w->ctx, pid), "/tmp/", 5) != NR_FILES ||
+             td_invalidate_prefix(td_find_process(w->ctx, shared_tid), "/tmp/file1", 10) == 0))
+            w->errors++;
+        if (td_process_destroy(w->ctx, tid2) != 0 ||
+            td_process_destroy(w->ctx, pid) != 0 ||
+            td_process_destroy(w->ctx, shared_tid) != 0)
+            w->errors++;
+        if (td_handle_syscall(w->ctx, pid, SYS_STAT, names[0], "/tmp", &buf1) != SYSCALL_PIDERR)
+            w->errors++;
+    }
+    return NULL;
+}
+
+/*
+ * with a checkpoint path, checkpoints are written while the workers run. with
+ * invalidate, the workers invalidate the files of their groups.
+ */
+static void stress(const struct td_config *config, const char *checkpoint = NULL,
+                   bool invalidate = false) {
+    struct worker workers[NR_WORKERS];
+    long i;
+    for (i = 0; i < NR_FILES; i++)
+        snprintf(names[i], sizeof(names[i]), "/tmp/file%ld", i);
+
+    struct td_context *ctx = td_context_create(config);
+    /* keeps the shared group alive while workers come and go */
+    EXPECT_TRUE(td_process_create(ctx, SHARED_PID, SHARED_PID, 0) != NULL);
+    for (i = 0; i < NR_WORKERS; i++) {
+        workers[i].ctx = ctx;
+        workers[i].id = i;
+        workers[i].errors = 0;
+        workers[i].invalidate = invalidate;
+        ASSERT_EQ(pthread_create(&(workers[i].thread), NULL, worker_main, &(workers[i])), 0);
+    }
+    for (i = 0; checkpoint != NULL && i < 20; i++)
+        EXPECT_EQ(td_context_checkpoint(ctx, checkpoint), 0);
+    for (i = 0; i < NR_WORKERS; i++) {
+        pthread_join(workers[i].thread, NULL);
+        EXPECT_EQ(workers[i].errors, 0);
+    }
+    EXPECT_TRUE(td_find_process(ctx, SHARED_PID) != NULL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, SHARED_PID), names[0], strlen(names[0])) != NULL);
+    EXPECT_TRUE(td_find_process(ctx, 1000) == NULL);
+    if (checkpoint != NULL) {
+        EXPECT_EQ(td_context_checkpoint(ctx, checkpoint), 0);
+        td_context_destroy(ctx);
+        ASSERT_TRUE((ctx = td_context_restore(checkpoint, config)) != NULL);
+        EXPECT_TRUE(find_file(td_find_process(ctx, SHARED_PID), names[0], strlen(names[0])) != NULL);
+        EXPECT_TRUE(td_find_process(ctx, 1000) == NULL);
+        unlink(checkpoint);
+    }
+    td_context_destroy(ctx);
+}
+
+TEST(TDConcurrentTest, Stress) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.concurrent = 1;
+    stress(&config);
+}
+
+/* private groups are forks of the shared group, which keeps changing */
+TEST(TDConcurrentTest, Inherit) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.concurrent = 1;
+    config.inherit = 1;
+    stress(&config);
+}
+
+/* private groups evict their retired files while all groups share a budget */
+TEST(TDConcurrentTest, Budget) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.concurrent = 1;
+    config.max_files = 64;
+    config.max_group_files = 8;
+    stress(&config);
+}
+
+/* checkpoints of the context are written while the workers change it */
+TEST(TDConcurrentTest, Checkpoint) {
+    char path[] = "/tmp/td_concurrent_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    struct td_config config = {};
+    config.quiet = 1;
+    config.concurrent = 1;
+    config.inherit = 1;
+    stress(&config, path);
+}
+
+/* groups invalidate their own and the inherited files of the shared group */
+TEST(TDConcurrentTest, Invalidate) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.concurrent = 1;
+    config.inherit = 1;
+    stress(&config, NULL, true);
+}
@@ -0,0 +1,195 @@
+/**
+ * @file td_dentry_test.cc
+ * A set of unit tests that check the directory cache and the path check.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <thread>
+#include <vector>
+
+#include "syscall_nr.h"
+#include "td_dentry.h"
+#include "td_filestate.h"
+
+#include "gtest/gtest.h"
+
+static void dir_stat(struct stat *buf, ino_t ino) {
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_mode = S_IFDIR | 0755;
+    buf->st_ino = ino;
+}
+
+TEST(TDDentryTest, Lookup) {
+    struct td_dentries dents;
+    td_dentry_init(&dents, 0);
+
+    struct td_dentry *c = td_dentry_lookup(&dents, "/a/b/c", 6);
+    ASSERT_TRUE(c != NULL);
+    EXPECT_STREQ(c->path, "/a/b/c");
+    EXPECT_STREQ(c->parent->path, "/a/b");
+    EXPECT_STREQ(c->parent->parent->path, "/a");
+    EXPECT_STREQ(c->parent->parent->parent->path, "/");
+    EXPECT_TRUE(c->parent->parent->parent->parent == NULL);
+    /* cached directories are reused, trailing slashes are ignored */
+    EXPECT_EQ(td_dentry_lookup(&dents, "/a/b/", 5), c->parent);
+    EXPECT_EQ(td_dentry_lookup(&dents, "/a//", 4), c->parent->parent);
+    EXPECT_TRUE(td_dentry_is(c, "/a/b/c/", 7));
+    EXPECT_FALSE(td_dentry_is(c, "/a/b", 4));
+    EXPECT_EQ(dents.table.count, 4UL);
+
+    /* relative paths end at their first component */
+    struct td_dentry *y = td_dentry_lookup(&dents, "x/y", 3);
+    EXPECT_STREQ(y->parent->path, "x");
+    EXPECT_TRUE(y->parent->parent == NULL);
+    EXPECT_TRUE(td_dentry_lookup(&dents, "", 0) == NULL);
+    td_dentry_destroy(&dents);
+}
+
+TEST(TDDentryTest, Replace) {
+    struct td_dentries dents;
+    struct stat buf1, buf2;
+    dir_stat(&buf1, 1);
+    dir_stat(&buf2, 2);
+    td_dentry_init(&dents, 0);
+
+    struct td_dentry *c = td_dentry_lookup(&dents, "/a/b/c", 6);
+    struct td_dentry *z = td_dentry_lookup(&dents, "/z", 2);
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf1), 0);
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf1), 0);
+    EXPECT_EQ(c->parent->parent->state, STATE_DIR_OK);
+    EXPECT_FALSE(td_dentry_stale(&dents, c));
+
+    /* replacing /a makes everything below the old version stale */
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf2), 1);
+    EXPECT_EQ(c->parent->parent->state, STATE_DIR_ERR);
+    EXPECT_TRUE(td_dentry_stale(&dents, c));
+    EXPECT_TRUE(td_dentry_stale(&dents, c->parent));
+    EXPECT_FALSE(td_dentry_stale(&dents, z));
+
+    struct td_dentry *nc = td_dentry_lookup(&dents, "/a/b/c", 6);
+    EXPECT_NE(nc, c);
+    EXPECT_FALSE(td_dentry_stale(&dents, nc));
+    EXPECT_EQ(nc->parent->parent->state, STATE_DIR_OK);
+    EXPECT_EQ(nc->parent->parent->fp.ino, 2UL);
+    EXPECT_EQ(nc->parent->parent->parent, c->parent->parent->parent);
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf2), 0);
+    td_dentry_destroy(&dents);
+}
+
+TEST(TDDentryTest, Reclaim) {
+    struct td_dentries dents;
+    struct stat buf[2];
+    long i;
+    dir_stat(&buf[0], 1);
+    dir_stat(&buf[1], 2);
+    td_dentry_init(&dents, 0);
+
+    /* a replaced version lives as long as a file or a directory points to it */
+    struct td_dentry *b = td_dentry_lookup(&dents, "/a/b", 4);
+    EXPECT_EQ(dents.count, 3UL);
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf[1]), 0);
+    EXPECT_EQ(td_dentry_verify(&dents, "/a", 2, &buf[0]), 1);
+    EXPECT_TRUE(td_dentry_stale(&dents, b));
+    EXPECT_EQ(dents.count, 4UL);
+    td_dentry_put(&dents, b);
+    EXPECT_EQ(dents.count, 4UL);
+    /* the stale /a/b goes once its path is looked up again */
+    struct td_dentry *nb = td_dentry_lookup(&dents, "/a/b", 4);
+    EXPECT_NE(nb, b);
+    EXPECT_EQ(dents.count, 3UL);
+    td_dentry_put(&dents, nb);
+
+    /* swapping a directory over and over does not pile up versions */
+    for (i = 0; i < 1000; i++) {
+        b = td_dentry_lookup(&dents, "/a/b", 4);
+        td_dentry_verify(&dents, "/a", 2, &buf[i % 2]);
+        td_dentry_put(&dents, b);
+    }
+    EXPECT_LE(dents.count, 4UL);
+    td_dentry_destroy(&dents);
+}
+
+TEST(TDDentryTest, PathRace) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct stat file, dir1, dir2;
+    memset(&file, 0, sizeof(struct stat));
+    file.st_ino = 100;
+    dir_stat(&dir1, 1);
+    dir_stat(&dir2, 2);
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_process_create(ctx, 2, 2, 0);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp", "/", &dir1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp/d", "/tmp", &dir1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp/d/f", "/tmp/d", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp/d/g", "/tmp/d", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/var/h", "/var", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/tmp/d/f", "/tmp/d", &file), SYSCALL_PASS);
+
+    /* another process swaps /tmp/d, the file itself looks the same */
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_STAT, "/tmp/d", "/tmp", &dir2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/tmp/d/g", "/tmp/d", &file), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/var/h", "/var", &file), SYSCALL_PASS);
+
+    /* a check after the swap is fine, a swap of a parent is not */
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp/d/i", "/tmp/d", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/tmp/d/i", "/tmp/d", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/tmp/d/j", "/tmp/d", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_STAT, "/tmp", "/", &dir2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/tmp/d/j", "/tmp/d", &file), SYSCALL_RACE);
+
+    /* a file that is used through another directory is not the checked one */
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "k", "/home", &file), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "k", "/root", &file), SYSCALL_RACE);
+    td_context_destroy(ctx);
+}
+
+TEST(TDDentryTest, Concurrent) {
+    struct td_dentries dents;
+    const int nr_threads = 4, nr_rounds = 2000;
+    std::vector<std::thread> threads;
+    td_dentry_init(&dents, 1);
+
+    for (int t = 0; t < nr_threads; t++)
+        threads.push_back(std::thread([&dents, t]() {
+            struct stat buf;
+            char path[32];
+            for (int i = 0; i < nr_rounds; i++) {
+                int len = snprintf(path, sizeof(path), "/a/%d/%d", i % 8, t);
+                struct td_dentry *dent = td_dentry_lookup(&dents, path, len);
+                /* everybody keeps replacing /a */
+                dir_stat(&buf, i % 3);
+                td_dentry_verify(&dents, "/a", 2, &buf);
+                td_dentry_stale(&dents, dent);
+                EXPECT_TRUE(td_dentry_is(dent, path, len));
+                td_dentry_put(&dents, dent);
+            }
+        }));
+    for (auto &t : threads)
+        t.join();
+    EXPECT_FALSE(td_dentry_stale(&dents, td_dentry_lookup(&dents, "/a/0/0", 6)));
+    td_dentry_destroy(&dents);
+}
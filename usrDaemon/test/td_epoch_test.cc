@@ -0,0 +1,119 @@
+/**
+ * @file td_epoch_test.cc
+ * A set of unit tests that check the epoch reclamation domains and the reuse
+ * of their reader records.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <pthread.h>
+
+#include "td_epoch.h"
+#include "gtest/gtest.h"
+
+static long reclaimed;
+static void count_reclaim(void *obj, void *arg) {
+    (void)obj;
+    (void)arg;
+    reclaimed++;
+}
+
+static void *enter_exit(void *arg) {
+    td_epoch_exit(td_epoch_enter((struct td_epoch*)arg));
+    return NULL;
+}
+
+TEST(TDEpochTest, Reclaim) {
+    struct td_epoch dom;
+    long i;
+    td_epoch_init(&dom);
+    reclaimed = 0;
+    /* nothing is reclaimed while a reader that could see it is inside */
+    struct td_epoch_rec *rec = td_epoch_enter(&dom);
+    for (i = 0; i < 1000; i++)
+        td_epoch_retire(&dom, NULL, count_reclaim, NULL);
+    EXPECT_EQ(reclaimed, 0L);
+    td_epoch_exit(rec);
+    td_epoch_synchronize(&dom);
+    EXPECT_EQ(reclaimed, 1000L);
+    td_epoch_destroy(&dom);
+}
+
+TEST(TDEpochTest, ThreadExit) {
+    struct td_epoch dom;
+    pthread_t thread;
+    long i;
+    td_epoch_init(&dom);
+    /* the record of a thread that exited is reused by the next one */
+    for (i = 0; i < 64; i++) {
+        ASSERT_EQ(pthread_create(&thread, NULL, enter_exit, &dom), 0);
+        ASSERT_EQ(pthread_join(thread, NULL), 0);
+    }
+    EXPECT_EQ(dom.nr_recs, 1UL);
+    td_epoch_destroy(&dom);
+}
+
+TEST(TDEpochTest, ManyDomains) {
+    struct td_epoch dom[16];
+    long i, round;
+    for (i = 0; i < 16; i++)
+        td_epoch_init(&dom[i]);
+    /* more domains than a thread caches records for */
+    for (round = 0; round < 10; round++)
+        for (i = 0; i < 16; i++)
+            td_epoch_exit(td_epoch_enter(&dom[i]));
+    for (i = 0; i < 16; i++)
+        EXPECT_EQ(dom[i].nr_recs, 1UL);
+
+    /* sections of different domains may be open at the same time */
+    struct td_epoch_rec *recs[16];
+    for (i = 0; i < 16; i++)
+        recs[i] = td_epoch_enter(&dom[i]);
+    for (i = 0; i < 16; i++)
+        td_epoch_exit(recs[i]);
+    for (i = 0; i < 16; i++) {
+        td_epoch_exit(td_epoch_enter(&dom[i]));
+        EXPECT_EQ(dom[i].nr_recs, 1UL);
+    }
+    for (i = 0; i < 16; i++)
+        td_epoch_destroy(&dom[i]);
+}
+
+static pthread_barrier_t destroyed;
+
+static void *enter_wait(void *arg) {
+    td_epoch_exit(td_epoch_enter((struct td_epoch*)arg));
+    pthread_barrier_wait(&destroyed);
+    pthread_barrier_wait(&destroyed);
+    return NULL;
+}
+
+TEST(TDEpochTest, DestroyBeforeThreadExit) {
+    struct td_epoch dom;
+    pthread_t thread;
+    td_epoch_init(&dom);
+    pthread_barrier_init(&destroyed, NULL, 2);
+    /* the thread still caches its record when the domain goes away */
+    ASSERT_EQ(pthread_create(&thread, NULL, enter_wait, &dom), 0);
+    pthread_barrier_wait(&destroyed);
+    td_epoch_destroy(&dom);
+    pthread_barrier_wait(&destroyed);
+    ASSERT_EQ(pthread_join(thread, NULL), 0);
+    pthread_barrier_destroy(&destroyed);
+}
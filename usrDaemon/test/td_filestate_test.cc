@@ -21,9 +21,12 @@
  * MA  02110-1301, USA.
  */
 
+#include <malloc.h>
+#include <stdio.h>
 #include <sys/stat.h>
 
 #include "avl.h"
+#include "td_metrics.h"
 #include "syscall_nr.h"
 #include "td_filestate.h"
 
@@ -147,3 +150,612 @@ TEST(TDFilestateTest, SimpleFileRace) {
     EXPECT_EQ(process_destroy(1), 0);
     EXPECT_EQ(process_destroy(0), 0);
 }
+
+TEST(TDFilestateTest, ManyFiles) {
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    for (i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        EXPECT_EQ(handle_syscall(1, SYS_STAT, name, "/tmp", &buf1), SYSCALL_PASS);
+    }
+    for (i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        EXPECT_EQ(handle_syscall(1, SYS_OPEN, name, "/tmp", &buf1), SYSCALL_PASS);
+    }
+    EXPECT_EQ(find_process(1)->files->table.count, 100000UL);
+    EXPECT_EQ(process_destroy(1), 0);
+}
+
+/* file entry before the hot/cold split, it was kept in an AVL node */
+struct legacy_file {
+    enum td_file_state state;
+    enum td_file_health health;
+    long nropen;
+    long fderr;
+    char name[256];
+    struct stat stat;
+    struct td_file *dir;
+};
+
+TEST(TDFilestateTest, Footprint) {
+    struct stat buf1;
+    char name[32];
+    long i;
+    const long nr = 1000000;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_LE(sizeof(struct td_file), 64UL);
+    struct td_thread *proc = process_create(1, 1, 0);
+    ASSERT_TRUE(proc != NULL);
+    /* large tables are mmapped, they show up in hblkhd */
+    struct mallinfo2 before = mallinfo2();
+    unsigned long records = proc->files->arena.used;
+    for (i = 0; i < nr; i++) {
+        snprintf(name, sizeof(name), "/usr/lib/file%ld", i);
+        handle_syscall(1, SYS_STAT, name, "/usr/lib", &buf1);
+    }
+    struct mallinfo2 after = mallinfo2();
+    records = (proc->files->arena.used - records) / nr;
+    size_t per_file = (after.uordblks + after.hblkhd -
+                       before.uordblks - before.hblkhd) / nr;
+    /* malloc chunk of the legacy entry, plus its 32 byte AVL node chunk */
+    size_t legacy_record = sizeof(struct legacy_file) + 16;
+    size_t legacy = legacy_record + 32;
+    /* the record that replaces the legacy entry is ~5x smaller */
+    EXPECT_LE(records * 5, legacy_record);
+    /* with the interned name and the slots of the file and name tables */
+    EXPECT_LE(per_file * 5, legacy * 2);
+    EXPECT_EQ(process_destroy(1), 0);
+}
+
+TEST(TDFilestateTest, Inherit) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    /* a fork sees the checked file, a new group without parent does not */
+    td_process_create(ctx, 2, 2, 1);
+    td_process_create(ctx, 3, 3, 0);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 2), "foo", 3) != NULL);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "foo", "/", &buf1), SYSCALL_UNCHECKED);
+
+    /* without inherit every group starts empty */
+    struct td_context *plain = td_context_create(NULL);
+    td_process_create(plain, 1, 1, 0);
+    td_handle_syscall(plain, 1, SYS_STAT, "foo", "/", &buf1);
+    td_process_create(plain, 2, 2, 1);
+    EXPECT_TRUE(find_file(td_find_process(plain, 2), "foo", 3) == NULL);
+    td_context_destroy(plain);
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, InheritCopyOnWrite) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_handle_syscall(ctx, 1, SYS_STAT, "foo", "/", &buf1);
+    td_handle_syscall(ctx, 1, SYS_STAT, "bar", "/", &buf1);
+    td_process_create(ctx, 2, 2, 1);
+    struct td_files *layer = td_find_process(ctx, 2)->files->base;
+    EXPECT_TRUE(layer != NULL);
+    EXPECT_EQ(layer->table.count, 2UL);
+    EXPECT_EQ(td_find_process(ctx, 1)->files->table.count, 0UL);
+
+    /* the race of the child stays in the child */
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "foo", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(find_file(td_find_process(ctx, 2), "bar", 3),
+              find_file(td_find_process(ctx, 1), "bar", 3));
+    EXPECT_EQ(td_find_process(ctx, 2)->files->table.count, 1UL);
+
+    /* files the parent checks after the fork are not inherited */
+    td_handle_syscall(ctx, 1, SYS_STAT, "baz", "/", &buf1);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "baz", "/", &buf1), SYSCALL_UNCHECKED);
+
+    /* forks of a group that did not touch new files share the layer */
+    td_process_create(ctx, 3, 3, 2);
+    td_process_create(ctx, 4, 4, 2);
+    EXPECT_TRUE(td_find_process(ctx, 3)->files->base ==
+                td_find_process(ctx, 4)->files->base);
+    td_process_create(ctx, 5, 5, 3);
+    EXPECT_TRUE(td_find_process(ctx, 5)->files->base ==
+                td_find_process(ctx, 3)->files->base);
+    EXPECT_TRUE(td_find_process(ctx, 3)->files->base->base == layer);
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, InheritParentExit) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    /* a chain of forks, each parent exits after the fork */
+    td_process_create(ctx, 1, 1, 0);
+    for (i = 1; i < 100; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        EXPECT_EQ(td_handle_syscall(ctx, i, SYS_STAT, name, "/tmp", &buf1), SYSCALL_PASS);
+        td_process_create(ctx, i + 1, i + 1, i);
+        EXPECT_EQ(td_process_destroy(ctx, i), 0);
+    }
+    for (i = 1; i < 100; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        EXPECT_EQ(td_handle_syscall(ctx, 100, SYS_OPEN, name, "/tmp", &buf1), SYSCALL_PASS);
+    }
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, FdClose) {
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    EXPECT_EQ(handle_syscall(1, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(bind_fd(1, 3, "foo"), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(bind_fd(1, 4, "foo"), SYSCALL_PASS);
+    struct td_file *file = find_file(find_process(1), "foo", 3);
+    EXPECT_EQ(file->nropen, 2);
+
+    /* the file stays open as long as a descriptor is left */
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    EXPECT_EQ(file->nropen, 1);
+    EXPECT_EQ(file->state, STATE_ENFORCE);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 4, -1), SYSCALL_PASS);
+    EXPECT_EQ(file->nropen, 0);
+    EXPECT_EQ(file->state, STATE_RETIRE);
+
+    /* unknown descriptors, files and threads */
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 4, -1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 1L << 30, -1), SYSCALL_PASS);
+    EXPECT_EQ(bind_fd(1, 5, "bar"), SYSCALL_UNCHECKED);
+    EXPECT_EQ(bind_fd(2, 5, "foo"), SYSCALL_PIDERR);
+    EXPECT_EQ(handle_syscall_fd(2, SYS_CLOSE, 3, -1), SYSCALL_PIDERR);
+    EXPECT_EQ(process_destroy(1), 0);
+}
+
+TEST(TDFilestateTest, FdDup) {
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 5;
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    handle_syscall(1, SYS_STAT, "foo", "/", &buf1);
+    handle_syscall(1, SYS_OPEN, "foo", "/", &buf1);
+    bind_fd(1, 3, "foo");
+    handle_syscall(1, SYS_STAT, "bar", "/", &buf1);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "bar", "/", &buf2), SYSCALL_RACE);
+    bind_fd(1, 4, "bar");
+    struct td_file *foo = find_file(find_process(1), "foo", 3);
+    struct td_file *bar = find_file(find_process(1), "bar", 3);
+
+    EXPECT_EQ(handle_syscall_fd(1, SYS_DUP, 3, 100), SYSCALL_PASS);
+    EXPECT_EQ(foo->nropen, 2);
+    /* dup2 onto an open descriptor closes it */
+    EXPECT_EQ(handle_syscall_fd(1, SYS_DUP2, 3, 4), SYSCALL_PASS);
+    EXPECT_EQ(foo->nropen, 3);
+    EXPECT_EQ(bar->nropen, 0);
+    EXPECT_EQ(bar->state, STATE_RETIRE);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_DUP3, 3, 3), SYSCALL_PASS);
+    EXPECT_EQ(foo->nropen, 3);
+
+    /* a descriptor of a raced file keeps reporting the race */
+    bind_fd(1, 5, "bar");
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 5, -1), SYSCALL_RACE);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 4, -1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall_fd(1, SYS_CLOSE, 100, -1), SYSCALL_PASS);
+    EXPECT_EQ(foo->nropen, 0);
+    EXPECT_EQ(foo->state, STATE_RETIRE);
+    EXPECT_EQ(process_destroy(1), 0);
+}
+
+TEST(TDFilestateTest, FdInherit) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_handle_syscall(ctx, 1, SYS_STAT, "foo", "/", &buf1);
+    td_handle_syscall(ctx, 1, SYS_OPEN, "foo", "/", &buf1);
+    EXPECT_EQ(td_bind_fd(ctx, 1, 3, "foo", 3), SYSCALL_PASS);
+    td_process_create(ctx, 2, 2, 1);
+
+    /* the child closes its copy of the descriptor, the parent keeps it */
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 2, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    struct td_file *child = find_file(td_find_process(ctx, 2), "foo", 3);
+    struct td_file *parent = find_file(td_find_process(ctx, 1), "foo", 3);
+    EXPECT_TRUE(child != parent);
+    EXPECT_EQ(child->state, STATE_RETIRE);
+    EXPECT_EQ(parent->state, STATE_ENFORCE);
+    EXPECT_EQ(parent->nropen, 1);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 1, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    parent = find_file(td_find_process(ctx, 1), "foo", 3);
+    EXPECT_EQ(parent->state, STATE_RETIRE);
+    EXPECT_EQ(td_find_process(ctx, 1)->files->table.count, 1UL);
+    td_context_destroy(ctx);
+}
+
+/* stat, open and close, leaves the file retired */
+static void retire(struct td_context *ctx, unsigned long tid, const char *name,
+                   struct stat *buf) {
+    td_handle_syscall(ctx, tid, SYS_STAT, name, "/tmp", buf);
+    td_handle_syscall(ctx, tid, SYS_OPEN, name, "/tmp", buf);
+    td_handle_syscall(ctx, tid, SYS_CLOSE, name, "/tmp", buf);
+}
+
+TEST(TDFilestateTest, Evict) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.metrics = td_metrics_create(NULL, 0);
+    config.max_group_files = 64;
+    struct td_metrics_values values;
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    /* open files are never evicted */
+    for (i = 0; i < 32; i++) {
+        snprintf(name, sizeof(name), "/tmp/open%ld", i);
+        td_handle_syscall(ctx, 1, SYS_STAT, name, "/tmp", &buf1);
+        td_handle_syscall(ctx, 1, SYS_OPEN, name, "/tmp", &buf1);
+    }
+    for (i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        retire(ctx, 1, name, &buf1);
+        /* a retired file that keeps being used stays */
+        td_handle_syscall(ctx, 1, SYS_CLOSE, "/tmp/file0", "/tmp", &buf1);
+        EXPECT_LE(td_find_process(ctx, 1)->files->table.count, 64UL);
+    }
+    for (i = 0; i < 32; i++) {
+        snprintf(name, sizeof(name), "/tmp/open%ld", i);
+        EXPECT_TRUE(find_file(td_find_process(ctx, 1), name, strlen(name)) != NULL);
+    }
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "/tmp/file0", 10) != NULL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "/tmp/file999", 12) != NULL);
+    EXPECT_TRUE(find_file(td_find_process(ctx, 1), "/tmp/file1", 10) == NULL);
+
+    td_metrics_publish(config.metrics, &values);
+    EXPECT_EQ(values.files, td_find_process(ctx, 1)->files->table.count);
+    EXPECT_EQ(values.evictions, 32 + 1000 - values.files);
+    td_context_destroy(ctx);
+    td_metrics_destroy(config.metrics);
+}
+
+TEST(TDFilestateTest, EvictGlobal) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.max_files = 100;
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_process_create(ctx, 2, 2, 0);
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        retire(ctx, 1, name, &buf1);
+    }
+    EXPECT_EQ(td_find_process(ctx, 1)->files->table.count, 100UL);
+    /* the group that adds files evicts its own ones */
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "/tmp/other%ld", i);
+        retire(ctx, 2, name, &buf1);
+    }
+    EXPECT_EQ(td_find_process(ctx, 1)->files->table.count, 100UL);
+    EXPECT_LE(td_find_process(ctx, 2)->files->table.count, 2UL);
+    td_context_destroy(ctx);
+}
+
+/* the verdict changes that are documented at td_config.max_files */
+TEST(TDFilestateTest, EvictVerdicts) {
+    struct td_config unlimited = {};
+    unlimited.quiet = 1;
+    struct td_config bounded = {};
+    bounded.quiet = 1;
+    bounded.max_group_files = 8;
+    const struct td_config *configs[2] = { &unlimited, &bounded };
+    struct stat buf1, buf2;
+    char name[32];
+    long i, c;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    for (c = 0; c < 2; c++) {
+        struct td_context *ctx = td_context_create(configs[c]);
+        td_process_create(ctx, 1, 1, 0);
+        retire(ctx, 1, "a", &buf1);
+        td_handle_syscall(ctx, 1, SYS_STAT, "b", "/tmp", &buf1);
+        EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "b", "/tmp", &buf2), SYSCALL_RACE);
+        td_handle_syscall(ctx, 1, SYS_CLOSE, "b", "/tmp", &buf2);
+        retire(ctx, 1, "c", &buf1);
+        td_handle_syscall(ctx, 1, SYS_OPEN, "d", "/tmp", &buf1);
+        EXPECT_EQ(td_bind_fd(ctx, 1, 3, "d", 1), SYSCALL_PASS);
+        td_handle_syscall(ctx, 1, SYS_CLOSE, "d", "/tmp", &buf1);
+        for (i = 0; i < 64; i++) {
+            snprintf(name, sizeof(name), "/tmp/file%ld", i);
+            retire(ctx, 1, name, &buf1);
+        }
+        if (configs[c] == &unlimited) {
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "a", "/tmp", &buf1), SYSCALL_PASS);
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "b", "/tmp", &buf1), SYSCALL_RACE);
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_CLOSE, "c", "/tmp", &buf1), SYSCALL_PASS);
+            EXPECT_EQ(td_handle_syscall_fd(ctx, 1, SYS_CLOSE, 3, -1), SYSCALL_UNCHECKED);
+        } else {
+            EXPECT_TRUE(find_file(td_find_process(ctx, 1), "a", 1) == NULL);
+            /* forgotten check, forgotten race, dropped descriptor */
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "a", "/tmp", &buf1), SYSCALL_UNCHECKED);
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "b", "/tmp", &buf1), SYSCALL_PASS);
+            EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_CLOSE, "c", "/tmp", &buf1), SYSCALL_UNCHECKED);
+            EXPECT_EQ(td_handle_syscall_fd(ctx, 1, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+        }
+        td_context_destroy(ctx);
+    }
+}
+
+TEST(TDFilestateTest, EvictInherited) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    config.max_group_files = 8;
+    struct stat buf1, buf2;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    retire(ctx, 1, "a", &buf1);
+    td_process_create(ctx, 2, 2, 1);
+    /* the copy of the child shadows the inherited file and is kept */
+    retire(ctx, 2, "a", &buf2);
+    for (i = 0; i < 64; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        retire(ctx, 2, name, &buf1);
+    }
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "a", "/tmp", &buf2), SYSCALL_PASS);
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, InvalidatePrefix) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    struct td_thread *proc = td_process_create(ctx, 1, 1, 0);
+    static const char *names[] = { "/d", "/d/a", "/d/b/c", "/dx", "/c", "/e" };
+    for (i = 0; i < 6; i++)
+        td_handle_syscall(ctx, 1, SYS_STAT, names[i], "/", &buf1);
+    /* only the names under the prefix, the directory itself is not */
+    EXPECT_EQ(td_invalidate_prefix(proc, "/d/", 3), 2UL);
+    EXPECT_EQ(td_invalidate_prefix(proc, "/f/", 3), 0UL);
+    EXPECT_TRUE(proc->files->names != NULL);
+
+    /* a use without a new check is a race, a new check clears the mark */
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/a", "/d", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/d/b/c", "/d/b", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/b/c", "/d/b", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/dx", "/", &buf1), SYSCALL_PASS);
+
+    /* the same holds for a file that is open */
+    struct stat buf2;
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+    EXPECT_EQ(td_invalidate_prefix(proc, "/d/b/", 5), 1UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/d/b/c", "/d/b", &buf2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/b/c", "/d/b", &buf2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_CLOSE, "/d/b/c", "/d/b", &buf2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_STAT, "/d/b/c", "/d/b", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_invalidate_prefix(proc, "/d/b/", 5), 1UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/b/c", "/d/b", &buf1), SYSCALL_RACE);
+
+    /* the index follows new files */
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "/d/new%ld", i);
+        td_handle_syscall(ctx, 1, SYS_STAT, name, "/d", &buf1);
+    }
+    EXPECT_EQ(td_invalidate_prefix(proc, "/d/new", 6), 100UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/new7", "/d", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_invalidate_prefix(proc, "/", 1), 106UL);
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, InvalidateInherited) {
+    struct td_config config = {};
+    config.quiet = 1;
+    config.inherit = 1;
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 1, 1, 0);
+    td_handle_syscall(ctx, 1, SYS_STAT, "/d/a", "/d", &buf1);
+    td_handle_syscall(ctx, 1, SYS_STAT, "/d/b", "/d", &buf1);
+    td_handle_syscall(ctx, 1, SYS_STAT, "/e/a", "/e", &buf1);
+    struct td_thread *child = td_process_create(ctx, 2, 2, 1);
+    td_handle_syscall(ctx, 2, SYS_STAT, "/d/b", "/d", &buf1);
+
+    /* the child gets copies of the inherited files, the parent keeps its own */
+    EXPECT_EQ(td_invalidate_prefix(child, "/d/", 3), 2UL);
+    EXPECT_EQ(child->files->table.count, 2UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "/d/a", "/d", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "/d/b", "/d", &buf1), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 2, SYS_OPEN, "/e/a", "/e", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 1, SYS_OPEN, "/d/a", "/d", &buf1), SYSCALL_PASS);
+
+    /* the index of the parent moved into the layer with its files */
+    EXPECT_EQ(td_invalidate_prefix(td_find_process(ctx, 1), "/d/", 3), 2UL);
+    td_process_create(ctx, 3, 3, 1);
+    EXPECT_EQ(td_invalidate_prefix(td_find_process(ctx, 3), "/d/", 3), 2UL);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_OPEN, "/d/b", "/d", &buf1), SYSCALL_RACE);
+    td_context_destroy(ctx);
+}
+
+TEST(TDFilestateTest, InvalidateEvict) {
+    struct stat buf1;
+    char name[32];
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    /* evicted files leave the index */
+    struct td_config config = {};
+    config.quiet = 1;
+    config.max_group_files = 16;
+    struct td_context *ctx = td_context_create(&config);
+    struct td_thread *proc = td_process_create(ctx, 1, 1, 0);
+    EXPECT_EQ(td_invalidate_prefix(proc, "/tmp/", 5), 0UL);
+    for (i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/tmp/file%ld", i);
+        retire(ctx, 1, name, &buf1);
+    }
+    EXPECT_EQ(td_invalidate_prefix(proc, "/tmp/", 5), proc->files->table.count);
+    td_context_destroy(ctx);
+}
+
+/* every transition in every state, for a matching and a different file */
+TEST(TDFilestateTest, Transitions) {
+    static const unsigned long syscalls[3] = { SYS_STAT, SYS_OPEN, SYS_CLOSE };
+    /* state, then resulting state and verdicts (match, mismatch) per syscall */
+    static const struct {
+        enum td_file_state next;
+        enum td_syscall_result match, mismatch;
+    } expected[3][3] = {
+        { { STATE_UPDATE, SYSCALL_PASS, SYSCALL_PASS },
+          { STATE_ENFORCE, SYSCALL_PASS, SYSCALL_RACE },
+          { STATE_RETIRE, SYSCALL_PASS, SYSCALL_RACE } },
+        { { STATE_ENFORCE, SYSCALL_PASS, SYSCALL_RACE },
+          { STATE_ENFORCE, SYSCALL_PASS, SYSCALL_RACE },
+          { STATE_RETIRE, SYSCALL_PASS, SYSCALL_RACE } },
+        { { STATE_UPDATE, SYSCALL_PASS, SYSCALL_PASS },
+          { STATE_ENFORCE, SYSCALL_PASS, SYSCALL_RACE },
+          { STATE_RETIRE, SYSCALL_PASS, SYSCALL_PASS } }
+    };
+    struct stat buf1, buf2;
+    long state, sc, mismatch;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 2;
+
+    for (state = 0; state < 3; state++) {
+        for (sc = 0; sc < 3; sc++) {
+            for (mismatch = 0; mismatch < 2; mismatch++) {
+                struct td_context *ctx = td_context_create(NULL);
+                td_process_create(ctx, 1, 1, 0);
+                /* reach the state through its checked path */
+                for (long i = 0; i <= state; i++)
+                    td_handle_syscall(ctx, 1, syscalls[i], "foo", "/", &buf1);
+                struct td_file *file = find_file(td_find_process(ctx, 1), "foo", 3);
+                ASSERT_EQ(file->state, (enum td_file_state)state);
+                EXPECT_EQ(td_handle_syscall(ctx, 1, syscalls[sc], "foo", "/",
+                                            mismatch ? &buf2 : &buf1),
+                          mismatch ? expected[state][sc].mismatch :
+                          expected[state][sc].match);
+                EXPECT_EQ(file->state, expected[state][sc].next);
+                td_context_destroy(ctx);
+            }
+        }
+    }
+}
+
+TEST(TDFilestateTest, AtSyscalls) {
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    /* a relative name is resolved against the directory of dirfd */
+    EXPECT_EQ(handle_syscall(1, SYS_NEWFSTATAT, "foo", "/tmp/", &buf1), SYSCALL_PASS);
+    EXPECT_TRUE(find_file(find_process(1), "/tmp/foo", 8) != NULL);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "/tmp/foo", "/tmp", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPENAT, "foo", "/var", &buf1), SYSCALL_UNCHECKED);
+    EXPECT_EQ(handle_syscall(1, SYS_STATX, "bar", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPENAT2, "/bar", "/", &buf1), SYSCALL_PASS);
+    /* AT_EMPTY_PATH refers to dirfd itself */
+    EXPECT_EQ(handle_syscall(1, SYS_FACCESSAT, "", "/etc/passwd", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "/etc/passwd", "/etc", &buf1), SYSCALL_PASS);
+
+    /* the directory of an *at call is the one of the resolved name */
+    EXPECT_EQ(handle_syscall(1, SYS_STAT, "/etc/group", "/etc", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPENAT, "/etc/group", "/home", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_NEWFSTATAT, "x/y", "/srv", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPEN, "/srv/x/y", "/srv/x", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_STAT, "/srv/z", "/srv", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPENAT, "z", "/srv/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_STAT, "/srv/w", "/srv", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, SYS_OPENAT, "w", "/var", &buf1), SYSCALL_UNCHECKED);
+
+    /* system calls that are not tracked pass */
+    unsigned long files = find_process(1)->files->table.count;
+    EXPECT_EQ(handle_syscall(1, 1000, "baz", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(1, 59, "baz", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(2, 59, "baz", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(find_process(1)->files->table.count, files);
+    EXPECT_EQ(process_destroy(1), 0);
+}
+
+TEST(TDFilestateTest, LoadGroup) {
+    struct stat buf1;
+    unsigned long tids[2] = { 10, 11 };
+    struct td_open_file ofiles[4];
+    long fds[4] = { 3, 4, 1L << 30, 3 };
+    long i;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(ofiles, 0, sizeof(ofiles));
+    for (i = 0; i < 4; i++) {
+        ofiles[i].name = "/tmp/foo";
+        ofiles[i].name_len = 8;
+        ofiles[i].fd = fds[i];
+    }
+
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    EXPECT_EQ(td_load_group(ctx, 10, 1, tids, 2, ofiles, 4), 2UL);
+    struct td_file *lfile = find_file(td_find_process(ctx, 10), "/tmp/foo", 8);
+    ASSERT_TRUE(lfile != NULL);
+    /* only the two descriptors that are tracked count as opens */
+    EXPECT_EQ(lfile->nropen, 2);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 10, SYS_CLOSE, 1L << 30, -1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 10, SYS_CLOSE, 3, -1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 10, SYS_CLOSE, 4, -1), SYSCALL_PASS);
+    EXPECT_EQ(lfile->nropen, 0);
+    td_context_destroy(ctx);
+}
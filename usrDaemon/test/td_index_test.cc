@@ -0,0 +1,183 @@
+/**
+ * @file td_index_test.cc
+ * A set of unit tests that check the ordered index (td_tree.h) and its C
+ * interface (td_index.h).
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <random>
+
+#include "td_index.h"
+#include "td_tree.h"
+#include "gtest/gtest.h"
+
+TEST(TDTreeTest, InsertSearchDelete) {
+    td_tree<unsigned long, long> tree;
+    unsigned long i;
+    bool inserted;
+    long value;
+    const unsigned long nr = 1000000;
+    /* sequential inserts are the worst case for an unbalanced tree */
+    for (i = 0; i < nr; i++) {
+        EXPECT_EQ(*tree.insert(i, (long)i * 2), (long)i * 2);
+    }
+    EXPECT_EQ(tree.size(), nr);
+    EXPECT_EQ(*tree.insert(5, 0, &inserted), 10L);
+    EXPECT_FALSE(inserted);
+    EXPECT_TRUE(tree.find(nr) == NULL);
+
+    /* delete every other element (mix of leaf and inner node deletes) */
+    for (i = 0; i < nr; i += 2) {
+        EXPECT_TRUE(tree.erase(i, &value));
+        EXPECT_EQ(value, (long)i * 2);
+    }
+    EXPECT_FALSE(tree.erase(0));
+    EXPECT_EQ(tree.size(), nr / 2);
+    for (i = 0; i < nr; i++) {
+        EXPECT_EQ(tree.find(i) == NULL, (i % 2) == 0);
+    }
+    tree.insert(0, 1, &inserted);
+    EXPECT_TRUE(inserted);
+
+    long sum = 0;
+    tree.clear([&sum](long &val) { sum += val; });
+    EXPECT_EQ(sum, 1 + 2 * (long)(nr / 2) * (long)(nr / 2));
+    EXPECT_EQ(tree.size(), 0UL);
+    EXPECT_TRUE(tree.find(1) == NULL);
+}
+
+TEST(TDTreeTest, Random) {
+    /* random operations behave like std::map */
+    td_tree<long, long> tree;
+    std::map<long, long> ref;
+    std::mt19937_64 rnd(42);
+    long i, value;
+    for (i = 0; i < 200000; i++) {
+        long key = rnd() % 10000;
+        if (rnd() % 2) {
+            bool inserted;
+            tree.insert(key, i, &inserted);
+            EXPECT_EQ(inserted, ref.insert(std::make_pair(key, i)).second);
+        } else {
+            EXPECT_EQ(tree.erase(key, &value), ref.erase(key) == 1);
+        }
+    }
+    EXPECT_EQ(tree.size(), ref.size());
+    for (auto &entry : ref) {
+        EXPECT_EQ(*tree.find(entry.first), entry.second);
+    }
+
+    /* an ordered walk visits the keys like the iterators of std::map */
+    td_tree<long, long>::cursor pos = tree.begin();
+    for (auto &entry : ref) {
+        ASSERT_TRUE(pos.valid());
+        EXPECT_EQ(pos.key(), entry.first);
+        EXPECT_EQ(pos.value(), entry.second);
+        pos.next();
+    }
+    EXPECT_FALSE(pos.valid());
+    for (i = -1; i <= 10000; i++) {
+        auto it = ref.lower_bound(i);
+        pos = tree.lower_bound(i);
+        EXPECT_EQ(pos.valid(), it != ref.end());
+        if (pos.valid()) {
+            EXPECT_EQ(pos.key(), it->first);
+        }
+    }
+    tree.clear();
+    EXPECT_FALSE(tree.begin().valid());
+    EXPECT_FALSE(tree.lower_bound(0).valid());
+}
+
+static long destroyed;
+static void count_dest(void *data) {
+    (void)data;
+    destroyed++;
+}
+
+TEST(TDIndexTest, Names) {
+    struct td_index *index = td_index_create();
+    static const char *prefixes[] = { "/a", "/a/", "/a/b", "/ab", "/a/b/c" };
+    char names[1000][32];
+    long i;
+    /* prefixes of each other are different names */
+    for (i = 0; i < 5; i++) {
+        EXPECT_EQ(td_index_insert(index, prefixes[i], strlen(prefixes[i]),
+                                  (void*)prefixes[i]), prefixes[i]);
+    }
+    for (i = 0; i < 1000; i++) {
+        snprintf(names[i], sizeof(names[i]), "/tmp/file%ld", i);
+        td_index_insert(index, names[i], strlen(names[i]), names[i]);
+    }
+    EXPECT_EQ(td_index_count(index), 1005UL);
+    for (i = 0; i < 5; i++) {
+        EXPECT_EQ(td_index_find(index, prefixes[i], strlen(prefixes[i])),
+                  prefixes[i]);
+    }
+    EXPECT_TRUE(td_index_find(index, "/a/b/", 5) == NULL);
+    /* names need not be NUL terminated */
+    EXPECT_EQ(td_index_find(index, "/tmp/file500xyz", 12), names[500]);
+    /* existing names keep their data */
+    EXPECT_EQ(td_index_insert(index, "/tmp/file500", 12, names[0]), names[500]);
+
+    EXPECT_EQ(td_index_delete(index, "/tmp/file500", 12), names[500]);
+    EXPECT_TRUE(td_index_delete(index, "/tmp/file500", 12) == NULL);
+    EXPECT_TRUE(td_index_find(index, "/tmp/file500", 12) == NULL);
+    EXPECT_EQ(td_index_find(index, "/tmp/file501", 12), names[501]);
+
+    destroyed = 0;
+    td_index_destroy(index, count_dest);
+    EXPECT_EQ(destroyed, 1004L);
+}
+
+TEST(TDIndexTest, Prefix) {
+    struct td_index *index = td_index_create();
+    struct td_index_cursor cur;
+    struct td_index_key key;
+    static const char *names[] = { "/d", "/d/", "/d/a", "/d/b/c", "/d0",
+                                   "/dx", "/c/d/e", "/e" };
+    char *data;
+    long i;
+    for (i = 7; i >= 0; i--)
+        td_index_insert(index, names[i], strlen(names[i]), (void*)names[i]);
+
+    /* the names under a prefix follow it in order */
+    td_index_lower_bound(index, &cur, "/d/", 3);
+    for (i = 1; i < 4; i++) {
+        EXPECT_EQ(td_index_next(&cur, &key), names[i]);
+        EXPECT_EQ(key.len, strlen(names[i]));
+    }
+    data = (char*)td_index_next(&cur, &key);
+    EXPECT_EQ(data, names[4]);
+    EXPECT_NE(memcmp(key.name, "/d/", 3), 0);
+
+    /* seeking between names and past the end */
+    td_index_lower_bound(index, &cur, "/d/aa", 5);
+    EXPECT_EQ(td_index_next(&cur, NULL), names[3]);
+    td_index_lower_bound(index, &cur, "/f", 2);
+    EXPECT_TRUE(td_index_next(&cur, NULL) == NULL);
+    td_index_lower_bound(index, &cur, "", 0);
+    EXPECT_EQ(td_index_next(&cur, NULL), names[6]);
+    td_index_destroy(index, NULL);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file td_intern_test.cc
+ * A set of unit tests that check the file name intern table.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <string>
+#include <sys/stat.h>
+
+#include "htab.h"
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "td_intern.h"
+
+#include "gtest/gtest.h"
+
+static const struct td_str *intern(struct td_intern *tab, const char *str,
+                                   unsigned long len) {
+    return td_intern(tab, str, len, htab_hash(str, len));
+}
+
+TEST(TDInternTest, HashConsing) {
+    struct td_intern tab;
+    td_intern_init(&tab, 0);
+    const struct td_str *a = intern(&tab, "/etc/ld.so.cache", 16);
+    /* no NUL terminator needed */
+    const struct td_str *b = intern(&tab, "/etc/ld.so.cache.bak", 16);
+    const struct td_str *c = intern(&tab, "/etc/ld.so.conf", 15);
+
+    EXPECT_TRUE(a == b);
+    EXPECT_TRUE(a != c);
+    EXPECT_EQ(a->refcnt, 2UL);
+    EXPECT_STREQ(a->str, "/etc/ld.so.cache");
+    EXPECT_EQ(td_intern_count(&tab), 2UL);
+
+    td_intern_put(&tab, a);
+    td_intern_put(&tab, b);
+    td_intern_put(&tab, c);
+    EXPECT_EQ(td_intern_count(&tab), 0UL);
+    td_intern_destroy(&tab);
+}
+
+TEST(TDInternTest, SharedAmongProcesses) {
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    EXPECT_TRUE(process_create(2, 2, 0) != NULL);
+    EXPECT_EQ(handle_syscall(1, SYS_STAT, "/etc/ld.so.cache", "/etc", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall(2, SYS_STAT, "/etc/ld.so.cache", "/etc", &buf1), SYSCALL_PASS);
+    struct td_file *f1 = find_file(find_process(1), "/etc/ld.so.cache", 16);
+    struct td_file *f2 = find_file(find_process(2), "/etc/ld.so.cache", 16);
+    ASSERT_TRUE(f1 != NULL && f2 != NULL);
+    EXPECT_TRUE(f1 != f2);
+    EXPECT_TRUE(f1->name == f2->name);
+    EXPECT_EQ(f1->name->refcnt, 2UL);
+
+    EXPECT_EQ(process_destroy(1), 0);
+    EXPECT_EQ(f2->name->refcnt, 1UL);
+    EXPECT_EQ(process_destroy(2), 0);
+}
+
+TEST(TDInternTest, LongPaths) {
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+    std::string name(4000, 'a');
+    name[0] = '/';
+
+    EXPECT_TRUE(process_create(1, 1, 0) != NULL);
+    EXPECT_EQ(handle_syscall_n(1, SYS_STAT, name.data(), name.size(), "/", 1, &buf1),
+              SYSCALL_PASS);
+    EXPECT_EQ(handle_syscall_n(1, SYS_OPEN, name.data(), name.size(), "/", 1, &buf1),
+              SYSCALL_PASS);
+    /* a prefix of the long name is a different file */
+    EXPECT_EQ(handle_syscall_n(1, SYS_OPEN, name.data(), 255, "/", 1, &buf1),
+              SYSCALL_UNCHECKED);
+    EXPECT_EQ(process_destroy(1), 0);
+}
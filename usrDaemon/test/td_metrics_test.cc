@@ -0,0 +1,239 @@
+/**
+ * @file td_metrics_test.cc
+ * A set of unit tests that check the built-in metrics.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <malloc.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <thread>
+#include <vector>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "td_metrics.h"
+
+#include "gtest/gtest.h"
+
+TEST(TDMetricsTest, Buckets) {
+    EXPECT_EQ(td_metrics_bucket(0), 0UL);
+    EXPECT_EQ(td_metrics_bucket(15), 15UL);
+    EXPECT_EQ(td_metrics_bucket_value(td_metrics_bucket(16)), 16UL);
+    EXPECT_LT(td_metrics_bucket(~0UL), (unsigned long)TD_METRICS_LATENCY);
+    /* buckets are ordered and lose at most 1/16 of the value */
+    for (uint64_t ns = 1; ns < (1UL << 40); ns = ns * 3 + 1) {
+        uint64_t low = td_metrics_bucket_value(td_metrics_bucket(ns));
+        EXPECT_LE(low, ns);
+        EXPECT_GE(low, ns - ns / 16);
+        EXPECT_LE(td_metrics_bucket(ns), td_metrics_bucket(ns + 1));
+    }
+}
+
+TEST(TDMetricsTest, Counters) {
+    struct td_metrics *metrics = td_metrics_create(NULL, 0);
+    struct td_config config = {};
+    config.quiet = 1;
+    config.metrics = metrics;
+    struct td_metrics_values values;
+    struct stat buf1, buf2;
+    uint64_t latencies = 0;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf1.st_ino = 1;
+    buf2.st_ino = 2;
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 3, 3, 0);
+    td_process_create(ctx, 3, 4, 0);
+    td_process_create(ctx, 5, 5, 0);
+    EXPECT_EQ(td_handle_syscall(ctx, 3, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 4, SYS_OPEN, "foo", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_OPEN, "bar", "/", &buf1), SYSCALL_UNCHECKED);
+    EXPECT_EQ(td_handle_syscall(ctx, 9, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PIDERR);
+    td_metrics_publish(metrics, &values);
+
+    EXPECT_EQ(values.syscalls[SYS_STAT], 1UL);
+    EXPECT_EQ(values.syscalls[SYS_OPEN], 3UL);
+    EXPECT_EQ(values.results[SYSCALL_PASS], 1UL);
+    EXPECT_EQ(values.results[SYSCALL_RACE], 1UL);
+    EXPECT_EQ(values.results[SYSCALL_UNCHECKED], 1UL);
+    EXPECT_EQ(values.results[SYSCALL_PIDERR], 1UL);
+    for (int i = 0; i < TD_METRICS_LATENCY; i++)
+        latencies += values.latency[i];
+    EXPECT_EQ(latencies, 4UL);
+    /* three lookups of known threads, the first probe of each table is free */
+    EXPECT_EQ(values.probes[0] + values.probes[1], 3UL);
+
+    EXPECT_EQ(values.threads, 3UL);
+    EXPECT_EQ(values.groups, 2UL);
+    EXPECT_EQ(values.files, 2UL);
+    EXPECT_GT(values.arena_bytes, 0UL);
+
+    td_process_destroy(ctx, 4);
+    td_process_destroy(ctx, 5);
+    td_metrics_publish(metrics, &values);
+    EXPECT_EQ(values.threads, 1UL);
+    EXPECT_EQ(values.groups, 1UL);
+    EXPECT_EQ(values.files, 1UL);
+
+    td_context_destroy(ctx);
+    td_metrics_publish(metrics, &values);
+    EXPECT_EQ(values.threads, 0UL);
+    EXPECT_EQ(values.groups, 0UL);
+    EXPECT_EQ(values.files, 0UL);
+    EXPECT_EQ(values.arena_bytes, 0UL);
+    td_metrics_destroy(metrics);
+}
+
+TEST(TDMetricsTest, Batch) {
+    struct td_metrics *metrics = td_metrics_create(NULL, 0);
+    struct td_config config = {};
+    config.quiet = 1;
+    config.metrics = metrics;
+    struct td_metrics_values values;
+    struct td_event ev[100];
+    enum td_syscall_result out[100];
+    struct stat buf;
+    memset(&buf, 0, sizeof(struct stat));
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 3, 3, 0);
+    for (int i = 0; i < 100; i++)
+        ev[i] = (struct td_event){ 3, SYS_STAT, "foo", 3, "/", 1, &buf };
+    td_handle_syscall_batch(ctx, ev, 100, out);
+    td_metrics_publish(metrics, &values);
+    EXPECT_EQ(values.syscalls[SYS_STAT], 100UL);
+    EXPECT_EQ(values.results[SYSCALL_PASS], 100UL);
+    EXPECT_EQ(values.files, 1UL);
+    td_context_destroy(ctx);
+    td_metrics_destroy(metrics);
+}
+
+TEST(TDMetricsTest, SharedSnapshot) {
+    struct td_metrics *metrics = td_metrics_create("/td_metrics_test", 0);
+    struct td_metrics_snapshot copy;
+    struct stat buf;
+    memset(&buf, 0, sizeof(struct stat));
+    ASSERT_TRUE(metrics != NULL);
+
+    const struct td_metrics_snapshot *snap = td_metrics_open("/td_metrics_test");
+    ASSERT_TRUE(snap != NULL);
+    struct td_config config = {};
+    config.quiet = 1;
+    config.metrics = metrics;
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 3, 3, 0);
+    td_handle_syscall(ctx, 3, SYS_ACCESS, "foo", "/", &buf);
+    td_metrics_publish(metrics, NULL);
+
+    ASSERT_EQ(td_metrics_read(snap, &copy), 0);
+    EXPECT_EQ(copy.magic, TD_METRICS_MAGIC);
+    EXPECT_EQ(copy.seq % 2, 0UL);
+    EXPECT_EQ(copy.values.syscalls[SYS_ACCESS], 1UL);
+    EXPECT_EQ(copy.values.threads, 1UL);
+
+    td_context_destroy(ctx);
+    td_metrics_close(snap);
+    td_metrics_destroy(metrics);
+    EXPECT_TRUE(td_metrics_open("/td_metrics_test") == NULL);
+}
+
+/* readers see complete, monotonic snapshots while threads record */
+TEST(TDMetricsTest, ConcurrentReaders) {
+    struct td_metrics *metrics = td_metrics_create("/td_metrics_test", 1);
+    ASSERT_TRUE(metrics != NULL);
+    const struct td_metrics_snapshot *snap = td_metrics_open("/td_metrics_test");
+    ASSERT_TRUE(snap != NULL);
+    const int nr_threads = 4, nr_calls = 20000;
+    std::vector<std::thread> threads;
+    int done = 0;
+
+    for (int t = 0; t < nr_threads; t++)
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < nr_calls; i++) {
+                td_metrics_gauges(metrics, 1, 1, 1, 16);
+                td_metrics_syscall(metrics, SYS_OPEN, SYSCALL_PASS, i);
+                td_metrics_gauges(metrics, -1, -1, -1, -16);
+            }
+        }));
+    std::thread reader([&]() {
+        struct td_metrics_snapshot copy;
+        uint64_t seq = 0, calls = 0;
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+            ASSERT_EQ(td_metrics_read(snap, &copy), 0);
+            EXPECT_EQ(copy.seq % 2, 0UL);
+            EXPECT_GE(copy.seq, seq);
+            EXPECT_GE(copy.values.syscalls[SYS_OPEN], calls);
+            EXPECT_LE(copy.values.syscalls[SYS_OPEN],
+                      (uint64_t)nr_threads * nr_calls);
+            seq = copy.seq;
+            calls = copy.values.syscalls[SYS_OPEN];
+        }
+    });
+    for (auto &t : threads)
+        t.join();
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    reader.join();
+
+    struct td_metrics_values values;
+    td_metrics_publish(metrics, &values);
+    EXPECT_EQ(values.syscalls[SYS_OPEN], (uint64_t)nr_threads * nr_calls);
+    EXPECT_EQ(values.threads, 0UL);
+    EXPECT_EQ(values.arena_bytes, 0UL);
+    td_metrics_close(snap);
+    td_metrics_destroy(metrics);
+}
+
+TEST(TDMetricsTest, ThreadChurn) {
+    struct td_metrics *metrics = td_metrics_create(NULL, 0);
+    struct td_metrics *others[8];
+    struct td_metrics_values values;
+    long i, t;
+    for (i = 0; i < 8; i++)
+        others[i] = td_metrics_create(NULL, 0);
+    auto record = [&]() {
+        td_metrics_syscall(metrics, SYS_OPEN, SYSCALL_PASS, 1);
+        /* more domains than a thread caches counters for */
+        for (long j = 0; j < 8; j++)
+            td_metrics_syscall(others[j], SYS_STAT, SYSCALL_PASS, 1);
+        td_metrics_syscall(metrics, SYS_OPEN, SYSCALL_PASS, 1);
+    };
+    std::thread(record).join();
+
+    /* threads that exited hand their counters on, nothing is lost */
+    struct mallinfo2 before = mallinfo2();
+    for (t = 0; t < 100; t++)
+        std::thread(record).join();
+    struct mallinfo2 after = mallinfo2();
+    EXPECT_LT(after.uordblks + after.hblkhd,
+              before.uordblks + before.hblkhd + 16 * 1024);
+
+    td_metrics_publish(metrics, &values);
+    EXPECT_EQ(values.syscalls[SYS_OPEN], 202UL);
+    for (i = 0; i < 8; i++) {
+        td_metrics_publish(others[i], &values);
+        EXPECT_EQ(values.syscalls[SYS_STAT], 101UL);
+        td_metrics_destroy(others[i]);
+    }
+    td_metrics_destroy(metrics);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file td_radix_test.cc
+ * A set of unit tests that check the id radix array and the constant time
+ * thread lookup built on top of it.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "td_filestate.h"
+#include "td_radix.h"
+
+#include "gtest/gtest.h"
+
+static long visited;
+static void count_visit(void *data, void *arg) {
+    (void)data;
+    (void)arg;
+    visited++;
+}
+
+TEST(TDRadixTest, SetFindClear) {
+    static struct td_radix radix;
+    unsigned long i;
+    td_radix_init(&radix);
+    EXPECT_TRUE(td_radix_find(&radix, 0) == NULL);
+    for (i = 0; i < (1UL << TD_RADIX_BITS); i += 997)
+        EXPECT_EQ(td_radix_set(&radix, i, (void*)(i + 1)), 0);
+    EXPECT_EQ(td_radix_set(&radix, 1UL << TD_RADIX_BITS, (void*)1), -1);
+    EXPECT_TRUE(td_radix_find(&radix, 1UL << TD_RADIX_BITS) == NULL);
+    EXPECT_TRUE(td_radix_find(&radix, ~0UL) == NULL);
+    for (i = 0; i < (1UL << TD_RADIX_BITS); i += 997)
+        EXPECT_EQ((unsigned long)td_radix_find(&radix, i), i + 1);
+    EXPECT_TRUE(td_radix_find(&radix, 998) == NULL);
+    visited = 0;
+    td_radix_foreach(&radix, count_visit, NULL);
+    EXPECT_EQ((unsigned long)visited, radix.count);
+    for (i = 0; i < (1UL << TD_RADIX_BITS); i += 997)
+        EXPECT_EQ(td_radix_set(&radix, i, NULL), 0);
+    EXPECT_EQ(radix.count, 0UL);
+    td_radix_destroy(&radix);
+}
+
+TEST(TDRadixTest, ProcessIds) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    EXPECT_TRUE(td_process_create(ctx, 1, 1, 0) != NULL);
+    /* duplicate tids and ids beyond PID_MAX_LIMIT are rejected */
+    EXPECT_TRUE(td_process_create(ctx, 2, 1, 0) == NULL);
+    EXPECT_TRUE(td_process_create(ctx, 1, 1UL << 22, 0) == NULL);
+    EXPECT_TRUE(td_process_create(ctx, 1UL << 40, 5, 0) == NULL);
+    EXPECT_TRUE(td_find_process(ctx, (1UL << 40) + 1) == NULL);
+    EXPECT_EQ(td_process_destroy(ctx, 1UL << 40), -1);
+    td_context_destroy(ctx);
+}
+
+TEST(TDRadixTest, ManyThreads) {
+    struct td_config config = {};
+    config.quiet = 1;
+    struct td_context *ctx = td_context_create(&config);
+    unsigned long i;
+    /* 100k threads, spread over the id space (timing: bench/) */
+    for (i = 0; i < 100000; i++)
+        ASSERT_TRUE(td_process_create(ctx, i * 37 + 2, i * 37 + 2, 1) != NULL);
+    for (i = 0; i < 100000; i++) {
+        EXPECT_TRUE(td_find_process(ctx, i * 37 + 2) != NULL);
+        EXPECT_TRUE(td_find_process(ctx, i * 37 + 3) == NULL);
+    }
+    td_context_destroy(ctx);
+}
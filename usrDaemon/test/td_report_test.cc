@@ -0,0 +1,176 @@
+/**
+ * @file td_report_test.cc
+ * A set of unit tests that check the asynchronous race reporter.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "td_report.h"
+
+#include "gtest/gtest.h"
+
+static void collect(void *arg, const struct td_report *rep) {
+    ((std::vector<struct td_report>*)arg)->push_back(*rep);
+}
+
+TEST(TDReportTest, Deduplicate) {
+    std::vector<struct td_report> reports;
+    struct td_reporter *rep = td_reporter_create(64, 0, collect, &reports);
+    struct td_config config = {};
+    config.reporter = rep;
+    struct td_reporter_stats stats;
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf1.st_ino = 1;
+    buf2.st_ino = 2;
+
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 3, 4, 0);
+    EXPECT_EQ(td_handle_syscall(ctx, 4, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    /* the race sticks, every later system call on foo is reported again */
+    for (int i = 0; i < 10; i++)
+        EXPECT_EQ(td_handle_syscall(ctx, 4, SYS_OPEN, "foo", "/", &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 4, SYS_OPEN, "bar", "/", &buf2), SYSCALL_UNCHECKED);
+    EXPECT_EQ(td_handle_syscall(ctx, 9, SYS_OPEN, "foo", "/", &buf2), SYSCALL_PIDERR);
+    td_reporter_flush(rep);
+    td_reporter_stats(rep, &stats);
+    EXPECT_EQ(stats.reported, 3UL);
+    EXPECT_EQ(stats.duplicates, 9UL);
+    EXPECT_EQ(stats.dropped, 0UL);
+
+    ASSERT_EQ(reports.size(), 3UL);
+    EXPECT_EQ(reports[0].verdict, (uint32_t)SYSCALL_RACE);
+    EXPECT_EQ(reports[0].tid, 4U);
+    EXPECT_EQ(reports[0].pid, 3U);
+    EXPECT_EQ(reports[0].syscall, (uint32_t)SYS_OPEN);
+    EXPECT_EQ(reports[0].checked.ino, 1U);
+    EXPECT_EQ(reports[0].seen.ino, 2U);
+    EXPECT_EQ(std::string(reports[0].name, reports[0].name_len), "foo");
+    EXPECT_EQ(reports[1].verdict, (uint32_t)SYSCALL_UNCHECKED);
+    EXPECT_EQ(reports[2].verdict, (uint32_t)SYSCALL_PIDERR);
+    EXPECT_EQ(reports[2].pid, 0U);
+    td_context_destroy(ctx);
+    td_reporter_destroy(rep);
+}
+
+static struct td_report make_report(unsigned long i) {
+    struct td_report rep;
+    memset(&rep, 0, sizeof(rep));
+    rep.name_hash = i;
+    rep.tid = rep.pid = 1;
+    rep.verdict = SYSCALL_RACE;
+    return rep;
+}
+
+static int release_sink = 0;
+
+static void blocking(void *arg, const struct td_report *rep) {
+    (void)arg;
+    (void)rep;
+    while (!__atomic_load_n(&release_sink, __ATOMIC_ACQUIRE))
+        ;
+}
+
+TEST(TDReportTest, DropWhenFull) {
+    struct td_reporter *rep = td_reporter_create(8, 0, blocking, NULL);
+    struct td_reporter_stats stats;
+    unsigned long ok = 0, i;
+    /* the writer is stuck in the sink, pushing must not wait for it */
+    for (i = 0; i < 100; i++) {
+        struct td_report report = make_report(i);
+        ok += (td_report_push(rep, &report) == 0);
+    }
+    EXPECT_LE(ok, 9UL);
+    td_reporter_stats(rep, &stats);
+    EXPECT_EQ(stats.dropped, 100 - ok);
+    __atomic_store_n(&release_sink, 1, __ATOMIC_RELEASE);
+    td_reporter_flush(rep);
+    td_reporter_stats(rep, &stats);
+    EXPECT_EQ(stats.reported, ok);
+    td_reporter_destroy(rep);
+}
+
+TEST(TDReportTest, RateLimit) {
+    std::vector<struct td_report> reports;
+    struct td_reporter *rep = td_reporter_create(1024, 5, collect, &reports);
+    struct td_reporter_stats stats;
+    for (unsigned long i = 0; i < 100; i++) {
+        struct td_report report = make_report(i);
+        EXPECT_EQ(td_report_push(rep, &report), 0);
+    }
+    td_reporter_flush(rep);
+    td_reporter_stats(rep, &stats);
+    EXPECT_GE(stats.reported, 5UL);
+    EXPECT_LE(stats.reported, 6UL);
+    EXPECT_EQ(stats.reported + stats.ratelimited, 100UL);
+    EXPECT_EQ(reports.size(), stats.reported);
+    td_reporter_destroy(rep);
+}
+
+TEST(TDReportTest, StatsWhileWriting) {
+    std::vector<struct td_report> reports;
+    struct td_reporter *rep = td_reporter_create(1024, 0, collect, &reports);
+    struct td_reporter_stats stats;
+    unsigned long last = 0;
+    for (unsigned long i = 0; i < 1000; i++) {
+        struct td_report report = make_report(i % 300);
+        EXPECT_EQ(td_report_push(rep, &report), 0);
+    }
+    /* the counters may be read while the writer handles the reports */
+    do {
+        td_reporter_stats(rep, &stats);
+        EXPECT_GE(stats.reported + stats.duplicates, last);
+        last = stats.reported + stats.duplicates;
+    } while (last < 1000);
+    EXPECT_EQ(stats.reported, 300UL);
+    EXPECT_EQ(stats.duplicates, 700UL);
+    td_reporter_destroy(rep);
+}
+
+TEST(TDReportTest, Text) {
+    FILE *out = tmpfile();
+    char line[256];
+    ASSERT_TRUE(out != NULL);
+    struct td_reporter *rep = td_reporter_create(16, 0, td_report_text, out);
+    struct td_report report = make_report(1);
+    report.tid = 7;
+    report.syscall = SYS_OPEN;
+    report.checked.ino = 5;
+    report.seen.ino = 6;
+    report.name_len = 3;
+    memcpy(report.name, "baz", 3);
+    EXPECT_EQ(td_report_push(rep, &report), 0);
+    td_reporter_destroy(rep);
+    rewind(out);
+    ASSERT_TRUE(fgets(line, sizeof(line), out) != NULL);
+    EXPECT_TRUE(strncmp(line, "Race condition: baz (tid 7", 26) == 0) << line;
+    EXPECT_TRUE(strstr(line, ":5 -> 0:6") != NULL) << line;
+    fclose(out);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file td_shard_test.cc
+ * A set of unit tests that check tracking contexts and the sharded front end.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "td_shard.h"
+
+#include "gtest/gtest.h"
+
+TEST(TDContextTest, Independent) {
+    struct stat buf1, buf2;
+    struct td_config config = {};
+    config.quiet = 1;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 5;
+
+    struct td_context *a = td_context_create(&config);
+    struct td_context *b = td_context_create(&config);
+    EXPECT_TRUE(td_process_create(a, 1, 1, 0) != NULL);
+    EXPECT_TRUE(td_process_create(b, 1, 1, 0) != NULL);
+    EXPECT_TRUE(td_find_process(a, 1) != td_find_process(b, 1));
+    EXPECT_TRUE(td_find_process(a, 1) != NULL);
+    /* the legacy API uses its own context */
+    EXPECT_TRUE(find_process(1) == NULL);
+
+    EXPECT_EQ(td_handle_syscall(a, 1, SYS_STAT, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(b, 1, SYS_STAT, "foo", "/", &buf2), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(a, 1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(b, 1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_RACE);
+
+    EXPECT_EQ(td_process_destroy(a, 1), 0);
+    EXPECT_EQ(td_handle_syscall(a, 1, SYS_OPEN, "foo", "/", &buf1), SYSCALL_PIDERR);
+    td_context_destroy(a);
+    /* destroying a context also releases all remaining processes */
+    EXPECT_TRUE(td_process_create(b, 2, 3, 0) != NULL);
+    td_context_destroy(b);
+}
+
+#define NR_PROCS 64
+#define NR_FILES 100
+
+static enum td_syscall_result verdicts[NR_PROCS * NR_FILES * 2];
+
+static void record_verdict(void *arg, void *cookie,
+                           enum td_syscall_result result) {
+    (void)arg;
+    verdicts[(long)cookie] = result;
+}
+
+TEST(TDShardTest, Dispatch) {
+    static char names[NR_FILES][32];
+    struct stat buf1, buf2;
+    struct td_config config = {};
+    config.quiet = 1;
+    long pid, i;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf2.st_ino = 5;
+    for (i = 0; i < NR_FILES; i++)
+        snprintf(names[i], sizeof(names[i]), "/tmp/file%ld", i);
+
+    struct td_shards *shards = td_shards_create(4, &config, record_verdict, NULL);
+    for (pid = 0; pid < NR_PROCS; pid++) {
+        td_shards_process_create(shards, pid + 100, pid + 100, 1);
+        /* second thread of the same group lands on the same shard */
+        td_shards_process_create(shards, pid + 100, pid + 1000, 1);
+    }
+    for (i = 0; i < NR_FILES; i++) {
+        for (pid = 0; pid < NR_PROCS; pid++) {
+            long ev = (pid * NR_FILES + i) * 2;
+            td_shards_syscall(shards, pid + 100, pid + 100, SYS_STAT, names[i],
+                              strlen(names[i]), "/tmp", 4, &buf1, (void*)ev);
+            /* odd processes see a different file on open */
+            td_shards_syscall(shards, pid + 100, pid + 1000, SYS_OPEN, names[i],
+                              strlen(names[i]), "/tmp", 4,
+                              (pid % 2) ? &buf2 : &buf1, (void*)(ev + 1));
+        }
+    }
+    td_shards_flush(shards);
+    for (pid = 0; pid < NR_PROCS; pid++) {
+        for (i = 0; i < NR_FILES; i++) {
+            long ev = (pid * NR_FILES + i) * 2;
+            EXPECT_EQ(verdicts[ev], SYSCALL_PASS);
+            EXPECT_EQ(verdicts[ev + 1], (pid % 2) ? SYSCALL_RACE : SYSCALL_PASS);
+        }
+    }
+    for (pid = 0; pid < NR_PROCS; pid++) {
+        td_shards_process_destroy(shards, pid + 100, pid + 100);
+        td_shards_process_destroy(shards, pid + 100, pid + 1000);
+    }
+    td_shards_destroy(shards);
+}
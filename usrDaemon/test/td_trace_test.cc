@@ -0,0 +1,166 @@
+/**
+ * @file td_trace_test.cc
+ * A set of unit tests that check recording and reading of binary traces.
+ *
+ * Copyright (c) 2013 UC Berkeley
+ * @author Mathias Payer <mathias.payer@nebelwelt.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "syscall_nr.h"
+#include "td_filestate.h"
+#include "td_trace.h"
+
+#include "gtest/gtest.h"
+
+TEST(TDTraceTest, RecordAndRead) {
+    char path[] = "/tmp/td_trace_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+
+    struct stat buf1, buf2;
+    memset(&buf1, 0, sizeof(struct stat));
+    memset(&buf2, 0, sizeof(struct stat));
+    buf1.st_ino = 3;
+    buf1.st_mode = 0100600;
+    buf2.st_ino = 4;
+    struct td_config config = {};
+    config.quiet = 1;
+    config.trace = td_trace_open(path);
+    ASSERT_TRUE(config.trace != NULL);
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 5, 5, 1);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_STAT, "foo", "/tmp", &buf1), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall(ctx, 5, SYS_OPEN, "foo", NULL, &buf2), SYSCALL_RACE);
+    EXPECT_EQ(td_handle_syscall(ctx, 6, SYS_OPEN, "foo", "/tmp", &buf2), SYSCALL_PIDERR);
+    td_process_destroy(ctx, 5);
+    td_context_destroy(ctx);
+    EXPECT_EQ(td_trace_close(config.trace), 0);
+
+    struct td_trace_reader reader;
+    const struct td_trace_rec *rec;
+    const struct td_trace_syscall *sc;
+    ASSERT_EQ(td_trace_map(&reader, path), 0);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    EXPECT_EQ(rec->type, TD_TRACE_CREATE);
+    EXPECT_EQ(rec->tid, 5U);
+    EXPECT_EQ(((const struct td_trace_create*)rec)->pid, 5U);
+    EXPECT_EQ(((const struct td_trace_create*)rec)->ppid, 1U);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    ASSERT_EQ(rec->type, TD_TRACE_SYSCALL);
+    sc = (const struct td_trace_syscall*)rec;
+    EXPECT_EQ(sc->syscall, (uint32_t)SYS_STAT);
+    EXPECT_EQ(sc->result, (uint32_t)SYSCALL_PASS);
+    EXPECT_EQ(sc->ino, 3U);
+    EXPECT_EQ(sc->mode, 0100600U);
+    ASSERT_EQ(sc->file_len, 3);
+    ASSERT_EQ(sc->path_len, 4);
+    EXPECT_EQ(memcmp(sc + 1, "foo/tmp", 7), 0);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    sc = (const struct td_trace_syscall*)rec;
+    EXPECT_EQ(sc->result, (uint32_t)SYSCALL_RACE);
+    EXPECT_EQ(sc->path_len, 0);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    sc = (const struct td_trace_syscall*)rec;
+    EXPECT_EQ(sc->rec.tid, 6U);
+    EXPECT_EQ(sc->result, (uint32_t)SYSCALL_PIDERR);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    EXPECT_EQ(rec->type, TD_TRACE_DESTROY);
+    EXPECT_EQ(rec->tid, 5U);
+    EXPECT_TRUE(td_trace_next(&reader) == NULL);
+    EXPECT_EQ(reader.pos, reader.size);
+    size_t size = reader.size;
+    td_trace_unmap(&reader);
+
+    /* a truncated record ends the trace early */
+    ASSERT_EQ(truncate(path, size - 4), 0);
+    ASSERT_EQ(td_trace_map(&reader, path), 0);
+    int nr = 0;
+    while (td_trace_next(&reader) != NULL)
+        nr++;
+    EXPECT_EQ(nr, 4);
+    EXPECT_NE(reader.pos, reader.size);
+    td_trace_unmap(&reader);
+
+    /* not a trace */
+    ASSERT_EQ(truncate(path, 4), 0);
+    EXPECT_EQ(td_trace_map(&reader, path), -1);
+    unlink(path);
+}
+
+TEST(TDTraceTest, Descriptors) {
+    char path[] = "/tmp/td_trace_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+
+    struct stat buf1;
+    memset(&buf1, 0, sizeof(struct stat));
+    struct td_config config = {};
+    config.quiet = 1;
+    config.trace = td_trace_open(path);
+    ASSERT_TRUE(config.trace != NULL);
+    struct td_context *ctx = td_context_create(&config);
+    td_process_create(ctx, 5, 5, 1);
+    td_handle_syscall(ctx, 5, SYS_OPEN, "foo", "/tmp", &buf1);
+    EXPECT_EQ(td_bind_fd(ctx, 5, 3, "foo", 3), SYSCALL_PASS);
+    EXPECT_EQ(td_handle_syscall_fd(ctx, 5, SYS_DUP2, 3, 7), SYSCALL_UNCHECKED);
+    td_context_destroy(ctx);
+    EXPECT_EQ(td_trace_close(config.trace), 0);
+
+    struct td_trace_reader reader;
+    const struct td_trace_rec *rec;
+    const struct td_trace_fd *fr;
+    ASSERT_EQ(td_trace_map(&reader, path), 0);
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    EXPECT_EQ(rec->type, TD_TRACE_CREATE);
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    EXPECT_EQ(rec->type, TD_TRACE_SYSCALL);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    ASSERT_EQ(rec->type, TD_TRACE_FD);
+    fr = (const struct td_trace_fd*)rec;
+    EXPECT_EQ(fr->syscall, (uint32_t)SYS_OPEN);
+    EXPECT_EQ(fr->result, (uint32_t)SYSCALL_PASS);
+    EXPECT_EQ(fr->fd, 3);
+    ASSERT_EQ(fr->file_len, 3);
+    EXPECT_EQ(memcmp(fr + 1, "foo", 3), 0);
+
+    ASSERT_TRUE((rec = td_trace_next(&reader)) != NULL);
+    ASSERT_EQ(rec->type, TD_TRACE_FD);
+    fr = (const struct td_trace_fd*)rec;
+    EXPECT_EQ(fr->syscall, (uint32_t)SYS_DUP2);
+    EXPECT_EQ(fr->result, (uint32_t)SYSCALL_UNCHECKED);
+    EXPECT_EQ(fr->fd, 3);
+    EXPECT_EQ(fr->newfd, 7);
+    EXPECT_EQ(fr->file_len, 0);
+    td_trace_unmap(&reader);
+    unlink(path);
+}